@@ -124,7 +124,8 @@ mongo_dump (config_t *config)
   bson_finish (b);
   cursor = mongo_sync_cursor_new (conn, config->ns,
 				  mongo_sync_cmd_query (conn, config->ns,
-							MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT,
+							MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT |
+							MONGO_WIRE_FLAG_QUERY_EXHAUST,
 							0, 10, b, NULL));
   bson_free (b);
 
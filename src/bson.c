@@ -1249,3 +1249,83 @@ bson_cursor_get_int64 (const bson_cursor *c, gint64 *dest)
 
   return TRUE;
 }
+
+gboolean
+bson_append_cursor_value (bson *b, const gchar *name, const bson_cursor *c)
+{
+  const guint8 *d;
+  gint32 bs;
+
+  if (!c || !c->obj)
+    return FALSE;
+
+  d = bson_data (c->obj);
+  bs = _bson_get_block_size (bson_cursor_type (c), d + c->value_pos);
+  if (bs < 0)
+    return FALSE;
+
+  if (!_bson_append_element_header (b, bson_cursor_type (c), name))
+    return FALSE;
+
+  b->data = g_byte_array_append (b->data, d + c->value_pos, bs);
+  return TRUE;
+}
+
+gboolean
+bson_stream_find (const guint8 *doc, gint32 size, const gchar *name,
+		  bson_type *type, const guint8 **value)
+{
+  gint32 pos = sizeof (gint32), name_len;
+
+  if (!doc || !name || size < (gint32)sizeof (gint32) + 1)
+    return FALSE;
+  if (bson_stream_doc_size (doc, 0) < size)
+    size = bson_stream_doc_size (doc, 0);
+
+  name_len = strlen (name);
+
+  while (pos < size - 1)
+    {
+      bson_type t = (bson_type) doc[pos];
+      const gchar *key = (gchar *) &doc[pos + 1];
+      gint32 key_len = strnlen (key, size - pos - 1);
+      gint32 value_pos = pos + key_len + 2, bs;
+
+      if (value_pos > size - 1)
+	return FALSE;
+
+      if (key_len == name_len && memcmp (key, name, key_len) == 0)
+	{
+	  if (type)
+	    *type = t;
+	  if (value)
+	    *value = &doc[value_pos];
+	  return TRUE;
+	}
+
+      /* Do not read a length prefix past the end of the document. */
+      switch (t)
+	{
+	case BSON_TYPE_STRING:
+	case BSON_TYPE_JS_CODE:
+	case BSON_TYPE_SYMBOL:
+	case BSON_TYPE_DOCUMENT:
+	case BSON_TYPE_ARRAY:
+	case BSON_TYPE_JS_CODE_W_SCOPE:
+	case BSON_TYPE_BINARY:
+	case BSON_TYPE_DBPOINTER:
+	  if (value_pos + (gint32)sizeof (gint32) > size)
+	    return FALSE;
+	  break;
+	default:
+	  break;
+	}
+
+      bs = _bson_get_block_size (t, &doc[value_pos]);
+      if (bs < 0 || bs > size - value_pos)
+	return FALSE;
+      pos = value_pos + bs;
+    }
+
+  return FALSE;
+}
@@ -25,6 +25,8 @@
 #include "mongo.h"
 #include "compat.h"
 
+#include <sys/socket.h>
+
 /** @internal BSON structure.
  */
 struct _bson
@@ -39,8 +41,46 @@ struct _mongo_connection
 {
   gint fd; /**< The file descriptor associated with the connection. */
   gint32 request_id; /**< The last sent command's requestID. */
+  gint timeout; /**< The I/O timeout, in milliseconds, zero if none. */
+  mongo_connection_options options; /**< Socket tuning options. */
+  mongo_uring *uring; /**< The io_uring transport, if any. */
+
+  struct
+  {
+    gint32 threshold; /**< Packets at least this big are sent
+			 zero-copy. Zero if disabled. */
+    guint32 next_id; /**< The kernel's counter of the next zero-copy
+			send. */
+    GQueue *pending; /**< Sends the kernel did not release yet, in
+			send order. */
+  } zerocopy; /**< Zero-copy send state. */
 };
 
+/** @internal State of a replica set member, as seen by the client. */
+typedef struct
+{
+  gchar *address; /**< The address of the member, as host:port. */
+  gint64 rtt; /**< The last measured round-trip time (or its moving
+		 average, when monitored), in microseconds, or -1 if
+		 unknown. */
+  mongo_sync_member_role role; /**< The role of the member. */
+  gint64 last_seen; /**< Wall-clock time of the last answer, in
+		       microseconds since the epoch, or 0. */
+  gint64 last_write; /**< The last write date reported by the member,
+			in milliseconds since the epoch, or -1. */
+  gint64 lag; /**< Replication lag behind the primary, in
+		 milliseconds, or -1 if unknown. */
+} mongo_sync_rs_member;
+
+/** @internal Number of read latencies kept for hedging percentiles. */
+#define MONGO_SYNC_HEDGE_SAMPLES 64
+
+/** @internal Number of latencies needed before percentiles are used. */
+#define MONGO_SYNC_HEDGE_MIN_SAMPLES 16
+
+/** @internal Number of queued cursor kills that forces a flush. */
+#define MONGO_SYNC_MAX_DEFERRED_KILLS 256
+
 /** @internal Synchronous connection object. */
 struct _mongo_sync_connection
 {
@@ -55,6 +95,8 @@ struct _mongo_sync_connection
     GList *seeds; /**< Replica set seeds, as a list of strings. */
     GList *hosts; /**< Replica set members, as a list of strings. */
     gchar *primary; /**< The replica master, if any. */
+    GHashTable *members; /**< Per-member state, mongo_sync_rs_member
+			    objects keyed by address. */
   } rs;  /**< Replica Set properties. */
 
   gchar *last_error; /**< The last error from the server, caught
@@ -62,6 +104,43 @@ struct _mongo_sync_connection
   gint32 max_insert_size; /**< Maximum number of bytes an insert
 			     command can be before being split to
 			     smaller chunks. Used for bulk inserts. */
+  mongo_sync_monitor *monitor; /**< The topology monitor to reconnect
+				  through, if any. Owned by the
+				  caller. */
+  mongo_sync_read_preference read_pref; /**< The read preference. */
+  gchar *address; /**< The member connected to, as host:port, or
+		     NULL if unknown. */
+
+  struct
+  {
+    gboolean active; /**< Whether the server is streaming the replies
+			of an exhaust query. */
+    gint64 cursor_id; /**< The cursor of the exhaust query. */
+  } exhaust; /**< Exhaust query state. */
+
+  gboolean prefetching; /**< Whether a cursor has a batch in flight
+			   on the connection. */
+
+  GArray *kills; /**< IDs of the cursors to kill with the next write,
+		    allocated on first use. */
+
+  struct
+  {
+    gboolean enabled; /**< Whether hedged reads are enabled. */
+    mongo_sync_hedge_options opts; /**< The hedging settings. */
+    mongo_connection *conn; /**< Connection to the hedge member, or
+			       NULL. */
+    gchar *address; /**< The hedge member, as host:port. */
+    gboolean pending; /**< Whether a reply is still due on the hedge
+			 connection. */
+    gint32 pending_rid; /**< Request ID of the reply still due. */
+    gint64 samples[MONGO_SYNC_HEDGE_SAMPLES]; /**< Recent read
+						 latencies, in
+						 microseconds. */
+    guint nsamples; /**< Number of valid samples. */
+    guint next; /**< Index of the next sample to replace. */
+    mongo_sync_hedge_stats stats; /**< Hedging counters. */
+  } hedge; /**< Hedged read state. */
 };
 
 /** @internal MongoDB cursor object.
@@ -81,6 +160,32 @@ struct _mongo_sync_cursor
 		    set. */
   mongo_reply_packet_header ph; /**< The reply headers extracted from
 				   the active result set. */
+
+  struct
+  {
+    gdouble fraction; /**< The part of a batch to consume before
+			 requesting the next one, zero if disabled. */
+    gboolean pending; /**< Whether the next batch was requested
+			 already. */
+    gint32 rid; /**< Request ID of the pending request. */
+  } prefetch; /**< Prefetching state. */
+
+  struct
+  {
+    gint32 size; /**< Number of documents to ask for per batch, zero
+		    for as many as the current batch has. */
+    gint32 max_bytes; /**< Byte budget of adaptive batches, zero if
+			 adaptive sizing is disabled. */
+    gint32 last; /**< Number of documents last asked for. */
+    gint64 requested; /**< When the current batch was requested, in
+			 monotonic microseconds, or zero if it came
+			 from the query. */
+    gint64 received; /**< When the current batch arrived, in
+			monotonic microseconds. */
+  } batch; /**< Batch sizing state. */
+
+  gboolean exhaust; /**< Whether the cursor reads the stream of an
+		       exhaust query. */
 };
 
 /** @internal Synchronous pool connection object. */
@@ -89,7 +194,17 @@ struct _mongo_sync_pool_connection
   mongo_sync_connection super; /**< The parent object. */
 
   gint pool_id; /**< ID of the connection. */
-  gboolean in_use; /**< Whether the object is in use or not. */
+  gboolean in_use; /**< Whether the object is in use or not. Only
+		      changed atomically. */
+  gboolean on_stack; /**< Whether the connection is on the free stack
+			of its shard. Protected by the lock of the
+			shard. */
+  gint64 rtt; /**< Round-trip time measured when connecting, in
+		 microseconds, or -1. */
+  gint64 last_used; /**< When the connection was last returned, in
+		       monotonic microseconds. */
+  gint router; /**< Index of the router the connection is open to, or
+		  -1 if the pool has no routers. */
 };
 
 /** @internal GridFS object */
@@ -151,6 +266,18 @@ typedef struct
   _mongo_gridfs_type type; /**< The type of the GridFS file. */
 } mongo_sync_gridfs_file_common;
 
+/** @internal A batch of GridFS chunks waiting to be inserted.
+ *
+ * Chunks are collected until the next one would push the batch over
+ * the maximum insert size of the connection, and then inserted with
+ * a single message, acknowledged once.
+ */
+typedef struct
+{
+  GPtrArray *chunks; /**< The chunks of the batch, as BSON objects. */
+  gint32 size; /**< The total size of the chunks, in bytes. */
+} mongo_sync_gridfs_chunk_batch;
+
 /** @internal GridFS file object. */
 struct _mongo_sync_gridfs_chunked_file
 {
@@ -197,8 +324,25 @@ struct _mongo_sync_gridfs_stream
 
       GChecksum *checksum; /**< The running checksum of the output
 			      file. */
+      mongo_sync_gridfs_chunk_batch batch; /**< The finished chunks
+					      not inserted yet. */
     } writer;
   };
+
+  /** Read-ahead state of readers.
+   *
+   * Kept outside of the reader structure, so that it is all zero for
+   * writers.
+   */
+  struct
+  {
+    mongo_sync_cursor *cursor; /**< Cursor over the chunks following
+				  the current one, or NULL. */
+    gint64 next; /**< The number of the chunk the cursor returns
+		    next. */
+    gint32 window; /**< The number of chunks to read ahead, zero if
+		      disabled. */
+  } read_ahead;
 };
 
 /** @internal Construct a kill cursors command, using a va_list.
@@ -216,6 +360,19 @@ struct _mongo_sync_gridfs_stream
 mongo_packet *mongo_wire_cmd_kill_cursors_va (gint32 id, gint32 n,
 					      va_list ap);
 
+/** @internal Construct a kill cursors command, from an array.
+ *
+ * @param id is the sequence id.
+ * @param n is the number of cursors to delete.
+ * @param cursor_ids are the IDs of the cursors to kill.
+ *
+ * @returns A newly allocated packet, or NULL on error. It is the
+ * responsibility of the caller to free the packet once it is not used
+ * anymore.
+ */
+mongo_packet *mongo_wire_cmd_kill_cursors_array (gint32 id, gint32 n,
+						 const gint64 *cursor_ids);
+
 /** @internal Get the header data of a packet, without conversion.
  *
  * Retrieve the mongo packet's header data, but do not convert the
@@ -250,4 +407,411 @@ gboolean
 mongo_wire_packet_set_header_raw (mongo_packet *p,
 				  const mongo_packet_header *header);
 
+/** @internal Take a reference to a packet.
+ *
+ * Keeps the packet alive across a mongo_wire_packet_free(), until
+ * the reference is dropped by another mongo_wire_packet_free() call.
+ *
+ * @param p is the packet to reference.
+ *
+ * @returns The packet itself.
+ */
+mongo_packet *mongo_wire_packet_ref (mongo_packet *p);
+
+/** @internal A single address to try connecting to. */
+typedef struct
+{
+  struct sockaddr_storage addr; /**< The address. */
+  socklen_t addrlen; /**< Length of the address. */
+  gint family; /**< Socket family. */
+  gint socktype; /**< Socket type. */
+  gint protocol; /**< Socket protocol. */
+  gint target; /**< Index of the host the address belongs to. */
+} mongo_connect_candidate;
+
+/** @internal Resolve a host into connection candidates.
+ *
+ * The addresses are ordered happy-eyeballs style, alternating between
+ * address families, starting with the one getaddrinfo() preferred.
+ *
+ * @param host is the host name, or unix socket path.
+ * @param port is the port, or #MONGO_CONN_LOCAL.
+ * @param target is the value to set the target of each candidate to.
+ *
+ * @returns A GArray of mongo_connect_candidate elements, or NULL on
+ * error.
+ */
+GArray *mongo_connect_resolve (const gchar *host, gint port, gint target);
+
+/** @internal Start a non-blocking connect to a candidate.
+ *
+ * @param c is the candidate to connect to.
+ * @param opts are the socket options to use.
+ * @param pending will be set to TRUE if the connect is still in
+ * progress, FALSE if it completed already.
+ *
+ * @returns The non-blocking socket, or -1 on error.
+ */
+gint mongo_connect_candidate_start (const mongo_connect_candidate *c,
+				    const mongo_connection_options *opts,
+				    gboolean *pending);
+
+/** @internal Wrap a connected socket into a connection.
+ *
+ * Puts the socket back into blocking mode, and applies the options.
+ *
+ * @param fd is the connected socket.
+ * @param tcp signals whether the socket is a TCP one.
+ * @param opts are the socket options to apply.
+ *
+ * @returns A newly allocated connection.
+ */
+mongo_connection *mongo_connection_new_from_fd (gint fd, gboolean tcp,
+						const mongo_connection_options *opts);
+
+/** @internal Connect to the first reachable of a set of hosts.
+ *
+ * Resolves all hosts, and races non-blocking connects to all their
+ * addresses, happy-eyeballs style: a new attempt is started every
+ * @a opts->connect_delay milliseconds (or when all running ones
+ * failed), until one succeeds, or @a opts->connect_timeout expires.
+ *
+ * @param hosts is the array of host names (or unix socket paths).
+ * @param ports is the array of ports, #MONGO_CONN_LOCAL for unix
+ * sockets.
+ * @param n is the number of hosts.
+ * @param opts are the socket options to use, or NULL for the
+ * defaults.
+ * @param index, if not NULL, is set to the index of the host
+ * connected to.
+ *
+ * @returns A newly allocated connection, or NULL on error, with errno
+ * set to ETIMEDOUT if the deadline expired.
+ */
+mongo_connection *mongo_connect_first (const gchar **hosts,
+				       const gint *ports, gint n,
+				       const mongo_connection_options *opts,
+				       gint *index);
+
+/** @internal Wait for the outstanding zero-copy sends of a connection.
+ *
+ * Waits until the kernel released every packet sent zero-copy on the
+ * connection (bounded by the connection timeout, or a second if there
+ * is none), and resets the zero-copy state, so the socket can be
+ * closed or replaced.
+ *
+ * @param conn is the connection to finish zero-copy sends on.
+ */
+void mongo_connection_zerocopy_finish (mongo_connection *conn);
+
+/** @internal Send two packets with a single write.
+ *
+ * Used to piggyback a packet that expects no reply onto another one.
+ * If zero-copy or io_uring would be used for @a p, the two packets
+ * are sent one after the other instead.
+ *
+ * @param conn is the connection to send the packets over.
+ * @param first is the packet to send first, or NULL.
+ * @param p is the packet to send after it.
+ *
+ * @returns TRUE if both packets were sent, FALSE otherwise.
+ */
+gboolean mongo_packet_send_pair (mongo_connection *conn,
+				 const mongo_packet *first,
+				 const mongo_packet *p);
+
+/** @internal Send a get more command, without waiting for the reply.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to work with.
+ * @param ret is the number of documents to return.
+ * @param cursor_id is the ID of the cursor to use.
+ * @param rid is set to the request ID to collect the reply with.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_cmd_get_more_send (mongo_sync_connection *conn,
+				       const gchar *ns,
+				       gint32 ret, gint64 cursor_id,
+				       gint32 *rid);
+
+/** @internal Receive the reply to a get more command.
+ *
+ * @param conn is the connection the command was sent on.
+ * @param rid is the request ID returned by
+ * mongo_sync_cmd_get_more_send().
+ *
+ * @returns A newly allocated reply packet, or NULL on error.
+ */
+mongo_packet *mongo_sync_cmd_get_more_recv (mongo_sync_connection *conn,
+					    gint32 rid);
+
+/** @internal Run a step of tailing a capped collection.
+ *
+ * Sends a query, or a get more command if there is a live cursor
+ * already, and receives the reply. Unlike mongo_sync_cmd_query() and
+ * mongo_sync_cmd_get_more(), replies without any documents are
+ * returned too, so that the cursor they carry is not lost, and so are
+ * replies to a get more command with #MONGO_REPLY_FLAG_NO_CURSOR set.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to tail.
+ * @param flags are the flags to send the query with.
+ * @param query is the query to send.
+ * @param cursor_id is the ID of the live cursor, or zero to query.
+ *
+ * @returns A newly allocated reply packet, or NULL on error.
+ */
+mongo_packet *mongo_sync_cmd_tail (mongo_sync_connection *conn,
+				   const gchar *ns, gint32 flags,
+				   const bson *query, gint64 cursor_id);
+
+/** @internal Queue a cursor to be killed with the next write.
+ *
+ * The cursor is killed by an OP_KILL_CURSORS message sent along with
+ * the next packet written to the connection, together with every
+ * other queued cursor. Once #MONGO_SYNC_MAX_DEFERRED_KILLS cursors
+ * are queued, they are killed right away.
+ *
+ * @param conn is the connection the cursor belongs to.
+ * @param cursor_id is the ID of the cursor. Zero is ignored, as the
+ * server closed that cursor already.
+ */
+void mongo_sync_conn_defer_kill (mongo_sync_connection *conn,
+				 gint64 cursor_id);
+
+/** @internal Select a replica set member according to a read
+ * preference.
+ *
+ * @param pref is the read preference to honour.
+ * @param members are the candidate members. The same member may
+ * appear more than once.
+ * @param n is the number of candidates.
+ *
+ * @returns The index of the selected member, or -1 if none of them
+ * is eligible.
+ */
+gint mongo_sync_read_preference_select (const mongo_sync_read_preference *pref,
+					const mongo_sync_rs_member **members,
+					guint n);
+
+/** @internal States of a replica set member probe. */
+typedef enum
+{
+  MONGO_SYNC_PROBE_CONNECTING,
+  MONGO_SYNC_PROBE_SENDING,
+  MONGO_SYNC_PROBE_RECEIVING,
+  MONGO_SYNC_PROBE_DONE
+} mongo_sync_probe_state;
+
+/** @internal A non-blocking ismaster probe of a single replica set
+ * member.
+ *
+ * Probes are driven by polling their sockets, so that any number of
+ * members can be probed at once.
+ */
+typedef struct
+{
+  gchar *address; /**< The address of the member, as host:port. */
+  gchar *host; /**< The host part of the address. */
+  gint port; /**< The port part of the address. */
+  GArray *cands; /**< Resolved addresses of the host. */
+  guint cand; /**< Index of the next address to try. */
+  gint fd; /**< The socket of the probe, or -1. */
+  mongo_sync_probe_state state; /**< State of the probe. */
+  mongo_packet_header h; /**< Header of the reply. */
+  guint8 *data; /**< Body of the reply. */
+  gsize len; /**< Bytes to transfer in the current state. */
+  gsize done; /**< Bytes transferred in the current state. */
+  gdouble sent; /**< When the request was sent, in seconds. */
+} mongo_sync_probe;
+
+/** @internal Build the request probes send.
+ *
+ * @param flags are the query flags to send the ismaster command with.
+ * @param reqlen will be set to the length of the request.
+ *
+ * @returns The raw ismaster request, or NULL on error.
+ */
+guint8 *mongo_sync_probe_request (gint32 flags, gsize *reqlen);
+
+/** @internal Create a probe, and start connecting it.
+ *
+ * @param address is the address of the member, as host:port.
+ * @param fd is a socket already connected to the member, which the
+ * probe takes over, or -1 to connect anew.
+ * @param opts are the options to connect with.
+ * @param reqlen is the length of the request.
+ *
+ * @returns A new probe. If the address cannot be resolved, the probe
+ * is finished already.
+ */
+mongo_sync_probe *mongo_sync_probe_new (const gchar *address, gint fd,
+					const mongo_connection_options *opts,
+					gsize reqlen);
+
+/** @internal Advance a probe after its socket became ready.
+ *
+ * @param probe is the probe to advance.
+ * @param req is the request, as returned by
+ * mongo_sync_probe_request().
+ * @param reqlen is the length of the request.
+ * @param opts are the options to connect with.
+ * @param timer is the timer the send time of the request is recorded
+ * with.
+ *
+ * @returns The reply, once it arrived in full, NULL otherwise.
+ */
+mongo_packet *mongo_sync_probe_step (mongo_sync_probe *probe,
+				     const guint8 *req, gsize reqlen,
+				     const mongo_connection_options *opts,
+				     GTimer *timer);
+
+/** @internal Stop a probe, closing its socket.
+ *
+ * @param probe is the probe to stop.
+ */
+void mongo_sync_probe_stop (mongo_sync_probe *probe);
+
+/** @internal Free a probe, closing its socket, if any.
+ *
+ * @param probe is the probe to free.
+ */
+void mongo_sync_probe_free (mongo_sync_probe *probe);
+
+/** @internal An immutable snapshot of a replica set topology. */
+typedef struct
+{
+  gchar *primary; /**< The address of the primary, or NULL. */
+  GPtrArray *members; /**< mongo_sync_rs_member objects, in
+			 discovery order. */
+  gint refs; /**< Number of references to the snapshot. */
+} mongo_sync_topology;
+
+/** @internal Get the current topology snapshot of a monitor.
+ *
+ * The snapshot is reference counted: it stays valid (and unchanged)
+ * until it is released with mongo_sync_monitor_topology_release(),
+ * even if the monitor publishes a newer one in the meantime. Getting
+ * it takes no locks, only a few atomic operations.
+ *
+ * @param monitor is the monitor to get the snapshot of.
+ *
+ * @returns The current snapshot, never NULL.
+ */
+const mongo_sync_topology *
+mongo_sync_monitor_topology_acquire (mongo_sync_monitor *monitor);
+
+/** @internal Release a topology snapshot.
+ *
+ * @param monitor is the monitor the snapshot belongs to.
+ * @param topology is the snapshot returned by
+ * mongo_sync_monitor_topology_acquire().
+ */
+void mongo_sync_monitor_topology_release (mongo_sync_monitor *monitor,
+					  const mongo_sync_topology *topology);
+
+/** @internal Append the value a cursor points at to a BSON object.
+ *
+ * The element is copied verbatim, whatever its type, under a new
+ * name.
+ *
+ * @param b is the BSON object to append to.
+ * @param name is the key name to append the value with.
+ * @param c is the cursor pointing at the value to copy.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean bson_append_cursor_value (bson *b, const gchar *name,
+				   const bson_cursor *c);
+
+/** @internal Find an element in a raw BSON document, in place.
+ *
+ * @param doc is the raw document to search.
+ * @param size is the number of bytes available at @a doc.
+ * @param name is the key to look for.
+ * @param type will be set to the type of the element found.
+ * @param value will be set to point to the value of the element,
+ * within @a doc.
+ *
+ * @returns TRUE if the element was found, FALSE otherwise.
+ */
+gboolean bson_stream_find (const guint8 *doc, gint32 size,
+			   const gchar *name, bson_type *type,
+			   const guint8 **value);
+
+/** @internal Get the document at the position of a cursor, in place.
+ *
+ * @param cursor is the cursor to get the document of.
+ * @param size will be set to the size of the document.
+ *
+ * @returns A pointer to the raw document within the current result
+ * set of the cursor, valid until the cursor is advanced or freed, or
+ * NULL on error.
+ */
+const guint8 *mongo_sync_cursor_get_raw_data (mongo_sync_cursor *cursor,
+					      gint32 *size);
+
+/** @internal Build the query of a single scan partition.
+ *
+ * Restricts @a query to the documents whose _id falls into the
+ * [@a lo, @a hi) range. Either bound may be NULL, in which case the
+ * range is open on that side. Without a lower bound, the range takes
+ * every _id not at or above @a hi, whatever its type, so that
+ * together the partitions cover every document.
+ *
+ * @param query is the query the whole scan runs, or NULL.
+ * @param lo is the lower bound, as an { _id: value } document.
+ * @param hi is the upper bound, as an { _id: value } document.
+ *
+ * @returns A newly allocated, finished query, or NULL on error.
+ */
+bson *mongo_sync_scan_range_query (const bson *query, const bson *lo,
+				   const bson *hi);
+
+/** @internal Initialize an empty chunk batch.
+ *
+ * @param batch is the batch to initialize.
+ */
+void mongo_sync_gridfs_chunk_batch_init (mongo_sync_gridfs_chunk_batch *batch);
+
+/** @internal Add a chunk to a batch.
+ *
+ * If the chunk would not fit into the batch under the maximum insert
+ * size of the GridFS connection, the batch is flushed first.
+ *
+ * @param gfs is the GridFS the chunk belongs to.
+ * @param batch is the batch to add to.
+ * @param oid is the ID of the file the chunk belongs to.
+ * @param n is the number of the chunk.
+ * @param data is the data of the chunk.
+ * @param size is the size of the chunk.
+ *
+ * @returns TRUE on success, FALSE if flushing failed. The chunk is
+ * not added in that case.
+ */
+gboolean mongo_sync_gridfs_chunk_batch_add (mongo_sync_gridfs *gfs,
+					    mongo_sync_gridfs_chunk_batch *batch,
+					    const guint8 *oid, gint64 n,
+					    const guint8 *data, gint32 size);
+
+/** @internal Insert the chunks of a batch.
+ *
+ * The batch is emptied only if the insert succeeded, so that a failed
+ * flush can be retried.
+ *
+ * @param gfs is the GridFS to insert into.
+ * @param batch is the batch to flush.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_gridfs_chunk_batch_flush (mongo_sync_gridfs *gfs,
+					      mongo_sync_gridfs_chunk_batch *batch);
+
+/** @internal Free the chunks of a batch, without inserting them.
+ *
+ * @param batch is the batch to clear.
+ */
+void mongo_sync_gridfs_chunk_batch_clear (mongo_sync_gridfs_chunk_batch *batch);
+
 #endif
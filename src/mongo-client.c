@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include "mongo-client.h"
+#include "mongo-uring.h"
 #include "bson.h"
 #include "mongo-wire.h"
 #include "libmongo-private.h"
@@ -39,21 +40,136 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <poll.h>
+
+#if HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+  defined(SO_EE_ORIGIN_ZEROCOPY)
+#define MONGO_ZEROCOPY_SUPPORTED 1
+#else
+#define MONGO_ZEROCOPY_SUPPORTED 0
+#define MSG_ZEROCOPY 0
+#endif
+
+/** @internal A zero-copy send the kernel did not release yet. */
+typedef struct
+{
+  guint32 id; /**< The kernel's counter of the send. */
+  mongo_packet_header h; /**< The raw packet header, sent from here. */
+  mongo_packet *p; /**< The packet, kept alive until released. */
+} _mongo_zerocopy_send;
+
+static gboolean _mongo_connection_zerocopy_reap (mongo_connection *conn,
+						 gboolean wait);
+
 static const int one = 1;
 
-mongo_connection *
-mongo_tcp_connect (const char *host, int port)
+void
+mongo_connection_options_init (mongo_connection_options *opts)
 {
-  struct addrinfo *res = NULL, *r;
-  struct addrinfo hints;
-  int e, fd = -1;
-  gchar *port_s;
-  mongo_connection *conn;
+  if (!opts)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  memset (opts, 0, sizeof (mongo_connection_options));
+  opts->tcp_nodelay = TRUE;
+  opts->keepalive = TRUE;
+  opts->keepalive_idle = 60;
+  opts->keepalive_interval = 10;
+  opts->keepalive_count = 6;
+  opts->connect_timeout = 10000;
+  opts->connect_delay = 250;
+}
+
+static void
+_mongo_setsockopt_int (gint fd, gint level, gint name, gint value,
+		       gint *err)
+{
+  if (setsockopt (fd, level, name, &value, sizeof (value)) == -1 &&
+      *err == 0)
+    *err = errno;
+}
+
+/** @internal Apply the buffer size options to a socket.
+ *
+ * These are applied before connecting, so the receive window scale
+ * negotiated during the handshake matches the buffer.
+ */
+static gboolean
+_mongo_socket_tune_buffers (gint fd, const mongo_connection_options *opts)
+{
+  gint err = 0;
+
+  if (opts->sndbuf > 0)
+    _mongo_setsockopt_int (fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, &err);
+  if (opts->rcvbuf > 0)
+    _mongo_setsockopt_int (fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, &err);
+
+  errno = err;
+  return (err == 0);
+}
+
+static gboolean
+_mongo_socket_tune (gint fd, gboolean tcp,
+		    const mongo_connection_options *opts)
+{
+  gint err = 0;
+
+  if (tcp)
+    {
+      _mongo_setsockopt_int (fd, IPPROTO_TCP, TCP_NODELAY,
+			     opts->tcp_nodelay ? 1 : 0, &err);
+      _mongo_setsockopt_int (fd, SOL_SOCKET, SO_KEEPALIVE,
+			     opts->keepalive ? 1 : 0, &err);
+      if (opts->keepalive)
+	{
+#ifdef TCP_KEEPIDLE
+	  if (opts->keepalive_idle > 0)
+	    _mongo_setsockopt_int (fd, IPPROTO_TCP, TCP_KEEPIDLE,
+				   opts->keepalive_idle, &err);
+#endif
+#ifdef TCP_KEEPINTVL
+	  if (opts->keepalive_interval > 0)
+	    _mongo_setsockopt_int (fd, IPPROTO_TCP, TCP_KEEPINTVL,
+				   opts->keepalive_interval, &err);
+#endif
+#ifdef TCP_KEEPCNT
+	  if (opts->keepalive_count > 0)
+	    _mongo_setsockopt_int (fd, IPPROTO_TCP, TCP_KEEPCNT,
+				   opts->keepalive_count, &err);
+#endif
+	}
+    }
+
+  if (opts->busy_poll > 0)
+    {
+#ifdef SO_BUSY_POLL
+      _mongo_setsockopt_int (fd, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll,
+			     &err);
+#else
+      if (err == 0)
+	err = ENOPROTOOPT;
+#endif
+    }
+
+  errno = err;
+  return (err == 0);
+}
+
+GArray *
+mongo_connect_resolve (const gchar *host, gint port, gint target)
+{
+  GArray *res;
+  mongo_connect_candidate c;
 
   if (!host)
     {
@@ -61,94 +177,369 @@ mongo_tcp_connect (const char *host, int port)
       return NULL;
     }
 
-  memset (&hints, 0, sizeof (hints));
-  hints.ai_socktype = SOCK_STREAM;
+  res = g_array_new (FALSE, FALSE, sizeof (mongo_connect_candidate));
+  memset (&c, 0, sizeof (c));
+  c.target = target;
 
-#ifdef __linux__
-  hints.ai_flags = AI_ADDRCONFIG;
-#endif
+  if (port == MONGO_CONN_LOCAL)
+    {
+      struct sockaddr_un *sun = (struct sockaddr_un *)&c.addr;
 
-  port_s = g_strdup_printf ("%d", port);
-  e = getaddrinfo (host, port_s, &hints, &res);
-  if (e != 0)
+      if (strlen (host) >= sizeof (sun->sun_path))
+	{
+	  g_array_free (res, TRUE);
+	  errno = ENAMETOOLONG;
+	  return NULL;
+	}
+      sun->sun_family = AF_UNIX;
+      strncpy (sun->sun_path, host, sizeof (sun->sun_path));
+      c.addrlen = sizeof (struct sockaddr_un);
+      c.family = AF_UNIX;
+      c.socktype = SOCK_STREAM;
+      g_array_append_val (res, c);
+    }
+  else
     {
-      int err = errno;
+      struct addrinfo *ai = NULL, *r, *first = NULL, *second = NULL;
+      struct addrinfo hints;
+      gchar *port_s;
+      gint e, i;
+
+      memset (&hints, 0, sizeof (hints));
+      hints.ai_socktype = SOCK_STREAM;
+
+#ifdef __linux__
+      hints.ai_flags = AI_ADDRCONFIG;
+#endif
 
+      port_s = g_strdup_printf ("%d", port);
+      e = getaddrinfo (host, port_s, &hints, &ai);
       g_free (port_s);
-      errno = err;
-      return NULL;
+      if (e != 0)
+	{
+	  int err = errno;
+
+	  g_array_free (res, TRUE);
+	  errno = err;
+	  return NULL;
+	}
+
+      /* Interleave the preferred family with the rest. */
+      first = ai;
+      second = ai;
+      while (first || second)
+	{
+	  while (first && first->ai_family != ai->ai_family)
+	    first = first->ai_next;
+	  while (second && second->ai_family == ai->ai_family)
+	    second = second->ai_next;
+
+	  for (i = 0; i < 2; i++)
+	    {
+	      r = (i == 0) ? first : second;
+	      if (!r || r->ai_addrlen > sizeof (c.addr))
+		continue;
+
+	      memcpy (&c.addr, r->ai_addr, r->ai_addrlen);
+	      c.addrlen = r->ai_addrlen;
+	      c.family = r->ai_family;
+	      c.socktype = r->ai_socktype;
+	      c.protocol = r->ai_protocol;
+	      g_array_append_val (res, c);
+	    }
+
+	  if (first)
+	    first = first->ai_next;
+	  if (second)
+	    second = second->ai_next;
+	}
+      freeaddrinfo (ai);
     }
-  g_free (port_s);
 
-  for (r = res; r != NULL; r = r->ai_next)
+  return res;
+}
+
+static gint
+_mongo_connect_elapsed (GTimer *timer)
+{
+  return (gint)(g_timer_elapsed (timer, NULL) * 1000);
+}
+
+/** @internal Race non-blocking connects to a list of candidates.
+ *
+ * A new attempt is started every @a opts->connect_delay milliseconds,
+ * or as soon as all running attempts failed. The first one to succeed
+ * wins, the rest are abandoned.
+ *
+ * @returns The connected socket, in blocking mode, or -1 on error.
+ */
+static gint
+_mongo_connect_race (const mongo_connect_candidate *cands, guint n,
+		     const mongo_connection_options *opts, gint *winner)
+{
+  struct pollfd *pfds;
+  gint *idx;
+  guint next = 0, active = 0, i;
+  gint fd = -1, err = EADDRNOTAVAIL, next_start = 0;
+  GTimer *timer;
+
+  pfds = g_new (struct pollfd, n);
+  idx = g_new (gint, n);
+  timer = g_timer_new ();
+
+  while (fd == -1 && (active > 0 || next < n))
     {
-      fd = socket (r->ai_family, r->ai_socktype, r->ai_protocol);
-      if (fd != -1 && connect (fd, r->ai_addr, r->ai_addrlen) == 0)
-	break;
-      if (fd != -1)
+      gint now = _mongo_connect_elapsed (timer), wait = -1, r;
+
+      if (opts->connect_timeout > 0 && now >= opts->connect_timeout)
 	{
-	  close (fd);
-	  fd = -1;
+	  err = ETIMEDOUT;
+	  break;
+	}
+
+      /* Start the next attempt, if it is time. */
+      if (next < n && (active == 0 || now >= next_start))
+	{
+	  gboolean pending;
+	  gint s;
+
+	  s = mongo_connect_candidate_start (&cands[next], opts, &pending);
+	  if (s == -1)
+	    {
+	      err = errno;
+	      next++;
+	      continue;
+	    }
+	  if (!pending)
+	    {
+	      fd = s;
+	      *winner = next;
+	      break;
+	    }
+
+	  pfds[active].fd = s;
+	  pfds[active].events = POLLOUT;
+	  idx[active] = next;
+	  active++;
+	  next++;
+	  next_start = now + opts->connect_delay;
+	}
+
+      if (next < n)
+	wait = MAX (next_start - now, 0);
+      if (opts->connect_timeout > 0)
+	wait = (wait == -1) ? opts->connect_timeout - now :
+	  MIN (wait, opts->connect_timeout - now);
+
+      r = poll (pfds, active, wait);
+      if (r == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  err = errno;
+	  break;
+	}
+
+      for (i = 0; i < active && fd == -1; )
+	{
+	  gint so_error = 0;
+	  socklen_t len = sizeof (so_error);
+
+	  if (!pfds[i].revents)
+	    {
+	      i++;
+	      continue;
+	    }
+
+	  if (getsockopt (pfds[i].fd, SOL_SOCKET, SO_ERROR, &so_error,
+			  &len) == 0 && so_error == 0)
+	    {
+	      fd = pfds[i].fd;
+	      *winner = idx[i];
+	      pfds[i] = pfds[--active];
+	      idx[i] = idx[active];
+	      break;
+	    }
+
+	  err = so_error ? so_error : errno;
+	  close (pfds[i].fd);
+	  pfds[i] = pfds[--active];
+	  idx[i] = idx[active];
 	}
     }
-  freeaddrinfo (res);
+
+  for (i = 0; i < active; i++)
+    close (pfds[i].fd);
+
+  g_timer_destroy (timer);
+  g_free (idx);
+  g_free (pfds);
 
   if (fd == -1)
     {
-      errno = EADDRNOTAVAIL;
-      return NULL;
+      errno = err;
+      return -1;
     }
 
-  setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof (one));
+  return fd;
+}
+
+gint
+mongo_connect_candidate_start (const mongo_connect_candidate *c,
+			       const mongo_connection_options *opts,
+			       gboolean *pending)
+{
+  gint fd;
+
+  fd = socket (c->family, c->socktype, c->protocol);
+  if (fd == -1)
+    return -1;
+  _mongo_socket_tune_buffers (fd, opts);
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  if (connect (fd, (const struct sockaddr *)&c->addr, c->addrlen) == 0)
+    {
+      *pending = FALSE;
+      return fd;
+    }
+  if (errno != EINPROGRESS)
+    {
+      int e = errno;
+
+      close (fd);
+      errno = e;
+      return -1;
+    }
+
+  *pending = TRUE;
+  return fd;
+}
+
+mongo_connection *
+mongo_connection_new_from_fd (gint fd, gboolean tcp,
+			      const mongo_connection_options *opts)
+{
+  mongo_connection *conn;
+
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+  _mongo_socket_tune (fd, tcp, opts);
 
   conn = g_new0 (mongo_connection, 1);
   conn->fd = fd;
+  conn->options = *opts;
 
   return conn;
 }
 
-static mongo_connection *
-mongo_unix_connect (const char *path)
+mongo_connection *
+mongo_connect_first (const gchar **hosts, const gint *ports, gint n,
+		     const mongo_connection_options *opts, gint *index)
 {
-  int fd = -1;
+  GArray **lists, *cands;
   mongo_connection *conn;
-  struct sockaddr_un remote;
+  mongo_connection_options defaults;
+  gint i, fd, winner = -1, e = EADDRNOTAVAIL;
+  guint j;
+  gboolean more = TRUE;
 
-  if (!path || strlen (path) >= sizeof (remote.sun_path))
+  if (!hosts || !ports || n <= 0)
     {
-      errno = path ? ENAMETOOLONG : EINVAL;
+      errno = EINVAL;
       return NULL;
     }
 
-  fd = socket (AF_UNIX, SOCK_STREAM, 0);
-  if (fd == -1)
+  if (!opts)
+    {
+      mongo_connection_options_init (&defaults);
+      opts = &defaults;
+    }
+
+  /* Resolve every host, then take their addresses round-robin, so
+     that the first address of every host is tried early. */
+  lists = g_new0 (GArray *, n);
+  for (i = 0; i < n; i++)
+    {
+      lists[i] = mongo_connect_resolve (hosts[i], ports[i], i);
+      if (!lists[i])
+	e = errno;
+    }
+
+  cands = g_array_new (FALSE, FALSE, sizeof (mongo_connect_candidate));
+  for (j = 0; more; j++)
+    {
+      more = FALSE;
+      for (i = 0; i < n; i++)
+	{
+	  if (!lists[i] || j >= lists[i]->len)
+	    continue;
+	  g_array_append_val (cands, g_array_index (lists[i],
+						    mongo_connect_candidate,
+						    j));
+	  more = TRUE;
+	}
+    }
+  for (i = 0; i < n; i++)
+    if (lists[i])
+      g_array_free (lists[i], TRUE);
+  g_free (lists);
+
+  if (cands->len == 0)
     {
-      errno = EADDRNOTAVAIL;
+      g_array_free (cands, TRUE);
+      errno = e;
       return NULL;
     }
 
-  remote.sun_family = AF_UNIX;
-  strncpy (remote.sun_path, path, sizeof (remote.sun_path));
-  if (connect (fd, (struct sockaddr *)&remote, sizeof (remote)) == -1)
+  fd = _mongo_connect_race ((mongo_connect_candidate *)cands->data,
+			    cands->len, opts, &winner);
+  if (fd == -1)
     {
-      close (fd);
-      errno = EADDRNOTAVAIL;
+      e = errno;
+      g_array_free (cands, TRUE);
+      errno = (e == ETIMEDOUT) ? ETIMEDOUT : EADDRNOTAVAIL;
       return NULL;
     }
 
-  conn = g_new0 (mongo_connection, 1);
-  conn->fd = fd;
+  conn = mongo_connection_new_from_fd
+    (fd, g_array_index (cands, mongo_connect_candidate,
+			winner).family != AF_UNIX, opts);
+  if (index)
+    *index = g_array_index (cands, mongo_connect_candidate,
+			    winner).target;
+  g_array_free (cands, TRUE);
 
   return conn;
 }
 
 mongo_connection *
-mongo_connect (const char *address, int port)
+mongo_tcp_connect (const char *host, int port)
 {
-  if (port == MONGO_CONN_LOCAL)
-    return mongo_unix_connect (address);
+  if (!host)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
 
-  return mongo_tcp_connect (address, port);
+  return mongo_connect_first (&host, &port, 1, NULL, NULL);
+}
+
+mongo_connection *
+mongo_connect_with_options (const char *address, int port,
+			    const mongo_connection_options *opts)
+{
+  if (!address)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  return mongo_connect_first (&address, &port, 1, opts, NULL);
+}
+
+mongo_connection *
+mongo_connect (const char *address, int port)
+{
+  return mongo_connect_with_options (address, port, NULL);
 }
 
 #if VERSIONED_SYMBOLS
@@ -164,6 +555,10 @@ mongo_disconnect (mongo_connection *conn)
       return;
     }
 
+  mongo_connection_zerocopy_finish (conn);
+  if (conn->zerocopy.pending)
+    g_queue_free (conn->zerocopy.pending);
+
   if (conn->fd >= 0)
     close (conn->fd);
 
@@ -179,6 +574,9 @@ mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
   mongo_packet_header h;
   struct iovec iov[2];
   struct msghdr msg;
+  _mongo_zerocopy_send *zs;
+  gboolean copy = TRUE;
+  gssize sent = -1;
 
   if (!conn)
     {
@@ -205,6 +603,9 @@ mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
   if (data_size == -1)
     return FALSE;
 
+  if (conn->uring)
+    return (mongo_uring_packet_send_all (conn->uring, &conn, &p, 1) == 1);
+
   iov[0].iov_base = (void *)&h;
   iov[0].iov_len = sizeof (h);
   iov[1].iov_base = (void *)data;
@@ -214,7 +615,41 @@ mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
   msg.msg_iov = iov;
   msg.msg_iovlen = 2;
 
-  if (sendmsg (conn->fd, &msg, MSG_NOSIGNAL) != (gint32)sizeof (h) + data_size)
+  if (conn->zerocopy.pending)
+    _mongo_connection_zerocopy_reap (conn, FALSE);
+
+  if (conn->zerocopy.threshold > 0 &&
+      (gint32)sizeof (h) + data_size >= conn->zerocopy.threshold)
+    {
+      /* The kernel reads the header after we return, so it can't
+	 live on the stack. */
+      zs = g_new (_mongo_zerocopy_send, 1);
+      zs->h = h;
+      iov[0].iov_base = (void *)&zs->h;
+
+      sent = sendmsg (conn->fd, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+      if (sent > 0)
+	{
+	  zs->id = conn->zerocopy.next_id++;
+	  zs->p = mongo_wire_packet_ref ((mongo_packet *)p);
+	  g_queue_push_tail (conn->zerocopy.pending, zs);
+	  copy = FALSE;
+	}
+      else
+	{
+	  g_free (zs);
+	  iov[0].iov_base = (void *)&h;
+
+	  /* ENOBUFS means the kernel ran out of memory to track
+	     zero-copy sends: fall back to copying. */
+	  copy = (sent == -1 && errno == ENOBUFS);
+	}
+    }
+
+  if (copy)
+    sent = sendmsg (conn->fd, &msg, MSG_NOSIGNAL);
+
+  if (sent != (gint32)sizeof (h) + data_size)
     return FALSE;
 
   conn->request_id = h.id;
@@ -222,6 +657,74 @@ mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
   return TRUE;
 }
 
+gboolean
+mongo_packet_send_pair (mongo_connection *conn, const mongo_packet *first,
+			const mongo_packet *p)
+{
+  const guint8 *data[2];
+  gint32 data_size[2];
+  mongo_packet_header h[2];
+  struct iovec iov[4];
+  struct msghdr msg;
+  gint i;
+
+  if (!first)
+    return mongo_packet_send (conn, p);
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!p)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (conn->fd < 0)
+    {
+      errno = EBADF;
+      return FALSE;
+    }
+
+  if (!mongo_wire_packet_get_header_raw (first, &h[0]) ||
+      !mongo_wire_packet_get_header_raw (p, &h[1]))
+    return FALSE;
+  data_size[0] = mongo_wire_packet_get_data (first, &data[0]);
+  data_size[1] = mongo_wire_packet_get_data (p, &data[1]);
+  if (data_size[0] == -1 || data_size[1] == -1)
+    return FALSE;
+
+  if (conn->uring ||
+      (conn->zerocopy.threshold > 0 &&
+       (gint32)sizeof (h[1]) + data_size[1] >= conn->zerocopy.threshold))
+    return mongo_packet_send (conn, first) && mongo_packet_send (conn, p);
+
+  for (i = 0; i < 2; i++)
+    {
+      iov[i * 2].iov_base = (void *)&h[i];
+      iov[i * 2].iov_len = sizeof (h[i]);
+      iov[i * 2 + 1].iov_base = (void *)data[i];
+      iov[i * 2 + 1].iov_len = data_size[i];
+    }
+
+  memset (&msg, 0, sizeof (struct msghdr));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 4;
+
+  if (conn->zerocopy.pending)
+    _mongo_connection_zerocopy_reap (conn, FALSE);
+
+  if (sendmsg (conn->fd, &msg, MSG_NOSIGNAL) !=
+      (gssize)(2 * sizeof (mongo_packet_header) + data_size[0] +
+	       data_size[1]))
+    return FALSE;
+
+  conn->request_id = h[1].id;
+
+  return TRUE;
+}
+
 mongo_packet *
 mongo_packet_recv (mongo_connection *conn)
 {
@@ -242,6 +745,13 @@ mongo_packet_recv (mongo_connection *conn)
       return NULL;
     }
 
+  if (conn->uring)
+    {
+      if (mongo_uring_packet_recv_all (conn->uring, &conn, &p, 1) != 1)
+	return NULL;
+      return p;
+    }
+
   memset (&h, 0, sizeof (h));
   if (recv (conn->fd, &h, sizeof (mongo_packet_header),
 	    MSG_NOSIGNAL | MSG_WAITALL) != sizeof (mongo_packet_header))
@@ -254,6 +764,13 @@ mongo_packet_recv (mongo_connection *conn)
   h.resp_to = GINT32_FROM_LE (h.resp_to);
   h.opcode = GINT32_FROM_LE (h.opcode);
 
+  if (h.length < (gint32)sizeof (mongo_packet_header) ||
+      h.length > MONGO_WIRE_MAX_MESSAGE_SIZE)
+    {
+      errno = EPROTO;
+      return NULL;
+    }
+
   p = mongo_wire_packet_new ();
 
   if (!mongo_wire_packet_set_header_raw (p, &h))
@@ -327,5 +844,208 @@ mongo_connection_set_timeout (mongo_connection *conn, gint timeout)
     return FALSE;
   if (setsockopt (conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) == -1)
     return FALSE;
+
+  conn->timeout = timeout;
   return TRUE;
 }
+
+gboolean
+mongo_connection_set_options (mongo_connection *conn,
+			      const mongo_connection_options *opts)
+{
+  struct sockaddr_storage ss;
+  socklen_t len = sizeof (ss);
+  gboolean tcp;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  if (opts)
+    conn->options = *opts;
+  else
+    mongo_connection_options_init (&conn->options);
+
+  if (getsockname (conn->fd, (struct sockaddr *)&ss, &len) == -1)
+    return FALSE;
+  tcp = (ss.ss_family != AF_UNIX);
+
+  if (!_mongo_socket_tune_buffers (conn->fd, &conn->options))
+    {
+      int e = errno;
+
+      _mongo_socket_tune (conn->fd, tcp, &conn->options);
+      errno = e;
+      return FALSE;
+    }
+  return _mongo_socket_tune (conn->fd, tcp, &conn->options);
+}
+
+gboolean
+mongo_connection_get_options (const mongo_connection *conn,
+			      mongo_connection_options *opts)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!opts)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  *opts = conn->options;
+  return TRUE;
+}
+
+gboolean
+mongo_connection_set_zerocopy (mongo_connection *conn, gint32 threshold)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (threshold < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+#if MONGO_ZEROCOPY_SUPPORTED
+  if (threshold > 0)
+    {
+      if (setsockopt (conn->fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+		      sizeof (one)) == -1)
+	return FALSE;
+      if (!conn->zerocopy.pending)
+	conn->zerocopy.pending = g_queue_new ();
+    }
+  conn->zerocopy.threshold = threshold;
+  return TRUE;
+#else
+  if (threshold == 0)
+    return TRUE;
+  errno = ENOSYS;
+  return FALSE;
+#endif
+}
+
+#if MONGO_ZEROCOPY_SUPPORTED
+static void
+_mongo_connection_zerocopy_release (mongo_connection *conn,
+				    guint32 lo, guint32 hi)
+{
+  GList *l = conn->zerocopy.pending->head;
+
+  while (l)
+    {
+      _mongo_zerocopy_send *zs = (_mongo_zerocopy_send *)l->data;
+      GList *next = l->next;
+
+      /* Unsigned arithmetic takes care of the counter wrapping
+	 around. */
+      if (zs->id - lo <= hi - lo)
+	{
+	  mongo_wire_packet_free (zs->p);
+	  g_free (zs);
+	  g_queue_delete_link (conn->zerocopy.pending, l);
+	}
+      l = next;
+    }
+}
+#endif
+
+static gboolean
+_mongo_connection_zerocopy_reap (mongo_connection *conn, gboolean wait)
+{
+#if MONGO_ZEROCOPY_SUPPORTED
+  guint8 control[CMSG_SPACE (sizeof (struct sock_extended_err)) +
+		 CMSG_SPACE (sizeof (struct sockaddr_storage))];
+  GTimer *timer = NULL;
+
+  if (!conn || !conn->zerocopy.pending)
+    return TRUE;
+
+  while (!g_queue_is_empty (conn->zerocopy.pending))
+    {
+      struct msghdr msg;
+      struct cmsghdr *cm;
+
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof (control);
+
+      if (recvmsg (conn->fd, &msg, MSG_ERRQUEUE) == -1)
+	{
+	  struct pollfd pfd;
+	  gint left;
+
+	  if (errno == EINTR)
+	    continue;
+	  if (errno != EAGAIN || !wait)
+	    break;
+
+	  /* Reading the error queue never blocks, poll for it. */
+	  if (!timer)
+	    timer = g_timer_new ();
+	  left = ((conn->timeout > 0) ? conn->timeout : 1000) -
+	    (gint)(g_timer_elapsed (timer, NULL) * 1000);
+	  if (left <= 0)
+	    break;
+
+	  pfd.fd = conn->fd;
+	  pfd.events = 0;
+	  if (poll (&pfd, 1, left) == -1 && errno != EINTR)
+	    break;
+	  continue;
+	}
+
+      for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+	{
+	  struct sock_extended_err *serr;
+
+	  if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+		(cm->cmsg_level == SOL_IPV6 &&
+		 cm->cmsg_type == IPV6_RECVERR)))
+	    continue;
+
+	  serr = (struct sock_extended_err *)CMSG_DATA (cm);
+	  if (serr->ee_errno != 0 ||
+	      serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	    continue;
+
+	  _mongo_connection_zerocopy_release (conn, serr->ee_info,
+					      serr->ee_data);
+	}
+    }
+
+  if (timer)
+    g_timer_destroy (timer);
+  return g_queue_is_empty (conn->zerocopy.pending);
+#else
+  return TRUE;
+#endif
+}
+
+void
+mongo_connection_zerocopy_finish (mongo_connection *conn)
+{
+  if (!conn || !conn->zerocopy.pending)
+    return;
+
+  if (!_mongo_connection_zerocopy_reap (conn, TRUE))
+    {
+      _mongo_zerocopy_send *zs;
+
+      /* The kernel may still read the packets: rather leak them, than
+	 let it send memory that got reused in the meantime. */
+      while ((zs = g_queue_pop_head (conn->zerocopy.pending)) != NULL)
+	g_free (zs);
+    }
+  conn->zerocopy.next_id = 0;
+}
@@ -45,9 +45,60 @@ typedef struct _mongo_connection mongo_connection;
  */
 #define MONGO_CONN_LOCAL -1
 
+/** Socket tuning options for MongoDB connections.
+ *
+ * Always initialise the structure with mongo_connection_options_init()
+ * before changing any of its fields.
+ */
+typedef struct
+{
+  gboolean tcp_nodelay; /**< Disable Nagle's algorithm, so small
+			   requests are sent out immediately. Default:
+			   TRUE. */
+  gint sndbuf; /**< Size of the socket send buffer, in bytes, or zero
+		  to leave it to the kernel's auto-tuning. Default: 0. */
+  gint rcvbuf; /**< Size of the socket receive buffer, in bytes, or
+		  zero to leave it to the kernel's auto-tuning. Default:
+		  0. */
+  gboolean keepalive; /**< Enable TCP keepalive probes. Default:
+			 TRUE. */
+  gint keepalive_idle; /**< Idle time before the first probe, in
+			  seconds, or zero for the system
+			  default. Default: 60. */
+  gint keepalive_interval; /**< Time between probes, in seconds, or
+			      zero for the system default. Default:
+			      10. */
+  gint keepalive_count; /**< Number of unanswered probes before the
+			   connection is dropped, or zero for the system
+			   default. Default: 6. */
+  gint busy_poll; /**< Busy poll the device queue for this long when
+		     waiting for data, in microseconds (SO_BUSY_POLL),
+		     or zero to disable. Trades CPU for latency.
+		     Default: 0. */
+  gint connect_timeout; /**< Hard deadline for establishing the
+			   connection, in milliseconds, or zero for
+			   none. Default: 10000. */
+  gint connect_delay; /**< When a host resolves to multiple
+			 addresses, they are connected to in parallel,
+			 starting a new attempt this many milliseconds
+			 after the previous one, unless that one failed
+			 already. Default: 250. */
+} mongo_connection_options;
+
+/** Initialise connection options with the defaults.
+ *
+ * The defaults are tuned for latency: Nagle's algorithm is disabled,
+ * dead peers are detected with keepalive probes in about two minutes,
+ * and connecting gives up after ten seconds.
+ *
+ * @param opts is the options structure to initialise.
+ */
+void mongo_connection_options_init (mongo_connection_options *opts);
+
 /** Connect to a MongoDB server.
  *
- * Connects to a single MongoDB server.
+ * Connects to a single MongoDB server, with the default connection
+ * options.
  *
  * @param address is the address of the server (IP or unix socket path).
  * @param port is the port to connect to, or #MONGO_CONN_LOCAL if
@@ -59,6 +110,52 @@ typedef struct _mongo_connection mongo_connection;
  */
 mongo_connection *mongo_connect (const char *address, int port);
 
+/** Connect to a MongoDB server, with custom socket options.
+ *
+ * Like mongo_connect(), but tunes the socket with @a opts. Applying
+ * the options is best effort: a setting the system refuses does not
+ * make the connection fail. Use mongo_connection_set_options() to
+ * find out whether every option applied.
+ *
+ * @param address is the address of the server (IP or unix socket path).
+ * @param port is the port to connect to, or #MONGO_CONN_LOCAL if
+ * address is a unix socket.
+ * @param opts are the socket options to use, or NULL for the
+ * defaults.
+ *
+ * @returns A newly allocated mongo_connection object or NULL on
+ * error. It is the responsibility of the caller to free it once it is
+ * not used anymore.
+ */
+mongo_connection *mongo_connect_with_options (const char *address, int port,
+					      const mongo_connection_options *opts);
+
+/** Change the socket options of a connection.
+ *
+ * @param conn is the connection whose options to change.
+ * @param opts are the new options, or NULL for the defaults.
+ *
+ * @returns TRUE if all options were applied, FALSE otherwise. The
+ * options are remembered, and used for reconnects by the Sync API,
+ * even if some of them could not be applied.
+ *
+ * @note Options that only make sense for TCP are ignored on unix
+ * sockets. Buffer sizes are best set at connect time, as the receive
+ * window is negotiated then.
+ */
+gboolean mongo_connection_set_options (mongo_connection *conn,
+				       const mongo_connection_options *opts);
+
+/** Get the socket options of a connection.
+ *
+ * @param conn is the connection whose options to query.
+ * @param opts is where the options will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_connection_get_options (const mongo_connection *conn,
+				       mongo_connection_options *opts);
+
 /** Disconnect from a MongoDB server.
  *
  * @param conn is the connection object to disconnect from.
@@ -109,6 +206,33 @@ gint32 mongo_connection_get_requestid (const mongo_connection *conn);
  */
 gboolean mongo_connection_set_timeout (mongo_connection *conn, gint timeout);
 
+/** Enable zero-copy sends on a connection.
+ *
+ * Packets at least @a threshold bytes big are sent with MSG_ZEROCOPY,
+ * letting the kernel transmit straight from the packet's memory
+ * instead of copying it into the socket buffer. Such packets are kept
+ * alive, even if freed with mongo_wire_packet_free(), until the kernel
+ * signals it is done with them.
+ *
+ * Zero-copy only pays off for large packets (GridFS chunks, big
+ * batches of inserts): below a few ten kilobytes, the bookkeeping
+ * costs more than the copy.
+ *
+ * @param conn is the connection to enable zero-copy sends on.
+ * @param threshold is the minimum size of a packet to send without
+ * copying, in bytes, or zero to disable zero-copy sends.
+ *
+ * @returns TRUE on success, FALSE otherwise, with errno set to ENOSYS
+ * if the system does not support zero-copy sends at all.
+ *
+ * @note Packets must not be modified while the kernel still holds
+ * them. Zero-copy does not apply to connections with an io_uring
+ * transport attached. Unlike the timeout, the setting is preserved
+ * accross reconnects, if using the Sync API.
+ */
+gboolean mongo_connection_set_zerocopy (mongo_connection *conn,
+					gint32 threshold);
+
 /** @} */
 
 G_END_DECLS
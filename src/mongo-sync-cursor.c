@@ -48,10 +48,174 @@ mongo_sync_cursor_new (mongo_sync_connection *conn, const gchar *ns,
   c->offset = -1;
 
   mongo_wire_reply_packet_get_header (c->results, &c->ph);
+  c->batch.received = g_get_monotonic_time ();
+  c->exhaust = (conn->exhaust.active &&
+		conn->exhaust.cursor_id == c->ph.cursor_id);
 
   return c;
 }
 
+gboolean
+mongo_sync_cursor_set_batch_size (mongo_sync_cursor *cursor,
+				  gint32 batch_size)
+{
+  if (!cursor)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (batch_size < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  cursor->batch.size = batch_size;
+  cursor->batch.last = 0;
+  return TRUE;
+}
+
+gboolean
+mongo_sync_cursor_set_adaptive_batching (mongo_sync_cursor *cursor,
+					 gint32 max_bytes)
+{
+  if (!cursor)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (max_bytes < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  cursor->batch.max_bytes = max_bytes;
+  cursor->batch.last = 0;
+  return TRUE;
+}
+
+/** @internal Decide how many documents to ask for in the next batch.
+ *
+ * Adaptive batches double whenever the application spent less time
+ * on the current batch than it took to fetch it, that is, when the
+ * network is the bottleneck. They are capped so that, at the average
+ * document size of the current batch, they fit in the byte budget.
+ */
+static gint32
+_mongo_sync_cursor_batch_size (mongo_sync_cursor *cursor)
+{
+  const guint8 *data;
+  gint32 size, bytes;
+  gint64 fetch, consume, cap;
+
+  size = (cursor->batch.size > 0) ? cursor->batch.size :
+    cursor->ph.returned;
+  if (cursor->batch.max_bytes <= 0 || cursor->ph.returned <= 0)
+    {
+      cursor->batch.last = size;
+      return size;
+    }
+
+  if (cursor->batch.last > 0)
+    size = cursor->batch.last;
+
+  /* The first batch came from the query, its fetch time is not
+     known: assume the scan goes on, and grow. */
+  fetch = cursor->batch.received - cursor->batch.requested;
+  consume = (g_get_monotonic_time () - cursor->batch.received) *
+    cursor->ph.returned / (cursor->offset + 1);
+  if (cursor->batch.requested == 0 || consume <= fetch)
+    size = (size > G_MAXINT32 / 2) ? G_MAXINT32 : size * 2;
+
+  bytes = mongo_wire_packet_get_data (cursor->results, &data) -
+    sizeof (mongo_reply_packet_header);
+  cap = (gint64)cursor->batch.max_bytes * cursor->ph.returned /
+    MAX (bytes, 1);
+  size = (gint32)CLAMP (size, 1, MAX (cap, 1));
+
+  cursor->batch.last = size;
+  return size;
+}
+
+gboolean
+mongo_sync_cursor_set_prefetch (mongo_sync_cursor *cursor,
+				gdouble fraction)
+{
+  if (!cursor)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (fraction < 0 || fraction > 1)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  cursor->prefetch.fraction = fraction;
+  return TRUE;
+}
+
+/** @internal Request the next batch of a cursor, if the application
+ * consumed enough of the current one.
+ */
+static void
+_mongo_sync_cursor_prefetch (mongo_sync_cursor *cursor)
+{
+  int e = errno;
+  gint32 ret;
+
+  if (cursor->exhaust ||
+      cursor->prefetch.fraction <= 0 || cursor->prefetch.pending ||
+      cursor->ph.cursor_id == 0 ||
+      cursor->offset + 1 < cursor->prefetch.fraction * cursor->ph.returned)
+    return;
+
+  /* If this fails, the next batch will be requested the usual way,
+     and that will report the error. */
+  ret = _mongo_sync_cursor_batch_size (cursor);
+  cursor->batch.requested = g_get_monotonic_time ();
+  cursor->prefetch.pending =
+    mongo_sync_cmd_get_more_send (cursor->conn, cursor->ns, ret,
+				  cursor->ph.cursor_id,
+				  &cursor->prefetch.rid);
+  cursor->conn->prefetching = cursor->prefetch.pending;
+  errno = e;
+}
+
+/** @internal Read the next reply of an exhaust stream.
+ *
+ * Each reply of the stream answers the previous one, so there is
+ * nothing to send: the reply is simply read off the connection.
+ */
+static gboolean
+_mongo_sync_cursor_exhaust_next (mongo_sync_cursor *cursor)
+{
+  mongo_packet_header h;
+
+  if (cursor->ph.cursor_id == 0 || !cursor->conn->exhaust.active)
+    {
+      errno = ENOENT;
+      return FALSE;
+    }
+
+  mongo_wire_packet_get_header_raw (cursor->results, &h);
+  mongo_wire_packet_free (cursor->results);
+  cursor->offset = -1;
+
+  cursor->results = mongo_sync_cmd_get_more_recv (cursor->conn, h.id);
+  if (!cursor->results)
+    {
+      cursor->conn->exhaust.active = FALSE;
+      return FALSE;
+    }
+  mongo_wire_reply_packet_get_header (cursor->results, &cursor->ph);
+  if (cursor->ph.cursor_id == 0)
+    cursor->conn->exhaust.active = FALSE;
+  return TRUE;
+}
+
 gboolean
 mongo_sync_cursor_next (mongo_sync_cursor *cursor)
 {
@@ -62,23 +226,86 @@ mongo_sync_cursor_next (mongo_sync_cursor *cursor)
     }
   errno = 0;
 
-  if (cursor->offset >= cursor->ph.returned - 1)
+  if (cursor->offset >= cursor->ph.returned - 1 && cursor->exhaust)
+    {
+      if (!_mongo_sync_cursor_exhaust_next (cursor))
+	return FALSE;
+    }
+  else if (cursor->offset >= cursor->ph.returned - 1)
     {
-      gint32 ret = cursor->ph.returned;
       gint64 cid = cursor->ph.cursor_id;
+      gint32 ret = 0;
+
+      if (!cursor->prefetch.pending)
+	{
+	  ret = _mongo_sync_cursor_batch_size (cursor);
+	  cursor->batch.requested = g_get_monotonic_time ();
+	}
 
       mongo_wire_packet_free (cursor->results);
       cursor->offset = -1;
-      cursor->results = mongo_sync_cmd_get_more (cursor->conn, cursor->ns,
-						 ret, cid);
+      if (cursor->prefetch.pending)
+	{
+	  cursor->prefetch.pending = FALSE;
+	  cursor->conn->prefetching = FALSE;
+	  cursor->results = mongo_sync_cmd_get_more_recv (cursor->conn,
+							  cursor->prefetch.rid);
+	}
+      else
+	cursor->results = mongo_sync_cmd_get_more (cursor->conn, cursor->ns,
+						   ret, cid);
       if (!cursor->results)
 	return FALSE;
       mongo_wire_reply_packet_get_header (cursor->results, &cursor->ph);
+      cursor->batch.received = g_get_monotonic_time ();
     }
   cursor->offset++;
+  _mongo_sync_cursor_prefetch (cursor);
   return TRUE;
 }
 
+const guint8 *
+mongo_sync_cursor_get_raw_data (mongo_sync_cursor *cursor, gint32 *size)
+{
+  const guint8 *data;
+  gint32 bytes, pos = 0, dsize, i;
+
+  if (!cursor || !size)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  bytes = mongo_wire_packet_get_data (cursor->results, &data) -
+    sizeof (mongo_reply_packet_header);
+  if (!mongo_wire_reply_packet_get_data (cursor->results, &data))
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  for (i = 0; ; i++)
+    {
+      if (pos + (gint32)sizeof (gint32) > bytes)
+	{
+	  errno = ERANGE;
+	  return NULL;
+	}
+      dsize = bson_stream_doc_size (data, pos);
+      if (dsize <= 0 || pos + dsize > bytes)
+	{
+	  errno = EPROTO;
+	  return NULL;
+	}
+      if (i == cursor->offset)
+	break;
+      pos += dsize;
+    }
+
+  *size = dsize;
+  return data + pos;
+}
+
 void
 mongo_sync_cursor_free (mongo_sync_cursor *cursor)
 {
@@ -89,7 +316,37 @@ mongo_sync_cursor_free (mongo_sync_cursor *cursor)
     }
   errno = 0;
 
-  mongo_sync_cmd_kill_cursors (cursor->conn, 1, cursor->ph.cursor_id);
+  /* The server does not stop streaming until the cursor is
+     exhausted, so the rest of the stream has to be read for the
+     connection to remain usable. */
+  if (cursor->exhaust)
+    {
+      while (_mongo_sync_cursor_exhaust_next (cursor))
+	;
+      g_free (cursor->ns);
+      mongo_wire_packet_free (cursor->results);
+      g_free (cursor);
+      errno = 0;
+      return;
+    }
+
+  /* Collect the batch still in flight, so that its reply does not
+     confuse the next command on the connection. It may well have
+     been the last one. */
+  if (cursor->prefetch.pending)
+    {
+      mongo_packet *p;
+
+      cursor->conn->prefetching = FALSE;
+      p = mongo_sync_cmd_get_more_recv (cursor->conn, cursor->prefetch.rid);
+      if (p)
+	{
+	  mongo_wire_reply_packet_get_header (p, &cursor->ph);
+	  mongo_wire_packet_free (p);
+	}
+    }
+
+  mongo_sync_conn_defer_kill (cursor->conn, cursor->ph.cursor_id);
   g_free (cursor->ns);
   mongo_wire_packet_free (cursor->results);
   g_free (cursor);
@@ -46,6 +46,13 @@ typedef struct _mongo_sync_cursor mongo_sync_cursor;
  * The @a packet argument is supposed to be the output of - for
  * example - mongo_sync_cmd_query().
  *
+ * If the query was sent with #MONGO_WIRE_FLAG_QUERY_EXHAUST, the
+ * cursor reads the stream of replies the server sends on its own,
+ * without asking for further batches. Until the stream ends, the
+ * connection cannot be used for anything else (commands fail with
+ * errno set to EBUSY), and freeing the cursor reads the rest of the
+ * stream.
+ *
  * @param conn is the connection to associate with the cursor.
  * @param ns is the namespace to use with the cursor.
  * @param packet is a reply packet on which the cursor should be
@@ -74,6 +81,65 @@ mongo_sync_cursor *mongo_sync_cursor_new (mongo_sync_connection *conn,
  */
 gboolean mongo_sync_cursor_next (mongo_sync_cursor *cursor);
 
+/** Default byte budget of adaptive cursor batches. */
+#define MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES (4 * 1024 * 1024)
+
+/** Set the batch size of a MongoDB cursor.
+ *
+ * The size of the first batch is decided by the query that created
+ * the cursor; this sets the number of documents every further batch
+ * is requested with.
+ *
+ * @param cursor is the cursor to set the batch size of.
+ * @param batch_size is the number of documents to request per batch,
+ * or zero to request as many as the current batch has (the
+ * default).
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_cursor_set_batch_size (mongo_sync_cursor *cursor,
+					   gint32 batch_size);
+
+/** Enable or disable adaptive batch sizing on a MongoDB cursor.
+ *
+ * Adaptive batches start from the batch size (see
+ * mongo_sync_cursor_set_batch_size()), and double every time the
+ * application went through a batch faster than it took to fetch it,
+ * so long scans need fewer and fewer round-trips, while short ones
+ * stay cheap. Batches are capped so that, at the average document
+ * size seen so far, they stay within the given byte budget.
+ *
+ * @param cursor is the cursor to set adaptive sizing up on.
+ * @param max_bytes is the byte budget of a batch (see
+ * #MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES), or zero to disable
+ * adaptive sizing.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_cursor_set_adaptive_batching (mongo_sync_cursor *cursor,
+						  gint32 max_bytes);
+
+/** Set up prefetching on a MongoDB cursor.
+ *
+ * With prefetching enabled, mongo_sync_cursor_next() requests the
+ * next batch as soon as the application moved past the given part of
+ * the current one, so that the network round-trip overlaps with the
+ * processing of the rest of the batch.
+ *
+ * @param cursor is the cursor to set prefetching up on.
+ * @param fraction is the part of a batch to consume before requesting
+ * the next one, between 0 and 1. Zero disables prefetching.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note While a prefetch is in flight, the connection of the cursor
+ * cannot be used for anything else, until the cursor reaches the end
+ * of the current batch, or is freed: commands sent over it meanwhile
+ * fail with errno set to EBUSY.
+ */
+gboolean mongo_sync_cursor_set_prefetch (mongo_sync_cursor *cursor,
+					 gdouble fraction);
+
 /** Retrieve the BSON document at the cursor's position.
  *
  * @param cursor is the cursor to retrieve data from.
@@ -90,6 +156,11 @@ bson *mongo_sync_cursor_get_data (mongo_sync_cursor *cursor);
  * database is holding, and then freeing up the resources allocated
  * for it.
  *
+ * Cursors the server closed already are not killed at all. Others
+ * are queued on the connection, and killed together with every other
+ * queued cursor, along with the next command sent over it. See
+ * mongo_sync_conn_flush_cursor_kills().
+ *
  * @param cursor is the cursor to destroy.
  */
 void mongo_sync_cursor_free (mongo_sync_cursor *cursor);
@@ -0,0 +1,687 @@
+/* mongo-sync-monitor.c - libmongo-client replica set monitor
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-monitor.c
+ * MongoDB replica set monitor implementation.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <glib.h>
+#include <mongo.h>
+#include "libmongo-private.h"
+
+/** @internal A member, as tracked by the monitor thread. */
+typedef struct
+{
+  mongo_sync_rs_member state; /**< The state of the member. */
+  gint fd; /**< The socket connected to the member, or -1. */
+  gboolean answered; /**< Whether the member answered the current
+			heartbeat. */
+} _mongo_sync_monitor_member;
+
+/** @internal Replica set monitor object. */
+struct _mongo_sync_monitor
+{
+  GThread *thread; /**< The monitor thread. */
+
+  GMutex lock; /**< Protects the fields below, up to the heartbeat. */
+  GCond cond; /**< Signalled on wakeups and finished heartbeats. */
+  gboolean stop; /**< Signals the thread to exit. */
+  gboolean wakeup; /**< Signals the thread to start a heartbeat
+		      early. */
+  guint64 started; /**< Number of heartbeats started. */
+  guint64 finished; /**< Number of heartbeats finished. */
+
+  gint heartbeat; /**< Time between heartbeats, in milliseconds. */
+  mongo_connection_options options; /**< Options of the member
+				       connections. */
+  GList *seeds; /**< Addresses to check on every heartbeat. */
+  GPtrArray *members; /**< _mongo_sync_monitor_member objects. Only
+			 touched by the monitor thread. */
+
+  mongo_sync_topology *snapshot; /**< The published snapshot. */
+  gint readers; /**< Number of readers between loading the snapshot
+		   pointer and taking a reference to it. */
+};
+
+static void
+_mongo_sync_topology_free (mongo_sync_topology *topology)
+{
+  guint i;
+
+  if (!topology)
+    return;
+
+  for (i = 0; i < topology->members->len; i++)
+    {
+      mongo_sync_rs_member *m = g_ptr_array_index (topology->members, i);
+
+      g_free (m->address);
+      g_free (m);
+    }
+  g_ptr_array_free (topology->members, TRUE);
+  g_free (topology->primary);
+  g_free (topology);
+}
+
+/** @internal Drop a reference to a topology snapshot, freeing it
+ * along with the last one.
+ */
+static void
+_mongo_sync_topology_unref (mongo_sync_topology *topology)
+{
+  if (g_atomic_int_dec_and_test (&topology->refs))
+    _mongo_sync_topology_free (topology);
+}
+
+const mongo_sync_topology *
+mongo_sync_monitor_topology_acquire (mongo_sync_monitor *monitor)
+{
+  mongo_sync_topology *topology;
+
+  /* The publisher does not drop the snapshot it replaced while
+     anybody is here, so the reference is taken before it can. */
+  g_atomic_int_inc (&monitor->readers);
+  topology = (mongo_sync_topology *)g_atomic_pointer_get (&monitor->snapshot);
+  g_atomic_int_inc (&topology->refs);
+  g_atomic_int_add (&monitor->readers, -1);
+
+  return topology;
+}
+
+void
+mongo_sync_monitor_topology_release (mongo_sync_monitor *monitor,
+				     const mongo_sync_topology *topology)
+{
+  _mongo_sync_topology_unref ((mongo_sync_topology *)topology);
+}
+
+/** @internal Publish a new topology snapshot.
+ *
+ * The new snapshot replaces the previous one, which is freed once its
+ * last reader released it. Readers never wait: the publisher waits
+ * instead, for those that may have loaded the previous snapshot to
+ * take their reference to it. Only called from the monitor thread.
+ */
+static void
+_mongo_sync_monitor_publish (mongo_sync_monitor *monitor,
+			     mongo_sync_topology *topology)
+{
+  mongo_sync_topology *old;
+
+  topology->refs = 1;
+
+  old = (mongo_sync_topology *)g_atomic_pointer_get (&monitor->snapshot);
+  g_atomic_pointer_set (&monitor->snapshot, topology);
+  while (g_atomic_int_get (&monitor->readers) > 0)
+    g_thread_yield ();
+
+  _mongo_sync_topology_unref (old);
+}
+
+/** @internal Find a member by address, adding it if not known yet. */
+static _mongo_sync_monitor_member *
+_mongo_sync_monitor_member_get (mongo_sync_monitor *monitor,
+				const gchar *address)
+{
+  _mongo_sync_monitor_member *m;
+  guint i;
+
+  for (i = 0; i < monitor->members->len; i++)
+    {
+      m = g_ptr_array_index (monitor->members, i);
+      if (strcmp (m->state.address, address) == 0)
+	return m;
+    }
+
+  m = g_new0 (_mongo_sync_monitor_member, 1);
+  m->state.address = g_strdup (address);
+  m->state.rtt = -1;
+  m->state.last_write = -1;
+  m->state.lag = -1;
+  m->fd = -1;
+  g_ptr_array_add (monitor->members, m);
+
+  return m;
+}
+
+/** @internal Append the string elements of an array in a document to
+ * a list.
+ */
+static GList *
+_mongo_sync_monitor_append_array (GList *list, const bson *doc,
+				  const gchar *name)
+{
+  bson_cursor *c;
+  bson *array;
+  const gchar *s;
+
+  c = bson_find (doc, name);
+  if (!bson_cursor_get_array (c, &array))
+    {
+      bson_cursor_free (c);
+      return list;
+    }
+  bson_cursor_free (c);
+  bson_finish (array);
+
+  c = bson_cursor_new (array);
+  while (bson_cursor_next (c))
+    if (bson_cursor_get_string (c, &s))
+      list = g_list_append (list, g_strdup (s));
+  bson_cursor_free (c);
+  bson_free (array);
+
+  return list;
+}
+
+/** @internal Parse an ismaster reply into the state of a member.
+ *
+ * @returns TRUE on success, FALSE otherwise. The members the reply
+ * mentions are appended to @a hosts.
+ */
+static gboolean
+_mongo_sync_monitor_parse (mongo_sync_rs_member *member,
+			   const mongo_packet *p, GList **hosts)
+{
+  bson *res, *lw;
+  bson_cursor *c;
+  gboolean master, b;
+
+  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &res))
+    return FALSE;
+  bson_finish (res);
+
+  c = bson_find (res, "ismaster");
+  if (!bson_cursor_get_boolean (c, &master))
+    {
+      bson_cursor_free (c);
+      bson_free (res);
+      return FALSE;
+    }
+  bson_cursor_free (c);
+
+  if (master)
+    member->role = MONGO_SYNC_MEMBER_PRIMARY;
+  else
+    {
+      member->role = MONGO_SYNC_MEMBER_OTHER;
+
+      c = bson_find (res, "secondary");
+      if (bson_cursor_get_boolean (c, &b) && b)
+	member->role = MONGO_SYNC_MEMBER_SECONDARY;
+      bson_cursor_free (c);
+
+      c = bson_find (res, "arbiterOnly");
+      if (bson_cursor_get_boolean (c, &b) && b)
+	member->role = MONGO_SYNC_MEMBER_ARBITER;
+      bson_cursor_free (c);
+    }
+
+  member->last_write = -1;
+  c = bson_find (res, "lastWrite");
+  if (bson_cursor_get_document (c, &lw))
+    {
+      bson_cursor_free (c);
+      bson_finish (lw);
+      c = bson_find (lw, "lastWriteDate");
+      if (!bson_cursor_get_utc_datetime (c, &member->last_write))
+	member->last_write = -1;
+      bson_free (lw);
+    }
+  bson_cursor_free (c);
+
+  *hosts = _mongo_sync_monitor_append_array (*hosts, res, "hosts");
+  *hosts = _mongo_sync_monitor_append_array (*hosts, res, "passives");
+  *hosts = _mongo_sync_monitor_append_array (*hosts, res, "arbiters");
+
+  bson_free (res);
+  return TRUE;
+}
+
+/** @internal Add a probe for a member to a heartbeat, unless it is
+ * probed already.
+ *
+ * The probe takes over the connection of the member, if it has one.
+ */
+static void
+_mongo_sync_monitor_probe_add (mongo_sync_monitor *monitor,
+			       GPtrArray *probes, const gchar *address,
+			       gsize reqlen)
+{
+  _mongo_sync_monitor_member *m;
+  guint i;
+
+  for (i = 0; i < probes->len; i++)
+    if (strcmp (((mongo_sync_probe *)g_ptr_array_index (probes, i))->address,
+		address) == 0)
+      return;
+
+  m = _mongo_sync_monitor_member_get (monitor, address);
+  g_ptr_array_add (probes, mongo_sync_probe_new (address, m->fd,
+						 &monitor->options, reqlen));
+  m->fd = -1;
+}
+
+/** @internal Run a single heartbeat, and publish its results.
+ *
+ * All members, including the ones discovered during the heartbeat,
+ * are probed at once, so a slow or unreachable member does not delay
+ * the others. The heartbeat is bounded by the heartbeat interval, or
+ * by the connect timeout, if that is shorter, so that an unreachable
+ * member never holds back news of a new primary for longer than one
+ * interval.
+ */
+static void
+_mongo_sync_monitor_heartbeat (mongo_sync_monitor *monitor)
+{
+  const mongo_connection_options *opts = &monitor->options;
+  mongo_sync_topology *topology;
+  GPtrArray *probes;
+  struct pollfd *pfds = NULL;
+  guint *idx = NULL;
+  guint8 *req;
+  gsize reqlen;
+  GTimer *timer;
+  GList *l;
+  gint64 ref = -1;
+  gint limit;
+  guint i, n, alloc = 0;
+
+  req = mongo_sync_probe_request (0, &reqlen);
+  if (!req)
+    return;
+
+  timer = g_timer_new ();
+  limit = (opts->connect_timeout > 0) ?
+    MIN (opts->connect_timeout, monitor->heartbeat) : monitor->heartbeat;
+
+  for (i = 0; i < monitor->members->len; i++)
+    ((_mongo_sync_monitor_member *)
+     g_ptr_array_index (monitor->members, i))->answered = FALSE;
+
+  probes = g_ptr_array_new ();
+  for (l = monitor->seeds; l; l = g_list_next (l))
+    _mongo_sync_monitor_probe_add (monitor, probes, (gchar *)l->data, reqlen);
+  for (i = 0; i < monitor->members->len; i++)
+    _mongo_sync_monitor_probe_add
+      (monitor, probes,
+       ((_mongo_sync_monitor_member *)
+	g_ptr_array_index (monitor->members, i))->state.address, reqlen);
+
+  for (;;)
+    {
+      gint timeout, r;
+
+      if (alloc < probes->len)
+	{
+	  alloc = probes->len;
+	  pfds = g_renew (struct pollfd, pfds, alloc);
+	  idx = g_renew (guint, idx, alloc);
+	}
+
+      n = 0;
+      for (i = 0; i < probes->len; i++)
+	{
+	  mongo_sync_probe *probe = g_ptr_array_index (probes, i);
+
+	  if (probe->state == MONGO_SYNC_PROBE_DONE)
+	    continue;
+	  pfds[n].fd = probe->fd;
+	  pfds[n].events = (probe->state == MONGO_SYNC_PROBE_RECEIVING) ?
+	    POLLIN : POLLOUT;
+	  pfds[n].revents = 0;
+	  idx[n++] = i;
+	}
+      if (n == 0)
+	break;
+
+      timeout = limit - (gint)(g_timer_elapsed (timer, NULL) * 1000);
+      if (timeout <= 0)
+	break;
+
+      r = poll (pfds, n, timeout);
+      if (r < 0 && errno != EINTR)
+	break;
+
+      for (i = 0; i < n && r > 0; i++)
+	{
+	  mongo_sync_probe *probe = g_ptr_array_index (probes, idx[i]);
+	  _mongo_sync_monitor_member *m;
+	  mongo_packet *p;
+	  GList *hosts = NULL;
+	  gint64 rtt;
+
+	  if (!pfds[i].revents)
+	    continue;
+
+	  p = mongo_sync_probe_step (probe, req, reqlen, opts, timer);
+	  if (!p)
+	    continue;
+	  rtt = (gint64)((g_timer_elapsed (timer, NULL) - probe->sent) *
+			 G_USEC_PER_SEC);
+
+	  m = _mongo_sync_monitor_member_get (monitor, probe->address);
+	  if (!_mongo_sync_monitor_parse (&m->state, p, &hosts))
+	    {
+	      mongo_wire_packet_free (p);
+	      mongo_sync_probe_stop (probe);
+	      continue;
+	    }
+	  mongo_wire_packet_free (p);
+
+	  /* Exponentially weighted moving average, with the newest
+	     sample weighing a fifth. */
+	  if (m->state.rtt < 0)
+	    m->state.rtt = rtt;
+	  else
+	    m->state.rtt = (m->state.rtt * 4 + rtt) / 5;
+	  m->state.last_seen = g_get_real_time ();
+	  m->answered = TRUE;
+
+	  /* Keep the connection for the next heartbeat. */
+	  m->fd = probe->fd;
+	  probe->fd = -1;
+	  probe->state = MONGO_SYNC_PROBE_DONE;
+
+	  for (l = hosts; l; l = g_list_next (l))
+	    {
+	      _mongo_sync_monitor_probe_add (monitor, probes,
+					     (gchar *)l->data, reqlen);
+	      g_free (l->data);
+	    }
+	  g_list_free (hosts);
+	}
+    }
+
+  for (i = 0; i < probes->len; i++)
+    mongo_sync_probe_free (g_ptr_array_index (probes, i));
+  g_ptr_array_free (probes, TRUE);
+  g_free (pfds);
+  g_free (idx);
+  g_free (req);
+  g_timer_destroy (timer);
+
+  for (i = 0; i < monitor->members->len; i++)
+    {
+      _mongo_sync_monitor_member *m = g_ptr_array_index (monitor->members, i);
+
+      if (!m->answered)
+	m->state.role = MONGO_SYNC_MEMBER_DOWN;
+    }
+
+  /* The replication lag is measured against the last write of the
+     primary, or the freshest secondary, if there is no primary. */
+  for (i = 0; i < monitor->members->len; i++)
+    {
+      _mongo_sync_monitor_member *m = g_ptr_array_index (monitor->members, i);
+
+      if (m->state.role == MONGO_SYNC_MEMBER_PRIMARY)
+	{
+	  ref = m->state.last_write;
+	  break;
+	}
+      if (m->state.role == MONGO_SYNC_MEMBER_SECONDARY)
+	ref = MAX (ref, m->state.last_write);
+    }
+
+  topology = g_new0 (mongo_sync_topology, 1);
+  topology->members = g_ptr_array_sized_new (monitor->members->len);
+  for (i = 0; i < monitor->members->len; i++)
+    {
+      _mongo_sync_monitor_member *m = g_ptr_array_index (monitor->members, i);
+      mongo_sync_rs_member *copy;
+
+      m->state.lag = -1;
+      if ((m->state.role == MONGO_SYNC_MEMBER_PRIMARY ||
+	   m->state.role == MONGO_SYNC_MEMBER_SECONDARY) &&
+	  ref >= 0 && m->state.last_write >= 0)
+	m->state.lag = MAX (ref - m->state.last_write, 0);
+
+      copy = g_new (mongo_sync_rs_member, 1);
+      *copy = m->state;
+      copy->address = g_strdup (m->state.address);
+      g_ptr_array_add (topology->members, copy);
+
+      if (m->state.role == MONGO_SYNC_MEMBER_PRIMARY && !topology->primary)
+	topology->primary = g_strdup (m->state.address);
+    }
+
+  _mongo_sync_monitor_publish (monitor, topology);
+}
+
+/** @internal The monitor thread. */
+static gpointer
+_mongo_sync_monitor_thread (gpointer data)
+{
+  mongo_sync_monitor *monitor = (mongo_sync_monitor *)data;
+
+  g_mutex_lock (&monitor->lock);
+  while (!monitor->stop)
+    {
+      gint64 until;
+
+      monitor->started++;
+      monitor->wakeup = FALSE;
+      g_mutex_unlock (&monitor->lock);
+
+      _mongo_sync_monitor_heartbeat (monitor);
+
+      g_mutex_lock (&monitor->lock);
+      monitor->finished++;
+      g_cond_broadcast (&monitor->cond);
+
+      until = g_get_monotonic_time () +
+	monitor->heartbeat * G_TIME_SPAN_MILLISECOND;
+      while (!monitor->stop && !monitor->wakeup)
+	if (!g_cond_wait_until (&monitor->cond, &monitor->lock, until))
+	  break;
+    }
+  g_mutex_unlock (&monitor->lock);
+
+  return NULL;
+}
+
+mongo_sync_monitor *
+mongo_sync_monitor_new (mongo_sync_connection *conn, gint heartbeat)
+{
+  mongo_sync_monitor *monitor;
+  GList *l;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+  if (heartbeat < 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  monitor = g_new0 (mongo_sync_monitor, 1);
+  g_mutex_init (&monitor->lock);
+  g_cond_init (&monitor->cond);
+
+  monitor->heartbeat = (heartbeat) ? heartbeat :
+    MONGO_SYNC_MONITOR_DEFAULT_HEARTBEAT;
+  monitor->options = conn->super.options;
+
+  if (conn->rs.primary)
+    monitor->seeds = g_list_append (monitor->seeds,
+				    g_strdup (conn->rs.primary));
+  for (l = conn->rs.hosts; l; l = g_list_next (l))
+    monitor->seeds = g_list_append (monitor->seeds, g_strdup (l->data));
+  for (l = conn->rs.seeds; l; l = g_list_next (l))
+    monitor->seeds = g_list_append (monitor->seeds, g_strdup (l->data));
+
+  monitor->members = g_ptr_array_new ();
+
+  monitor->snapshot = g_new0 (mongo_sync_topology, 1);
+  monitor->snapshot->members = g_ptr_array_new ();
+  monitor->snapshot->refs = 1;
+
+  monitor->thread = g_thread_try_new ("mongo-sync-monitor",
+				      _mongo_sync_monitor_thread, monitor,
+				      NULL);
+  if (!monitor->thread)
+    {
+      mongo_sync_monitor_free (monitor);
+      errno = EAGAIN;
+      return NULL;
+    }
+
+  return monitor;
+}
+
+void
+mongo_sync_monitor_free (mongo_sync_monitor *monitor)
+{
+  guint i;
+
+  if (!monitor)
+    return;
+
+  if (monitor->thread)
+    {
+      g_mutex_lock (&monitor->lock);
+      monitor->stop = TRUE;
+      g_cond_broadcast (&monitor->cond);
+      g_mutex_unlock (&monitor->lock);
+
+      g_thread_join (monitor->thread);
+    }
+
+  for (i = 0; i < monitor->members->len; i++)
+    {
+      _mongo_sync_monitor_member *m = g_ptr_array_index (monitor->members, i);
+
+      if (m->fd != -1)
+	close (m->fd);
+      g_free (m->state.address);
+      g_free (m);
+    }
+  g_ptr_array_free (monitor->members, TRUE);
+
+  while (monitor->seeds)
+    {
+      g_free (monitor->seeds->data);
+      monitor->seeds = g_list_delete_link (monitor->seeds, monitor->seeds);
+    }
+
+  _mongo_sync_topology_unref (monitor->snapshot);
+
+  g_cond_clear (&monitor->cond);
+  g_mutex_clear (&monitor->lock);
+  g_free (monitor);
+}
+
+gboolean
+mongo_sync_monitor_refresh (mongo_sync_monitor *monitor)
+{
+  guint64 want;
+
+  if (!monitor)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  g_mutex_lock (&monitor->lock);
+  want = monitor->started + 1;
+  monitor->wakeup = TRUE;
+  g_cond_broadcast (&monitor->cond);
+  while (monitor->finished < want)
+    g_cond_wait (&monitor->cond, &monitor->lock);
+  g_mutex_unlock (&monitor->lock);
+
+  return TRUE;
+}
+
+gchar *
+mongo_sync_monitor_get_primary (mongo_sync_monitor *monitor)
+{
+  const mongo_sync_topology *topology;
+  gchar *primary;
+
+  if (!monitor)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  topology = mongo_sync_monitor_topology_acquire (monitor);
+  primary = g_strdup (topology->primary);
+  mongo_sync_monitor_topology_release (monitor, topology);
+
+  if (!primary)
+    errno = ENOENT;
+  return primary;
+}
+
+gboolean
+mongo_sync_monitor_get_member (mongo_sync_monitor *monitor,
+			       const gchar *member,
+			       mongo_sync_member_info *info)
+{
+  const mongo_sync_topology *topology;
+  gboolean found = FALSE;
+  guint i;
+
+  if (!monitor || !member || !info)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  topology = mongo_sync_monitor_topology_acquire (monitor);
+  for (i = 0; i < topology->members->len && !found; i++)
+    {
+      const mongo_sync_rs_member *m = g_ptr_array_index (topology->members,
+							 i);
+
+      if (strcmp (m->address, member) != 0)
+	continue;
+
+      info->role = m->role;
+      info->rtt = m->rtt;
+      info->last_seen = m->last_seen;
+      info->lag = m->lag;
+      found = TRUE;
+    }
+  mongo_sync_monitor_topology_release (monitor, topology);
+
+  if (!found)
+    errno = ENOENT;
+  return found;
+}
+
+gboolean
+mongo_sync_conn_set_monitor (mongo_sync_connection *conn,
+			     mongo_sync_monitor *monitor)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  conn->monitor = monitor;
+  return TRUE;
+}
@@ -0,0 +1,171 @@
+/* mongo-sync-monitor.h - libmongo-client replica set monitor API
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-monitor.h
+ * MongoDB replica set monitor API public header.
+ *
+ * @addtogroup mongo_sync
+ * @{
+ */
+
+#ifndef LIBMONGO_SYNC_MONITOR_H
+#define LIBMONGO_SYNC_MONITOR_H 1
+
+#include <mongo-sync.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** @defgroup mongo_sync_monitor_api Mongo Sync Monitor API
+ *
+ * A topology monitor keeps track of the members of a replica set on a
+ * dedicated thread, so that application threads never have to pay for
+ * discovery themselves.
+ *
+ * Every heartbeat, the monitor sends an ismaster command to each known
+ * member over its own connections, and records the role, the moving
+ * average of the round-trip times, the time the member was last seen
+ * and its replication lag. The results are published as an immutable
+ * snapshot, which readers access without taking any locks.
+ *
+ * Sync connections can be attached to a monitor with
+ * mongo_sync_conn_set_monitor(), in which case mongo_sync_reconnect()
+ * connects straight to the member the latest snapshot points at.
+ *
+ * @addtogroup mongo_sync_monitor_api
+ * @{
+ */
+
+/** Opaque replica set monitor object. */
+typedef struct _mongo_sync_monitor mongo_sync_monitor;
+
+/** Default time between two heartbeats, in milliseconds. */
+#define MONGO_SYNC_MONITOR_DEFAULT_HEARTBEAT 10000
+
+/** Roles of a replica set member. */
+typedef enum
+{
+  /** The member was not checked yet. */
+  MONGO_SYNC_MEMBER_UNKNOWN = 0,
+  /** The member did not answer the last heartbeat. */
+  MONGO_SYNC_MEMBER_DOWN,
+  /** The member is the primary. */
+  MONGO_SYNC_MEMBER_PRIMARY,
+  /** The member is a secondary. */
+  MONGO_SYNC_MEMBER_SECONDARY,
+  /** The member is an arbiter. */
+  MONGO_SYNC_MEMBER_ARBITER,
+  /** The member is up, but in some other state (recovering, startup,
+      and so on). */
+  MONGO_SYNC_MEMBER_OTHER
+} mongo_sync_member_role;
+
+/** State of a replica set member, as seen by a monitor. */
+typedef struct
+{
+  mongo_sync_member_role role; /**< The role of the member. */
+  gint64 rtt; /**< Moving average of the round-trip time, in
+		 microseconds, or -1 if unknown. */
+  gint64 last_seen; /**< Wall-clock time of the last answer, in
+		       microseconds since the epoch, or 0 if never. */
+  gint64 lag; /**< Replication lag behind the primary, in
+		 milliseconds, or -1 if unknown. */
+} mongo_sync_member_info;
+
+/** Create a new replica set monitor.
+ *
+ * The monitor starts from the primary, the hosts and the seeds known
+ * by @a conn, uses the same socket options, and discovers the rest of
+ * the set on its own. It does not use the socket of @a conn, which
+ * can be freed independently.
+ *
+ * The first heartbeat starts right away, in the background.
+ *
+ * @param conn is the connection to take the seeds from.
+ * @param heartbeat is the time between two heartbeats, in
+ * milliseconds, or zero for #MONGO_SYNC_MONITOR_DEFAULT_HEARTBEAT.
+ *
+ * @returns A newly allocated monitor, or NULL on error. It is the
+ * responsibility of the caller to free the monitor once it is not
+ * used anymore.
+ */
+mongo_sync_monitor *mongo_sync_monitor_new (mongo_sync_connection *conn,
+					    gint heartbeat);
+
+/** Stop and free a replica set monitor.
+ *
+ * @param monitor is the monitor to free.
+ *
+ * @note Connections attached to the monitor must be detached (or
+ * disconnected) before freeing it.
+ */
+void mongo_sync_monitor_free (mongo_sync_monitor *monitor);
+
+/** Run a heartbeat right away.
+ *
+ * Wakes the monitor thread up, and waits until it finished a full
+ * heartbeat that started after the call.
+ *
+ * @param monitor is the monitor to refresh.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_monitor_refresh (mongo_sync_monitor *monitor);
+
+/** Get the primary of the replica set, as seen by a monitor.
+ *
+ * @param monitor is the monitor to query.
+ *
+ * @returns A newly allocated copy of the address of the primary, or
+ * NULL on error, in which case errno is set to ENOENT if there is no
+ * known primary.
+ */
+gchar *mongo_sync_monitor_get_primary (mongo_sync_monitor *monitor);
+
+/** Get the state of a replica set member, as seen by a monitor.
+ *
+ * @param monitor is the monitor to query.
+ * @param member is the address of the member, as host:port.
+ * @param info is where the state of the member will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise, in which case errno is
+ * set to ENOENT if the member is not known by the monitor.
+ */
+gboolean mongo_sync_monitor_get_member (mongo_sync_monitor *monitor,
+					const gchar *member,
+					mongo_sync_member_info *info);
+
+/** Attach a replica set monitor to a connection.
+ *
+ * @param conn is the connection to attach the monitor to.
+ * @param monitor is the monitor to use, or NULL to detach.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note The monitor is not owned by the connection, and must outlive
+ * it. The same monitor can be shared by any number of connections,
+ * from any number of threads.
+ */
+gboolean mongo_sync_conn_set_monitor (mongo_sync_connection *conn,
+				      mongo_sync_monitor *monitor);
+
+/** @} */
+
+/** @} */
+
+G_END_DECLS
+
+#endif
@@ -20,166 +20,2017 @@
 
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
 #include <glib.h>
 #include <mongo.h>
 #include "libmongo-private.h"
 
+/** @internal The most threads to open the initial connections with. */
+#define MONGO_SYNC_POOL_MAX_OPENERS 16
+
+/** @internal Time to wait before trying to open replacement
+ * connections again, after failing to, in milliseconds. */
+#define MONGO_SYNC_POOL_REFILL_RETRY 1000
+
+/** @internal The size of a cache line, to keep data written by
+ * different threads apart. */
+#define MONGO_SYNC_POOL_CACHE_LINE 64
+
+/** @internal The in_use value of a connection while it is being
+ * returned. Counts as in use, but is not the caller's to return. */
+#define MONGO_SYNC_POOL_RETURNING 2
+
+/** @internal A shard of the free connections of a pool.
+ *
+ * Every connection belongs to exactly one shard, and is pushed back
+ * onto the stack of that shard when it is returned.
+ */
+typedef struct
+{
+  GMutex lock; /**< Protects the stack. */
+  mongo_sync_pool_connection **stack; /**< The free connections. */
+  gint top; /**< Number of connections on the stack. */
+} mongo_sync_pool_shard;
+
+/** @internal The free connections of one role, in shards. */
+typedef struct
+{
+  gint nshards; /**< Number of shards. */
+  mongo_sync_pool_shard *shards; /**< The shards themselves. */
+} mongo_sync_pool_free_list;
+
+/** @internal Where a connection is parked for the thread that
+ * returned it last.
+ *
+ * Each one takes a cache line of its own, so that threads taking
+ * back their own connections do not disturb each other.
+ */
+typedef struct
+{
+  gint owner; /**< The number of the thread the connection is parked
+		 for, or zero if it is not parked. Only changed
+		 atomically. */
+  gchar pad[MONGO_SYNC_POOL_CACHE_LINE - sizeof (gint)]; /**< Padding. */
+} mongo_sync_pool_parking;
+
+/** @internal A mongos router of a pool. */
+typedef struct
+{
+  gchar *host; /**< The address of the router. */
+  gint port; /**< The port of the router. */
+  gboolean healthy; /**< Whether connections may be opened to it. Only
+		       changed atomically. */
+  gint open; /**< Number of connections open to it. Only changed
+		atomically. */
+  gint rtt; /**< The round-trip time last measured, in microseconds,
+	       or -1. Only changed atomically. */
+} mongo_sync_pool_router;
+
 /** @internal A connection pool object. */
 struct _mongo_sync_pool
 {
-  gint nmasters; /**< Number of master connections in the pool. */
-  gint nslaves; /**< Number of slave connections in the pool. */
+  gint nmasters; /**< Most master connections in the pool. */
+  gint nslaves; /**< Most slave connections in the pool. */
+  gint min_masters; /**< Master connections to keep open. */
+  gint min_slaves; /**< Slave connections to keep open. */
+  gint idle_timeout; /**< Time after which idle connections above the
+			minimum are closed, in milliseconds. */
+
+  gint open_masters; /**< Master slots taken, including connections
+			being opened. Only changed atomically. */
+  gint open_slaves; /**< Slave slots taken, including connections
+		       being opened. Only changed atomically. */
+
+  GMutex topology_lock; /**< Protects the addresses below. */
+  gchar *host; /**< The address of the master. */
+  gint port; /**< The port of the master. */
+  mongo_connection_options opts; /**< The socket options to use. */
+  gboolean have_opts; /**< Whether @a opts were given. */
+  gchar **secondaries; /**< The addresses of the secondaries. */
+  gint nsecondaries; /**< Number of secondaries. */
+  gint next_secondary; /**< The secondary to open the next slave to.
+			  Only changed atomically. */
+
+  mongo_sync_pool_router *routers; /**< The routers masters are opened
+				      to, if any. */
+  gint nrouters; /**< Number of routers. */
+  gint next_router; /**< Where to start looking for a router to open
+		       the next connection to. Only changed
+		       atomically. */
+  gint balance; /**< The #mongo_sync_pool_balance strategy to pick
+		   with. Only changed atomically. */
+
+  GRWLock slots_lock; /**< Taken for writing while connections are
+			 put into or taken out of their slots. */
+  mongo_sync_pool_connection **masters; /**< The master connections,
+					   indexed by their ID. Empty
+					   slots are NULL. */
+  mongo_sync_pool_connection **slaves; /**< The slave connections. */
+
+  mongo_sync_pool_free_list free_masters; /**< The free masters. */
+  mongo_sync_pool_free_list free_slaves; /**< The free slaves. */
+
+  gboolean affinity; /**< Whether returned connections are parked for
+			the thread returning them. Only changed
+			atomically. */
+  mongo_sync_pool_parking *parking; /**< Parking spots, indexed by
+				       connection ID. */
+
+  mongo_sync_monitor *monitor; /**< The replica set monitor to pick
+				  connections by, if any. */
+
+  GMutex reap_lock; /**< Held while reaping idle connections. */
+  gint64 next_reap; /**< When to reap idle connections next, in
+		       monotonic microseconds. */
+
+  GMutex wait_lock; /**< Protects the wait queue and statistics. */
+  GQueue waiters; /**< Callers waiting for a connection, oldest
+		     first. */
+  gint nwaiters; /**< Length of the wait queue, readable without the
+		    lock. */
+  mongo_sync_pool_wait_stats stats; /**< Wait time statistics. */
+
+  struct
+  {
+    GMutex lock; /**< Protects the fields below. */
+    GCond cond; /**< Signalled when there is work to do. */
+    GThread *thread; /**< The maintenance thread, if started. */
+    gint interval; /**< Time after which idle connections are
+		      validated, in milliseconds, or zero. */
+    gboolean refill; /**< Whether connections were evicted. */
+    gboolean stop; /**< Whether the thread should stop. */
+  } health; /**< Health checking state. */
+};
+
+/** @internal A caller waiting for a connection. */
+typedef struct
+{
+  GCond cond; /**< Signalled once a connection was handed over. */
+  gboolean want_master; /**< Whether only a master will do. */
+  mongo_sync_pool_connection *conn; /**< The connection handed over. */
+} mongo_sync_pool_waiter;
+
+/** @internal The connection a thread parked last. */
+typedef struct
+{
+  mongo_sync_pool *pool; /**< The pool the connection belongs to. */
+  gint pool_id; /**< The ID of the connection. */
+} mongo_sync_pool_affinity;
+
+/** @internal The number of the calling thread, plus one. */
+static GPrivate _mongo_sync_pool_thread_slot;
+/** @internal The number of threads that picked a slot so far. */
+static gint _mongo_sync_pool_threads;
+/** @internal The connection the calling thread parked last. */
+static GPrivate _mongo_sync_pool_thread_affinity = G_PRIVATE_INIT (g_free);
+
+/** @internal Get the number of the calling thread, plus one.
+ *
+ * Threads are numbered in the order they first pick a connection.
+ */
+static gint
+_mongo_sync_pool_thread_number (void)
+{
+  gint slot;
+
+  slot = GPOINTER_TO_INT (g_private_get (&_mongo_sync_pool_thread_slot));
+  if (slot == 0)
+    {
+      slot = g_atomic_int_add (&_mongo_sync_pool_threads, 1) + 1;
+      g_private_set (&_mongo_sync_pool_thread_slot, GINT_TO_POINTER (slot));
+    }
+  return slot;
+}
+
+/** @internal Find the shard a thread starts looking at.
+ *
+ * Threads are spread over the shards in the order they first pick a
+ * connection, so that up to as many threads as there are shards do
+ * not contend for the same lock.
+ */
+static gint
+_mongo_sync_pool_home_shard (const mongo_sync_pool_free_list *fl)
+{
+  return (_mongo_sync_pool_thread_number () - 1) % fl->nshards;
+}
+
+/** @internal Set up the free list of a role, for up to @a n
+ * connections.
+ *
+ * One shard is made per processor, but never more than there can be
+ * connections.
+ */
+static void
+_mongo_sync_pool_free_list_init (mongo_sync_pool_free_list *fl, gint n)
+{
+  gint i;
+
+  fl->nshards = MIN ((gint)g_get_num_processors (), n);
+  if (fl->nshards <= 0)
+    {
+      fl->nshards = 0;
+      fl->shards = NULL;
+      return;
+    }
+
+  fl->shards = g_new0 (mongo_sync_pool_shard, fl->nshards);
+  for (i = 0; i < fl->nshards; i++)
+    {
+      g_mutex_init (&fl->shards[i].lock);
+      fl->shards[i].stack = g_new (mongo_sync_pool_connection *,
+				   (n + fl->nshards - 1) / fl->nshards);
+    }
+}
+
+static void
+_mongo_sync_pool_free_list_clear (mongo_sync_pool_free_list *fl)
+{
+  gint i;
+
+  for (i = 0; i < fl->nshards; i++)
+    {
+      g_mutex_clear (&fl->shards[i].lock);
+      g_free (fl->shards[i].stack);
+    }
+  g_free (fl->shards);
+}
+
+/** @internal Push a returned connection back onto its shard, and
+ * mark it as free.
+ *
+ * The connection is only marked free once it is on the stack, under
+ * the shard lock, so that whoever claims it from then on finds it
+ * there when taking it off again before closing it.
+ *
+ * @param fl is the free list of the role of the connection.
+ * @param index is the index of the connection within its role.
+ * @param c is the connection.
+ */
+static void
+_mongo_sync_pool_free_list_push (mongo_sync_pool_free_list *fl, gint index,
+				 mongo_sync_pool_connection *c)
+{
+  mongo_sync_pool_shard *shard = &fl->shards[index % fl->nshards];
+
+  g_mutex_lock (&shard->lock);
+  /* A connection picked by read preference is left on the stack, and
+     is valid there again now that it is free. */
+  if (!c->on_stack)
+    {
+      c->on_stack = TRUE;
+      shard->stack[shard->top++] = c;
+    }
+  g_atomic_int_set (&c->in_use, FALSE);
+  g_mutex_unlock (&shard->lock);
+}
+
+/** @internal Take a connection off the stack of its shard, if it is
+ * there, before it is closed.
+ */
+static void
+_mongo_sync_pool_free_list_remove (mongo_sync_pool_free_list *fl,
+				   gint index,
+				   mongo_sync_pool_connection *c)
+{
+  mongo_sync_pool_shard *shard = &fl->shards[index % fl->nshards];
+  gint i;
+
+  g_mutex_lock (&shard->lock);
+  if (c->on_stack)
+    {
+      for (i = 0; i < shard->top; i++)
+	if (shard->stack[i] == c)
+	  {
+	    shard->stack[i] = shard->stack[--shard->top];
+	    break;
+	  }
+      c->on_stack = FALSE;
+    }
+  g_mutex_unlock (&shard->lock);
+}
+
+/** @internal Pop a free connection off a free list.
+ *
+ * Looks at the home shard of the calling thread first, and at the
+ * others in turn if that one is empty.
+ *
+ * @returns The connection, already marked as in use, or NULL if there
+ * are no free connections.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_free_list_pop (mongo_sync_pool_free_list *fl)
+{
+  gint home, i;
+
+  if (fl->nshards == 0)
+    return NULL;
+
+  home = _mongo_sync_pool_home_shard (fl);
+  for (i = 0; i < fl->nshards; i++)
+    {
+      mongo_sync_pool_shard *shard = &fl->shards[(home + i) % fl->nshards];
+      mongo_sync_pool_connection *c = NULL;
+
+      g_mutex_lock (&shard->lock);
+      while (shard->top > 0)
+	{
+	  c = shard->stack[--shard->top];
+	  c->on_stack = FALSE;
+	  /* Connections picked by read preference are not taken off
+	     the stack, so skip those that are in use. */
+	  if (g_atomic_int_compare_and_exchange (&c->in_use, FALSE, TRUE))
+	    break;
+	  c = NULL;
+	}
+      g_mutex_unlock (&shard->lock);
+
+      if (c)
+	return c;
+    }
+  return NULL;
+}
+
+static mongo_sync_pool_connection *
+_mongo_sync_pool_connect (const gchar *host, gint port, gboolean slaveok,
+			  const mongo_connection_options *opts)
+{
+  mongo_sync_connection *c;
+  mongo_sync_pool_connection *conn;
+  gint64 start, rtt = -1;
+
+  c = mongo_sync_connect_with_options (host, port, slaveok, opts);
+  if (!c)
+    return NULL;
+
+  start = g_get_monotonic_time ();
+  if (mongo_sync_cmd_ping (c))
+    rtt = g_get_monotonic_time () - start;
+
+  conn = g_realloc (c, sizeof (mongo_sync_pool_connection));
+  conn->pool_id = 0;
+  conn->in_use = FALSE;
+  conn->on_stack = FALSE;
+  conn->rtt = rtt;
+  conn->last_used = g_get_monotonic_time ();
+  conn->router = -1;
+
+  return conn;
+}
+
+/** @internal Reserve a slot for a new connection, if the pool is not
+ * at its maximum size yet.
+ */
+static gboolean
+_mongo_sync_pool_reserve (gint *open, gint max)
+{
+  gint n;
+
+  do
+    {
+      n = g_atomic_int_get (open);
+      if (n >= max)
+	return FALSE;
+    }
+  while (!g_atomic_int_compare_and_exchange (open, n, n + 1));
+
+  return TRUE;
+}
+
+/** @internal Release a reserved slot, unless that would take the pool
+ * below @a min connections.
+ */
+static gboolean
+_mongo_sync_pool_release (gint *open, gint min)
+{
+  gint n;
+
+  do
+    {
+      n = g_atomic_int_get (open);
+      if (n <= min)
+	return FALSE;
+    }
+  while (!g_atomic_int_compare_and_exchange (open, n, n - 1));
+
+  return TRUE;
+}
+
+/** @internal Get the connection in the slot of a connection ID. */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_slot (mongo_sync_pool *pool, gint pool_id)
+{
+  if (pool_id < pool->nmasters)
+    return pool->masters[pool_id];
+  return pool->slaves[pool_id - pool->nmasters - 1];
+}
+
+/** @internal Take a parked connection, whichever thread it is parked
+ * for.
+ *
+ * @returns TRUE if the connection with @a pool_id was parked, and is
+ * now held by the caller.
+ */
+static gboolean
+_mongo_sync_pool_unpark (mongo_sync_pool *pool, gint pool_id)
+{
+  gint *owner = &pool->parking[pool_id].owner;
+  gint t;
+
+  while ((t = g_atomic_int_get (owner)) != 0)
+    if (g_atomic_int_compare_and_exchange (owner, t, 0))
+      return TRUE;
+  return FALSE;
+}
+
+/** @internal Take back the connection the calling thread parked last,
+ * if it is still parked.
+ *
+ * Only the parking spot, which nobody else writes while the
+ * connection stays parked, is touched until the connection is taken:
+ * a parked connection is held, so it cannot be closed in the
+ * meantime.
+ *
+ * @returns The connection, already marked as in use, or NULL.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_pick_parked (mongo_sync_pool *pool, gboolean want_master)
+{
+  mongo_sync_pool_affinity *a;
+
+  a = (mongo_sync_pool_affinity *)
+    g_private_get (&_mongo_sync_pool_thread_affinity);
+
+  /* The pool may be a new one at the address of a freed one, hence
+     the range check. */
+  if (!a || a->pool != pool ||
+      a->pool_id > pool->nmasters + pool->nslaves ||
+      (want_master && a->pool_id >= pool->nmasters))
+    return NULL;
+
+  if (!g_atomic_int_compare_and_exchange (&pool->parking[a->pool_id].owner,
+					  _mongo_sync_pool_thread_number (),
+					  0))
+    return NULL;
+  return _mongo_sync_pool_slot (pool, a->pool_id);
+}
+
+/** @internal Take a connection parked for any thread.
+ *
+ * Used when there are no free connections left, so that parked
+ * connections are not lost to other threads. Secondaries are
+ * preferred when acceptable.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_steal (mongo_sync_pool *pool, gboolean want_master)
+{
+  gint i;
+
+  if (!g_atomic_int_get (&pool->affinity))
+    return NULL;
+
+  if (!want_master)
+    for (i = 0; i < pool->nslaves; i++)
+      if (_mongo_sync_pool_unpark (pool, pool->nmasters + i + 1))
+	return pool->slaves[i];
+  for (i = 0; i < pool->nmasters; i++)
+    if (_mongo_sync_pool_unpark (pool, i))
+      return pool->masters[i];
+  return NULL;
+}
+
+static void _mongo_sync_pool_evict (mongo_sync_pool *pool,
+				    mongo_sync_pool_connection *c);
+static void _mongo_sync_pool_schedule_refill (mongo_sync_pool *pool);
+
+/** @internal Stop opening connections to a router, and close the
+ * free ones open to it.
+ *
+ * Connections to the router that are in use are closed when they are
+ * returned. The router is probed by the maintenance thread, until it
+ * answers again.
+ */
+static void
+_mongo_sync_pool_router_down (mongo_sync_pool *pool, gint r)
+{
+  gint i;
+
+  if (!g_atomic_int_compare_and_exchange (&pool->routers[r].healthy,
+					  TRUE, FALSE))
+    return;
+
+  for (i = 0; i < pool->nmasters; i++)
+    {
+      mongo_sync_pool_connection *c;
+
+      g_rw_lock_reader_lock (&pool->slots_lock);
+      c = pool->masters[i];
+      if (c && (c->router != r ||
+		(!g_atomic_int_compare_and_exchange (&c->in_use, FALSE, TRUE) &&
+		 !_mongo_sync_pool_unpark (pool, c->pool_id))))
+	c = NULL;
+      g_rw_lock_reader_unlock (&pool->slots_lock);
+
+      if (c)
+	_mongo_sync_pool_evict (pool, c);
+    }
+  _mongo_sync_pool_schedule_refill (pool);
+}
+
+/** @internal Choose the router to open the next connection to, and
+ * count the connection as open to it.
+ *
+ * The healthy router with the fewest connections is chosen, so that
+ * connections spread evenly, and move back to routers that recover
+ * as the pool grows or is refilled. Ties are broken in turn. If no
+ * router is healthy, all of them are considered.
+ */
+static gint
+_mongo_sync_pool_choose_router (mongo_sync_pool *pool)
+{
+  gint start, pass, i, r, best = -1, best_open = 0;
+
+  start = (guint)g_atomic_int_add (&pool->next_router, 1) % pool->nrouters;
+  for (pass = 0; pass < 2 && best < 0; pass++)
+    for (i = 0; i < pool->nrouters; i++)
+      {
+	gint open;
+
+	r = (start + i) % pool->nrouters;
+	if (pass == 0 && !g_atomic_int_get (&pool->routers[r].healthy))
+	  continue;
+	open = g_atomic_int_get (&pool->routers[r].open);
+	if (best < 0 || open < best_open)
+	  {
+	    best = r;
+	    best_open = open;
+	  }
+      }
+
+  /* Count it right away, so that connections opened in parallel are
+     spread too. */
+  g_atomic_int_inc (&pool->routers[best].open);
+  return best;
+}
+
+/** @internal Note a new connection to a router. */
+static void
+_mongo_sync_pool_router_opened (mongo_sync_pool *pool,
+				mongo_sync_pool_connection *c, gint r)
+{
+  c->router = r;
+  if (c->rtt >= 0)
+    g_atomic_int_set (&pool->routers[r].rtt, (gint)MIN (c->rtt, G_MAXINT));
+}
+
+/** @internal Open a master connection to one of the routers.
+ *
+ * Routers that cannot be connected to are marked down, and the next
+ * one is tried.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_connect_router (mongo_sync_pool *pool,
+				 const mongo_connection_options *opts)
+{
+  mongo_sync_pool_connection *c;
+  gint i, r;
+
+  for (i = 0; i < pool->nrouters; i++)
+    {
+      r = _mongo_sync_pool_choose_router (pool);
+      c = _mongo_sync_pool_connect (pool->routers[r].host,
+				    pool->routers[r].port, FALSE, opts);
+      if (c)
+	{
+	  _mongo_sync_pool_router_opened (pool, c, r);
+	  return c;
+	}
+      g_atomic_int_add (&pool->routers[r].open, -1);
+      _mongo_sync_pool_router_down (pool, r);
+    }
+  return NULL;
+}
+
+/** @internal Probe the routers that are down.
+ *
+ * @returns TRUE if every router is up, FALSE otherwise.
+ */
+static gboolean
+_mongo_sync_pool_probe_routers (mongo_sync_pool *pool)
+{
+  gboolean up = TRUE;
+  gint r;
+
+  for (r = 0; r < pool->nrouters; r++)
+    {
+      mongo_sync_connection *c;
+
+      if (g_atomic_int_get (&pool->routers[r].healthy))
+	continue;
+
+      c = mongo_sync_connect_with_options (pool->routers[r].host,
+					   pool->routers[r].port, FALSE,
+					   (pool->have_opts) ?
+					   &pool->opts : NULL);
+      if (c && mongo_sync_cmd_is_master (c))
+	g_atomic_int_set (&pool->routers[r].healthy, TRUE);
+      else
+	up = FALSE;
+      mongo_sync_disconnect (c);
+    }
+  return up;
+}
+
+/** @internal Open a connection into a reserved slot.
+ *
+ * Slave slots are spread over the secondaries in a round-robin
+ * fashion.
+ *
+ * @returns The new connection, already marked as in use, or NULL on
+ * error, in which case the reservation is released.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_open (mongo_sync_pool *pool, gboolean master)
+{
+  mongo_sync_pool_connection *c, **slots;
+  const mongo_connection_options *opts;
+  gint i, n;
+
+  gchar *host = NULL;
+  gint port = 27017;
+
+  opts = (pool->have_opts) ? &pool->opts : NULL;
+  n = (master) ? pool->nmasters : pool->nslaves;
+  slots = (master) ? pool->masters : pool->slaves;
+
+  if (master && pool->nrouters > 0)
+    c = _mongo_sync_pool_connect_router (pool, opts);
+  else
+    {
+      g_mutex_lock (&pool->topology_lock);
+      if (master)
+	{
+	  host = g_strdup (pool->host);
+	  port = pool->port;
+	}
+      else if (pool->nsecondaries > 0)
+	{
+	  guint j = g_atomic_int_add (&pool->next_secondary, 1);
+
+	  if (!mongo_util_parse_addr (pool->secondaries[j %
+							pool->nsecondaries],
+				      &host, &port))
+	    host = NULL;
+	}
+      g_mutex_unlock (&pool->topology_lock);
+
+      c = (host) ? _mongo_sync_pool_connect (host, port, !master, opts) : NULL;
+      g_free (host);
+    }
+
+  if (!c)
+    {
+      g_atomic_int_add ((master) ? &pool->open_masters : &pool->open_slaves,
+			-1);
+      return NULL;
+    }
+  c->in_use = TRUE;
+
+  /* The reservation guarantees there is an empty slot. */
+  g_rw_lock_writer_lock (&pool->slots_lock);
+  for (i = 0; i < n && slots[i]; i++)
+    ;
+  c->pool_id = (master) ? i : pool->nmasters + i + 1;
+  slots[i] = c;
+  g_rw_lock_writer_unlock (&pool->slots_lock);
+
+  return c;
+}
+
+/** @internal The shared state of the threads opening the initial
+ * connections of a pool.
+ */
+typedef struct
+{
+  mongo_sync_pool *pool; /**< The pool to open connections for. */
+  gint masters; /**< Number of masters to open. */
+  gint slaves; /**< Number of slaves to open. */
+  gint next; /**< The next connection to open. */
+} mongo_sync_pool_warmup;
+
+static void _mongo_sync_pool_put (mongo_sync_pool *pool,
+				  mongo_sync_pool_connection *c);
+
+static gpointer
+_mongo_sync_pool_warmup_run (gpointer data)
+{
+  mongo_sync_pool_warmup *w = (mongo_sync_pool_warmup *)data;
+  mongo_sync_pool *pool = w->pool;
+  gint i;
+
+  while ((i = g_atomic_int_add (&w->next, 1)) < w->masters + w->slaves)
+    {
+      gboolean master = (i < w->masters);
+      mongo_sync_pool_connection *c;
+
+      if (!_mongo_sync_pool_reserve ((master) ? &pool->open_masters :
+				     &pool->open_slaves,
+				     (master) ? pool->nmasters :
+				     pool->nslaves))
+	continue;
+      if ((c = _mongo_sync_pool_open (pool, master)) != NULL)
+	_mongo_sync_pool_put (pool, c);
+    }
+  return NULL;
+}
+
+/** @internal Open the initial connections of a pool, in parallel. */
+static void
+_mongo_sync_pool_warm_up (mongo_sync_pool *pool, gint masters, gint slaves)
+{
+  mongo_sync_pool_warmup w;
+  GThread **threads;
+  gint n, i;
+
+  w.pool = pool;
+  w.masters = masters;
+  w.slaves = slaves;
+  w.next = 0;
+
+  n = MIN (masters + slaves, MONGO_SYNC_POOL_MAX_OPENERS);
+  if (n <= 0)
+    return;
+
+  /* The calling thread is one of the openers, and takes over the
+     connections of any thread that could not be started. */
+  threads = g_new0 (GThread *, n);
+  for (i = 1; i < n; i++)
+    threads[i] = g_thread_try_new ("mongo-sync-pool",
+				   _mongo_sync_pool_warmup_run, &w, NULL);
+  _mongo_sync_pool_warmup_run (&w);
+  for (i = 1; i < n; i++)
+    if (threads[i])
+      g_thread_join (threads[i]);
+  g_free (threads);
+}
+
+/** @internal Collect the addresses of the secondaries of a replica
+ * set, as seen by a connection to one of its members.
+ *
+ * @param host is the address of the primary, to leave out.
+ * @param port is the port of the primary.
+ * @param conn is the connection to look at.
+ * @param n is where to store the number of secondaries.
+ *
+ * @returns A NULL-terminated array of addresses.
+ */
+static gchar **
+_mongo_sync_pool_find_secondaries (const gchar *host, gint port,
+				   mongo_sync_connection *conn, gint *n)
+{
+  GPtrArray *secondaries;
+  GList *l;
+
+  secondaries = g_ptr_array_new ();
+  for (l = conn->rs.hosts; l; l = g_list_next (l))
+    {
+      gchar *shost = NULL;
+      gint sport = 27017;
+
+      if (!mongo_util_parse_addr ((gchar *)l->data, &shost, &sport))
+	continue;
+      if (sport != port || strcmp (host, shost) != 0)
+	g_ptr_array_add (secondaries, g_strdup ((gchar *)l->data));
+      g_free (shost);
+    }
+  *n = secondaries->len;
+  g_ptr_array_add (secondaries, NULL);
+  return (gchar **)g_ptr_array_free (secondaries, FALSE);
+}
+
+void
+mongo_sync_pool_limits_init (mongo_sync_pool_limits *limits,
+			     gint nmasters, gint nslaves)
+{
+  if (!limits)
+    return;
+
+  limits->min_masters = limits->max_masters = nmasters;
+  limits->min_slaves = limits->max_slaves = nslaves;
+  limits->idle_timeout = 0;
+}
+
+mongo_sync_pool *
+mongo_sync_pool_new (const gchar *host,
+		     gint port,
+		     gint nmasters, gint nslaves)
+{
+  return mongo_sync_pool_new_with_options (host, port, nmasters, nslaves,
+					   NULL);
+}
+
+mongo_sync_pool *
+mongo_sync_pool_new_with_options (const gchar *host,
+				  gint port,
+				  gint nmasters, gint nslaves,
+				  const mongo_connection_options *opts)
+{
+  mongo_sync_pool_limits limits;
+
+  mongo_sync_pool_limits_init (&limits, nmasters, nslaves);
+  return mongo_sync_pool_new_with_limits (host, port, &limits, opts);
+}
+
+/** @internal Check the size limits of a new pool. */
+static gboolean
+_mongo_sync_pool_limits_valid (const mongo_sync_pool_limits *limits)
+{
+  if (limits->min_masters < 0 || limits->min_slaves < 0 ||
+      limits->max_masters < limits->min_masters ||
+      limits->max_slaves < limits->min_slaves ||
+      limits->idle_timeout < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+  if (limits->max_masters + limits->max_slaves <= 0)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/** @internal Set up a new pool around its first connection, and open
+ * the rest of the initial connections.
+ *
+ * @param conn is the first connection, to a master.
+ * @param host is the address of the master.
+ * @param port is the port of the master.
+ * @param limits are the size limits of the pool.
+ * @param opts are the socket options to use, or NULL.
+ * @param routers are the routers to open masters to, or NULL. Owned
+ * by the pool from now on.
+ * @param nrouters is the number of routers.
+ */
+static mongo_sync_pool *
+_mongo_sync_pool_setup (mongo_sync_pool_connection *conn,
+			const gchar *host, gint port,
+			const mongo_sync_pool_limits *limits,
+			const mongo_connection_options *opts,
+			mongo_sync_pool_router *routers, gint nrouters)
+{
+  mongo_sync_pool *pool;
+  gint i;
+
+  pool = g_new0 (mongo_sync_pool, 1);
+  pool->host = g_strdup (host);
+  pool->port = port;
+  if (opts)
+    {
+      pool->opts = *opts;
+      pool->have_opts = TRUE;
+    }
+  pool->routers = routers;
+  pool->nrouters = nrouters;
+  pool->balance = MONGO_SYNC_POOL_BALANCE_ROUND_ROBIN;
+
+  /* Routers have no secondaries to open slaves to. */
+  if (nrouters > 0)
+    pool->secondaries = g_new0 (gchar *, 1);
+  else
+    pool->secondaries =
+      _mongo_sync_pool_find_secondaries (host, port,
+					 (mongo_sync_connection *)conn,
+					 &pool->nsecondaries);
+
+  pool->nmasters = limits->max_masters;
+  pool->min_masters = limits->min_masters;
+  /* Without secondaries, there is nothing to open slaves to. */
+  pool->nslaves = (pool->nsecondaries > 0) ? limits->max_slaves : 0;
+  pool->min_slaves = (pool->nsecondaries > 0) ? limits->min_slaves : 0;
+  pool->idle_timeout = limits->idle_timeout;
+  pool->next_reap = g_get_monotonic_time () +
+    (gint64)pool->idle_timeout * 1000;
+
+  pool->masters = g_new0 (mongo_sync_pool_connection *, pool->nmasters);
+  pool->slaves = g_new0 (mongo_sync_pool_connection *, pool->nslaves);
+  pool->parking = g_new0 (mongo_sync_pool_parking,
+			  pool->nmasters + pool->nslaves + 1);
+  g_rw_lock_init (&pool->slots_lock);
+  _mongo_sync_pool_free_list_init (&pool->free_masters, pool->nmasters);
+  _mongo_sync_pool_free_list_init (&pool->free_slaves, pool->nslaves);
+  g_mutex_init (&pool->topology_lock);
+  g_mutex_init (&pool->reap_lock);
+  g_mutex_init (&pool->wait_lock);
+  g_queue_init (&pool->waiters);
+  g_mutex_init (&pool->health.lock);
+  g_cond_init (&pool->health.cond);
+
+  /* The connection used to look at the replica set is a perfectly
+     good first master. */
+  if (pool->min_masters > 0)
+    {
+      pool->open_masters = 1;
+      conn->pool_id = 0;
+      if (conn->router >= 0)
+	{
+	  g_atomic_int_inc (&pool->routers[conn->router].open);
+	  _mongo_sync_pool_router_opened (pool, conn, conn->router);
+	}
+      pool->masters[0] = conn;
+      _mongo_sync_pool_free_list_push (&pool->free_masters, 0, conn);
+      _mongo_sync_pool_warm_up (pool, pool->min_masters - 1,
+				pool->min_slaves);
+    }
+  else
+    {
+      mongo_sync_disconnect ((mongo_sync_connection *)conn);
+      _mongo_sync_pool_warm_up (pool, 0, pool->min_slaves);
+    }
+
+  /* Have the routers that could not be reached probed. */
+  for (i = 0; i < nrouters; i++)
+    if (!g_atomic_int_get (&routers[i].healthy))
+      {
+	_mongo_sync_pool_schedule_refill (pool);
+	break;
+      }
+
+  return pool;
+}
+
+mongo_sync_pool *
+mongo_sync_pool_new_with_limits (const gchar *host, gint port,
+				 const mongo_sync_pool_limits *limits,
+				 const mongo_connection_options *opts)
+{
+  mongo_sync_pool_connection *conn;
+
+  if (!host || port < 0 || !limits)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (!_mongo_sync_pool_limits_valid (limits))
+    return NULL;
+
+  conn = _mongo_sync_pool_connect (host, port, FALSE, opts);
+  if (!conn)
+    return NULL;
+
+  if (!mongo_sync_cmd_is_master ((mongo_sync_connection *)conn))
+    {
+      mongo_sync_disconnect ((mongo_sync_connection *)conn);
+      errno = EPROTO;
+      return NULL;
+    }
+
+  return _mongo_sync_pool_setup (conn, host, port, limits, opts, NULL, 0);
+}
+
+/** @internal Free the routers of a pool. */
+static void
+_mongo_sync_pool_routers_free (mongo_sync_pool_router *routers, gint n)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    g_free (routers[i].host);
+  g_free (routers);
+}
+
+mongo_sync_pool *
+mongo_sync_pool_new_with_routers (const gchar **routers,
+				  const mongo_sync_pool_limits *limits,
+				  const mongo_connection_options *opts)
+{
+  mongo_sync_pool_router *rs;
+  mongo_sync_pool_connection *conn = NULL;
+  gint n, i, e = ENOTCONN;
+
+  if (!routers || !routers[0] || !limits)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (!_mongo_sync_pool_limits_valid (limits))
+    return NULL;
+
+  n = g_strv_length ((gchar **)routers);
+  rs = g_new0 (mongo_sync_pool_router, n);
+  for (i = 0; i < n; i++)
+    {
+      rs[i].port = 27017;
+      rs[i].rtt = -1;
+      if (!mongo_util_parse_addr (routers[i], &rs[i].host, &rs[i].port))
+	{
+	  _mongo_sync_pool_routers_free (rs, n);
+	  errno = EINVAL;
+	  return NULL;
+	}
+    }
+
+  /* The first router that answers provides the first connection.
+     Those before it start out down, and those after it up, until
+     connecting to them fails. */
+  for (i = 0; i < n; i++)
+    {
+      if (!conn)
+	{
+	  conn = _mongo_sync_pool_connect (rs[i].host, rs[i].port, FALSE,
+					   opts);
+	  if (conn && !mongo_sync_cmd_is_master ((mongo_sync_connection *)conn))
+	    {
+	      mongo_sync_disconnect ((mongo_sync_connection *)conn);
+	      conn = NULL;
+	      errno = EPROTO;
+	    }
+	  if (!conn)
+	    {
+	      e = errno;
+	      continue;
+	    }
+	  conn->router = i;
+	}
+      rs[i].healthy = TRUE;
+    }
+
+  if (!conn)
+    {
+      _mongo_sync_pool_routers_free (rs, n);
+      errno = e;
+      return NULL;
+    }
+
+  return _mongo_sync_pool_setup (conn, rs[conn->router].host,
+				 rs[conn->router].port, limits, opts, rs, n);
+}
+
+void
+mongo_sync_pool_free (mongo_sync_pool *pool)
+{
+  gint i;
+
+  if (!pool)
+    return;
+
+  g_mutex_lock (&pool->health.lock);
+  pool->health.stop = TRUE;
+  g_cond_signal (&pool->health.cond);
+  g_mutex_unlock (&pool->health.lock);
+  if (pool->health.thread)
+    g_thread_join (pool->health.thread);
+
+  for (i = 0; i < pool->nmasters; i++)
+    mongo_sync_disconnect ((mongo_sync_connection *)pool->masters[i]);
+  for (i = 0; i < pool->nslaves; i++)
+    mongo_sync_disconnect ((mongo_sync_connection *)pool->slaves[i]);
+
+  _mongo_sync_pool_free_list_clear (&pool->free_masters);
+  _mongo_sync_pool_free_list_clear (&pool->free_slaves);
+  g_rw_lock_clear (&pool->slots_lock);
+  g_mutex_clear (&pool->topology_lock);
+  g_mutex_clear (&pool->health.lock);
+  g_cond_clear (&pool->health.cond);
+  g_mutex_clear (&pool->reap_lock);
+  g_mutex_clear (&pool->wait_lock);
+  g_queue_clear (&pool->waiters);
+  g_strfreev (pool->secondaries);
+  g_free (pool->host);
+  g_free (pool->masters);
+  g_free (pool->slaves);
+  g_free (pool->parking);
+  _mongo_sync_pool_routers_free (pool->routers, pool->nrouters);
+  g_free (pool);
+}
+
+/** @internal Describe a pool connection as a replica set member.
+ *
+ * The role and round-trip time come from the monitor of the pool, if
+ * it knows the member, or from what was known when the pool was set
+ * up.
+ */
+static void
+_mongo_sync_pool_member (mongo_sync_monitor *monitor,
+			 mongo_sync_pool_connection *c,
+			 mongo_sync_member_role role,
+			 mongo_sync_rs_member *m)
+{
+  mongo_sync_member_info info;
+
+  memset (m, 0, sizeof (mongo_sync_rs_member));
+  m->address = (gchar *)c->super.rs.seeds->data;
+  m->role = role;
+  m->rtt = c->rtt;
+  m->last_write = -1;
+  m->lag = -1;
+
+  if (monitor &&
+      mongo_sync_monitor_get_member (monitor, m->address, &info) &&
+      info.role != MONGO_SYNC_MEMBER_UNKNOWN)
+    {
+      m->role = info.role;
+      m->lag = info.lag;
+      if (info.rtt >= 0)
+	m->rtt = info.rtt;
+    }
+}
+
+/** @internal Pop a free connection of the given role.
+ *
+ * When secondaries are acceptable, a secondary is preferred, and a
+ * master is taken if there are none.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_pick_free (mongo_sync_pool *pool, gboolean want_master)
+{
+  mongo_sync_pool_connection *c = NULL;
+
+  if (!want_master)
+    c = _mongo_sync_pool_free_list_pop (&pool->free_slaves);
+  if (!c)
+    c = _mongo_sync_pool_free_list_pop (&pool->free_masters);
+  if (!c)
+    c = _mongo_sync_pool_steal (pool, want_master);
+  return c;
+}
+
+/** @internal Hand a returned connection to the oldest waiter that
+ * accepts it.
+ *
+ * The connection stays marked as in use, and never passes through the
+ * free stacks, so callers that are not waiting cannot take it first.
+ *
+ * @returns TRUE if the connection was handed over, FALSE if nobody
+ * waits for it.
+ */
+static gboolean
+_mongo_sync_pool_hand_over (mongo_sync_pool *pool,
+			    mongo_sync_pool_connection *c,
+			    gboolean is_master)
+{
+  GList *l;
+  gboolean handed = FALSE;
+
+  if (g_atomic_int_get (&pool->nwaiters) == 0)
+    return FALSE;
+
+  g_mutex_lock (&pool->wait_lock);
+  for (l = pool->waiters.head; l; l = g_list_next (l))
+    {
+      mongo_sync_pool_waiter *w = (mongo_sync_pool_waiter *)l->data;
+
+      if (w->want_master && !is_master)
+	continue;
+
+      w->conn = c;
+      g_queue_delete_link (&pool->waiters, l);
+      g_atomic_int_add (&pool->nwaiters, -1);
+      g_cond_signal (&w->cond);
+      handed = TRUE;
+      break;
+    }
+  g_mutex_unlock (&pool->wait_lock);
+
+  return handed;
+}
+
+/** @internal Hand free connections to whoever waits for them.
+ *
+ * Called after a connection was pushed back onto the free stacks, in
+ * case a caller started waiting in the meantime.
+ */
+static void
+_mongo_sync_pool_wake_waiters (mongo_sync_pool *pool)
+{
+  GList *l, *next;
+
+  if (g_atomic_int_get (&pool->nwaiters) == 0)
+    return;
+
+  g_mutex_lock (&pool->wait_lock);
+  for (l = pool->waiters.head; l; l = next)
+    {
+      mongo_sync_pool_waiter *w = (mongo_sync_pool_waiter *)l->data;
+
+      next = g_list_next (l);
+      w->conn = _mongo_sync_pool_pick_free (pool, w->want_master);
+      if (!w->conn)
+	continue;
+
+      g_queue_delete_link (&pool->waiters, l);
+      g_atomic_int_add (&pool->nwaiters, -1);
+      g_cond_signal (&w->cond);
+    }
+  g_mutex_unlock (&pool->wait_lock);
+}
+
+/** @internal Put a connection that is not in use anymore back into
+ * the pool.
+ *
+ * The connection goes to the oldest caller waiting for one like it,
+ * or back onto the free stacks if nobody waits.
+ */
+static void
+_mongo_sync_pool_put (mongo_sync_pool *pool, mongo_sync_pool_connection *c)
+{
+  gboolean master = (c->pool_id < pool->nmasters);
+  gint index = (master) ? c->pool_id : c->pool_id - pool->nmasters - 1;
+
+  c->last_used = g_get_monotonic_time ();
+  g_atomic_int_set (&c->in_use, TRUE);
+  if (_mongo_sync_pool_hand_over (pool, c, master))
+    return;
+
+  _mongo_sync_pool_free_list_push ((master) ? &pool->free_masters :
+				   &pool->free_slaves, index, c);
+  _mongo_sync_pool_wake_waiters (pool);
+}
+
+/** @internal Park a returned connection for the calling thread.
+ *
+ * The connection stays marked as in use, so it is not on the free
+ * stacks, and the thread can take it back without touching them. The
+ * connection the thread parked before, if still parked, goes back to
+ * the pool, as a thread only keeps one.
+ *
+ * @returns TRUE if the connection was parked, FALSE if it should be
+ * put back into the pool instead.
+ */
+static gboolean
+_mongo_sync_pool_park (mongo_sync_pool *pool, mongo_sync_pool_connection *c)
+{
+  mongo_sync_pool_affinity *a;
+  gint self, *owner;
+
+  /* Waiters come first, and roles may change under a monitor. */
+  if (!g_atomic_int_get (&pool->affinity) ||
+      g_atomic_pointer_get (&pool->monitor) ||
+      g_atomic_int_get (&pool->nwaiters) > 0)
+    return FALSE;
+
+  a = (mongo_sync_pool_affinity *)
+    g_private_get (&_mongo_sync_pool_thread_affinity);
+  if (!a)
+    {
+      a = g_new0 (mongo_sync_pool_affinity, 1);
+      g_private_set (&_mongo_sync_pool_thread_affinity, a);
+    }
+
+  self = _mongo_sync_pool_thread_number ();
+  if (a->pool == pool && a->pool_id != c->pool_id &&
+      a->pool_id <= pool->nmasters + pool->nslaves &&
+      g_atomic_int_compare_and_exchange (&pool->parking[a->pool_id].owner,
+					 self, 0))
+    _mongo_sync_pool_put (pool, _mongo_sync_pool_slot (pool, a->pool_id));
+
+  c->last_used = g_get_monotonic_time ();
+  g_atomic_int_set (&c->in_use, TRUE);
+  owner = &pool->parking[c->pool_id].owner;
+  g_atomic_int_set (owner, self);
+  a->pool = pool;
+  a->pool_id = c->pool_id;
+
+  /* A caller that started waiting, or affinity turned off, in the
+     meantime may have missed the connection: put it back then, unless
+     someone took it already. */
+  if ((g_atomic_int_get (&pool->nwaiters) > 0 ||
+       !g_atomic_int_get (&pool->affinity)) &&
+      g_atomic_int_compare_and_exchange (owner, self, 0))
+    return FALSE;
+  return TRUE;
+}
+
+gboolean
+mongo_sync_pool_set_thread_affinity (mongo_sync_pool *pool, gboolean enable)
+{
+  gint i;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  g_atomic_int_set (&pool->affinity, enable);
+
+  /* Nobody would look for parked connections anymore. */
+  if (!enable)
+    for (i = 0; i <= pool->nmasters + pool->nslaves; i++)
+      if (i != pool->nmasters && _mongo_sync_pool_unpark (pool, i))
+	_mongo_sync_pool_put (pool, _mongo_sync_pool_slot (pool, i));
+
+  return TRUE;
+}
+
+/** @internal Close the idle connections of one role.
+ *
+ * @returns The number of connections closed.
+ */
+static gint
+_mongo_sync_pool_reap_role (mongo_sync_pool *pool, gboolean master,
+			    gint64 idle_since)
+{
+  mongo_sync_pool_connection **slots;
+  gint *open, min, n, i, reaped = 0;
+
+  slots = (master) ? pool->masters : pool->slaves;
+  open = (master) ? &pool->open_masters : &pool->open_slaves;
+  min = (master) ? pool->min_masters : pool->min_slaves;
+  n = (master) ? pool->nmasters : pool->nslaves;
+
+  for (i = 0; i < n && g_atomic_int_get (open) > min; i++)
+    {
+      mongo_sync_pool_connection *c;
+      gboolean idle;
+
+      /* Claim the connection, so nobody picks it while it is being
+	 closed. */
+      g_rw_lock_reader_lock (&pool->slots_lock);
+      c = slots[i];
+      if (c && !g_atomic_int_compare_and_exchange (&c->in_use, FALSE, TRUE) &&
+	  !_mongo_sync_pool_unpark (pool, c->pool_id))
+	c = NULL;
+      g_rw_lock_reader_unlock (&pool->slots_lock);
+      if (!c)
+	continue;
+
+      g_rw_lock_writer_lock (&pool->slots_lock);
+      idle = (c->last_used <= idle_since &&
+	      _mongo_sync_pool_release (open, min));
+      if (idle)
+	slots[i] = NULL;
+      g_rw_lock_writer_unlock (&pool->slots_lock);
+
+      /* A pop may have dropped the claimed connection off its stack,
+	 so push it back, as if it was returned. */
+      if (!idle)
+	{
+	  _mongo_sync_pool_free_list_push ((master) ? &pool->free_masters :
+					   &pool->free_slaves, i, c);
+	  _mongo_sync_pool_wake_waiters (pool);
+	  continue;
+	}
+
+      _mongo_sync_pool_free_list_remove ((master) ? &pool->free_masters :
+					 &pool->free_slaves, i, c);
+      if (c->router >= 0)
+	g_atomic_int_add (&pool->routers[c->router].open, -1);
+      mongo_sync_disconnect ((mongo_sync_connection *)c);
+      reaped++;
+    }
+  return reaped;
+}
+
+gint
+mongo_sync_pool_reap_idle (mongo_sync_pool *pool)
+{
+  gint64 idle_since;
+  gint n;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+  if (pool->idle_timeout == 0)
+    return 0;
+
+  g_mutex_lock (&pool->reap_lock);
+  idle_since = g_get_monotonic_time () - (gint64)pool->idle_timeout * 1000;
+  n = _mongo_sync_pool_reap_role (pool, FALSE, idle_since) +
+    _mongo_sync_pool_reap_role (pool, TRUE, idle_since);
+  pool->next_reap = g_get_monotonic_time () +
+    (gint64)pool->idle_timeout * 1000;
+  g_mutex_unlock (&pool->reap_lock);
+
+  return n;
+}
+
+/** @internal Reap idle connections, if it is time to, and nobody else
+ * is doing it already.
+ */
+static void
+_mongo_sync_pool_maybe_reap (mongo_sync_pool *pool)
+{
+  gboolean due;
+
+  if (pool->idle_timeout == 0 || !g_mutex_trylock (&pool->reap_lock))
+    return;
+  due = (g_get_monotonic_time () >= pool->next_reap);
+  g_mutex_unlock (&pool->reap_lock);
+
+  if (due)
+    mongo_sync_pool_reap_idle (pool);
+}
+
+gboolean
+mongo_sync_pool_get_size (mongo_sync_pool *pool, gint *masters,
+			  gint *slaves)
+{
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  if (masters)
+    *masters = g_atomic_int_get (&pool->open_masters);
+  if (slaves)
+    *slaves = g_atomic_int_get (&pool->open_slaves);
+  return TRUE;
+}
+
+/** @internal Check whether a connection at rest is still usable.
+ *
+ * A connection that is not in use has nothing to read: anything
+ * readable is either the server closing the connection, or a stray
+ * reply that would be mistaken for the answer to the next request.
+ */
+static gboolean
+_mongo_sync_pool_conn_broken (mongo_sync_pool_connection *c)
+{
+  struct pollfd pfd;
+
+  if (c->super.super.fd < 0 || c->super.exhaust.active ||
+      c->super.prefetching)
+    return TRUE;
+
+  pfd.fd = c->super.super.fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return (poll (&pfd, 1, 0) > 0);
+}
+
+/** @internal Close a broken connection, and have it replaced.
+ *
+ * A broken connection to a router is taken as a sign of the router
+ * going away, so the router is marked down too.
+ *
+ * @param pool is the pool the connection belongs to.
+ * @param c is the connection, which the caller holds.
+ */
+static void
+_mongo_sync_pool_evict (mongo_sync_pool *pool, mongo_sync_pool_connection *c)
+{
+  gboolean master = (c->pool_id < pool->nmasters);
+  gint index = (master) ? c->pool_id : c->pool_id - pool->nmasters - 1;
+  gint router = c->router;
+
+  g_rw_lock_writer_lock (&pool->slots_lock);
+  if (master)
+    pool->masters[index] = NULL;
+  else
+    pool->slaves[index] = NULL;
+  g_atomic_int_add ((master) ? &pool->open_masters : &pool->open_slaves, -1);
+  g_rw_lock_writer_unlock (&pool->slots_lock);
+
+  _mongo_sync_pool_free_list_remove ((master) ? &pool->free_masters :
+				     &pool->free_slaves, index, c);
+  mongo_sync_disconnect ((mongo_sync_connection *)c);
+
+  if (router >= 0)
+    {
+      g_atomic_int_add (&pool->routers[router].open, -1);
+      _mongo_sync_pool_router_down (pool, router);
+    }
+  _mongo_sync_pool_schedule_refill (pool);
+}
+
+/** @internal Look up the current primary and secondaries.
+ *
+ * Asks the first member that answers, starting with the primary last
+ * known, and records the primary and secondaries it reports, so that
+ * replacement connections go where the replica set is now.
+ */
+static void
+_mongo_sync_pool_refresh_topology (mongo_sync_pool *pool)
+{
+  mongo_sync_connection *c = NULL;
+  gchar **seeds, *mhost, *host = NULL;
+  gint mport, port = 27017, i;
+
+  /* Routers do not change. */
+  if (pool->nrouters > 0)
+    return;
+
+  g_mutex_lock (&pool->topology_lock);
+  mhost = g_strdup (pool->host);
+  mport = pool->port;
+  seeds = g_strdupv (pool->secondaries);
+  g_mutex_unlock (&pool->topology_lock);
+
+  for (i = -1; (i < 0 || seeds[i]) && !c; i++)
+    {
+      gchar *shost = NULL;
+      gint sport = 27017;
+
+      if (i < 0)
+	{
+	  shost = g_strdup (mhost);
+	  sport = mport;
+	}
+      else if (!mongo_util_parse_addr (seeds[i], &shost, &sport))
+	continue;
+
+      c = mongo_sync_connect_with_options (shost, sport, TRUE,
+					   (pool->have_opts) ?
+					   &pool->opts : NULL);
+      if (c && mongo_sync_cmd_is_master (c))
+	{
+	  host = shost;
+	  port = sport;
+	  shost = NULL;
+	}
+      else if (c && !(c->rs.primary &&
+		      mongo_util_parse_addr (c->rs.primary, &host, &port)))
+	{
+	  /* A member that does not know the primary is no help. */
+	  mongo_sync_disconnect (c);
+	  c = NULL;
+	}
+      g_free (shost);
+    }
+
+  if (c)
+    {
+      g_mutex_lock (&pool->topology_lock);
+      g_free (pool->host);
+      g_strfreev (pool->secondaries);
+      pool->host = host;
+      pool->port = port;
+      pool->secondaries =
+	_mongo_sync_pool_find_secondaries (host, port, c,
+					   &pool->nsecondaries);
+      g_mutex_unlock (&pool->topology_lock);
+      mongo_sync_disconnect (c);
+    }
+
+  g_free (mhost);
+  g_strfreev (seeds);
+}
+
+/** @internal Open connections until the pool is back at its minimum
+ * size.
+ *
+ * @returns TRUE if the pool is at its minimum size, FALSE if
+ * connections could not be opened.
+ */
+static gboolean
+_mongo_sync_pool_refill (mongo_sync_pool *pool)
+{
+  gboolean refreshed = FALSE;
 
-  GList *masters; /**< List of master connections in the pool. */
-  GList *slaves; /**< List of slave connections in the pool. */
-};
+  for (;;)
+    {
+      mongo_sync_pool_connection *c;
+      gboolean master;
 
-static mongo_sync_pool_connection *
-_mongo_sync_pool_connect (const gchar *host, gint port, gboolean slaveok)
+      if (_mongo_sync_pool_reserve (&pool->open_masters, pool->min_masters))
+	master = TRUE;
+      else if (_mongo_sync_pool_reserve (&pool->open_slaves,
+					 pool->min_slaves))
+	master = FALSE;
+      else
+	return TRUE;
+
+      /* Connections broke, so the topology may well have changed. */
+      if (!refreshed)
+	{
+	  _mongo_sync_pool_refresh_topology (pool);
+	  refreshed = TRUE;
+	}
+
+      if ((c = _mongo_sync_pool_open (pool, master)) == NULL)
+	return FALSE;
+      _mongo_sync_pool_put (pool, c);
+    }
+}
+
+/** @internal Ping the connections that were idle for a while.
+ *
+ * Each connection is held while it is pinged, so nobody picks it in
+ * the meantime, and is evicted if the ping fails.
+ */
+static void
+_mongo_sync_pool_validate_role (mongo_sync_pool *pool, gboolean master,
+				gint64 idle_since)
 {
-  mongo_sync_connection *c;
-  mongo_sync_pool_connection *conn;
+  mongo_sync_pool_connection **slots;
+  gint n, i;
 
-  c = mongo_sync_connect (host, port, slaveok);
-  if (!c)
-    return NULL;
-  conn = g_realloc (c, sizeof (mongo_sync_pool_connection));
-  conn->pool_id = 0;
-  conn->in_use = FALSE;
+  slots = (master) ? pool->masters : pool->slaves;
+  n = (master) ? pool->nmasters : pool->nslaves;
 
-  return conn;
+  for (i = 0; i < n; i++)
+    {
+      mongo_sync_pool_connection *c;
+
+      g_rw_lock_reader_lock (&pool->slots_lock);
+      c = slots[i];
+      if (c && (c->last_used > idle_since ||
+		(!g_atomic_int_compare_and_exchange (&c->in_use, FALSE, TRUE) &&
+		 !_mongo_sync_pool_unpark (pool, c->pool_id))))
+	c = NULL;
+      g_rw_lock_reader_unlock (&pool->slots_lock);
+      if (!c)
+	continue;
+
+      /* Whether it is still idle is only known once it is held. */
+      if (c->last_used <= idle_since &&
+	  (_mongo_sync_pool_conn_broken (c) ||
+	   !mongo_sync_cmd_ping ((mongo_sync_connection *)c)))
+	{
+	  _mongo_sync_pool_evict (pool, c);
+	  continue;
+	}
+
+      /* Put it back without touching last_used, so that it still
+	 counts as idle. */
+      _mongo_sync_pool_free_list_push ((master) ? &pool->free_masters :
+				       &pool->free_slaves, i, c);
+      _mongo_sync_pool_wake_waiters (pool);
+    }
 }
 
-mongo_sync_pool *
-mongo_sync_pool_new (const gchar *host,
-		     gint port,
-		     gint nmasters, gint nslaves)
+/** @internal The maintenance thread of a pool.
+ *
+ * Validates idle connections every interval, if health checks were
+ * started, replaces evicted connections, and reaps idle ones whenever
+ * the idle timeout of the pool says so, even without an interval, so
+ * that quiet pools shrink too.
+ */
+static gpointer
+_mongo_sync_pool_health_run (gpointer data)
 {
-  mongo_sync_pool *pool;
-  mongo_sync_pool_connection *conn;
-  gint i, j = 0;
+  mongo_sync_pool *pool = (mongo_sync_pool *)data;
 
-  if (!host || port < 0)
+  g_mutex_lock (&pool->health.lock);
+  while (!pool->health.stop)
     {
-      errno = EINVAL;
-      return NULL;
+      gint interval = pool->health.interval;
+      gint64 next_reap = G_MAXINT64;
+      gboolean refilled;
+
+      pool->health.refill = FALSE;
+      g_mutex_unlock (&pool->health.lock);
+
+      if (interval > 0)
+	{
+	  gint64 idle_since = g_get_monotonic_time () -
+	    (gint64)interval * 1000;
+
+	  _mongo_sync_pool_validate_role (pool, TRUE, idle_since);
+	  _mongo_sync_pool_validate_role (pool, FALSE, idle_since);
+	}
+      /* Routers still down are probed again later, the same way
+	 failed refills are retried. */
+      refilled = _mongo_sync_pool_probe_routers (pool);
+      refilled = _mongo_sync_pool_refill (pool) && refilled;
+      _mongo_sync_pool_maybe_reap (pool);
+      if (pool->idle_timeout > 0)
+	{
+	  g_mutex_lock (&pool->reap_lock);
+	  next_reap = pool->next_reap;
+	  g_mutex_unlock (&pool->reap_lock);
+	}
+
+      g_mutex_lock (&pool->health.lock);
+      if (!refilled)
+	pool->health.refill = TRUE;
+      if (pool->health.stop || (pool->health.refill && refilled))
+	continue;
+
+      /* Wake up for whatever is due first: a retry of the refill, the
+	 next round of validation, or the next reaping. */
+      if (!refilled)
+	next_reap = MIN (next_reap, g_get_monotonic_time () +
+			 MONGO_SYNC_POOL_REFILL_RETRY * 1000);
+      else if (pool->health.interval > 0)
+	next_reap = MIN (next_reap, g_get_monotonic_time () +
+			 (gint64)pool->health.interval * 1000);
+
+      if (next_reap < G_MAXINT64)
+	g_cond_wait_until (&pool->health.cond, &pool->health.lock,
+			   next_reap);
+      else
+	g_cond_wait (&pool->health.cond, &pool->health.lock);
+    }
+  g_mutex_unlock (&pool->health.lock);
+
+  return NULL;
+}
+
+/** @internal Start the maintenance thread, if it is not running yet.
+ *
+ * Must be called with the health lock held.
+ */
+static void
+_mongo_sync_pool_health_start (mongo_sync_pool *pool)
+{
+  if (!pool->health.thread && !pool->health.stop)
+    pool->health.thread = g_thread_try_new ("mongo-sync-pool",
+					    _mongo_sync_pool_health_run,
+					    pool, NULL);
+  g_cond_signal (&pool->health.cond);
+}
+
+/** @internal Have evicted connections replaced, in the background. */
+static void
+_mongo_sync_pool_schedule_refill (mongo_sync_pool *pool)
+{
+  g_mutex_lock (&pool->health.lock);
+  pool->health.refill = TRUE;
+  _mongo_sync_pool_health_start (pool);
+  g_mutex_unlock (&pool->health.lock);
+}
+
+gboolean
+mongo_sync_pool_start_health_checks (mongo_sync_pool *pool, gint interval)
+{
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
     }
-  if (nmasters < 0 || nslaves < 0)
+  if (interval < 0)
     {
       errno = ERANGE;
+      return FALSE;
+    }
+
+  g_mutex_lock (&pool->health.lock);
+  pool->health.interval = interval;
+  _mongo_sync_pool_health_start (pool);
+  g_mutex_unlock (&pool->health.lock);
+
+  return TRUE;
+}
+
+mongo_sync_pool_connection *
+mongo_sync_pool_pick_with_read_preference (mongo_sync_pool *pool,
+					   const mongo_sync_read_preference *pref)
+{
+  mongo_sync_pool_connection **conns, *c = NULL;
+  mongo_sync_rs_member *views;
+  const mongo_sync_rs_member **members;
+  mongo_sync_monitor *monitor;
+  guint n, total;
+  gint i;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
       return NULL;
     }
-  if (nmasters + nslaves <= 0)
+  if (!pref)
     {
       errno = EINVAL;
       return NULL;
     }
 
-  conn = _mongo_sync_pool_connect (host, port, FALSE);
-  if (!conn)
-    return FALSE;
+  monitor = g_atomic_pointer_get (&pool->monitor);
+  total = pool->nmasters + pool->nslaves;
+  conns = g_new (mongo_sync_pool_connection *, total);
+  views = g_new (mongo_sync_rs_member, total);
+  members = g_new (const mongo_sync_rs_member *, total);
 
-  if (!mongo_sync_cmd_is_master ((mongo_sync_connection *)conn))
+  /* Other threads may pick the selected connection before we do, in
+     which case select again, out of those still free. The slots are
+     read-locked, so that no connection is closed under us. */
+  g_rw_lock_reader_lock (&pool->slots_lock);
+  do
     {
-      mongo_sync_disconnect ((mongo_sync_connection *)conn);
-      errno = EPROTO;
-      return NULL;
+      n = 0;
+      for (i = 0; i < pool->nmasters + pool->nslaves; i++)
+	{
+	  conns[n] = (i < pool->nmasters) ? pool->masters[i] :
+	    pool->slaves[i - pool->nmasters];
+	  if (!conns[n] || g_atomic_int_get (&conns[n]->in_use))
+	    continue;
+	  _mongo_sync_pool_member (monitor, conns[n],
+				   (i < pool->nmasters) ?
+				   MONGO_SYNC_MEMBER_PRIMARY :
+				   MONGO_SYNC_MEMBER_SECONDARY,
+				   &views[n]);
+	  members[n] = &views[n];
+	  n++;
+	}
+
+      i = mongo_sync_read_preference_select (pref, members, n);
+      if (i >= 0 &&
+	  g_atomic_int_compare_and_exchange (&conns[i]->in_use, FALSE, TRUE))
+	{
+	  c = conns[i];
+	  if (views[i].role == MONGO_SYNC_MEMBER_SECONDARY)
+	    c->super.slaveok = TRUE;
+	}
     }
+  while (i >= 0 && !c);
+  g_rw_lock_reader_unlock (&pool->slots_lock);
 
-  pool = g_new0 (mongo_sync_pool, 1);
-  pool->nmasters = nmasters;
-  pool->nslaves = nslaves;
+  g_free (members);
+  g_free (views);
+  g_free (conns);
 
-  for (i = 0; i < pool->nmasters; i++)
-    {
-      mongo_sync_pool_connection *c;
+  if (!c)
+    errno = EAGAIN;
+  return c;
+}
 
-      c = _mongo_sync_pool_connect (host, port, FALSE);
-      c->pool_id = i;
+/** @internal The weight of a router when picking by round-trip time.
+ *
+ * Inversely proportional to the round-trip time, with a tenth of a
+ * millisecond added, so that measurement noise on fast networks does
+ * not dominate. Routers not measured yet count as a millisecond away.
+ */
+static gdouble
+_mongo_sync_pool_router_weight (mongo_sync_pool_router *r)
+{
+  gint rtt = g_atomic_int_get (&r->rtt);
 
-      pool->masters = g_list_append (pool->masters, c);
-    }
+  return 1.0 / (((rtt >= 0) ? rtt : 1000) + 100);
+}
 
-  for (i = 0; i < pool->nslaves; i++)
-    {
-      mongo_sync_pool_connection *c;
-      gchar *shost = NULL;
-      gint sport = 27017;
-      GList *l;
-      gboolean found = FALSE;
-      gboolean need_restart = (j != 0);
+/** @internal Pick a free connection to a router, by a balancing
+ * strategy.
+ *
+ * Counts the connections in use per router, and takes a free
+ * connection to the router with the fewest of them, or to a router
+ * chosen at random, weighted by its round-trip time.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_pick_balanced (mongo_sync_pool *pool,
+				mongo_sync_pool_balance balance)
+{
+  mongo_sync_pool_connection **free_conns, *c = NULL;
+  gint *busy, i, r, start;
+  gdouble total, x;
 
-      /* Select the next secondary */
-      l = g_list_nth (conn->super.rs.hosts, j);
+  busy = g_new (gint, pool->nrouters);
+  free_conns = g_new (mongo_sync_pool_connection *, pool->nrouters);
+  start = g_random_int_range (0, pool->nrouters);
 
-      do
+  g_rw_lock_reader_lock (&pool->slots_lock);
+  do
+    {
+      memset (busy, 0, sizeof (gint) * pool->nrouters);
+      memset (free_conns, 0,
+	      sizeof (mongo_sync_pool_connection *) * pool->nrouters);
+      for (i = 0; i < pool->nmasters; i++)
 	{
-	  j++;
-	  if (l && mongo_util_parse_addr ((gchar *)l->data, &shost, &sport))
-	    {
-	      if (sport != port || strcmp (host, shost) != 0)
-		{
-		  found = TRUE;
-		  break;
-		}
-	    }
-	  l = g_list_next (l);
-	  if (!l && need_restart)
+	  mongo_sync_pool_connection *m = pool->masters[i];
+
+	  if (!m)
+	    continue;
+	  /* Parked connections are not doing anything. */
+	  if (!g_atomic_int_get (&m->in_use))
 	    {
-	      need_restart = FALSE;
-	      j = 0;
-	      l = g_list_nth (conn->super.rs.hosts, j);
+	      if (!free_conns[m->router])
+		free_conns[m->router] = m;
 	    }
+	  else if (!g_atomic_int_get (&pool->parking[m->pool_id].owner))
+	    busy[m->router]++;
 	}
-      while (l);
 
-      if (!found)
+      r = -1;
+      if (balance == MONGO_SYNC_POOL_BALANCE_LEAST_OUTSTANDING)
 	{
-	  pool->nslaves = i - 1;
-	  break;
+	  /* Start at a random router, to break ties. */
+	  for (i = 0; i < pool->nrouters; i++)
+	    {
+	      gint j = (start + i) % pool->nrouters;
+
+	      if (free_conns[j] && (r < 0 || busy[j] < busy[r]))
+		r = j;
+	    }
 	}
+      else
+	{
+	  total = 0;
+	  for (i = 0; i < pool->nrouters; i++)
+	    if (free_conns[i])
+	      total += _mongo_sync_pool_router_weight (&pool->routers[i]);
 
-      /* Connect to it*/
-      c = _mongo_sync_pool_connect (shost, sport, TRUE);
-      c->pool_id = pool->nmasters + i + 1;
+	  x = g_random_double_range (0, total);
+	  for (i = 0; i < pool->nrouters; i++)
+	    {
+	      if (!free_conns[i])
+		continue;
+	      r = i;
+	      x -= _mongo_sync_pool_router_weight (&pool->routers[i]);
+	      if (x < 0)
+		break;
+	    }
+	}
 
-      pool->slaves = g_list_append (pool->slaves, c);
+      if (r >= 0 &&
+	  g_atomic_int_compare_and_exchange (&free_conns[r]->in_use,
+					     FALSE, TRUE))
+	c = free_conns[r];
     }
+  while (r >= 0 && !c);
+  g_rw_lock_reader_unlock (&pool->slots_lock);
 
-  mongo_sync_disconnect ((mongo_sync_connection *)conn);
-  return pool;
+  g_free (free_conns);
+  g_free (busy);
+
+  return c;
 }
 
-void
-mongo_sync_pool_free (mongo_sync_pool *pool)
+gboolean
+mongo_sync_pool_set_balance (mongo_sync_pool *pool,
+			     mongo_sync_pool_balance balance)
 {
-  GList *l;
-
   if (!pool)
-    return;
-
-  l = pool->masters;
-  while (l)
     {
-      mongo_sync_disconnect ((mongo_sync_connection *)l->data);
-      l = g_list_delete_link (l, l);
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (balance != MONGO_SYNC_POOL_BALANCE_ROUND_ROBIN &&
+      balance != MONGO_SYNC_POOL_BALANCE_LEAST_OUTSTANDING &&
+      balance != MONGO_SYNC_POOL_BALANCE_RTT)
+    {
+      errno = EINVAL;
+      return FALSE;
     }
 
-  l = pool->slaves;
-  while (l)
+  g_atomic_int_set (&pool->balance, balance);
+  return TRUE;
+}
+
+gboolean
+mongo_sync_pool_get_router (mongo_sync_pool *pool, gint index,
+			    mongo_sync_pool_router_info *info)
+{
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!info)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (index < 0 || index >= pool->nrouters)
     {
-      mongo_sync_disconnect ((mongo_sync_connection *)l->data);
-      l = g_list_delete_link (l, l);
+      errno = ERANGE;
+      return FALSE;
     }
 
-  g_free (pool);
+  info->healthy = g_atomic_int_get (&pool->routers[index].healthy);
+  info->connections = g_atomic_int_get (&pool->routers[index].open);
+  info->rtt = g_atomic_int_get (&pool->routers[index].rtt);
+  return TRUE;
+}
+
+/** @internal Open a new connection for the caller, if the pool may
+ * grow.
+ *
+ * A secondary is opened if secondaries are acceptable and there is
+ * room for one, a master otherwise.
+ *
+ * @returns The new connection, already marked as in use, or NULL.
+ */
+static mongo_sync_pool_connection *
+_mongo_sync_pool_pick_new (mongo_sync_pool *pool, gboolean want_master)
+{
+  gboolean master;
+
+  if (!want_master &&
+      _mongo_sync_pool_reserve (&pool->open_slaves, pool->nslaves))
+    master = FALSE;
+  else if (_mongo_sync_pool_reserve (&pool->open_masters, pool->nmasters))
+    master = TRUE;
+  else
+    return NULL;
+
+  return _mongo_sync_pool_open (pool, master);
+}
+
+/** @internal Open a new connection for a waiting caller, if the pool
+ * may grow.
+ *
+ * The new connection is put into the pool like a returned one, so it
+ * goes to the oldest waiter that accepts it.
+ */
+static void
+_mongo_sync_pool_grow (mongo_sync_pool *pool, gboolean want_master)
+{
+  mongo_sync_pool_connection *c;
+
+  if ((c = _mongo_sync_pool_pick_new (pool, want_master)) != NULL)
+    _mongo_sync_pool_put (pool, c);
 }
 
 mongo_sync_pool_connection *
 mongo_sync_pool_pick (mongo_sync_pool *pool,
 		      gboolean want_master)
 {
-  GList *l;
+  mongo_sync_read_preference pref;
+  mongo_sync_pool_connection *c = NULL;
+  mongo_sync_pool_balance balance;
 
   if (!pool)
     {
@@ -187,46 +2038,154 @@ mongo_sync_pool_pick (mongo_sync_pool *pool,
       return NULL;
     }
 
-  if (!want_master)
+  /* Roles may change under a monitor, so let it decide. */
+  if (g_atomic_pointer_get (&pool->monitor))
+    {
+      mongo_sync_read_preference_init
+	(&pref, (want_master) ? MONGO_SYNC_READ_PRIMARY :
+	 MONGO_SYNC_READ_SECONDARY_PREFERRED);
+      c = mongo_sync_pool_pick_with_read_preference (pool, &pref);
+    }
+  else
     {
-      l = pool->slaves;
+      c = _mongo_sync_pool_pick_parked (pool, want_master);
+      if (!c && pool->nrouters > 0 &&
+	  (balance = g_atomic_int_get (&pool->balance)) !=
+	  MONGO_SYNC_POOL_BALANCE_ROUND_ROBIN)
+	c = _mongo_sync_pool_pick_balanced (pool, balance);
+      if (!c)
+	c = _mongo_sync_pool_pick_free (pool, want_master);
+    }
 
-      while (l)
-	{
-	  mongo_sync_pool_connection *c;
+  /* An elastic pool grows, rather than turn the caller away. */
+  if (!c)
+    c = _mongo_sync_pool_pick_new (pool, want_master);
+  if (!c)
+    errno = EAGAIN;
+  return c;
+}
 
-	  c = (mongo_sync_pool_connection *)l->data;
-	  if (!c->in_use)
-	    {
-	      c->in_use = TRUE;
-	      return c;
-	    }
-	  l = g_list_next (l);
-	}
+mongo_sync_pool_connection *
+mongo_sync_pool_pick_timeout (mongo_sync_pool *pool, gboolean want_master,
+			      gint timeout)
+{
+  mongo_sync_pool_waiter w;
+  gint64 start, waited;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return NULL;
     }
 
-  l = pool->masters;
-  while (l)
+  w.conn = mongo_sync_pool_pick (pool, want_master);
+  if (w.conn || timeout == 0)
+    return w.conn;
+
+  start = g_get_monotonic_time ();
+  g_cond_init (&w.cond);
+  w.want_master = want_master;
+
+  g_mutex_lock (&pool->wait_lock);
+  g_queue_push_tail (&pool->waiters, &w);
+  g_atomic_int_inc (&pool->nwaiters);
+
+  /* A connection returned since the first attempt, but before we
+     were queued, would not have been handed to us: look again. */
+  if ((w.conn = _mongo_sync_pool_pick_free (pool, want_master)) != NULL)
     {
-      mongo_sync_pool_connection *c;
+      g_queue_remove (&pool->waiters, &w);
+      g_atomic_int_add (&pool->nwaiters, -1);
+    }
+  else
+    {
+      /* Someone is waiting now, so the pool may grow. */
+      g_mutex_unlock (&pool->wait_lock);
+      _mongo_sync_pool_grow (pool, want_master);
+      g_mutex_lock (&pool->wait_lock);
+    }
 
-      c = (mongo_sync_pool_connection *)l->data;
-      if (!c->in_use)
+  while (!w.conn)
+    {
+      if (timeout < 0)
+	g_cond_wait (&w.cond, &pool->wait_lock);
+      else if (!g_cond_wait_until (&w.cond, &pool->wait_lock,
+				   start + (gint64)timeout * 1000) &&
+	       !w.conn)
 	{
-	  c->in_use = TRUE;
-	  return c;
+	  g_queue_remove (&pool->waiters, &w);
+	  g_atomic_int_add (&pool->nwaiters, -1);
+	  break;
 	}
-      l = g_list_next (l);
     }
 
-  errno = EAGAIN;
-  return NULL;
+  waited = g_get_monotonic_time () - start;
+  pool->stats.waits++;
+  pool->stats.total_wait += waited;
+  pool->stats.max_wait = MAX (pool->stats.max_wait, waited);
+  if (!w.conn)
+    pool->stats.timeouts++;
+  g_mutex_unlock (&pool->wait_lock);
+
+  g_cond_clear (&w.cond);
+
+  if (!w.conn)
+    errno = ETIMEDOUT;
+  return w.conn;
+}
+
+gboolean
+mongo_sync_pool_get_wait_stats (mongo_sync_pool *pool,
+				mongo_sync_pool_wait_stats *stats)
+{
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!stats)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  g_mutex_lock (&pool->wait_lock);
+  *stats = pool->stats;
+  stats->waiting = g_queue_get_length (&pool->waiters);
+  g_mutex_unlock (&pool->wait_lock);
+
+  return TRUE;
+}
+
+gboolean
+mongo_sync_pool_set_monitor (mongo_sync_pool *pool,
+			     mongo_sync_monitor *monitor)
+{
+  gint i;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  g_atomic_pointer_set (&pool->monitor, monitor);
+
+  /* Picking under a monitor does not look for parked connections. */
+  if (monitor)
+    for (i = 0; i <= pool->nmasters + pool->nslaves; i++)
+      if (i != pool->nmasters && _mongo_sync_pool_unpark (pool, i))
+	_mongo_sync_pool_put (pool, _mongo_sync_pool_slot (pool, i));
+
+  return TRUE;
 }
 
 gboolean
 mongo_sync_pool_return (mongo_sync_pool *pool,
 			mongo_sync_pool_connection *conn)
 {
+  mongo_sync_pool_connection *c;
+
   if (!pool)
     {
       errno = ENOTCONN;
@@ -240,30 +2199,44 @@ mongo_sync_pool_return (mongo_sync_pool *pool,
 
   if (conn->pool_id > pool->nmasters)
     {
-      mongo_sync_pool_connection *c;
-
-      if (conn->pool_id - pool->nmasters > pool->nslaves ||
-	  pool->nslaves == 0)
+      if (conn->pool_id - pool->nmasters - 1 >= pool->nslaves)
 	{
 	  errno = ERANGE;
 	  return FALSE;
 	}
-
-      c = (mongo_sync_pool_connection *)g_list_nth_data
-	(pool->slaves, conn->pool_id - pool->nmasters - 1);
-      c->in_use = FALSE;
-      return TRUE;
+      c = pool->slaves[conn->pool_id - pool->nmasters - 1];
     }
   else
     {
-      mongo_sync_pool_connection *c;
+      if (conn->pool_id < 0 || conn->pool_id >= pool->nmasters)
+	{
+	  errno = ERANGE;
+	  return FALSE;
+	}
+      c = pool->masters[conn->pool_id];
+    }
 
-      c = (mongo_sync_pool_connection *)g_list_nth_data (pool->masters,
-							 conn->pool_id);
-      c->in_use = FALSE;
-      return TRUE;
+  if (!c)
+    {
+      errno = ENOENT;
+      return FALSE;
     }
 
-  errno = ENOENT;
-  return FALSE;
+  /* A connection that is free, parked, or being returned already is
+     not the caller's to return. */
+  if (g_atomic_int_get (&pool->parking[c->pool_id].owner) != 0 ||
+      !g_atomic_int_compare_and_exchange (&c->in_use, TRUE,
+					  MONGO_SYNC_POOL_RETURNING))
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (_mongo_sync_pool_conn_broken (c) ||
+      (c->router >= 0 && !g_atomic_int_get (&pool->routers[c->router].healthy)))
+    _mongo_sync_pool_evict (pool, c);
+  else if (!_mongo_sync_pool_park (pool, c))
+    _mongo_sync_pool_put (pool, c);
+  _mongo_sync_pool_maybe_reap (pool);
+  return TRUE;
 }
@@ -25,6 +25,7 @@
 #define LIBMONGO_POOL_H 1
 
 #include <mongo-sync.h>
+#include <mongo-sync-monitor.h>
 #include <glib.h>
 
 G_BEGIN_DECLS
@@ -35,8 +36,15 @@ G_BEGIN_DECLS
  * family of commands.
  *
  * Once a pool is set up, one can pick and return connections at one's
- * leisure. Picking is done in a round-robin fashion (excluding
- * connections that have been picked but not returned yet).
+ * leisure, from any thread, without locking the pool. The free
+ * connections are kept on stacks, sharded per processor, so that
+ * picking and returning a connection takes constant time, and threads
+ * on different processors rarely contend for the same stack.
+ *
+ * A pool may also be elastic, see mongo_sync_pool_new_with_limits():
+ * it then opens connections while callers wait for one, up to a
+ * maximum, and closes those that sat idle for too long, down to a
+ * minimum.
  *
  * @addtogroup mongo_sync_pool_api
  * @{
@@ -54,6 +62,82 @@ typedef struct _mongo_sync_pool_connection mongo_sync_pool_connection;
  */
 typedef struct _mongo_sync_pool mongo_sync_pool;
 
+/** Wait time statistics of a pool.
+ *
+ * @see mongo_sync_pool_get_wait_stats()
+ */
+typedef struct
+{
+  gint64 waits; /**< Number of picks that had to wait. */
+  gint64 timeouts; /**< Number of waits that ran out of time. */
+  gint64 total_wait; /**< Total time spent waiting, in
+			microseconds. */
+  gint64 max_wait; /**< The longest single wait, in microseconds. */
+  gint waiting; /**< Number of callers waiting right now. */
+} mongo_sync_pool_wait_stats;
+
+/** Size limits of an elastic pool.
+ *
+ * @see mongo_sync_pool_limits_init(), mongo_sync_pool_new_with_limits()
+ */
+typedef struct
+{
+  gint min_masters; /**< Connections to the master to open up front,
+		       and to keep open. */
+  gint max_masters; /**< The most connections to open to the
+		       master. */
+  gint min_slaves; /**< Connections to the secondaries to open up
+		      front, and to keep open. */
+  gint max_slaves; /**< The most connections to open to the
+		      secondaries. */
+  gint idle_timeout; /**< Time after which connections above the
+			minimum that were not picked are closed, in
+			milliseconds, or zero to never close them. */
+} mongo_sync_pool_limits;
+
+/** Strategies to spread picks over the routers of a pool with.
+ *
+ * @see mongo_sync_pool_set_balance()
+ */
+typedef enum
+{
+  /** Pick any free connection. As connections are opened to the
+      routers in turn, picks spread evenly over them. This is the
+      default, and the cheapest. */
+  MONGO_SYNC_POOL_BALANCE_ROUND_ROBIN,
+  /** Pick a free connection to the router with the fewest
+      connections in use. */
+  MONGO_SYNC_POOL_BALANCE_LEAST_OUTSTANDING,
+  /** Pick a free connection to a router chosen at random, weighted
+      by the inverse of its round-trip time. */
+  MONGO_SYNC_POOL_BALANCE_RTT
+} mongo_sync_pool_balance;
+
+/** The state of a router of a pool.
+ *
+ * @see mongo_sync_pool_get_router()
+ */
+typedef struct
+{
+  gboolean healthy; /**< Whether connections are opened to the
+		       router. */
+  gint connections; /**< Number of connections open to the router. */
+  gint64 rtt; /**< The round-trip time last measured, in
+		 microseconds, or -1. */
+} mongo_sync_pool_router_info;
+
+/** Initialise pool limits to a fixed size.
+ *
+ * Sets both the minimum and the maximum to the given number of
+ * connections, which is what mongo_sync_pool_new() uses.
+ *
+ * @param limits is the structure to initialise.
+ * @param nmasters is the number of connections to the master.
+ * @param nslaves is the number of connections to the secondaries.
+ */
+void mongo_sync_pool_limits_init (mongo_sync_pool_limits *limits,
+				  gint nmasters, gint nslaves);
+
 /** Create a new synchronous connection pool.
  *
  * Sets up a connection pool towards a given MongoDB server, and all
@@ -80,6 +164,199 @@ mongo_sync_pool *mongo_sync_pool_new (const gchar *host,
 				      gint port,
 				      gint nmasters, gint nslaves);
 
+/** Create a new synchronous connection pool, with custom socket
+ * options.
+ *
+ * Like mongo_sync_pool_new(), but every connection of the pool is
+ * tuned with @a opts.
+ *
+ * @param host is the address of the server.
+ * @param port is the port to connect to.
+ * @param nmasters is the number of connections to make towards the
+ * master.
+ * @param nslaves is the number of connections to make towards the
+ * secondaries.
+ * @param opts are the socket options to use, or NULL for the
+ * defaults.
+ *
+ * @returns A newly allocated mongo_sync_pool object, or NULL on
+ * error. It is the responsibility of the caller to close and free the
+ * pool when appropriate.
+ */
+mongo_sync_pool *mongo_sync_pool_new_with_options (const gchar *host,
+						   gint port,
+						   gint nmasters, gint nslaves,
+						   const mongo_connection_options *opts);
+
+/** Create a new elastic synchronous connection pool.
+ *
+ * Like mongo_sync_pool_new_with_options(), but only the minimum
+ * number of connections of @a limits is opened up front, in parallel.
+ *
+ * Whenever mongo_sync_pool_pick() or mongo_sync_pool_pick_timeout()
+ * finds no free connection, a new one is opened, as long as the pool
+ * is below its maximum size. Connections above the minimum that were not picked
+ * for longer than the idle timeout are closed when connections are
+ * returned, or by mongo_sync_pool_reap_idle().
+ *
+ * @param host is the address of the server.
+ * @param port is the port to connect to.
+ * @param limits are the size limits of the pool.
+ * @param opts are the socket options to use, or NULL for the
+ * defaults.
+ *
+ * @note The @a host MUST be a master, otherwise the function will
+ * return an error.
+ *
+ * @returns A newly allocated mongo_sync_pool object, or NULL on
+ * error, in which case errno is set to ERANGE if the limits are
+ * negative, or a minimum is above its maximum.
+ */
+mongo_sync_pool *mongo_sync_pool_new_with_limits (const gchar *host,
+						  gint port,
+						  const mongo_sync_pool_limits *limits,
+						  const mongo_connection_options *opts);
+
+/** Create a new connection pool over a set of mongos routers.
+ *
+ * Like mongo_sync_pool_new_with_limits(), but the master connections
+ * are spread over every router given, always opening the next one to
+ * the healthy router with the fewest connections. Routers do not have
+ * secondaries, so the pool has no slave connections.
+ *
+ * A router that cannot be connected to, or one a connection to which
+ * is found broken, is marked down: no connections are opened to it,
+ * its free connections are closed, and those in use are closed as
+ * they are returned. The closed connections are replaced with ones to
+ * the other routers, in the background, and the router is probed
+ * every second, until it answers again. Routers that cannot be
+ * reached when the pool is created start out down.
+ *
+ * @param routers is a NULL-terminated array of router addresses, in
+ * "host:port" form.
+ * @param limits are the size limits of the pool. The limits for
+ * slaves are ignored.
+ * @param opts are the socket options to use, or NULL for the
+ * defaults.
+ *
+ * @returns A newly allocated mongo_sync_pool object, or NULL on
+ * error, in which case errno is set to EINVAL if an address cannot be
+ * parsed, or to the error of the last router tried, if none could be
+ * connected to.
+ */
+mongo_sync_pool *mongo_sync_pool_new_with_routers (const gchar **routers,
+						   const mongo_sync_pool_limits *limits,
+						   const mongo_connection_options *opts);
+
+/** Close the idle connections of a pool.
+ *
+ * Closes the free connections that were not picked for longer than
+ * the idle timeout of the pool, as long as the pool stays at or above
+ * its minimum size.
+ *
+ * @param pool is the pool to reap.
+ *
+ * @returns The number of connections closed, or -1 on error.
+ */
+gint mongo_sync_pool_reap_idle (mongo_sync_pool *pool);
+
+/** Start checking the health of the connections of a pool.
+ *
+ * Starts a maintenance thread that pings every connection that was
+ * not picked for @a interval milliseconds, and closes those that do
+ * not answer.
+ *
+ * Independently of health checks, a connection returned to the pool
+ * with its socket closed by the server, or with unread data on it, is
+ * closed instead of being put back.
+ *
+ * Closed connections are replaced in the background, up to the
+ * minimum size of the pool. Before replacing them, the pool asks the
+ * replica set for its current primary and secondaries, so the new
+ * connections go where the members are now.
+ *
+ * @param pool is the pool to check.
+ * @param interval is the time after which idle connections are
+ * pinged, in milliseconds, or zero to only replace connections found
+ * broken on return. Either way, if the pool has an idle timeout, the
+ * thread also reaps idle connections as they time out.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note The thread is stopped by mongo_sync_pool_free().
+ */
+gboolean mongo_sync_pool_start_health_checks (mongo_sync_pool *pool,
+					      gint interval);
+
+/** Get the number of open connections of a pool.
+ *
+ * @param pool is the pool to query.
+ * @param masters is where to store the number of connections to the
+ * master, or NULL.
+ * @param slaves is where to store the number of connections to the
+ * secondaries, or NULL.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_pool_get_size (mongo_sync_pool *pool, gint *masters,
+				   gint *slaves);
+
+/** Enable or disable thread affinity on a pool.
+ *
+ * With thread affinity enabled, a connection returned to the pool is
+ * parked for the thread that returned it, instead of being put back
+ * onto the shared free lists. The next time the same thread picks a
+ * connection with mongo_sync_pool_pick() or
+ * mongo_sync_pool_pick_timeout(), it gets the parked one back,
+ * without touching any state shared with other threads, as long as
+ * the parked connection is of a suitable role.
+ *
+ * Parked connections are not lost to other threads: once there are no
+ * free connections left, they are taken from whichever thread they
+ * are parked for. Connections are never parked while callers are
+ * waiting for one, or while a monitor is attached to the pool. Each
+ * thread keeps at most one connection parked per pool.
+ *
+ * @param pool is the pool to change.
+ * @param enable is whether to park returned connections.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note Disabling thread affinity puts every parked connection back
+ * into the pool.
+ */
+gboolean mongo_sync_pool_set_thread_affinity (mongo_sync_pool *pool,
+					      gboolean enable);
+
+/** Set the strategy to spread picks over the routers of a pool with.
+ *
+ * Only affects mongo_sync_pool_pick() and
+ * mongo_sync_pool_pick_timeout() on pools created with
+ * mongo_sync_pool_new_with_routers(). Strategies other than
+ * #MONGO_SYNC_POOL_BALANCE_ROUND_ROBIN look at every connection of
+ * the pool, so they take time linear in the size of the pool.
+ *
+ * @param pool is the pool to change.
+ * @param balance is the strategy to use.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_pool_set_balance (mongo_sync_pool *pool,
+				      mongo_sync_pool_balance balance);
+
+/** Get the state of a router of a pool.
+ *
+ * @param pool is the pool to query.
+ * @param index is the index of the router, in the order the routers
+ * were given to mongo_sync_pool_new_with_routers().
+ * @param info is where the state will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise, in which case errno is
+ * set to ERANGE if the pool has no router with that index.
+ */
+gboolean mongo_sync_pool_get_router (mongo_sync_pool *pool, gint index,
+				     mongo_sync_pool_router_info *info);
+
 /** Close and free a synchronous connection pool.
  *
  * @param pool is the pool to shut down.
@@ -97,9 +374,26 @@ void mongo_sync_pool_free (mongo_sync_pool *pool);
  * @param want_master flags whether the caller wants a master connection,
  * or secondaries are acceptable too.
  *
+ * When secondaries are acceptable, a free secondary is picked if
+ * there is one, and a master otherwise.
+ *
+ * If thread affinity is enabled, the connection the calling thread
+ * returned last is preferred, see
+ * mongo_sync_pool_set_thread_affinity().
+ *
+ * If a monitor is attached to the pool, this is the same as picking
+ * with a #MONGO_SYNC_READ_PRIMARY or
+ * #MONGO_SYNC_READ_SECONDARY_PREFERRED read preference instead, see
+ * mongo_sync_pool_pick_with_read_preference().
+ *
+ * If there is no suitable free connection, and the pool is elastic
+ * and below its maximum size, a new connection is opened and
+ * returned.
+ *
  * @note For write operations, always select a master!
  *
- * @returns A connection object from the pool.
+ * @returns A connection object from the pool, or NULL if there is no
+ * suitable free connection, in which case errno is set to EAGAIN.
  *
  * @note The returned object can be safely casted to
  * mongo_sync_connection, and passed to any of the mongo_sync family
@@ -109,15 +403,115 @@ void mongo_sync_pool_free (mongo_sync_pool *pool);
 mongo_sync_pool_connection *mongo_sync_pool_pick (mongo_sync_pool *pool,
 						  gboolean want_master);
 
+/** Pick a connection from a synchronous connection pool, according
+ * to a read preference.
+ *
+ * Out of the free connections to the members the read preference
+ * allows, picks one at random among those within the latency window
+ * of the closest member.
+ *
+ * The roles, round-trip times and replication lags come from the
+ * monitor of the pool, if there is one. Otherwise the roles and the
+ * round-trip times measured when the pool was created are used, and
+ * the staleness bound is not enforced.
+ *
+ * Unlike mongo_sync_pool_pick(), this looks at every connection of
+ * the pool, so it takes time linear in the size of the pool.
+ *
+ * @param pool is the pool to select from.
+ * @param pref is the read preference to honour.
+ *
+ * @returns A connection object from the pool, or NULL if there is no
+ * suitable free connection, in which case errno is set to EAGAIN.
+ *
+ * @note The same rules apply to the returned object as to the ones
+ * returned by mongo_sync_pool_pick().
+ */
+mongo_sync_pool_connection *
+mongo_sync_pool_pick_with_read_preference (mongo_sync_pool *pool,
+					   const mongo_sync_read_preference *pref);
+
+/** Pick a connection from a synchronous connection pool, waiting for
+ * one to be returned if necessary.
+ *
+ * Like mongo_sync_pool_pick(), but if there is no suitable free
+ * connection, the caller is queued, and the next suitable connection
+ * returned to the pool is handed to it directly. Waiting callers are
+ * served in the order they started waiting. If the pool is elastic,
+ * and below its maximum size, a new connection is opened too.
+ *
+ * @param pool is the pool to select from.
+ * @param want_master flags whether the caller wants a master
+ * connection, or secondaries are acceptable too.
+ * @param timeout is the longest time to wait, in milliseconds. Zero
+ * does not wait at all, a negative value waits forever.
+ *
+ * @note Connections handed over to a waiting caller are matched by
+ * the role they were connected with, even if a monitor is attached to
+ * the pool.
+ *
+ * @note The pool must not be freed while callers are waiting on it.
+ *
+ * @returns A connection object from the pool, or NULL on error, in
+ * which case errno is set to ETIMEDOUT if no connection was returned
+ * in time, or to EAGAIN if @a timeout was zero and there was no free
+ * connection.
+ */
+mongo_sync_pool_connection *
+mongo_sync_pool_pick_timeout (mongo_sync_pool *pool, gboolean want_master,
+			      gint timeout);
+
+/** Get the wait time statistics of a pool.
+ *
+ * Only calls to mongo_sync_pool_pick_timeout() that could not pick a
+ * connection right away are counted.
+ *
+ * @param pool is the pool to query.
+ * @param stats is where the statistics will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_pool_get_wait_stats (mongo_sync_pool *pool,
+					 mongo_sync_pool_wait_stats *stats);
+
+/** Attach a replica set monitor to a connection pool.
+ *
+ * The monitor keeps the roles, round-trip times and replication lags
+ * of the members up to date for
+ * mongo_sync_pool_pick_with_read_preference(). Members are matched
+ * by the address the pool connected to, so the pool should be set up
+ * with the same host names the replica set reports.
+ *
+ * While a monitor is attached, connections are not kept for the
+ * thread that returned them, as with mongo_sync_pool_set_thread_affinity(),
+ * and those kept already are put back into the pool.
+ *
+ * @param pool is the pool to attach the monitor to.
+ * @param monitor is the monitor to use, or NULL to detach.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note The monitor is not owned by the pool, and must outlive it.
+ */
+gboolean mongo_sync_pool_set_monitor (mongo_sync_pool *pool,
+				      mongo_sync_monitor *monitor);
+
 /** Return a connection to the synchronous connection pool.
  *
  * Once one is not using a connection anymore, it should be returned
- * to the pool using this function.
+ * to the pool using this function. If a caller is waiting in
+ * mongo_sync_pool_pick_timeout() for a connection like this one, the
+ * connection is handed to it directly.
+ *
+ * A connection whose socket was closed by the server, or that has
+ * unread data on it, is closed instead, and replaced in the
+ * background, see mongo_sync_pool_start_health_checks().
  *
  * @param pool is the pool to return to.
  * @param conn is the connection to return.
  *
- * @returns TRUE on success, FALSE otherwise.
+ * @returns TRUE on success, FALSE otherwise. Returning a connection
+ * that was returned already fails with errno set to EINVAL.
  *
  * @note The returned connection should not be used afterwards.
  */
@@ -0,0 +1,647 @@
+/* mongo-sync-scan.c - libmongo-client parallel collection scan
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-scan.c
+ * MongoDB parallel collection scan implementation.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#include <mongo.h>
+#include "libmongo-private.h"
+
+/** @internal State shared by the workers of a scan. */
+typedef struct
+{
+  const gchar *ns; /**< The namespace being scanned. */
+  const bson *sel; /**< The field selector, if any. */
+  GPtrArray *queries; /**< The query of each partition. */
+
+  mongo_sync_scan_func func; /**< The function to deliver documents
+				to. */
+  gpointer user_data; /**< User data to pass to the function. */
+
+  gint next; /**< The next partition to scan. Atomic. */
+  gint stop; /**< Set when the scan is to be aborted. Atomic. */
+  gint error; /**< The errno of the first failure, if any. Atomic. */
+} _mongo_sync_scan;
+
+/** @internal A worker of a scan. */
+typedef struct
+{
+  _mongo_sync_scan *scan; /**< The scan the worker belongs to. */
+  mongo_sync_pool_connection *conn; /**< The connection the worker
+				       reads over. */
+  GThread *thread; /**< The thread of the worker, or NULL if it runs
+		      on the calling thread. */
+} _mongo_sync_scan_worker;
+
+bson *
+mongo_sync_scan_range_query (const bson *query, const bson *lo,
+			     const bson *hi)
+{
+  bson *range, *cond, *and, *b;
+  bson_cursor *c;
+
+  if (!lo && !hi)
+    {
+      if (!query)
+	{
+	  b = bson_new ();
+	  bson_finish (b);
+	  return b;
+	}
+      b = bson_new_from_data (bson_data (query), bson_size (query) - 1);
+      bson_finish (b);
+      return b;
+    }
+
+  cond = bson_new ();
+  if (lo)
+    {
+      c = bson_find (lo, "_id");
+      bson_append_cursor_value (cond, "$gte", c);
+      bson_cursor_free (c);
+    }
+  if (hi && !lo)
+    {
+      bson *outside = bson_new ();
+
+      /* Comparisons only match values of the same type, so the first
+	 partition takes everything that is not in the ones after it,
+	 _id values of other types included. */
+      c = bson_find (hi, "_id");
+      bson_append_cursor_value (outside, "$gte", c);
+      bson_cursor_free (c);
+      bson_finish (outside);
+      bson_append_document (cond, "$not", outside);
+      bson_free (outside);
+    }
+  else if (hi)
+    {
+      c = bson_find (hi, "_id");
+      bson_append_cursor_value (cond, "$lt", c);
+      bson_cursor_free (c);
+    }
+  bson_finish (cond);
+
+  range = bson_new ();
+  bson_append_document (range, "_id", cond);
+  bson_finish (range);
+  bson_free (cond);
+
+  /* An empty document is five bytes: the length and the terminator. */
+  if (!query || bson_size (query) <= 5)
+    return range;
+
+  and = bson_new ();
+  bson_append_document (and, "0", query);
+  bson_append_document (and, "1", range);
+  bson_finish (and);
+  bson_free (range);
+
+  b = bson_new ();
+  bson_append_array (b, "$and", and);
+  bson_finish (b);
+  bson_free (and);
+
+  return b;
+}
+
+/** @internal Build a query that returns the matches in _id order.
+ *
+ * @param query is the query to wrap, or NULL.
+ * @param order is 1 for ascending, -1 for descending order.
+ */
+static bson *
+_mongo_sync_scan_sorted_query (const bson *query, gint32 order)
+{
+  bson *b, *q, *orderby;
+
+  q = bson_new ();
+  bson_finish (q);
+  orderby = bson_new ();
+  bson_append_int32 (orderby, "_id", order);
+  bson_finish (orderby);
+
+  b = bson_new ();
+  bson_append_document (b, "$query", (query) ? query : q);
+  bson_append_document (b, "$orderby", orderby);
+  bson_finish (b);
+
+  bson_free (orderby);
+  bson_free (q);
+  return b;
+}
+
+/** @internal Extract the _id of a document.
+ *
+ * @returns A newly allocated { _id: value } document, or NULL if
+ * @a doc has no _id.
+ */
+static bson *
+_mongo_sync_scan_id (const bson *doc)
+{
+  bson_cursor *c;
+  bson *point;
+
+  c = bson_find (doc, "_id");
+  if (!c)
+    {
+      errno = EPROTO;
+      return NULL;
+    }
+
+  point = bson_new ();
+  bson_append_cursor_value (point, "_id", c);
+  bson_finish (point);
+
+  bson_cursor_free (c);
+  return point;
+}
+
+/** @internal Fetch the _id of a single document.
+ *
+ * @param conn is the connection to query over.
+ * @param ns is the namespace to query.
+ * @param query is a query sorted by _id.
+ * @param skip is the number of matches to skip.
+ *
+ * @returns A newly allocated { _id: value } document, or NULL on
+ * error, in which case errno is ENOENT if there were fewer matches
+ * than @a skip.
+ */
+static bson *
+_mongo_sync_scan_point (mongo_sync_connection *conn, const gchar *ns,
+			const bson *query, gint32 skip)
+{
+  mongo_packet *p;
+  bson *sel, *doc = NULL, *point;
+
+  sel = bson_new ();
+  bson_append_int32 (sel, "_id", 1);
+  bson_finish (sel);
+
+  p = mongo_sync_cmd_query (conn, ns, 0, skip, -1, query, sel);
+  bson_free (sel);
+  if (!p)
+    return NULL;
+
+  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &doc))
+    {
+      int e = errno;
+
+      mongo_wire_packet_free (p);
+      errno = e;
+      return NULL;
+    }
+  mongo_wire_packet_free (p);
+  bson_finish (doc);
+
+  point = _mongo_sync_scan_id (doc);
+  bson_free (doc);
+  return point;
+}
+
+/** @internal Sample split points from the collection.
+ *
+ * Counts the matches, then walks their _id values once, in _id
+ * order, and picks every n-th of them. The walk only reads the _id
+ * index, and stops at the last split point.
+ */
+static gboolean
+_mongo_sync_scan_split_sample (mongo_sync_connection *conn, const gchar *ns,
+			       const bson *query, gint partitions,
+			       GPtrArray *splits)
+{
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+  gchar *db;
+  const gchar *coll;
+  gdouble count;
+  bson *q, *sel;
+  gint64 at = 0;
+  gint i = 1;
+  int e = 0;
+
+  coll = strchr (ns, '.');
+  if (!coll)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  db = g_strndup (ns, coll - ns);
+  count = mongo_sync_cmd_count (conn, db, coll + 1, query);
+  g_free (db);
+  if (count < 0)
+    return FALSE;
+
+  q = _mongo_sync_scan_sorted_query (query, 1);
+  sel = bson_new ();
+  bson_append_int32 (sel, "_id", 1);
+  bson_finish (sel);
+  p = mongo_sync_cmd_query (conn, ns, 0, 0, 0, q, sel);
+  bson_free (sel);
+  bson_free (q);
+  if (!p)
+    return (errno == ENOENT);
+
+  cursor = mongo_sync_cursor_new (conn, ns, p);
+  if (!cursor)
+    {
+      e = errno;
+      mongo_wire_packet_free (p);
+      errno = e;
+      return FALSE;
+    }
+  mongo_sync_cursor_set_adaptive_batching
+    (cursor, MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES);
+
+  while (i < partitions)
+    {
+      bson *doc, *point;
+
+      /* The server closed the cursor with the last batch: the
+	 collection shrank since it was counted. */
+      if (cursor->offset >= cursor->ph.returned - 1 &&
+	  cursor->ph.cursor_id == 0)
+	break;
+
+      if (!mongo_sync_cursor_next (cursor))
+	{
+	  if (errno != ENOENT)
+	    e = errno;
+	  break;
+	}
+
+      if (at++ == 0 || at - 1 < (gint64)(count * i / partitions))
+	continue;
+
+      doc = mongo_sync_cursor_get_data (cursor);
+      point = (doc) ? _mongo_sync_scan_id (doc) : NULL;
+      bson_free (doc);
+      if (!point)
+	{
+	  e = errno;
+	  break;
+	}
+      g_ptr_array_add (splits, point);
+
+      /* Several split points may fall on the same document, if there
+	 are fewer matches than partitions. */
+      while (i < partitions && (gint64)(count * i / partitions) < at)
+	i++;
+    }
+  mongo_sync_cursor_free (cursor);
+
+  if (e)
+    {
+      errno = e;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/** @internal Read the leading eight bytes of an ObjectId bound.
+ *
+ * @returns TRUE if the _id of @a point is an ObjectId.
+ */
+static gboolean
+_mongo_sync_scan_oid_prefix (const bson *point, guint64 *prefix)
+{
+  bson_cursor *c;
+  const guint8 *oid = NULL;
+  gint i;
+
+  c = bson_find (point, "_id");
+  if (!bson_cursor_get_oid (c, &oid))
+    {
+      bson_cursor_free (c);
+      return FALSE;
+    }
+
+  *prefix = 0;
+  for (i = 0; i < 8; i++)
+    *prefix = (*prefix << 8) | oid[i];
+
+  bson_cursor_free (c);
+  return TRUE;
+}
+
+/** @internal Check whether every split point has an _id of the same
+ * type.
+ *
+ * Range conditions only match values of the type of their bound, so
+ * partitions between split points of different types would miss
+ * documents, or overlap.
+ */
+static gboolean
+_mongo_sync_scan_splits_uniform (GPtrArray *splits)
+{
+  bson_type type = BSON_TYPE_NONE;
+  guint i;
+
+  for (i = 0; i < splits->len; i++)
+    {
+      bson_cursor *c = bson_find (g_ptr_array_index (splits, i), "_id");
+      bson_type t = bson_cursor_type (c);
+
+      bson_cursor_free (c);
+      if (i > 0 && t != type)
+	return FALSE;
+      type = t;
+    }
+  return TRUE;
+}
+
+/** @internal Interpolate split points between the _id bounds.
+ *
+ * ObjectIds start with a big-endian timestamp, so their leading
+ * bytes, taken as a number, grow with their creation time.
+ */
+static gboolean
+_mongo_sync_scan_split_bounds (mongo_sync_connection *conn, const gchar *ns,
+			       const bson *query, gint partitions,
+			       GPtrArray *splits)
+{
+  bson *q, *lo, *hi;
+  guint64 min, max, step;
+  gint i, j;
+
+  q = _mongo_sync_scan_sorted_query (query, 1);
+  lo = _mongo_sync_scan_point (conn, ns, q, 0);
+  bson_free (q);
+  if (!lo)
+    return (errno == ENOENT);
+
+  q = _mongo_sync_scan_sorted_query (query, -1);
+  hi = _mongo_sync_scan_point (conn, ns, q, 0);
+  bson_free (q);
+  if (!hi)
+    {
+      int e = errno;
+
+      bson_free (lo);
+      errno = e;
+      return (e == ENOENT);
+    }
+
+  if (!_mongo_sync_scan_oid_prefix (lo, &min) ||
+      !_mongo_sync_scan_oid_prefix (hi, &max))
+    {
+      bson_free (lo);
+      bson_free (hi);
+      return _mongo_sync_scan_split_sample (conn, ns, query, partitions,
+					    splits);
+    }
+  bson_free (lo);
+  bson_free (hi);
+
+  step = (max > min) ? (max - min) / partitions : 0;
+  if (step == 0)
+    return TRUE;
+
+  for (i = 1; i < partitions; i++)
+    {
+      guint64 v = min + step * i;
+      guint8 oid[12];
+      bson *point;
+
+      memset (oid, 0, sizeof (oid));
+      for (j = 7; j >= 0; j--)
+	{
+	  oid[j] = v & 0xff;
+	  v >>= 8;
+	}
+
+      point = bson_new ();
+      bson_append_oid (point, "_id", oid);
+      bson_finish (point);
+      g_ptr_array_add (splits, point);
+    }
+
+  return TRUE;
+}
+
+/** @internal Record the first failure of a scan, and stop it. */
+static void
+_mongo_sync_scan_fail (_mongo_sync_scan *scan, int e)
+{
+  g_atomic_int_compare_and_exchange (&scan->error, 0, (e) ? e : EIO);
+  g_atomic_int_set (&scan->stop, 1);
+}
+
+/** @internal Scan a single partition. */
+static void
+_mongo_sync_scan_partition (_mongo_sync_scan *scan,
+			    mongo_sync_connection *conn, gint partition)
+{
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+
+  p = mongo_sync_cmd_query (conn, scan->ns,
+			    MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT, 0, 0,
+			    g_ptr_array_index (scan->queries, partition),
+			    scan->sel);
+  if (!p)
+    {
+      /* An empty partition is not an error. */
+      if (errno != ENOENT)
+	_mongo_sync_scan_fail (scan, errno);
+      return;
+    }
+
+  cursor = mongo_sync_cursor_new (conn, scan->ns, p);
+  if (!cursor)
+    {
+      int e = errno;
+
+      mongo_wire_packet_free (p);
+      _mongo_sync_scan_fail (scan, e);
+      return;
+    }
+  mongo_sync_cursor_set_adaptive_batching
+    (cursor, MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES);
+  mongo_sync_cursor_set_prefetch (cursor, 0.5);
+
+  while (!g_atomic_int_get (&scan->stop))
+    {
+      bson *doc;
+      gboolean cont;
+
+      /* The server closed the cursor with the last batch. */
+      if (cursor->offset >= cursor->ph.returned - 1 &&
+	  cursor->ph.cursor_id == 0)
+	break;
+
+      if (!mongo_sync_cursor_next (cursor))
+	{
+	  if (errno != ENOENT)
+	    _mongo_sync_scan_fail (scan, errno);
+	  break;
+	}
+
+      doc = mongo_sync_cursor_get_data (cursor);
+      if (!doc)
+	{
+	  _mongo_sync_scan_fail (scan, errno);
+	  break;
+	}
+      cont = scan->func (doc, partition, scan->user_data);
+      bson_free (doc);
+
+      if (!cont)
+	{
+	  _mongo_sync_scan_fail (scan, ECANCELED);
+	  break;
+	}
+    }
+
+  mongo_sync_cursor_free (cursor);
+}
+
+/** @internal Scan partitions until there are none left. */
+static gpointer
+_mongo_sync_scan_run (gpointer data)
+{
+  _mongo_sync_scan_worker *w = (_mongo_sync_scan_worker *)data;
+  _mongo_sync_scan *scan = w->scan;
+
+  while (!g_atomic_int_get (&scan->stop))
+    {
+      gint i = g_atomic_int_add (&scan->next, 1);
+
+      if (i >= (gint)scan->queries->len)
+	break;
+      _mongo_sync_scan_partition (scan, (mongo_sync_connection *)w->conn, i);
+    }
+  return NULL;
+}
+
+gboolean
+mongo_sync_pool_scan (mongo_sync_pool *pool, const gchar *ns,
+		      const bson *query, const bson *sel,
+		      gint partitions, mongo_sync_scan_split split,
+		      mongo_sync_scan_func func, gpointer user_data)
+{
+  mongo_sync_pool_connection *conn;
+  _mongo_sync_scan scan;
+  _mongo_sync_scan_worker *workers;
+  GPtrArray *splits;
+  gboolean ok = TRUE;
+  guint i, nworkers = 0;
+  int e = 0;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!ns || !func || partitions <= 0)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  /* Plan the partitions on the primary. */
+  conn = mongo_sync_pool_pick (pool, TRUE);
+  if (!conn)
+    return FALSE;
+
+  splits = g_ptr_array_new ();
+  if (partitions > 1)
+    {
+      if (split == MONGO_SYNC_SCAN_SPLIT_BOUNDS)
+	ok = _mongo_sync_scan_split_bounds ((mongo_sync_connection *)conn, ns,
+					    query, partitions, splits);
+      else
+	ok = _mongo_sync_scan_split_sample ((mongo_sync_connection *)conn, ns,
+					    query, partitions, splits);
+      e = errno;
+    }
+  mongo_sync_pool_return (pool, conn);
+
+  /* With _id values of several types, scan everything as a single
+     partition, rather than lose documents between the types. */
+  if (ok && !_mongo_sync_scan_splits_uniform (splits))
+    {
+      for (i = 0; i < splits->len; i++)
+	bson_free (g_ptr_array_index (splits, i));
+      g_ptr_array_set_size (splits, 0);
+    }
+
+  memset (&scan, 0, sizeof (scan));
+  scan.ns = ns;
+  scan.sel = sel;
+  scan.func = func;
+  scan.user_data = user_data;
+  scan.queries = g_ptr_array_sized_new (splits->len + 1);
+
+  if (ok)
+    {
+      for (i = 0; i <= splits->len; i++)
+	g_ptr_array_add (scan.queries, mongo_sync_scan_range_query
+			 (query,
+			  (i > 0) ? g_ptr_array_index (splits, i - 1) : NULL,
+			  (i < splits->len) ? g_ptr_array_index (splits, i) :
+			  NULL));
+
+      /* Pick a connection for every partition, or as many as there
+	 are, and let the first one work on the calling thread. */
+      workers = g_new0 (_mongo_sync_scan_worker, scan.queries->len);
+      while (nworkers < scan.queries->len &&
+	     (conn = mongo_sync_pool_pick (pool, FALSE)) != NULL)
+	{
+	  workers[nworkers].scan = &scan;
+	  workers[nworkers].conn = conn;
+	  if (nworkers > 0)
+	    workers[nworkers].thread =
+	      g_thread_try_new ("mongo-sync-scan", _mongo_sync_scan_run,
+				&workers[nworkers], NULL);
+	  nworkers++;
+	}
+
+      if (nworkers == 0)
+	_mongo_sync_scan_fail (&scan, EAGAIN);
+      else
+	_mongo_sync_scan_run (&workers[0]);
+
+      for (i = 0; i < nworkers; i++)
+	{
+	  if (workers[i].thread)
+	    g_thread_join (workers[i].thread);
+	  mongo_sync_pool_return (pool, workers[i].conn);
+	}
+      g_free (workers);
+    }
+  else
+    _mongo_sync_scan_fail (&scan, e);
+
+  for (i = 0; i < splits->len; i++)
+    bson_free (g_ptr_array_index (splits, i));
+  g_ptr_array_free (splits, TRUE);
+  for (i = 0; i < scan.queries->len; i++)
+    bson_free (g_ptr_array_index (scan.queries, i));
+  g_ptr_array_free (scan.queries, TRUE);
+
+  if (scan.error)
+    {
+      errno = scan.error;
+      return FALSE;
+    }
+  return TRUE;
+}
@@ -0,0 +1,126 @@
+/* mongo-sync-scan.h - libmongo-client parallel collection scan API
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-scan.h
+ * MongoDB parallel collection scan API public header.
+ *
+ * @addtogroup mongo_sync
+ * @{
+ */
+
+#ifndef LIBMONGO_SYNC_SCAN_H
+#define LIBMONGO_SYNC_SCAN_H 1
+
+#include <mongo-sync-pool.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** @defgroup mongo_sync_scan_api Mongo Sync Parallel Scan API
+ *
+ * A parallel scan splits a collection into disjoint ranges of _id
+ * values, and reads each range over its own pooled connection, on its
+ * own thread. A single cursor is bound by the round-trip time of
+ * every batch; reading the partitions concurrently keeps every
+ * connection of the pool busy instead.
+ *
+ * @addtogroup mongo_sync_scan_api
+ * @{
+ */
+
+/** Strategies to split a collection into partitions with. */
+typedef enum
+{
+  /** Sample the split points from the collection itself: count the
+      matching documents, and pick the _id of every n-th of them, in
+      _id order. Produces evenly sized partitions, at the cost of
+      reading the _id of every match up to the last split point. */
+  MONGO_SYNC_SCAN_SPLIT_SAMPLE,
+  /** Interpolate the split points between the smallest and the
+      largest _id. Only two queries are needed, but the partitions
+      are only even if the ObjectIds were generated at a steady
+      rate. Falls back to #MONGO_SYNC_SCAN_SPLIT_SAMPLE when the _id
+      values are not ObjectIds. */
+  MONGO_SYNC_SCAN_SPLIT_BOUNDS
+} mongo_sync_scan_split;
+
+/** Callback to deliver scanned documents with.
+ *
+ * The callback is called from the worker threads of the scan,
+ * concurrently for different partitions, but sequentially within a
+ * partition, in _id order. To deliver the documents to a queue
+ * instead, push a copy of @a doc onto a GAsyncQueue from within the
+ * callback.
+ *
+ * @param doc is the scanned document. It is only valid until the
+ * callback returns.
+ * @param partition is the number of the partition the document
+ * belongs to.
+ * @param user_data is the user data passed to
+ * mongo_sync_pool_scan().
+ *
+ * @returns TRUE to continue the scan, FALSE to abort it.
+ */
+typedef gboolean (*mongo_sync_scan_func) (const bson *doc, gint partition,
+					  gpointer user_data);
+
+/** Scan a collection in parallel, over the connections of a pool.
+ *
+ * Splits the documents matching @a query into at most @a partitions
+ * ranges by their _id, using a master connection of the pool, then
+ * reads the ranges concurrently, each over a connection picked from
+ * the pool, on a thread of its own. If the pool has fewer free
+ * connections than partitions, the connections take the remaining
+ * partitions as they finish their previous ones.
+ *
+ * The function returns once every partition was read, or the scan was
+ * aborted.
+ *
+ * @param pool is the pool to scan with.
+ * @param ns is the namespace to scan.
+ * @param query is an optional query to restrict the scan to, or
+ * NULL.
+ * @param sel is an optional field selector, or NULL.
+ * @param partitions is the number of partitions to split the
+ * collection into.
+ * @param split is the strategy to find the split points with.
+ * @param func is the function to deliver the documents to.
+ * @param user_data is passed on to @a func as-is.
+ *
+ * @note The connections used by the scan must not be picked from the
+ * pool by other threads while the scan runs.
+ *
+ * @note Documents whose _id has a different type than the split
+ * points all fall into the first partition, so the partitions are
+ * only even if every _id in the collection has the same type. If the
+ * split points themselves have different types, the collection is
+ * scanned as a single partition.
+ *
+ * @returns TRUE if every partition was scanned, FALSE otherwise, in
+ * which case errno is set to ECANCELED if @a func aborted the scan.
+ */
+gboolean mongo_sync_pool_scan (mongo_sync_pool *pool, const gchar *ns,
+			       const bson *query, const bson *sel,
+			       gint partitions, mongo_sync_scan_split split,
+			       mongo_sync_scan_func func, gpointer user_data);
+
+/** @} */
+
+/** @} */
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,337 @@
+/* mongo-sync-tailer.c - libmongo-client oplog tailer
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-tailer.c
+ * MongoDB oplog and capped collection tailer implementation.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#include <mongo.h>
+#include "libmongo-private.h"
+
+/** @internal Tailer object. */
+struct _mongo_sync_tailer
+{
+  mongo_sync_connection *conn; /**< The connection to tail over. */
+  gchar *ns; /**< The namespace to tail. */
+  bson *query; /**< The query to filter the entries with, if any. */
+  gboolean oplog_replay; /**< Whether to set the OplogReplay flag. */
+
+  gint64 cursor_id; /**< The ID of the live cursor, zero if none. */
+
+  gboolean have_last; /**< Whether an entry with a ts was seen. */
+  gint64 last; /**< The timestamp of the last entry seen. */
+};
+
+mongo_sync_tailer *
+mongo_sync_tailer_new (mongo_sync_connection *conn, const gchar *ns,
+		       const bson *query)
+{
+  mongo_sync_tailer *t;
+  const gchar *coll;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+  if (!ns || !(coll = strchr (ns, '.')))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  t = g_new0 (mongo_sync_tailer, 1);
+  t->conn = conn;
+  t->ns = g_strdup (ns);
+  if (query)
+    {
+      t->query = bson_new_from_data (bson_data (query),
+				     bson_size (query) - 1);
+      bson_finish (t->query);
+    }
+  t->oplog_replay = g_str_has_prefix (coll + 1, "oplog.");
+
+  return t;
+}
+
+void
+mongo_sync_tailer_free (mongo_sync_tailer *tailer)
+{
+  if (!tailer)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  mongo_sync_conn_defer_kill (tailer->conn, tailer->cursor_id);
+
+  bson_free (tailer->query);
+  g_free (tailer->ns);
+  g_free (tailer);
+  errno = 0;
+}
+
+gboolean
+mongo_sync_tailer_set_oplog_replay (mongo_sync_tailer *tailer,
+				    gboolean replay)
+{
+  if (!tailer)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  tailer->oplog_replay = replay;
+  return TRUE;
+}
+
+gboolean
+mongo_sync_tailer_set_start (mongo_sync_tailer *tailer, gint64 ts)
+{
+  if (!tailer)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  tailer->have_last = TRUE;
+  tailer->last = ts;
+  return TRUE;
+}
+
+gboolean
+mongo_sync_tailer_get_last (mongo_sync_tailer *tailer, gint64 *ts)
+{
+  if (!tailer || !ts)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (!tailer->have_last)
+    {
+      errno = ENOENT;
+      return FALSE;
+    }
+
+  *ts = tailer->last;
+  return TRUE;
+}
+
+/** @internal Build the query to (re)start tailing with.
+ *
+ * Once the tailer has seen an entry, the query is restricted to the
+ * entries at or after it, with the ts condition at the top level, as
+ * OplogReplay requires.
+ */
+static bson *
+_mongo_sync_tailer_query (mongo_sync_tailer *tailer)
+{
+  bson *b, *cond;
+  bson_cursor *c;
+
+  b = bson_new ();
+  if (tailer->query)
+    {
+      c = bson_cursor_new (tailer->query);
+      while (bson_cursor_next (c))
+	{
+	  if (tailer->have_last && strcmp (bson_cursor_key (c), "ts") == 0)
+	    continue;
+	  bson_append_cursor_value (b, bson_cursor_key (c), c);
+	}
+      bson_cursor_free (c);
+    }
+  if (tailer->have_last)
+    {
+      cond = bson_new ();
+      bson_append_timestamp (cond, "$gte", tailer->last);
+      bson_finish (cond);
+      bson_append_document (b, "ts", cond);
+      bson_free (cond);
+    }
+  bson_finish (b);
+
+  return b;
+}
+
+/** @internal Deliver the new entries of a reply.
+ *
+ * Entries at or before the last timestamp seen were delivered
+ * already, before the tailer resumed, and are skipped.
+ *
+ * @returns The number of entries delivered, or -1 if the callback
+ * asked to stop.
+ */
+static gint
+_mongo_sync_tailer_deliver (mongo_sync_tailer *tailer, mongo_packet *p,
+			    gint32 returned, mongo_sync_tailer_func func,
+			    gpointer user_data)
+{
+  GPtrArray *entries;
+  const guint8 *data;
+  gint32 size, pos = 0, i;
+  gint n;
+  gboolean cont = TRUE;
+
+  size = mongo_wire_packet_get_data (p, &data) -
+    sizeof (mongo_reply_packet_header);
+  if (!mongo_wire_reply_packet_get_data (p, &data))
+    size = 0;
+  entries = g_ptr_array_sized_new (returned);
+
+  for (i = 0; i < returned && pos + (gint32)sizeof (gint32) <= size; i++)
+    {
+      gint32 dsize = bson_stream_doc_size (data, pos);
+      bson *doc;
+      bson_cursor *c;
+      gint64 ts;
+
+      if (dsize <= 0 || pos + dsize > size)
+	break;
+      doc = bson_new_from_data (data + pos, dsize - 1);
+      bson_finish (doc);
+      pos += dsize;
+
+      c = bson_find (doc, "ts");
+      if (bson_cursor_get_timestamp (c, &ts))
+	{
+	  if (tailer->have_last && (guint64)ts <= (guint64)tailer->last)
+	    {
+	      bson_cursor_free (c);
+	      bson_free (doc);
+	      continue;
+	    }
+	  tailer->have_last = TRUE;
+	  tailer->last = ts;
+	}
+      bson_cursor_free (c);
+
+      g_ptr_array_add (entries, doc);
+    }
+
+  n = entries->len;
+  if (n > 0)
+    cont = func ((const bson **)entries->pdata, n, user_data);
+
+  for (i = 0; i < (gint32)entries->len; i++)
+    bson_free (g_ptr_array_index (entries, i));
+  g_ptr_array_free (entries, TRUE);
+
+  return (cont) ? n : -1;
+}
+
+gint
+mongo_sync_tailer_poll (mongo_sync_tailer *tailer,
+			mongo_sync_tailer_func func, gpointer user_data)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet *p;
+  gboolean had_cursor;
+  gint n;
+
+  if (!tailer || !func)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  had_cursor = (tailer->cursor_id != 0);
+  if (had_cursor)
+    p = mongo_sync_cmd_tail (tailer->conn, tailer->ns, 0, NULL,
+			     tailer->cursor_id);
+  else
+    {
+      bson *q = _mongo_sync_tailer_query (tailer);
+
+      p = mongo_sync_cmd_tail (tailer->conn, tailer->ns,
+			       MONGO_WIRE_FLAG_QUERY_TAILABLE_CURSOR |
+			       MONGO_WIRE_FLAG_QUERY_AWAIT_DATA |
+			       MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT |
+			       ((tailer->oplog_replay) ?
+				MONGO_WIRE_FLAG_QUERY_OPLOG_REPLAY : 0),
+			       q, 0);
+      bson_free (q);
+    }
+
+  if (!p)
+    {
+      /* Tailing resumes with a new query after any failure of a
+	 getmore. The cursor may well live on, and as it never times
+	 out, it is killed along with the next command. */
+      mongo_sync_conn_defer_kill (tailer->conn, tailer->cursor_id);
+      tailer->cursor_id = 0;
+      if (had_cursor && errno == EPROTO)
+	return 0;
+      return -1;
+    }
+
+  /* Empty replies carry the cursor too, even the first one: losing
+     it would leak a cursor on the server with every retry. */
+  mongo_wire_reply_packet_get_header (p, &rh);
+  if (rh.flags & MONGO_REPLY_FLAG_NO_CURSOR)
+    {
+      /* The server forgot the cursor, so there is nothing to kill. */
+      mongo_wire_packet_free (p);
+      tailer->cursor_id = 0;
+      return 0;
+    }
+  tailer->cursor_id = rh.cursor_id;
+
+  n = _mongo_sync_tailer_deliver (tailer, p, rh.returned, func, user_data);
+  mongo_wire_packet_free (p);
+
+  if (n < 0)
+    {
+      errno = ECANCELED;
+      return -1;
+    }
+  return n;
+}
+
+gboolean
+mongo_sync_tailer_run (mongo_sync_tailer *tailer,
+		       mongo_sync_tailer_func func, gpointer user_data)
+{
+  gint backoff = 0;
+
+  if (!tailer || !func)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  for (;;)
+    {
+      gint n = mongo_sync_tailer_poll (tailer, func, user_data);
+
+      if (n < 0)
+	return FALSE;
+      if (n > 0)
+	backoff = 0;
+
+      /* With a live cursor, the server waits for new entries itself;
+	 without one, there is nothing to tail yet, so back off. */
+      if (n == 0 && tailer->cursor_id == 0)
+	{
+	  backoff = (backoff == 0) ? MONGO_SYNC_TAILER_MIN_BACKOFF :
+	    MIN (backoff * 2, MONGO_SYNC_TAILER_MAX_BACKOFF);
+	  g_usleep (backoff * 1000);
+	}
+    }
+}
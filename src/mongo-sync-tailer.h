@@ -0,0 +1,180 @@
+/* mongo-sync-tailer.h - libmongo-client oplog tailer API
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-tailer.h
+ * MongoDB oplog and capped collection tailer API public header.
+ *
+ * @addtogroup mongo_sync
+ * @{
+ */
+
+#ifndef LIBMONGO_SYNC_TAILER_H
+#define LIBMONGO_SYNC_TAILER_H 1
+
+#include <mongo-sync.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** @defgroup mongo_sync_tailer_api Mongo Sync Tailer API
+ *
+ * A tailer follows the oplog, or any other capped collection whose
+ * entries carry an increasing "ts" timestamp, and hands new entries
+ * to a callback as they arrive.
+ *
+ * The tailer reads with a tailable, await-data cursor, so that the
+ * server holds empty requests open until new entries arrive, instead
+ * of the client polling for them. Every entry is remembered by its
+ * timestamp, and whenever the cursor dies, the tailer queries again
+ * from the last timestamp it saw, skipping the entries already
+ * delivered. When there is nothing to tail yet, it backs off
+ * exponentially, from #MONGO_SYNC_TAILER_MIN_BACKOFF to
+ * #MONGO_SYNC_TAILER_MAX_BACKOFF milliseconds.
+ *
+ * @note The server holds await-data requests open for a few seconds,
+ * so the receive timeout of the connection, if any, must be longer
+ * than that.
+ *
+ * @addtogroup mongo_sync_tailer_api
+ * @{
+ */
+
+/** Opaque tailer object. */
+typedef struct _mongo_sync_tailer mongo_sync_tailer;
+
+/** The shortest time to back off for, in milliseconds. */
+#define MONGO_SYNC_TAILER_MIN_BACKOFF 10
+/** The longest time to back off for, in milliseconds. */
+#define MONGO_SYNC_TAILER_MAX_BACKOFF 1000
+
+/** Callback to deliver tailed entries with.
+ *
+ * @param entries are the new entries, in the order the server
+ * returned them. They are only valid until the callback returns.
+ * @param n is the number of entries.
+ * @param user_data is the user data passed to the tailer function.
+ *
+ * @returns TRUE to keep tailing, FALSE to stop.
+ */
+typedef gboolean (*mongo_sync_tailer_func) (const bson **entries, gint n,
+					    gpointer user_data);
+
+/** Create a new tailer.
+ *
+ * If @a ns is an oplog (its collection starts with "oplog."), the
+ * tailer sets the OplogReplay flag on its queries.
+ *
+ * @param conn is the connection to tail over. Owned by the caller,
+ * and must not be used for anything else while the tailer is alive.
+ * @param ns is the namespace to tail.
+ * @param query is an optional query to filter the entries with, or
+ * NULL. Any condition on ts is replaced once the tailer resumes.
+ *
+ * @returns A newly allocated tailer, or NULL on error. Free it with
+ * mongo_sync_tailer_free().
+ */
+mongo_sync_tailer *mongo_sync_tailer_new (mongo_sync_connection *conn,
+					  const gchar *ns,
+					  const bson *query);
+
+/** Free a tailer.
+ *
+ * Queues the cursor of the tailer for killing, if it is still alive,
+ * the same way mongo_sync_cursor_free() does.
+ *
+ * @param tailer is the tailer to free.
+ */
+void mongo_sync_tailer_free (mongo_sync_tailer *tailer);
+
+/** Set whether the tailer uses the OplogReplay flag.
+ *
+ * @param tailer is the tailer to change.
+ * @param replay is whether to set the flag.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_tailer_set_oplog_replay (mongo_sync_tailer *tailer,
+					     gboolean replay);
+
+/** Set the timestamp to resume tailing from.
+ *
+ * Entries up to, and including @a ts, will not be delivered. The
+ * change takes effect the next time the tailer queries.
+ *
+ * @param tailer is the tailer to change.
+ * @param ts is the timestamp of the last entry already processed, in
+ * the same format as bson_cursor_get_timestamp() returns.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_tailer_set_start (mongo_sync_tailer *tailer,
+				      gint64 ts);
+
+/** Get the timestamp of the last entry delivered.
+ *
+ * Store this value to resume from later, with
+ * mongo_sync_tailer_set_start().
+ *
+ * @param tailer is the tailer to query.
+ * @param ts is where the timestamp will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise, in which case errno is
+ * set to ENOENT if no entry with a timestamp was seen yet.
+ */
+gboolean mongo_sync_tailer_get_last (mongo_sync_tailer *tailer,
+				     gint64 *ts);
+
+/** Fetch and deliver the next batch of entries.
+ *
+ * Issues a single request: the query if the tailer has no live
+ * cursor, or a getmore otherwise, which the server holds open for a
+ * while if there are no new entries. Whatever arrives is delivered to
+ * @a func in one batch.
+ *
+ * @param tailer is the tailer to poll.
+ * @param func is the function to deliver the entries to.
+ * @param user_data is passed on to @a func as-is.
+ *
+ * @returns The number of entries delivered, or -1 on error, in which
+ * case errno is set to ECANCELED if @a func asked to stop.
+ */
+gint mongo_sync_tailer_poll (mongo_sync_tailer *tailer,
+			     mongo_sync_tailer_func func,
+			     gpointer user_data);
+
+/** Tail until told to stop.
+ *
+ * Polls the tailer in a loop, backing off whenever there is nothing
+ * to tail, and resuming whenever the cursor dies.
+ *
+ * @param tailer is the tailer to run.
+ * @param func is the function to deliver the entries to.
+ * @param user_data is passed on to @a func as-is.
+ *
+ * @returns FALSE, once @a func asked to stop, in which case errno is
+ * set to ECANCELED, or on error.
+ */
+gboolean mongo_sync_tailer_run (mongo_sync_tailer *tailer,
+				mongo_sync_tailer_func func,
+				gpointer user_data);
+
+/** @} */
+
+/** @} */
+
+G_END_DECLS
+
+#endif
@@ -26,17 +26,24 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 
-mongo_sync_connection *
-mongo_sync_connect (const gchar *address, gint port,
-		    gboolean slaveok)
+#define _SLAVE_FLAG(c) ((c->slaveok) ? MONGO_WIRE_FLAG_QUERY_SLAVE_OK : 0)
+
+/** @internal How long discovery keeps waiting for a preferred member
+ * once a fallback answered, in round-trip times of the fallback. */
+#define MONGO_SYNC_RS_FALLBACK_RTTS 4
+
+/** @internal The least time discovery keeps waiting for a preferred
+ * member once a fallback answered, in milliseconds. */
+#define MONGO_SYNC_RS_FALLBACK_MIN_WAIT 50
+
+static mongo_sync_connection *
+_mongo_sync_connection_new (mongo_connection *c, const gchar *address,
+			    gint port, gboolean slaveok)
 {
   mongo_sync_connection *s;
-  mongo_connection *c;
 
-  c = mongo_connect (address, port);
-  if (!c)
-    return NULL;
   s = g_realloc (c, sizeof (mongo_sync_connection));
 
   s->slaveok = slaveok;
@@ -45,12 +52,42 @@ mongo_sync_connect (const gchar *address, gint port,
   s->rs.seeds = g_list_append (NULL, g_strdup_printf ("%s:%d", address, port));
   s->rs.hosts = NULL;
   s->rs.primary = NULL;
+  s->rs.members = NULL;
   s->last_error = NULL;
   s->max_insert_size = MONGO_SYNC_DEFAULT_MAX_INSERT_SIZE;
+  s->monitor = NULL;
+  mongo_sync_read_preference_init (&s->read_pref,
+				   MONGO_SYNC_READ_PRIMARY_PREFERRED);
+  s->address = g_strdup (s->rs.seeds->data);
+  s->exhaust.active = FALSE;
+  s->exhaust.cursor_id = 0;
+  s->prefetching = FALSE;
+  s->kills = NULL;
+  memset (&s->hedge, 0, sizeof (s->hedge));
 
   return s;
 }
 
+mongo_sync_connection *
+mongo_sync_connect_with_options (const gchar *address, gint port,
+				 gboolean slaveok,
+				 const mongo_connection_options *opts)
+{
+  mongo_connection *c;
+
+  c = mongo_connect_with_options (address, port, opts);
+  if (!c)
+    return NULL;
+  return _mongo_sync_connection_new (c, address, port, slaveok);
+}
+
+mongo_sync_connection *
+mongo_sync_connect (const gchar *address, gint port,
+		    gboolean slaveok)
+{
+  return mongo_sync_connect_with_options (address, port, slaveok, NULL);
+}
+
 mongo_sync_connection *
 mongo_sync_connect_0_1_0 (const gchar *host, gint port,
                           gboolean slaveok)
@@ -82,6 +119,105 @@ mongo_sync_conn_seed_add (mongo_sync_connection *conn,
   return TRUE;
 }
 
+/** @internal Drop the hedge connection of a sync connection. */
+static void
+_mongo_sync_hedge_drop (mongo_sync_connection *conn)
+{
+  if (conn->hedge.conn)
+    mongo_disconnect (conn->hedge.conn);
+  conn->hedge.conn = NULL;
+  conn->hedge.pending = FALSE;
+  g_free (conn->hedge.address);
+  conn->hedge.address = NULL;
+}
+
+/** @internal Collect the reply of a hedged read that lost.
+ *
+ * Waits at most @a wait milliseconds for the reply due on the hedge
+ * connection, and kills the cursor it opened, if any. Closes the
+ * hedge connection if it broke.
+ *
+ * @returns TRUE if no reply is due anymore, FALSE otherwise.
+ */
+static gboolean
+_mongo_sync_hedge_drain (mongo_sync_connection *conn, gint wait)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  struct pollfd pfd;
+  mongo_packet *p;
+  gint r;
+
+  if (!conn->hedge.conn || !conn->hedge.pending)
+    return TRUE;
+
+  pfd.fd = conn->hedge.conn->fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  do
+    r = poll (&pfd, 1, wait);
+  while (r < 0 && errno == EINTR);
+  if (r == 0)
+    return FALSE;
+
+  p = (r > 0) ? mongo_packet_recv (conn->hedge.conn) : NULL;
+  if (p && mongo_wire_packet_get_header_raw (p, &h) &&
+      h.resp_to == conn->hedge.pending_rid &&
+      mongo_wire_reply_packet_get_header (p, &rh))
+    {
+      conn->hedge.pending = FALSE;
+      mongo_wire_packet_free (p);
+
+      if (rh.cursor_id == 0)
+	return TRUE;
+
+      p = mongo_wire_cmd_kill_cursors
+	(mongo_connection_get_requestid (conn->hedge.conn) + 1, 1,
+	 rh.cursor_id);
+      r = mongo_packet_send (conn->hedge.conn, p);
+      mongo_wire_packet_free (p);
+      if (r)
+	return TRUE;
+    }
+  else if (p)
+    mongo_wire_packet_free (p);
+
+  _mongo_sync_hedge_drop (conn);
+  return TRUE;
+}
+
+/** @internal Close the hedge connection of a sync connection.
+ *
+ * Gives the reply still due on it at most @a wait milliseconds to
+ * arrive, so the cursor it opened can be killed.
+ */
+static void
+_mongo_sync_hedge_close (mongo_sync_connection *conn, gint wait)
+{
+  _mongo_sync_hedge_drain (conn, wait);
+  _mongo_sync_hedge_drop (conn);
+}
+
+/** @internal Kill the queued cursors of a connection before its
+ * socket is closed.
+ *
+ * The cursor of an exhaust stream still running is killed too, and a
+ * prefetched batch still in flight is lost with the socket. The
+ * cursors that could not be killed stay queued, to be killed with the
+ * next write, if there is one.
+ */
+static void
+_mongo_sync_conn_kill_on_close (mongo_sync_connection *conn)
+{
+  conn->prefetching = FALSE;
+  if (conn->exhaust.active)
+    {
+      conn->exhaust.active = FALSE;
+      mongo_sync_conn_defer_kill (conn, conn->exhaust.cursor_id);
+    }
+  mongo_sync_conn_flush_cursor_kills (conn);
+}
+
 static void
 _mongo_sync_connect_replace (mongo_sync_connection *old,
 			     mongo_sync_connection *new)
@@ -102,10 +238,25 @@ _mongo_sync_connect_replace (mongo_sync_connection *old,
     }
   old->rs.hosts = NULL;
 
+  /* The hedge may well be the member we are moving to. */
+  _mongo_sync_hedge_close (old, 0);
+  g_free (old->address);
+  old->address = new->address;
+  new->address = NULL;
+
+  /* Server side cursors outlive the connection they were opened on,
+     so they are killed over the old socket while it is still open,
+     or failing that, over the new one. */
+  _mongo_sync_conn_kill_on_close (old);
+
+  mongo_connection_zerocopy_finish (&old->super);
   if (old->super.fd)
     close (old->super.fd);
 
   old->super.fd = new->super.fd;
+  if (old->super.zerocopy.threshold > 0)
+    mongo_connection_set_zerocopy (&old->super,
+				   old->super.zerocopy.threshold);
   old->super.request_id = -1;
   old->slaveok = new->slaveok;
   old->rs.primary = NULL;
@@ -127,113 +278,790 @@ _mongo_sync_connect_replace (mongo_sync_connection *old,
       l = g_list_delete_link (l, l);
     }
   g_free (new->rs.primary);
+  if (new->rs.members)
+    g_hash_table_destroy (new->rs.members);
   g_free (new->last_error);
   g_free (new);
 }
 
-mongo_sync_connection *
-mongo_sync_reconnect (mongo_sync_connection *conn,
-		      gboolean force_master)
+/** @internal Free a replica set member. */
+static void
+_mongo_sync_rs_member_free (mongo_sync_rs_member *member)
 {
-  gboolean ping = FALSE;
-  guint i;
-  mongo_sync_connection *nc;
-  gchar *host;
-  gint port;
+  g_free (member->address);
+  g_free (member);
+}
+
+/** @internal Look up a replica set member, adding it if not known
+ * yet.
+ */
+static mongo_sync_rs_member *
+_mongo_sync_rs_member_get (mongo_sync_connection *conn,
+			   const gchar *address)
+{
+  mongo_sync_rs_member *member;
+
+  if (!conn->rs.members)
+    conn->rs.members = g_hash_table_new_full
+      (g_str_hash, g_str_equal, NULL,
+       (GDestroyNotify)_mongo_sync_rs_member_free);
+
+  member = g_hash_table_lookup (conn->rs.members, address);
+  if (member)
+    return member;
+
+  member = g_new0 (mongo_sync_rs_member, 1);
+  member->address = g_strdup (address);
+  member->rtt = -1;
+  member->last_write = -1;
+  member->lag = -1;
+  g_hash_table_insert (conn->rs.members, member->address, member);
+
+  return member;
+}
+
+gint64
+mongo_sync_conn_get_member_rtt (const mongo_sync_connection *conn,
+				const gchar *member)
+{
+  mongo_sync_rs_member *m = NULL;
+  mongo_sync_member_info info;
 
   if (!conn)
     {
       errno = ENOTCONN;
-      return NULL;
+      return -1;
+    }
+  if (!member)
+    {
+      errno = EINVAL;
+      return -1;
     }
 
-  ping = mongo_sync_cmd_ping (conn);
+  if (conn->monitor &&
+      mongo_sync_monitor_get_member (conn->monitor, member, &info) &&
+      info.rtt >= 0)
+    return info.rtt;
 
-  if (ping)
+  if (conn->rs.members)
+    m = g_hash_table_lookup (conn->rs.members, member);
+  if (!m || m->rtt < 0)
     {
-      if (!force_master)
-	return conn;
-      if (force_master && mongo_sync_cmd_is_master (conn))
-	return conn;
+      errno = ENOENT;
+      return -1;
+    }
+  return m->rtt;
+}
+
+/** @internal Parse an ismaster reply.
+ *
+ * @param p is the reply packet.
+ * @param master is set to whether the replying node is a primary.
+ * @param secondary is set to whether the replying node is a
+ * secondary.
+ * @param primary is set to a newly allocated copy of the primary
+ * reported by a secondary, or NULL.
+ * @param hosts is set to a newly allocated list of the members
+ * (including passives) of the set, or NULL if the reply had none.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_mongo_sync_is_master_parse (const mongo_packet *p, gboolean *master,
+			     gboolean *secondary, gchar **primary,
+			     GList **hosts)
+{
+  bson *res, *members;
+  bson_cursor *c;
+  const gchar *s;
+
+  *secondary = FALSE;
+  *primary = NULL;
+  *hosts = NULL;
 
-      /* Force refresh the host list. */
-      mongo_sync_cmd_is_master (conn);
+  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &res))
+    return FALSE;
+  bson_finish (res);
+
+  c = bson_find (res, "ismaster");
+  if (!bson_cursor_get_boolean (c, master))
+    {
+      bson_cursor_free (c);
+      bson_free (res);
+      errno = EPROTO;
+      return FALSE;
     }
+  bson_cursor_free (c);
 
-  /* We either didn't ping, or we're not master, and have to
-   * reconnect.
-   *
-   * First, check if we have a primary, and if we can connect there.
-   */
+  if (!*master)
+    {
+      c = bson_find (res, "secondary");
+      if (!bson_cursor_get_boolean (c, secondary))
+	*secondary = FALSE;
+      bson_cursor_free (c);
+
+      /* We're not the master, so we should have a 'primary' key in
+	 the response. */
+      c = bson_find (res, "primary");
+      if (bson_cursor_get_string (c, &s))
+	*primary = g_strdup (s);
+      bson_cursor_free (c);
+    }
+
+  /* Find all the members of the set. */
+  c = bson_find (res, "hosts");
+  if (!bson_cursor_get_array (c, &members))
+    {
+      bson_cursor_free (c);
+      bson_free (res);
+      return TRUE;
+    }
+  bson_cursor_free (c);
+  bson_finish (members);
+
+  c = bson_cursor_new (members);
+  while (bson_cursor_next (c))
+    if (bson_cursor_get_string (c, &s))
+      *hosts = g_list_append (*hosts, g_strdup (s));
+  bson_cursor_free (c);
+  bson_free (members);
+
+  c = bson_find (res, "passives");
+  if (bson_cursor_get_array (c, &members))
+    {
+      bson_cursor_free (c);
+      bson_finish (members);
+
+      c = bson_cursor_new (members);
+      while (bson_cursor_next (c))
+	if (bson_cursor_get_string (c, &s))
+	  *hosts = g_list_append (*hosts, g_strdup (s));
+      bson_free (members);
+    }
+  bson_cursor_free (c);
+
+  bson_free (res);
+  return TRUE;
+}
+
+/** @internal Map the flags of an ismaster reply to a member role. */
+static mongo_sync_member_role
+_mongo_sync_member_role (gboolean master, gboolean secondary)
+{
+  if (master)
+    return MONGO_SYNC_MEMBER_PRIMARY;
+  return (secondary) ? MONGO_SYNC_MEMBER_SECONDARY : MONGO_SYNC_MEMBER_OTHER;
+}
+
+/** @internal Update the replica set state of a connection from a
+ * parsed ismaster reply.
+ *
+ * Takes ownership of @a primary and @a hosts.
+ */
+static void
+_mongo_sync_is_master_update (mongo_sync_connection *conn,
+			      gchar *primary, GList *hosts)
+{
+  GList *l;
+
+  if (primary)
+    {
+      g_free (conn->rs.primary);
+      conn->rs.primary = primary;
+    }
+
+  if (!hosts)
+    return;
+
+  /* Delete the old host list. */
+  l = conn->rs.hosts;
+  while (l)
+    {
+      g_free (l->data);
+      l = g_list_delete_link (l, l);
+    }
+  conn->rs.hosts = hosts;
+}
+
+/** @internal Free the primary and the host list parsed from an
+ * ismaster reply.
+ */
+static void
+_mongo_sync_free_hosts (gchar *primary, GList *hosts)
+{
+  g_free (primary);
+  while (hosts)
+    {
+      g_free (hosts->data);
+      hosts = g_list_delete_link (hosts, hosts);
+    }
+}
+
+/** @internal Check whether a read preference mode accepts a member.
+ *
+ * @param mode is the read preference mode.
+ * @param master signals whether the member is a primary.
+ * @param secondary signals whether the member is a secondary.
+ * @param fallback signals whether to check the fallback of the mode
+ * (the secondaries for #MONGO_SYNC_READ_PRIMARY_PREFERRED, and the
+ * primary for #MONGO_SYNC_READ_SECONDARY_PREFERRED) instead of its
+ * preferred members.
+ */
+static gboolean
+_mongo_sync_read_mode_accepts (mongo_sync_read_mode mode, gboolean master,
+			       gboolean secondary, gboolean fallback)
+{
+  switch (mode)
+    {
+    case MONGO_SYNC_READ_PRIMARY:
+      return (!fallback && master);
+    case MONGO_SYNC_READ_PRIMARY_PREFERRED:
+      return (fallback) ? secondary : master;
+    case MONGO_SYNC_READ_SECONDARY:
+      return (!fallback && secondary);
+    case MONGO_SYNC_READ_SECONDARY_PREFERRED:
+      return (fallback) ? master : secondary;
+    case MONGO_SYNC_READ_NEAREST:
+      return (!fallback && (master || secondary));
+    }
+  return FALSE;
+}
+
+void
+mongo_sync_probe_stop (mongo_sync_probe *probe)
+{
+  if (probe->fd != -1)
+    close (probe->fd);
+  probe->fd = -1;
+  probe->state = MONGO_SYNC_PROBE_DONE;
+}
+
+/** @internal Start connecting a probe to the next address of its
+ * host.
+ */
+static void
+_mongo_sync_probe_connect (mongo_sync_probe *probe,
+			   const mongo_connection_options *opts,
+			   gsize reqlen)
+{
+  gboolean pending;
+
+  mongo_sync_probe_stop (probe);
+
+  while (probe->cands && probe->cand < probe->cands->len)
+    {
+      probe->fd = mongo_connect_candidate_start
+	(&g_array_index (probe->cands, mongo_connect_candidate,
+			 probe->cand++), opts, &pending);
+      if (probe->fd == -1)
+	continue;
+
+      probe->state = (pending) ? MONGO_SYNC_PROBE_CONNECTING :
+	MONGO_SYNC_PROBE_SENDING;
+      probe->len = reqlen;
+      probe->done = 0;
+      return;
+    }
+}
+
+mongo_sync_probe *
+mongo_sync_probe_new (const gchar *address, gint fd,
+		      const mongo_connection_options *opts, gsize reqlen)
+{
+  mongo_sync_probe *probe;
+
+  probe = g_new0 (mongo_sync_probe, 1);
+  probe->address = g_strdup (address);
+  probe->fd = -1;
+  probe->state = MONGO_SYNC_PROBE_DONE;
+
+  /* Unparsable and unresolvable hosts are kept as finished probes, so
+     they are not retried. */
+  if (!mongo_util_parse_addr (address, &probe->host, &probe->port))
+    {
+      if (fd != -1)
+	close (fd);
+      return probe;
+    }
+
+  if (fd != -1)
+    {
+      probe->fd = fd;
+      probe->state = MONGO_SYNC_PROBE_SENDING;
+      probe->len = reqlen;
+      probe->done = 0;
+      return probe;
+    }
+
+  probe->cands = mongo_connect_resolve (probe->host, probe->port, 0);
+  _mongo_sync_probe_connect (probe, opts, reqlen);
+  return probe;
+}
+
+guint8 *
+mongo_sync_probe_request (gint32 flags, gsize *reqlen)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  const guint8 *data;
+  guint8 *req;
+  gint32 size;
+  bson *cmd;
+
+  cmd = bson_new_sized (32);
+  bson_append_int32 (cmd, "ismaster", 1);
+  bson_finish (cmd);
+  p = mongo_wire_cmd_custom (1, "system", flags, cmd);
+  bson_free (cmd);
+  if (!p)
+    return NULL;
+
+  mongo_wire_packet_get_header_raw (p, &h);
+  size = mongo_wire_packet_get_data (p, &data);
+  *reqlen = sizeof (mongo_packet_header) + size;
+  req = g_malloc (*reqlen);
+  memcpy (req, &h, sizeof (mongo_packet_header));
+  memcpy (req + sizeof (mongo_packet_header), data, size);
+  mongo_wire_packet_free (p);
+
+  return req;
+}
+
+/** @internal Add a probe for a member, unless it is probed already. */
+static void
+_mongo_sync_probe_add (GPtrArray *probes, const gchar *address,
+		       const mongo_connection_options *opts, gsize reqlen)
+{
+  guint i;
+
+  for (i = 0; i < probes->len; i++)
+    if (strcmp (((mongo_sync_probe *)g_ptr_array_index (probes, i))->address,
+		address) == 0)
+      return;
+
+  g_ptr_array_add (probes, mongo_sync_probe_new (address, -1, opts, reqlen));
+}
+
+void
+mongo_sync_probe_free (mongo_sync_probe *probe)
+{
+  mongo_sync_probe_stop (probe);
+  if (probe->cands)
+    g_array_free (probe->cands, TRUE);
+  g_free (probe->data);
+  g_free (probe->host);
+  g_free (probe->address);
+  g_free (probe);
+}
+
+mongo_packet *
+mongo_sync_probe_step (mongo_sync_probe *probe,
+			const guint8 *req, gsize reqlen,
+			const mongo_connection_options *opts,
+			GTimer *timer)
+{
+  mongo_packet *p;
+  gssize n;
+  gint32 id;
+  int err = 0;
+  socklen_t errlen = sizeof (err);
 
+  switch (probe->state)
+    {
+    case MONGO_SYNC_PROBE_CONNECTING:
+      if (getsockopt (probe->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0 ||
+	  err != 0)
+	{
+	  _mongo_sync_probe_connect (probe, opts, reqlen);
+	  return NULL;
+	}
+      probe->state = MONGO_SYNC_PROBE_SENDING;
+      /* Fall through - the socket is writable, so send right away. */
+
+    case MONGO_SYNC_PROBE_SENDING:
+      n = send (probe->fd, req + probe->done, reqlen - probe->done,
+		MSG_NOSIGNAL);
+      if (n < 0)
+	{
+	  if (errno != EAGAIN && errno != EINTR)
+	    mongo_sync_probe_stop (probe);
+	  return NULL;
+	}
+      probe->done += n;
+      if (probe->done < reqlen)
+	return NULL;
+
+      probe->sent = g_timer_elapsed (timer, NULL);
+      probe->state = MONGO_SYNC_PROBE_RECEIVING;
+      probe->len = sizeof (mongo_packet_header);
+      probe->done = 0;
+      return NULL;
+
+    case MONGO_SYNC_PROBE_RECEIVING:
+      if (probe->data)
+	n = recv (probe->fd, probe->data + probe->done,
+		  probe->len - probe->done, 0);
+      else
+	n = recv (probe->fd, (guint8 *)&probe->h + probe->done,
+		  probe->len - probe->done, 0);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+	{
+	  mongo_sync_probe_stop (probe);
+	  return NULL;
+	}
+      if (n < 0)
+	return NULL;
+      probe->done += n;
+      if (probe->done < probe->len)
+	return NULL;
+
+      if (!probe->data)
+	{
+	  probe->h.length = GINT32_FROM_LE (probe->h.length);
+	  probe->h.id = GINT32_FROM_LE (probe->h.id);
+	  probe->h.resp_to = GINT32_FROM_LE (probe->h.resp_to);
+	  probe->h.opcode = GINT32_FROM_LE (probe->h.opcode);
+
+	  memcpy (&id, req + G_STRUCT_OFFSET (mongo_packet_header, id),
+		  sizeof (id));
+
+	  /* Anything but the answer to our request, or a reply no
+	     server would send, rules the member out. */
+	  if (probe->h.resp_to != GINT32_FROM_LE (id) ||
+	      probe->h.length <= (gint32)sizeof (mongo_packet_header) ||
+	      probe->h.length > MONGO_WIRE_MAX_MESSAGE_SIZE)
+	    {
+	      mongo_sync_probe_stop (probe);
+	      return NULL;
+	    }
+	  probe->len = probe->h.length - sizeof (mongo_packet_header);
+	  probe->data = g_malloc (probe->len);
+	  probe->done = 0;
+	  return NULL;
+	}
+
+      p = mongo_wire_packet_new ();
+      if (!mongo_wire_packet_set_header_raw (p, &probe->h) ||
+	  !mongo_wire_packet_set_data (p, probe->data, probe->len))
+	{
+	  mongo_wire_packet_free (p);
+	  p = NULL;
+	}
+      g_free (probe->data);
+      probe->data = NULL;
+      return p;
+
+    case MONGO_SYNC_PROBE_DONE:
+      break;
+    }
+  return NULL;
+}
+
+/** @internal Find a member to connect to, probing all known members
+ * in parallel.
+ *
+ * An ismaster command is sent to every known member (the primary,
+ * the hosts and the seeds) at once, and members reported by the
+ * replies are probed too, as they are discovered. The round-trip time
+ * of every member that answers is recorded. The first member the
+ * read preference mode of the connection prefers wins (a primary, if
+ * @a force_master is set). If none of those answer, the first one the
+ * mode merely accepts is used.
+ *
+ * The whole discovery is bounded by the connect timeout of the
+ * connection. Once a fallback answered, the wait for a preferred
+ * member is bounded by a few round-trip times of the fallback too, so
+ * an unresponsive member cannot stall the discovery.
+ *
+ * @returns The connection on success, with the socket replaced, NULL
+ * otherwise.
+ */
+static mongo_sync_connection *
+_mongo_sync_rs_discover (mongo_sync_connection *conn,
+			 gboolean force_master)
+{
+  const mongo_connection_options *opts = &conn->super.options;
+  GPtrArray *probes;
+  mongo_sync_probe *winner = NULL, *fallback = NULL;
+  gchar *winner_primary = NULL, *fallback_primary = NULL;
+  GList *winner_hosts = NULL, *fallback_hosts = NULL, *l;
+  mongo_sync_read_mode mode = (force_master) ? MONGO_SYNC_READ_PRIMARY :
+    conn->read_pref.mode;
+  struct pollfd *pfds = NULL;
+  guint *idx = NULL;
+  guint8 *req;
+  gsize reqlen;
+  GTimer *timer;
+  gdouble fallback_until = 0;
+  mongo_packet *p;
+  guint i, n, alloc = 0;
+
+  req = mongo_sync_probe_request (_SLAVE_FLAG (conn), &reqlen);
+  if (!req)
+    return NULL;
+
+  timer = g_timer_new ();
+
+  probes = g_ptr_array_new ();
   if (conn->rs.primary)
+    _mongo_sync_probe_add (probes, conn->rs.primary, opts, reqlen);
+  for (l = conn->rs.hosts; l; l = g_list_next (l))
+    _mongo_sync_probe_add (probes, (gchar *)l->data, opts, reqlen);
+  for (l = conn->rs.seeds; l; l = g_list_next (l))
+    _mongo_sync_probe_add (probes, (gchar *)l->data, opts, reqlen);
+
+  while (!winner)
     {
-      if (mongo_util_parse_addr (conn->rs.primary, &host, &port))
+      gint timeout = -1, r;
+
+      if (alloc < probes->len)
+	{
+	  alloc = probes->len;
+	  pfds = g_renew (struct pollfd, pfds, alloc);
+	  idx = g_renew (guint, idx, alloc);
+	}
+
+      n = 0;
+      for (i = 0; i < probes->len; i++)
+	{
+	  mongo_sync_probe *probe = g_ptr_array_index (probes, i);
+
+	  if (probe->state == MONGO_SYNC_PROBE_DONE)
+	    continue;
+	  pfds[n].fd = probe->fd;
+	  pfds[n].events = (probe->state == MONGO_SYNC_PROBE_RECEIVING) ?
+	    POLLIN : POLLOUT;
+	  pfds[n].revents = 0;
+	  idx[n++] = i;
+	}
+      if (n == 0)
+	break;
+
+      if (opts->connect_timeout > 0)
 	{
-	  nc = mongo_sync_connect (host, port, conn->slaveok);
-	  g_free (host);
-	  if (nc)
+	  timeout = opts->connect_timeout -
+	    (gint)(g_timer_elapsed (timer, NULL) * 1000);
+	  if (timeout <= 0)
+	    break;
+	}
+      if (fallback)
+	{
+	  gint wait = (gint)((fallback_until -
+			      g_timer_elapsed (timer, NULL)) * 1000);
+
+	  if (wait <= 0)
+	    break;
+	  if (timeout < 0 || wait < timeout)
+	    timeout = wait;
+	}
+
+      r = poll (pfds, n, timeout);
+      if (r < 0 && errno != EINTR)
+	break;
+
+      for (i = 0; i < n && r > 0 && !winner; i++)
+	{
+	  mongo_sync_probe *probe = g_ptr_array_index (probes, idx[i]);
+	  mongo_sync_rs_member *member;
+	  gboolean master, secondary;
+	  gchar *primary;
+	  GList *hosts;
+
+	  if (!pfds[i].revents)
+	    continue;
+
+	  p = mongo_sync_probe_step (probe, req, reqlen, opts, timer);
+	  if (!p)
+	    continue;
+
+	  member = _mongo_sync_rs_member_get (conn, probe->address);
+	  member->rtt =
+	    (gint64)((g_timer_elapsed (timer, NULL) - probe->sent) * 1000000);
+
+	  if (!_mongo_sync_is_master_parse (p, &master, &secondary,
+					    &primary, &hosts))
 	    {
-	      int e;
+	      mongo_wire_packet_free (p);
+	      mongo_sync_probe_stop (probe);
+	      continue;
+	    }
+	  mongo_wire_packet_free (p);
+	  member->role = _mongo_sync_member_role (master, secondary);
 
-	      /* We can call ourselves here, since connect does not set
-		 conn->rs, thus, we won't end up in an infinite loop. */
-	      nc = mongo_sync_reconnect (nc, force_master);
-	      e = errno;
-	      _mongo_sync_connect_replace (conn, nc);
-	      errno = e;
-	      return conn;
+	  /* Probe the members we did not know about yet. */
+	  if (primary)
+	    _mongo_sync_probe_add (probes, primary, opts, reqlen);
+	  for (l = hosts; l; l = g_list_next (l))
+	    _mongo_sync_probe_add (probes, (gchar *)l->data, opts, reqlen);
+
+	  if (_mongo_sync_read_mode_accepts (mode, master, secondary, FALSE))
+	    {
+	      winner = probe;
+	      winner_primary = primary;
+	      winner_hosts = hosts;
+	      break;
 	    }
+	  if (!fallback &&
+	      _mongo_sync_read_mode_accepts (mode, master, secondary, TRUE))
+	    {
+	      /* Keep the socket, in case nothing better answers. */
+	      fallback = probe;
+	      fallback->state = MONGO_SYNC_PROBE_DONE;
+	      fallback_primary = primary;
+	      fallback_hosts = hosts;
+	      fallback_until = g_timer_elapsed (timer, NULL) +
+		MAX (MONGO_SYNC_RS_FALLBACK_RTTS * (member->rtt / 1000000.0),
+		     MONGO_SYNC_RS_FALLBACK_MIN_WAIT / 1000.0);
+	      continue;
+	    }
+
+	  mongo_sync_probe_stop (probe);
+	  _mongo_sync_free_hosts (primary, hosts);
 	}
     }
 
-  /* No primary found, or we couldn't connect, try the rest of the
-     hosts. */
+  if (!winner && fallback)
+    {
+      winner = fallback;
+      winner_primary = fallback_primary;
+      winner_hosts = fallback_hosts;
+    }
+  else if (fallback)
+    _mongo_sync_free_hosts (fallback_primary, fallback_hosts);
+
+  g_free (pfds);
+  g_free (idx);
+  g_free (req);
+  g_timer_destroy (timer);
 
-  for (i = 0; i < g_list_length (conn->rs.hosts); i++)
+  if (winner)
     {
-      gchar *addr = (gchar *)g_list_nth_data (conn->rs.hosts, i);
-      int e;
+      mongo_connection *c;
 
-      if (!mongo_util_parse_addr (addr, &host, &port))
-	continue;
+      c = mongo_connection_new_from_fd
+	(winner->fd, g_array_index (winner->cands, mongo_connect_candidate,
+				    winner->cand - 1).family != AF_UNIX,
+	 opts);
+      winner->fd = -1;
 
-      nc = mongo_sync_connect (host, port, conn->slaveok);
-      g_free (host);
-      if (!nc)
-	continue;
+      _mongo_sync_connect_replace
+	(conn, _mongo_sync_connection_new (c, winner->host, winner->port,
+					   conn->slaveok));
+      _mongo_sync_is_master_update (conn, winner_primary, winner_hosts);
+    }
 
-      nc = mongo_sync_reconnect (nc, force_master);
-      e = errno;
-      _mongo_sync_connect_replace (conn, nc);
-      errno = e;
-      return conn;
+  for (i = 0; i < probes->len; i++)
+    mongo_sync_probe_free (g_ptr_array_index (probes, i));
+  g_ptr_array_free (probes, TRUE);
+
+  if (!winner)
+    {
+      errno = EHOSTUNREACH;
+      return NULL;
     }
 
-  /* And if that failed too, try the seeds. */
+  errno = 0;
+  return conn;
+}
 
-  for (i = 0; i < g_list_length (conn->rs.seeds); i++)
+/** @internal Reconnect to the member suggested by the topology
+ * monitor of a connection.
+ *
+ * Goes to the primary if @a force_master is set, or to the member the
+ * read preference of the connection selects otherwise.
+ *
+ * @returns The connection on success, with the socket replaced, NULL
+ * otherwise.
+ */
+static mongo_sync_connection *
+_mongo_sync_monitor_reconnect (mongo_sync_connection *conn,
+			       gboolean force_master)
+{
+  const mongo_sync_topology *topology;
+  mongo_sync_read_preference pref = conn->read_pref;
+  mongo_sync_connection *nc = NULL;
+  gchar *address = NULL, *primary, *host;
+  GList *hosts = NULL;
+  gint port, i;
+  guint j;
+
+  if (force_master)
+    pref.mode = MONGO_SYNC_READ_PRIMARY;
+
+  topology = mongo_sync_monitor_topology_acquire (conn->monitor);
+  for (j = 0; j < topology->members->len; j++)
     {
-      gchar *addr = (gchar *)g_list_nth_data (conn->rs.seeds, i);
-      int e;
+      const mongo_sync_rs_member *m = g_ptr_array_index (topology->members,
+							 j);
 
-      if (!mongo_util_parse_addr (addr, &host, &port))
-	continue;
+      if (m->role != MONGO_SYNC_MEMBER_ARBITER)
+	hosts = g_list_append (hosts, g_strdup (m->address));
+    }
+  i = mongo_sync_read_preference_select
+    (&pref, (const mongo_sync_rs_member **)topology->members->pdata,
+     topology->members->len);
+  if (i >= 0)
+    address = g_strdup (((mongo_sync_rs_member *)
+			 g_ptr_array_index (topology->members, i))->address);
+  primary = g_strdup (topology->primary);
+  mongo_sync_monitor_topology_release (conn->monitor, topology);
 
-      nc = mongo_sync_connect (host, port, conn->slaveok);
+  if (address && mongo_util_parse_addr (address, &host, &port))
+    {
+      nc = mongo_sync_connect_with_options (host, port, conn->slaveok,
+					    &conn->super.options);
       g_free (host);
-      if (!nc)
-	continue;
+    }
+  g_free (address);
 
-      nc = mongo_sync_reconnect (nc, force_master);
-      e = errno;
-      _mongo_sync_connect_replace (conn, nc);
-      errno = e;
-      return conn;
+  if (!nc)
+    {
+      g_free (primary);
+      while (hosts)
+	{
+	  g_free (hosts->data);
+	  hosts = g_list_delete_link (hosts, hosts);
+	}
+      return NULL;
     }
 
-  errno = EHOSTUNREACH;
-  return NULL;
+  _mongo_sync_connect_replace (conn, nc);
+  _mongo_sync_is_master_update (conn, primary, hosts);
+
+  errno = 0;
+  return conn;
+}
+
+mongo_sync_connection *
+mongo_sync_reconnect (mongo_sync_connection *conn,
+		      gboolean force_master)
+{
+  gboolean ping = FALSE;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  ping = mongo_sync_cmd_ping (conn);
+
+  if (ping)
+    {
+      if (!force_master)
+	return conn;
+      if (force_master && mongo_sync_cmd_is_master (conn))
+	return conn;
+    }
+
+  /* We either didn't ping, or we're not master, and have to
+   * reconnect. If a monitor keeps track of the set, go where it
+   * points; otherwise (or if that fails), ask every member we know
+   * of at once, and go with the first suitable one that answers.
+   */
+  if (conn->monitor && _mongo_sync_monitor_reconnect (conn, force_master))
+    return conn;
+  return _mongo_sync_rs_discover (conn, force_master);
 }
 
 void
@@ -244,8 +1072,18 @@ mongo_sync_disconnect (mongo_sync_connection *conn)
   if (!conn)
     return;
 
+  _mongo_sync_hedge_close (conn, (conn->super.timeout > 0) ?
+			   conn->super.timeout : 1000);
+  g_free (conn->address);
+
+  _mongo_sync_conn_kill_on_close (conn);
+  if (conn->kills)
+    g_array_free (conn->kills, TRUE);
+
   g_free (conn->rs.primary);
   g_free (conn->last_error);
+  if (conn->rs.members)
+    g_hash_table_destroy (conn->rs.members);
 
   /* Delete the host list. */
   l = conn->rs.hosts;
@@ -380,7 +1218,209 @@ mongo_sync_conn_set_slaveok (mongo_sync_connection *conn,
   return TRUE;
 }
 
-#define _SLAVE_FLAG(c) ((c->slaveok) ? MONGO_WIRE_FLAG_QUERY_SLAVE_OK : 0)
+void
+mongo_sync_read_preference_init (mongo_sync_read_preference *pref,
+				 mongo_sync_read_mode mode)
+{
+  if (!pref)
+    return;
+
+  pref->mode = mode;
+  pref->latency_window = MONGO_SYNC_DEFAULT_LATENCY_WINDOW;
+  pref->max_staleness = 0;
+}
+
+gboolean
+mongo_sync_conn_get_read_preference (const mongo_sync_connection *conn,
+				     mongo_sync_read_preference *pref)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!pref)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  *pref = conn->read_pref;
+  return TRUE;
+}
+
+gboolean
+mongo_sync_conn_set_read_preference (mongo_sync_connection *conn,
+				     const mongo_sync_read_preference *pref)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!pref || pref->mode < MONGO_SYNC_READ_PRIMARY ||
+      pref->mode > MONGO_SYNC_READ_NEAREST ||
+      pref->latency_window < 0 || pref->max_staleness < 0)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  conn->read_pref = *pref;
+  conn->slaveok = (pref->mode != MONGO_SYNC_READ_PRIMARY);
+  return TRUE;
+}
+
+gboolean
+mongo_sync_conn_set_hedged_reads (mongo_sync_connection *conn,
+				  const mongo_sync_hedge_options *opts)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (opts && (opts->delay < 0 || opts->percentile < 0 ||
+	       opts->percentile > 99))
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (!opts)
+    {
+      _mongo_sync_hedge_close (conn, (conn->super.timeout > 0) ?
+			       conn->super.timeout : 1000);
+      conn->hedge.enabled = FALSE;
+      return TRUE;
+    }
+
+  conn->hedge.opts = *opts;
+  conn->hedge.enabled = TRUE;
+  return TRUE;
+}
+
+gboolean
+mongo_sync_conn_get_hedge_stats (const mongo_sync_connection *conn,
+				 mongo_sync_hedge_stats *stats)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!stats)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  *stats = conn->hedge.stats;
+  return TRUE;
+}
+
+/** @internal Check whether a member may be read from. */
+static gboolean
+_mongo_sync_read_preference_eligible (const mongo_sync_read_preference *pref,
+				      const mongo_sync_rs_member *m,
+				      gboolean primary, gboolean secondary)
+{
+  if (m->role == MONGO_SYNC_MEMBER_PRIMARY)
+    return primary;
+  if (m->role != MONGO_SYNC_MEMBER_SECONDARY || !secondary)
+    return FALSE;
+
+  return (pref->max_staleness <= 0 || m->lag < 0 ||
+	  m->lag <= pref->max_staleness);
+}
+
+/** @internal Check whether an eligible member is within the latency
+ * window.
+ *
+ * Members with an unknown round-trip time are only considered if
+ * none of them has a known one, that is, when @a min is negative.
+ */
+static gboolean
+_mongo_sync_read_preference_in_window (const mongo_sync_read_preference *pref,
+				       const mongo_sync_rs_member *m,
+				       gint64 min)
+{
+  if (min < 0)
+    return TRUE;
+  return (m->rtt >= 0 && m->rtt <= min + pref->latency_window * 1000);
+}
+
+/** @internal Pick a random member within the latency window out of
+ * the eligible ones.
+ */
+static gint
+_mongo_sync_read_preference_pick (const mongo_sync_read_preference *pref,
+				  const mongo_sync_rs_member **members,
+				  guint n, gboolean primary,
+				  gboolean secondary)
+{
+  gint64 min = -1;
+  guint i, count = 0, k;
+
+  for (i = 0; i < n; i++)
+    if (_mongo_sync_read_preference_eligible (pref, members[i],
+					      primary, secondary) &&
+	members[i]->rtt >= 0 && (min < 0 || members[i]->rtt < min))
+      min = members[i]->rtt;
+
+  for (i = 0; i < n; i++)
+    if (_mongo_sync_read_preference_eligible (pref, members[i],
+					      primary, secondary) &&
+	_mongo_sync_read_preference_in_window (pref, members[i], min))
+      count++;
+  if (count == 0)
+    return -1;
+
+  k = g_random_int_range (0, count);
+  for (i = 0; i < n; i++)
+    if (_mongo_sync_read_preference_eligible (pref, members[i],
+					      primary, secondary) &&
+	_mongo_sync_read_preference_in_window (pref, members[i], min) &&
+	k-- == 0)
+      break;
+
+  return i;
+}
+
+gint
+mongo_sync_read_preference_select (const mongo_sync_read_preference *pref,
+				   const mongo_sync_rs_member **members,
+				   guint n)
+{
+  gint i = -1;
+
+  switch (pref->mode)
+    {
+    case MONGO_SYNC_READ_PRIMARY:
+      i = _mongo_sync_read_preference_pick (pref, members, n, TRUE, FALSE);
+      break;
+    case MONGO_SYNC_READ_PRIMARY_PREFERRED:
+      i = _mongo_sync_read_preference_pick (pref, members, n, TRUE, FALSE);
+      if (i < 0)
+	i = _mongo_sync_read_preference_pick (pref, members, n,
+					      FALSE, TRUE);
+      break;
+    case MONGO_SYNC_READ_SECONDARY:
+      i = _mongo_sync_read_preference_pick (pref, members, n, FALSE, TRUE);
+      break;
+    case MONGO_SYNC_READ_SECONDARY_PREFERRED:
+      i = _mongo_sync_read_preference_pick (pref, members, n, FALSE, TRUE);
+      if (i < 0)
+	i = _mongo_sync_read_preference_pick (pref, members, n,
+					      TRUE, FALSE);
+      break;
+    case MONGO_SYNC_READ_NEAREST:
+      i = _mongo_sync_read_preference_pick (pref, members, n, TRUE, TRUE);
+      break;
+    }
+
+  return i;
+}
 
 static inline gboolean
 _mongo_cmd_ensure_conn (mongo_sync_connection *conn,
@@ -458,6 +1498,30 @@ _mongo_cmd_verify_slaveok (mongo_sync_connection *conn)
   return TRUE;
 }
 
+/** @internal Build the message killing the queued cursors.
+ *
+ * @param conn is the connection whose queue to build the message of.
+ * @param p is the packet the message will be sent along with.
+ *
+ * @returns A newly allocated packet, or NULL if there is nothing to
+ * kill.
+ */
+static mongo_packet *
+_mongo_sync_kill_packet (mongo_sync_connection *conn, const mongo_packet *p)
+{
+  mongo_packet_header h;
+
+  if (!conn || !conn->kills || conn->kills->len == 0)
+    return NULL;
+
+  /* Kill messages have no reply, so sharing the ID of the packet they
+     ride along with confuses nothing. */
+  if (!mongo_wire_packet_get_header (p, &h))
+    return NULL;
+  return mongo_wire_cmd_kill_cursors_array (h.id, conn->kills->len,
+					    (const gint64 *)conn->kills->data);
+}
+
 static inline gboolean
 _mongo_sync_packet_send (mongo_sync_connection *conn,
 			 mongo_packet *p,
@@ -466,13 +1530,36 @@ _mongo_sync_packet_send (mongo_sync_connection *conn,
 {
   gboolean out = FALSE;
 
+  /* Replies to anything sent now would get lost in the stream, or be
+     mistaken for the prefetched batch. */
+  if (conn && (conn->exhaust.active || conn->prefetching))
+    {
+      mongo_wire_packet_free (p);
+      errno = EBUSY;
+      return FALSE;
+    }
+
   if (force_master)
     if (!_mongo_cmd_ensure_conn (conn, force_master))
       return FALSE;
 
   for (;;)
     {
-      if (!mongo_packet_send ((mongo_connection *)conn, p))
+      mongo_packet *kill = _mongo_sync_kill_packet (conn, p);
+      gboolean sent;
+
+      sent = mongo_packet_send_pair ((mongo_connection *)conn, kill, p);
+      if (kill)
+	{
+	  int e = errno;
+
+	  mongo_wire_packet_free (kill);
+	  if (sent)
+	    g_array_set_size (conn->kills, 0);
+	  errno = e;
+	}
+
+      if (!sent)
 	{
 	  int e = errno;
 
@@ -499,8 +1586,12 @@ _mongo_sync_packet_send (mongo_sync_connection *conn,
   return TRUE;
 }
 
-static inline mongo_packet *
-_mongo_sync_packet_recv (mongo_sync_connection *conn, gint32 rid, gint32 flags)
+/** @internal Receive a reply, keeping it even if it is empty, when
+ * @a keep_empty is set.
+ */
+static mongo_packet *
+_mongo_sync_packet_recv_full (mongo_sync_connection *conn, gint32 rid,
+			      gint32 flags, gboolean keep_empty)
 {
   mongo_packet *p;
   mongo_packet_header h;
@@ -542,7 +1633,7 @@ _mongo_sync_packet_recv (mongo_sync_connection *conn, gint32 rid, gint32 flags)
       return NULL;
     }
 
-  if (rh.returned == 0)
+  if (rh.returned == 0 && !keep_empty)
     {
       mongo_wire_packet_free (p);
       errno = ENOENT;
@@ -552,6 +1643,12 @@ _mongo_sync_packet_recv (mongo_sync_connection *conn, gint32 rid, gint32 flags)
   return p;
 }
 
+static inline mongo_packet *
+_mongo_sync_packet_recv (mongo_sync_connection *conn, gint32 rid, gint32 flags)
+{
+  return _mongo_sync_packet_recv_full (conn, rid, flags, FALSE);
+}
+
 static gboolean
 _mongo_sync_check_ok (bson *b)
 {
@@ -821,6 +1918,261 @@ mongo_sync_cmd_insert (mongo_sync_connection *conn,
   return b;
 }
 
+/** @internal Compare two latency samples, for qsort(). */
+static gint
+_mongo_sync_hedge_sample_cmp (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+/** @internal Get the time to wait before hedging a read, in
+ * milliseconds.
+ */
+static gint
+_mongo_sync_hedge_delay (const mongo_sync_connection *conn)
+{
+  gint64 sorted[MONGO_SYNC_HEDGE_SAMPLES];
+  guint n = conn->hedge.nsamples;
+
+  if (conn->hedge.opts.percentile <= 0 ||
+      n < MONGO_SYNC_HEDGE_MIN_SAMPLES)
+    return conn->hedge.opts.delay;
+
+  memcpy (sorted, conn->hedge.samples, n * sizeof (gint64));
+  qsort (sorted, n, sizeof (gint64), _mongo_sync_hedge_sample_cmp);
+  return (gint)((sorted[(n - 1) * conn->hedge.opts.percentile / 100] +
+		 999) / 1000);
+}
+
+/** @internal Record the latency of a read that started at @a start. */
+static void
+_mongo_sync_hedge_sample (mongo_sync_connection *conn, gint64 start)
+{
+  conn->hedge.samples[conn->hedge.next] = g_get_monotonic_time () - start;
+  conn->hedge.next = (conn->hedge.next + 1) % MONGO_SYNC_HEDGE_SAMPLES;
+  if (conn->hedge.nsamples < MONGO_SYNC_HEDGE_SAMPLES)
+    conn->hedge.nsamples++;
+}
+
+/** @internal Connect to a member to send hedged reads to.
+ *
+ * The member is selected by the read preference of the connection,
+ * out of the members the monitor (or discovery) knows about, except
+ * the one the connection is on.
+ */
+static gboolean
+_mongo_sync_hedge_connect (mongo_sync_connection *conn)
+{
+  const mongo_sync_topology *topology = NULL;
+  GPtrArray *members;
+  GHashTableIter it;
+  gpointer m;
+  gchar *address = NULL, *host;
+  gint port, i;
+  guint j;
+
+  members = g_ptr_array_new ();
+  if (conn->monitor)
+    {
+      topology = mongo_sync_monitor_topology_acquire (conn->monitor);
+      for (j = 0; j < topology->members->len; j++)
+	g_ptr_array_add (members, g_ptr_array_index (topology->members, j));
+    }
+  else if (conn->rs.members)
+    {
+      g_hash_table_iter_init (&it, conn->rs.members);
+      while (g_hash_table_iter_next (&it, NULL, &m))
+	g_ptr_array_add (members, m);
+    }
+
+  for (j = members->len; j > 0; j--)
+    if (conn->address &&
+	strcmp (((mongo_sync_rs_member *)
+		 g_ptr_array_index (members, j - 1))->address,
+		conn->address) == 0)
+      g_ptr_array_remove_index_fast (members, j - 1);
+
+  i = mongo_sync_read_preference_select
+    (&conn->read_pref, (const mongo_sync_rs_member **)members->pdata,
+     members->len);
+  if (i >= 0)
+    address = g_strdup (((mongo_sync_rs_member *)
+			 g_ptr_array_index (members, i))->address);
+
+  if (topology)
+    mongo_sync_monitor_topology_release (conn->monitor, topology);
+  g_ptr_array_free (members, TRUE);
+
+  if (!address || !mongo_util_parse_addr (address, &host, &port))
+    {
+      g_free (address);
+      return FALSE;
+    }
+
+  conn->hedge.conn = mongo_connect_with_options (host, port,
+						 &conn->super.options);
+  g_free (host);
+  if (!conn->hedge.conn)
+    {
+      g_free (address);
+      return FALSE;
+    }
+  if (conn->super.timeout > 0)
+    mongo_connection_set_timeout (conn->hedge.conn, conn->super.timeout);
+  conn->hedge.address = address;
+  return TRUE;
+}
+
+/** @internal Send a hedged copy of a query.
+ *
+ * @param rid is set to the request ID of the hedge.
+ *
+ * @returns TRUE if the hedge was sent, FALSE otherwise.
+ */
+static gboolean
+_mongo_sync_hedge_fire (mongo_sync_connection *conn,
+			const gchar *ns, gint32 flags,
+			gint32 skip, gint32 ret,
+			const bson *query, const bson *sel,
+			gint32 *rid)
+{
+  mongo_packet *p;
+  gboolean sent;
+
+  /* If the previous loser still did not answer, its member is not
+     worth hedging to. */
+  if (!_mongo_sync_hedge_drain (conn, 0))
+    return FALSE;
+  if (!conn->hedge.conn && !_mongo_sync_hedge_connect (conn))
+    return FALSE;
+
+  *rid = mongo_connection_get_requestid (conn->hedge.conn) + 1;
+  p = mongo_wire_cmd_query (*rid, ns, flags | MONGO_WIRE_FLAG_QUERY_SLAVE_OK,
+			    skip, ret, query, sel);
+  if (!p)
+    return FALSE;
+
+  sent = mongo_packet_send (conn->hedge.conn, p);
+  mongo_wire_packet_free (p);
+  if (!sent)
+    {
+      _mongo_sync_hedge_drop (conn);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/** @internal Move a connection over to its hedge member.
+ *
+ * The sockets are swapped, so that the reply still due from the
+ * original member can be drained from the hedge connection later.
+ * Queued cursor kills are flushed to the original member first.
+ */
+static void
+_mongo_sync_hedge_swap (mongo_sync_connection *conn, gint32 rid)
+{
+  mongo_connection *h = conn->hedge.conn;
+  gchar *address;
+  gint32 id;
+  gint fd;
+
+  /* Cursors queued for killing live on the member we are leaving, so
+     they are killed over its socket before it becomes the hedge. */
+  mongo_sync_conn_flush_cursor_kills (conn);
+
+  mongo_connection_zerocopy_finish (&conn->super);
+
+  fd = conn->super.fd;
+  conn->super.fd = h->fd;
+  h->fd = fd;
+
+  id = conn->super.request_id;
+  conn->super.request_id = h->request_id;
+  h->request_id = id;
+
+  address = conn->address;
+  conn->address = conn->hedge.address;
+  conn->hedge.address = address;
+
+  if (conn->super.zerocopy.threshold > 0)
+    mongo_connection_set_zerocopy (&conn->super,
+				   conn->super.zerocopy.threshold);
+
+  conn->hedge.pending = TRUE;
+  conn->hedge.pending_rid = rid;
+}
+
+/** @internal Receive the reply to a query, hedging it if it takes
+ * too long.
+ *
+ * @param conn is the connection the query was sent on.
+ * @param rid is the request ID of the query.
+ * @param start is when the query was sent.
+ *
+ * The rest of the parameters are those of the query, to send the
+ * hedge with.
+ */
+static mongo_packet *
+_mongo_sync_hedged_recv (mongo_sync_connection *conn, gint32 rid,
+			 gint64 start, const gchar *ns, gint32 flags,
+			 gint32 skip, gint32 ret,
+			 const bson *query, const bson *sel)
+{
+  struct pollfd pfds[2];
+  mongo_packet *p;
+  gint32 hrid;
+  gint64 deadline;
+  gint r;
+
+  conn->hedge.stats.reads++;
+
+  pfds[0].fd = conn->super.fd;
+  pfds[0].events = POLLIN;
+  pfds[0].revents = 0;
+
+  deadline = start + (gint64)_mongo_sync_hedge_delay (conn) * 1000;
+  do
+    r = poll (pfds, 1,
+	      (gint)(MAX (deadline - g_get_monotonic_time (), 0) / 1000));
+  while (r < 0 && errno == EINTR);
+
+  if (r == 0 &&
+      _mongo_sync_hedge_fire (conn, ns, flags, skip, ret, query, sel, &hrid))
+    {
+      conn->hedge.stats.fired++;
+
+      pfds[1].fd = conn->hedge.conn->fd;
+      pfds[1].events = POLLIN;
+      pfds[1].revents = 0;
+      do
+	r = poll (pfds, 2, (conn->super.timeout > 0) ?
+		  conn->super.timeout : -1);
+      while (r < 0 && errno == EINTR);
+
+      /* If the hedge wins, the connection stays on its member for
+	 good: the reply of the original member is still due, and is
+	 only collected later, from the hedge connection. */
+      if (r > 0 && !pfds[0].revents)
+	{
+	  conn->hedge.stats.won++;
+	  _mongo_sync_hedge_swap (conn, rid);
+	  rid = hrid;
+	}
+      else
+	{
+	  conn->hedge.pending = TRUE;
+	  conn->hedge.pending_rid = hrid;
+	}
+    }
+
+  p = _mongo_sync_packet_recv (conn, rid, MONGO_REPLY_FLAG_QUERY_FAIL);
+  if (p)
+    _mongo_sync_hedge_sample (conn, start);
+  return p;
+}
+
 mongo_packet *
 mongo_sync_cmd_query (mongo_sync_connection *conn,
 		      const gchar *ns, gint32 flags,
@@ -829,6 +2181,8 @@ mongo_sync_cmd_query (mongo_sync_connection *conn,
 {
   mongo_packet *p;
   gint32 rid;
+  gboolean slaveok;
+  gint64 start;
 
   if (!_mongo_cmd_verify_slaveok (conn))
     return FALSE;
@@ -840,13 +2194,57 @@ mongo_sync_cmd_query (mongo_sync_connection *conn,
   if (!p)
     return NULL;
 
-  if (!_mongo_sync_packet_send (conn, p,
-				!((conn && conn->slaveok) ||
-				  (flags & MONGO_WIRE_FLAG_QUERY_SLAVE_OK)),
-				TRUE))
+  slaveok = (conn->slaveok || (flags & MONGO_WIRE_FLAG_QUERY_SLAVE_OK));
+  start = g_get_monotonic_time ();
+  if (!_mongo_sync_packet_send (conn, p, !slaveok, TRUE))
     return NULL;
 
-  p = _mongo_sync_packet_recv (conn, rid, MONGO_REPLY_FLAG_QUERY_FAIL);
+  if (conn->hedge.enabled && slaveok &&
+      conn->read_pref.mode != MONGO_SYNC_READ_PRIMARY &&
+      !(flags & MONGO_WIRE_FLAG_QUERY_EXHAUST))
+    p = _mongo_sync_hedged_recv (conn, rid, start, ns, flags, skip, ret,
+				 query, sel);
+  else
+    p = _mongo_sync_packet_recv (conn, rid, MONGO_REPLY_FLAG_QUERY_FAIL);
+  p = _mongo_sync_packet_check_error (conn, p, FALSE);
+
+  if (p && (flags & MONGO_WIRE_FLAG_QUERY_EXHAUST))
+    {
+      mongo_reply_packet_header rh;
+
+      mongo_wire_reply_packet_get_header (p, &rh);
+      conn->exhaust.active = (rh.cursor_id != 0);
+      conn->exhaust.cursor_id = rh.cursor_id;
+    }
+  return p;
+}
+
+gboolean
+mongo_sync_cmd_get_more_send (mongo_sync_connection *conn,
+			      const gchar *ns,
+			      gint32 ret, gint64 cursor_id,
+			      gint32 *rid)
+{
+  mongo_packet *p;
+
+  if (!_mongo_cmd_verify_slaveok (conn))
+    return FALSE;
+
+  *rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+
+  p = mongo_wire_cmd_get_more (*rid, ns, ret, cursor_id);
+  if (!p)
+    return FALSE;
+
+  return _mongo_sync_packet_send (conn, p, FALSE, TRUE);
+}
+
+mongo_packet *
+mongo_sync_cmd_get_more_recv (mongo_sync_connection *conn, gint32 rid)
+{
+  mongo_packet *p;
+
+  p = _mongo_sync_packet_recv (conn, rid, MONGO_REPLY_FLAG_NO_CURSOR);
   return _mongo_sync_packet_check_error (conn, p, FALSE);
 }
 
@@ -855,22 +2253,54 @@ mongo_sync_cmd_get_more (mongo_sync_connection *conn,
 			 const gchar *ns,
 			 gint32 ret, gint64 cursor_id)
 {
-  mongo_packet *p;
   gint32 rid;
 
-  if (!_mongo_cmd_verify_slaveok (conn))
-    return FALSE;
+  if (!mongo_sync_cmd_get_more_send (conn, ns, ret, cursor_id, &rid))
+    return NULL;
 
-  rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+  return mongo_sync_cmd_get_more_recv (conn, rid);
+}
+
+mongo_packet *
+mongo_sync_cmd_tail (mongo_sync_connection *conn, const gchar *ns,
+		     gint32 flags, const bson *query, gint64 cursor_id)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet *p;
+  gint32 rid;
+  gboolean slaveok;
+
+  if (cursor_id != 0)
+    {
+      if (!mongo_sync_cmd_get_more_send (conn, ns, 0, cursor_id, &rid))
+	return NULL;
+      /* The caller needs to know the cursor is gone, as opposed to the
+	 getmore failing, so that reply is returned too. */
+      p = _mongo_sync_packet_recv_full (conn, rid, 0, TRUE);
+    }
+  else
+    {
+      if (!_mongo_cmd_verify_slaveok (conn))
+	return NULL;
 
-  p = mongo_wire_cmd_get_more (rid, ns, ret, cursor_id);
+      rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+      p = mongo_wire_cmd_query (rid, ns, flags | _SLAVE_FLAG (conn),
+				0, 0, query, NULL);
+      if (!p)
+	return NULL;
+      slaveok = (conn->slaveok || (flags & MONGO_WIRE_FLAG_QUERY_SLAVE_OK));
+      if (!_mongo_sync_packet_send (conn, p, !slaveok, TRUE))
+	return NULL;
+      p = _mongo_sync_packet_recv_full (conn, rid,
+					MONGO_REPLY_FLAG_QUERY_FAIL, TRUE);
+    }
   if (!p)
     return NULL;
 
-  if (!_mongo_sync_packet_send (conn, p, FALSE, TRUE))
-    return FALSE;
-
-  p = _mongo_sync_packet_recv (conn, rid, MONGO_REPLY_FLAG_NO_CURSOR);
+  /* There is no error to look for in an empty reply. */
+  mongo_wire_reply_packet_get_header (p, &rh);
+  if (rh.returned == 0)
+    return p;
   return _mongo_sync_packet_check_error (conn, p, FALSE);
 }
 
@@ -921,6 +2351,57 @@ mongo_sync_cmd_kill_cursors (mongo_sync_connection *conn,
   return _mongo_sync_packet_send (conn, p, FALSE, TRUE);
 }
 
+void
+mongo_sync_conn_defer_kill (mongo_sync_connection *conn, gint64 cursor_id)
+{
+  if (!conn || cursor_id == 0)
+    return;
+
+  if (!conn->kills)
+    conn->kills = g_array_new (FALSE, FALSE, sizeof (gint64));
+  g_array_append_val (conn->kills, cursor_id);
+
+  if (conn->kills->len >= MONGO_SYNC_MAX_DEFERRED_KILLS)
+    mongo_sync_conn_flush_cursor_kills (conn);
+}
+
+gboolean
+mongo_sync_conn_flush_cursor_kills (mongo_sync_connection *conn)
+{
+  mongo_packet *p;
+  GArray *kills;
+  gint32 rid;
+  gboolean sent;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!conn->kills || conn->kills->len == 0)
+    return TRUE;
+  if (conn->exhaust.active || conn->prefetching)
+    {
+      errno = EBUSY;
+      return FALSE;
+    }
+
+  rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+  p = mongo_wire_cmd_kill_cursors_array (rid, conn->kills->len,
+					 (const gint64 *)conn->kills->data);
+
+  /* Take the queue away while sending, so the kills do not ride along
+     with themselves, and put it back if they could not be sent. */
+  kills = conn->kills;
+  conn->kills = NULL;
+  sent = _mongo_sync_packet_send (conn, p, FALSE, FALSE);
+  if (sent)
+    g_array_set_size (kills, 0);
+  conn->kills = kills;
+
+  return sent;
+}
+
 static mongo_packet *
 _mongo_sync_cmd_custom (mongo_sync_connection *conn,
 			const gchar *db,
@@ -1284,11 +2765,11 @@ mongo_sync_cmd_reset_error (mongo_sync_connection *conn,
 gboolean
 mongo_sync_cmd_is_master (mongo_sync_connection *conn)
 {
-  bson *cmd, *res, *hosts;
+  bson *cmd;
   mongo_packet *p;
-  bson_cursor *c;
-  gboolean b;
-  GList *l;
+  gboolean b, secondary;
+  gchar *primary;
+  GList *hosts;
 
   cmd = bson_new_sized (32);
   bson_append_int32 (cmd, "ismaster", 1);
@@ -1305,7 +2786,7 @@ mongo_sync_cmd_is_master (mongo_sync_connection *conn)
     }
   bson_free (cmd);
 
-  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &res))
+  if (!_mongo_sync_is_master_parse (p, &b, &secondary, &primary, &hosts))
     {
       int e = errno;
 
@@ -1314,91 +2795,12 @@ mongo_sync_cmd_is_master (mongo_sync_connection *conn)
       return FALSE;
     }
   mongo_wire_packet_free (p);
-  bson_finish (res);
-
-  c = bson_find (res, "ismaster");
-  if (!bson_cursor_get_boolean (c, &b))
-    {
-      bson_cursor_free (c);
-      bson_free (res);
-      errno = EPROTO;
-      return FALSE;
-    }
-  bson_cursor_free (c);
-
-  if (!b)
-    {
-      const gchar *s;
-
-      /* We're not the master, so we should have a 'primary' key in
-	 the response. */
-      c = bson_find (res, "primary");
-      if (bson_cursor_get_string (c, &s))
-	{
-	  g_free (conn->rs.primary);
-	  conn->rs.primary = g_strdup (s);
-	}
-      bson_cursor_free (c);
-    }
-
-  /* Find all the members of the set, and cache them. */
-  c = bson_find (res, "hosts");
-  if (!c)
-    {
-      bson_free (res);
-      errno = 0;
-      return b;
-    }
-
-  if (!bson_cursor_get_array (c, &hosts))
-    {
-      bson_cursor_free (c);
-      bson_free (res);
-      errno = 0;
-      return b;
-    }
-  bson_cursor_free (c);
-  bson_finish (hosts);
-
-  /* Delete the old host list. */
-  l = conn->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
-  conn->rs.hosts = NULL;
-
-  c = bson_cursor_new (hosts);
-  while (bson_cursor_next (c))
-    {
-      const gchar *s;
-
-      if (bson_cursor_get_string (c, &s))
-	conn->rs.hosts = g_list_append (conn->rs.hosts, g_strdup (s));
-    }
-  bson_cursor_free (c);
-  bson_free (hosts);
-
-  c = bson_find (res, "passives");
-  if (bson_cursor_get_array (c, &hosts))
-    {
-      bson_cursor_free (c);
-      bson_finish (hosts);
-
-      c = bson_cursor_new (hosts);
-      while (bson_cursor_next (c))
-	{
-	  const gchar *s;
 
-	  if (bson_cursor_get_string (c, &s))
-	    conn->rs.hosts = g_list_append (conn->rs.hosts, g_strdup (s));
-	}
-      bson_free (hosts);
-    }
-  bson_cursor_free (c);
+  if (conn->address)
+    _mongo_sync_rs_member_get (conn, conn->address)->role =
+      _mongo_sync_member_role (b, secondary);
+  _mongo_sync_is_master_update (conn, primary, hosts);
 
-  bson_free (res);
   errno = 0;
   return b;
 }
@@ -68,6 +68,29 @@ mongo_sync_connection *mongo_sync_connect (const gchar *address,
 					   gint port,
 					   gboolean slaveok);
 
+/** Synchronously connect to a MongoDB server, with custom socket
+ * options.
+ *
+ * Like mongo_sync_connect(), but tunes the socket with @a opts. The
+ * options are reused when reconnecting.
+ *
+ * @param address is the address of the server (IP or unix socket path).
+ * @param port is the port to connect to, or #MONGO_CONN_LOCAL if
+ * address is a unix socket.
+ * @param slaveok signals whether queries made against a slave are
+ * acceptable.
+ * @param opts are the socket options to use, or NULL for the
+ * defaults.
+ *
+ * @returns A newly allocated mongo_sync_connection object, or NULL on
+ * error. It is the responsibility of the caller to close and free the
+ * connection when appropriate.
+ */
+mongo_sync_connection *mongo_sync_connect_with_options (const gchar *address,
+							gint port,
+							gboolean slaveok,
+							const mongo_connection_options *opts);
+
 /** Add a seed to an existing MongoDB connection.
  *
  * The seed list will be used for reconnects, prioritized before the
@@ -85,8 +108,14 @@ gboolean mongo_sync_conn_seed_add (mongo_sync_connection *conn,
 /** Attempt to connect to another member of a replica set.
  *
  * Given an existing connection, this function will try to connect to
- * an available node (enforcing that it's a primary, if asked to) by
- * trying all known hosts until it finds one available.
+ * an available node (enforcing that it's a primary, if asked to). All
+ * known hosts are probed in parallel, and the first suitable one that
+ * answers wins. The round-trip time of each member that answered is
+ * recorded, see mongo_sync_conn_get_member_rtt().
+ *
+ * The probing is bounded by the connect timeout of the connection
+ * options. If a monitor is attached to the connection, the member it
+ * suggests is tried first, without probing.
  *
  * @param conn is an existing MongoDB connection.
  * @param force_master signals whether a primary node should be found.
@@ -99,6 +128,21 @@ gboolean mongo_sync_conn_seed_add (mongo_sync_connection *conn,
 mongo_sync_connection *mongo_sync_reconnect (mongo_sync_connection *conn,
 					     gboolean force_master);
 
+/** Get the last measured round-trip time of a replica set member.
+ *
+ * The round-trip times are measured by mongo_sync_reconnect(), when
+ * probing the members of the replica set, or by the monitor attached
+ * to the connection, if any (see mongo_sync_conn_set_monitor()).
+ *
+ * @param conn is the connection to query.
+ * @param member is the address of the member, as host:port.
+ *
+ * @returns The round-trip time in microseconds, or -1 on error, in
+ * which case errno is set to ENOENT if the member was never measured.
+ */
+gint64 mongo_sync_conn_get_member_rtt (const mongo_sync_connection *conn,
+				       const gchar *member);
+
 /** Close and free a synchronous MongoDB connection.
  *
  * @param conn is the connection to close.
@@ -125,6 +169,140 @@ gboolean mongo_sync_conn_get_slaveok (const mongo_sync_connection *conn);
 gboolean mongo_sync_conn_set_slaveok (mongo_sync_connection *conn,
 				      gboolean slaveok);
 
+/** Read preference modes.
+ *
+ * These decide which members of a replica set reads may go to.
+ */
+typedef enum
+{
+  /** Read from the primary only. */
+  MONGO_SYNC_READ_PRIMARY,
+  /** Read from the primary, or a secondary if there is no primary. */
+  MONGO_SYNC_READ_PRIMARY_PREFERRED,
+  /** Read from secondaries only. */
+  MONGO_SYNC_READ_SECONDARY,
+  /** Read from a secondary, or the primary if there are no
+      secondaries. */
+  MONGO_SYNC_READ_SECONDARY_PREFERRED,
+  /** Read from the closest member, be that a primary or a
+      secondary. */
+  MONGO_SYNC_READ_NEAREST
+} mongo_sync_read_mode;
+
+/** Default latency window of read preferences, in milliseconds. */
+#define MONGO_SYNC_DEFAULT_LATENCY_WINDOW 15
+
+/** Read preference.
+ *
+ * Out of the members the mode allows, only those are eligible whose
+ * round-trip time is within the latency window of the closest one,
+ * and one of them is picked at random. Secondaries lagging behind the
+ * primary by more than the staleness bound are not eligible at all.
+ *
+ * Always initialise with mongo_sync_read_preference_init(), so that
+ * fields added in later versions get their defaults.
+ */
+typedef struct
+{
+  mongo_sync_read_mode mode; /**< The read preference mode. */
+  gint latency_window; /**< The latency window, in milliseconds. */
+  gint max_staleness; /**< The maximum replication lag of eligible
+			 secondaries, in milliseconds, or zero for no
+			 bound. Only enforced when the lag is known,
+			 see mongo_sync_monitor. */
+} mongo_sync_read_preference;
+
+/** Initialise a read preference with the default settings.
+ *
+ * @param pref is the read preference to initialise.
+ * @param mode is the mode to set.
+ */
+void mongo_sync_read_preference_init (mongo_sync_read_preference *pref,
+				      mongo_sync_read_mode mode);
+
+/** Retrieve the read preference of a sync connection.
+ *
+ * @param conn is the connection to get the read preference of.
+ * @param pref is where the read preference will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_conn_get_read_preference (const mongo_sync_connection *conn,
+					      mongo_sync_read_preference *pref);
+
+/** Set the read preference of a sync connection.
+ *
+ * The read preference decides which member mongo_sync_reconnect()
+ * goes to when a primary is not required. It also sets the SLAVE_OK
+ * flag, unless the mode is #MONGO_SYNC_READ_PRIMARY.
+ *
+ * New connections use #MONGO_SYNC_READ_PRIMARY_PREFERRED.
+ *
+ * @param conn is the connection to set the read preference of.
+ * @param pref is the read preference to set.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_conn_set_read_preference (mongo_sync_connection *conn,
+					      const mongo_sync_read_preference *pref);
+
+/** Hedged read settings.
+ *
+ * When a query sent to one member did not get an answer in time, the
+ * same query is sent to a second member the read preference allows,
+ * and the first reply wins.
+ */
+typedef struct
+{
+  gint delay; /**< Time to wait for the first member, in
+		 milliseconds. */
+  gint percentile; /**< If non-zero, wait for this percentile (1-99)
+		      of the recently observed read latencies instead,
+		      once enough of them were observed. */
+} mongo_sync_hedge_options;
+
+/** Hedged read counters. */
+typedef struct
+{
+  guint64 reads; /**< Number of reads eligible for hedging. */
+  guint64 fired; /**< Number of reads a hedge was sent for. */
+  guint64 won; /**< Number of reads the hedge answered first. */
+} mongo_sync_hedge_stats;
+
+/** Enable or disable hedged reads on a sync connection.
+ *
+ * Hedging only applies to mongo_sync_cmd_query() calls that may go
+ * to secondaries, when the read preference is not
+ * #MONGO_SYNC_READ_PRIMARY. The second member is chosen by the read
+ * preference, out of the members known by the attached monitor (see
+ * mongo_sync_conn_set_monitor()), or the ones found during discovery.
+ *
+ * If the hedge answers first, the connection moves over to its
+ * member, so that cursors continue where their first batch came
+ * from. The connection stays on that member for every later
+ * operation too, until it is reconnected: moving back would mean
+ * waiting for the reply of the original member, which is what
+ * hedging avoids. The cursor of the losing query is killed once its
+ * reply arrives.
+ *
+ * @param conn is the connection to set hedging up on.
+ * @param opts are the hedging settings, or NULL to disable hedging.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_conn_set_hedged_reads (mongo_sync_connection *conn,
+					   const mongo_sync_hedge_options *opts);
+
+/** Retrieve the hedged read counters of a sync connection.
+ *
+ * @param conn is the connection to get the counters of.
+ * @param stats is where the counters will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_conn_get_hedge_stats (const mongo_sync_connection *conn,
+					  mongo_sync_hedge_stats *stats);
+
 /** Retrieve the state of the safe mode flag from a sync connection.
  *
  * @param conn is the connection to check the flag on.
@@ -250,6 +428,9 @@ gboolean mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
 				  const bson **docs);
 
 /** Send a query command to MongoDB.
+ *
+ * With #MONGO_WIRE_FLAG_QUERY_EXHAUST set, the reply should be handed
+ * to mongo_sync_cursor_new(), which reads the rest of the stream.
  *
  * @param conn is the connection to work with.
  * @param ns is the namespace, the database and collection name
@@ -312,6 +493,21 @@ gboolean mongo_sync_cmd_delete (mongo_sync_connection *conn, const gchar *ns,
 gboolean mongo_sync_cmd_kill_cursors (mongo_sync_connection *conn,
 				      gint32 n, ...);
 
+/** Kill the cursors queued for killing on a connection.
+ *
+ * Freeing a cursor does not kill it right away: its ID is queued on
+ * the connection, and all queued cursors are killed with a single
+ * message sent along with the next command. This function sends that
+ * message immediately, which is useful before leaving a connection
+ * idle for long.
+ *
+ * @param conn is the connection to work with.
+ *
+ * @returns TRUE on success (including when there was nothing to
+ * kill), FALSE otherwise, in which case the cursors stay queued.
+ */
+gboolean mongo_sync_conn_flush_cursor_kills (mongo_sync_connection *conn);
+
 /** Send a custom command to MongoDB.
  *
  * Custom commands are queries run in the db.$cmd namespace. The
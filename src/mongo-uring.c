@@ -0,0 +1,931 @@
+/* mongo-uring.c - libmongo-client io_uring transport
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-uring.c
+ * MongoDB io_uring transport implementation.
+ */
+
+#include "config.h"
+#include "mongo-uring.h"
+#include "mongo-client.h"
+#include "mongo-wire.h"
+#include "libmongo-private.h"
+
+#include <glib.h>
+
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#if WITH_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+/** @internal Marker bit for the user_data of link timeout SQEs. */
+#define URING_TIMEOUT_TAG (1ULL << 63)
+
+/** @internal Submission queue, as mapped from the kernel. */
+typedef struct
+{
+  guint *head; /**< Kernel-owned head index. */
+  guint *tail; /**< Our tail index. */
+  guint *mask; /**< Ring mask. */
+  guint *array; /**< Index array into ->sqes. */
+  guint entries; /**< Number of entries. */
+  struct io_uring_sqe *sqes; /**< The submission queue entries. */
+  gsize sqes_len; /**< Size of the ->sqes mapping. */
+} _mongo_uring_sq;
+
+/** @internal Completion queue, as mapped from the kernel. */
+typedef struct
+{
+  guint *head; /**< Our head index. */
+  guint *tail; /**< Kernel-owned tail index. */
+  guint *mask; /**< Ring mask. */
+  struct io_uring_cqe *cqes; /**< The completion queue entries. */
+} _mongo_uring_cq;
+
+/** @internal The io_uring transport object. */
+struct _mongo_uring
+{
+  gint fd; /**< The io_uring file descriptor. */
+
+  gpointer sq_ptr; /**< The submission ring mapping. */
+  gsize sq_len; /**< Size of the submission ring mapping. */
+  gpointer cq_ptr; /**< The completion ring mapping, may be the
+		      same as ->sq_ptr. */
+  gsize cq_len; /**< Size of the completion ring mapping. */
+
+  _mongo_uring_sq sq; /**< The submission queue. */
+  _mongo_uring_cq cq; /**< The completion queue. */
+
+  guint inflight; /**< Number of completions we are waiting for. */
+
+  guint8 *buffers; /**< The registered buffer area. */
+  gsize buffers_len; /**< Size of the registered buffer area. */
+  gsize buffer_size; /**< Size of a single registered buffer. */
+  guint nbuffers; /**< Number of registered buffers. */
+  guint *free_buffers; /**< Stack of unused buffer indexes. */
+  guint nfree; /**< Number of unused buffers. */
+};
+
+/** @internal States an operation goes through. */
+typedef enum
+{
+  URING_OP_SEND, /**< Sending a whole packet. */
+  URING_OP_RECV_HEADER, /**< Receiving the packet header. */
+  URING_OP_RECV_BODY, /**< Receiving the packet body. */
+  URING_OP_DONE, /**< Finished successfully. */
+  URING_OP_FAILED /**< Finished with an error. */
+} _mongo_uring_op_state;
+
+/** @internal A single send or receive, driven through the ring. */
+typedef struct
+{
+  mongo_connection *conn; /**< The connection to do I/O on. */
+  _mongo_uring_op_state state; /**< Where the operation is at. */
+
+  mongo_packet_header h; /**< The packet header: raw when sending,
+			    decoded when receiving. */
+  const guint8 *data; /**< Packet data when sending. */
+  gint32 data_size; /**< Size of the packet data. */
+
+  gint buf_index; /**< Registered buffer in use, or -1. */
+  guint8 *buf; /**< Memory the current phase reads into or writes
+		  from. */
+  guint8 *body; /**< Heap allocated receive body, if the packet did
+		   not fit into a registered buffer. */
+  gsize len; /**< Number of bytes the current phase has to move. */
+  gsize done; /**< Number of bytes moved so far. */
+
+  struct iovec iov[2]; /**< Vectors for unbuffered sends. */
+  struct msghdr msg; /**< Message for unbuffered sends. */
+  struct __kernel_timespec ts; /**< Link timeout, if any. */
+
+  gint error; /**< errno value, when the operation failed. */
+} _mongo_uring_op;
+
+static inline int
+_uring_setup (guint entries, struct io_uring_params *p)
+{
+  return (int) syscall (__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+_uring_enter (gint fd, guint to_submit, guint min_complete, guint flags)
+{
+  return (int) syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+static inline int
+_uring_register (gint fd, guint opcode, void *arg, guint nr_args)
+{
+  return (int) syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static gboolean
+_mongo_uring_probe (mongo_uring *ring)
+{
+  static const guint8 needed[] = {
+    IORING_OP_READ_FIXED, IORING_OP_SEND, IORING_OP_SENDMSG,
+    IORING_OP_RECV, IORING_OP_LINK_TIMEOUT
+  };
+  struct io_uring_probe *probe;
+  gsize len = sizeof (struct io_uring_probe) +
+    256 * sizeof (struct io_uring_probe_op);
+  guint i;
+
+  probe = g_malloc0 (len);
+  if (_uring_register (ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    {
+      g_free (probe);
+      return FALSE;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (needed); i++)
+    {
+      if (needed[i] > probe->last_op ||
+	  !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+	{
+	  g_free (probe);
+	  return FALSE;
+	}
+    }
+  g_free (probe);
+  return TRUE;
+}
+
+static gboolean
+_mongo_uring_map (mongo_uring *ring, struct io_uring_params *p)
+{
+  guint8 *sq, *cq;
+
+  ring->sq_len = p->sq_off.array + p->sq_entries * sizeof (guint);
+  ring->cq_len = p->cq_off.cqes + p->cq_entries * sizeof (struct io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_len = ring->cq_len = MAX (ring->sq_len, ring->cq_len);
+#endif
+
+  ring->sq_ptr = mmap (NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring->fd,
+		       IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED)
+    {
+      ring->sq_ptr = NULL;
+      return FALSE;
+    }
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ptr = ring->sq_ptr;
+  else
+#endif
+    {
+      ring->cq_ptr = mmap (NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring->fd,
+			   IORING_OFF_CQ_RING);
+      if (ring->cq_ptr == MAP_FAILED)
+	{
+	  ring->cq_ptr = NULL;
+	  return FALSE;
+	}
+    }
+
+  ring->sq.sqes_len = p->sq_entries * sizeof (struct io_uring_sqe);
+  ring->sq.sqes = mmap (NULL, ring->sq.sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd,
+			IORING_OFF_SQES);
+  if (ring->sq.sqes == MAP_FAILED)
+    {
+      ring->sq.sqes = NULL;
+      return FALSE;
+    }
+
+  sq = (guint8 *)ring->sq_ptr;
+  ring->sq.head = (guint *)(sq + p->sq_off.head);
+  ring->sq.tail = (guint *)(sq + p->sq_off.tail);
+  ring->sq.mask = (guint *)(sq + p->sq_off.ring_mask);
+  ring->sq.array = (guint *)(sq + p->sq_off.array);
+  ring->sq.entries = p->sq_entries;
+
+  cq = (guint8 *)ring->cq_ptr;
+  ring->cq.head = (guint *)(cq + p->cq_off.head);
+  ring->cq.tail = (guint *)(cq + p->cq_off.tail);
+  ring->cq.mask = (guint *)(cq + p->cq_off.ring_mask);
+  ring->cq.cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+  return TRUE;
+}
+
+static gboolean
+_mongo_uring_register_buffers (mongo_uring *ring, guint nbuffers,
+			       gsize buffer_size)
+{
+  struct iovec *iov;
+  guint i;
+
+  ring->buffers_len = nbuffers * buffer_size;
+  ring->buffers = mmap (NULL, ring->buffers_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buffers == MAP_FAILED)
+    {
+      ring->buffers = NULL;
+      return FALSE;
+    }
+
+  iov = g_new (struct iovec, nbuffers);
+  for (i = 0; i < nbuffers; i++)
+    {
+      iov[i].iov_base = ring->buffers + i * buffer_size;
+      iov[i].iov_len = buffer_size;
+    }
+
+  if (_uring_register (ring->fd, IORING_REGISTER_BUFFERS, iov, nbuffers) < 0)
+    {
+      g_free (iov);
+      munmap (ring->buffers, ring->buffers_len);
+      ring->buffers = NULL;
+      return FALSE;
+    }
+  g_free (iov);
+
+  ring->nbuffers = nbuffers;
+  ring->buffer_size = buffer_size;
+  ring->free_buffers = g_new (guint, nbuffers);
+  for (i = 0; i < nbuffers; i++)
+    ring->free_buffers[i] = nbuffers - i - 1;
+  ring->nfree = nbuffers;
+
+  return TRUE;
+}
+
+mongo_uring *
+mongo_uring_new (guint entries, guint nbuffers, gsize buffer_size)
+{
+  mongo_uring *ring;
+  struct io_uring_params p;
+
+  if (entries == 0)
+    entries = MONGO_URING_DEFAULT_ENTRIES;
+  if (nbuffers == 0)
+    nbuffers = MONGO_URING_DEFAULT_BUFFERS;
+  if (buffer_size == 0)
+    buffer_size = MONGO_URING_DEFAULT_BUFFER_SIZE;
+
+  /* An operation with a timeout takes two entries at once. */
+  if (entries < 2 || buffer_size < sizeof (mongo_packet_header))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  memset (&p, 0, sizeof (p));
+  ring = g_new0 (mongo_uring, 1);
+  ring->fd = _uring_setup (entries, &p);
+  if (ring->fd < 0)
+    {
+      int e = errno;
+
+      g_free (ring);
+      errno = (e == EPERM || e == ENOSYS) ? ENOSYS : e;
+      return NULL;
+    }
+
+  if (!_mongo_uring_probe (ring) || !_mongo_uring_map (ring, &p))
+    {
+      mongo_uring_free (ring);
+      errno = ENOSYS;
+      return NULL;
+    }
+
+  /* Registering the buffers can fail when the locked memory limit is
+     low. The ring is still useful without them, so carry on. */
+  _mongo_uring_register_buffers (ring, nbuffers, buffer_size);
+
+  return ring;
+}
+
+void
+mongo_uring_free (mongo_uring *ring)
+{
+  if (!ring)
+    {
+      errno = EINVAL;
+      return;
+    }
+
+  if (ring->sq.sqes)
+    munmap (ring->sq.sqes, ring->sq.sqes_len);
+  if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    munmap (ring->cq_ptr, ring->cq_len);
+  if (ring->sq_ptr)
+    munmap (ring->sq_ptr, ring->sq_len);
+  if (ring->fd >= 0)
+    close (ring->fd);
+  if (ring->buffers)
+    munmap (ring->buffers, ring->buffers_len);
+  g_free (ring->free_buffers);
+  g_free (ring);
+
+  errno = 0;
+}
+
+static inline gint
+_mongo_uring_buffer_get (mongo_uring *ring, gsize size)
+{
+  if (ring->nfree == 0 || size > ring->buffer_size)
+    return -1;
+  return (gint)ring->free_buffers[--ring->nfree];
+}
+
+static inline void
+_mongo_uring_buffer_put (mongo_uring *ring, _mongo_uring_op *op)
+{
+  if (op->buf_index < 0)
+    return;
+  ring->free_buffers[ring->nfree++] = (guint)op->buf_index;
+  op->buf_index = -1;
+}
+
+/** @internal Queue the SQE(s) for the current phase of an operation.
+ *
+ * @returns The number of SQEs used, zero if the submission queue is
+ * full.
+ */
+static guint
+_mongo_uring_op_submit (mongo_uring *ring, _mongo_uring_op *op, guint idx)
+{
+  struct io_uring_sqe *sqe;
+  guint tail, head, need;
+
+  need = (op->conn->timeout > 0) ? 2 : 1;
+
+  head = g_atomic_int_get ((gint *)ring->sq.head);
+  tail = *ring->sq.tail;
+  if (tail - head + need > ring->sq.entries ||
+      ring->inflight + need > ring->sq.entries)
+    return 0;
+
+  sqe = &ring->sq.sqes[tail & *ring->sq.mask];
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->fd = op->conn->fd;
+  sqe->user_data = idx;
+
+  switch (op->state)
+    {
+    case URING_OP_SEND:
+      if (op->buf_index >= 0)
+	{
+	  sqe->opcode = IORING_OP_SEND;
+	  sqe->addr = (guint64)(gsize)(op->buf + op->done);
+	  sqe->len = op->len - op->done;
+	  sqe->msg_flags = MSG_NOSIGNAL;
+	}
+      else
+	{
+	  gsize hsize = sizeof (mongo_packet_header);
+
+	  memset (&op->msg, 0, sizeof (op->msg));
+	  op->msg.msg_iov = op->iov;
+	  if (op->done < hsize)
+	    {
+	      op->iov[0].iov_base = (guint8 *)&op->h + op->done;
+	      op->iov[0].iov_len = hsize - op->done;
+	      op->iov[1].iov_base = (void *)op->data;
+	      op->iov[1].iov_len = op->data_size;
+	      op->msg.msg_iovlen = 2;
+	    }
+	  else
+	    {
+	      op->iov[0].iov_base = (void *)(op->data + op->done - hsize);
+	      op->iov[0].iov_len = op->len - op->done;
+	      op->msg.msg_iovlen = 1;
+	    }
+	  sqe->opcode = IORING_OP_SENDMSG;
+	  sqe->addr = (guint64)(gsize)&op->msg;
+	  sqe->len = 1;
+	  sqe->msg_flags = MSG_NOSIGNAL;
+	}
+      break;
+    case URING_OP_RECV_HEADER:
+    case URING_OP_RECV_BODY:
+      if (op->buf_index >= 0)
+	{
+	  sqe->opcode = IORING_OP_READ_FIXED;
+	  sqe->buf_index = op->buf_index;
+	  sqe->addr = (guint64)(gsize)(op->buf + op->done);
+	  sqe->len = op->len - op->done;
+	}
+      else
+	{
+	  sqe->opcode = IORING_OP_RECV;
+	  sqe->addr = (guint64)(gsize)(op->buf + op->done);
+	  sqe->len = op->len - op->done;
+	  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	}
+      break;
+    default:
+      return 0;
+    }
+  ring->sq.array[tail & *ring->sq.mask] = tail & *ring->sq.mask;
+  tail++;
+
+  if (need == 2)
+    {
+      sqe->flags |= IOSQE_IO_LINK;
+
+      op->ts.tv_sec = op->conn->timeout / 1000;
+      op->ts.tv_nsec = (op->conn->timeout % 1000) * 1000000;
+
+      sqe = &ring->sq.sqes[tail & *ring->sq.mask];
+      memset (sqe, 0, sizeof (*sqe));
+      sqe->opcode = IORING_OP_LINK_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = (guint64)(gsize)&op->ts;
+      sqe->len = 1;
+      sqe->user_data = idx | URING_TIMEOUT_TAG;
+      ring->sq.array[tail & *ring->sq.mask] = tail & *ring->sq.mask;
+      tail++;
+    }
+
+  g_atomic_int_set ((gint *)ring->sq.tail, tail);
+  ring->inflight += need;
+
+  return need;
+}
+
+static void
+_mongo_uring_op_fail (mongo_uring *ring, _mongo_uring_op *op, gint error)
+{
+  _mongo_uring_buffer_put (ring, op);
+  g_free (op->body);
+  op->body = NULL;
+  op->error = error;
+  op->state = URING_OP_FAILED;
+}
+
+/** @internal Move a receive on to the body, once the header is in. */
+static void
+_mongo_uring_op_recv_body (mongo_uring *ring, _mongo_uring_op *op)
+{
+  mongo_packet_header h;
+  gsize hsize = sizeof (mongo_packet_header);
+
+  if (op->buf_index >= 0)
+    memcpy (&h, op->buf, hsize);
+  else
+    memcpy (&h, &op->h, hsize);
+
+  op->h.length = GINT32_FROM_LE (h.length);
+  op->h.id = GINT32_FROM_LE (h.id);
+  op->h.resp_to = GINT32_FROM_LE (h.resp_to);
+  op->h.opcode = GINT32_FROM_LE (h.opcode);
+
+  if (op->h.length <= (gint32)hsize ||
+      op->h.length > MONGO_WIRE_MAX_MESSAGE_SIZE)
+    {
+      _mongo_uring_op_fail (ring, op, EPROTO);
+      return;
+    }
+  op->data_size = op->h.length - hsize;
+
+  if (op->buf_index < 0 || (gsize)op->h.length > ring->buffer_size)
+    {
+      _mongo_uring_buffer_put (ring, op);
+      op->body = g_try_malloc (op->data_size);
+      if (!op->body)
+	{
+	  _mongo_uring_op_fail (ring, op, ENOMEM);
+	  return;
+	}
+      op->buf = op->body;
+    }
+  else
+    op->buf += hsize;
+
+  op->state = URING_OP_RECV_BODY;
+  op->len = op->data_size;
+  op->done = 0;
+}
+
+/** @internal Process the completion of an operation's current phase.
+ *
+ * @returns TRUE if the operation needs to be submitted again.
+ */
+static gboolean
+_mongo_uring_op_complete (mongo_uring *ring, _mongo_uring_op *op, gint res)
+{
+  if (res == -ECANCELED || res == -ETIME)
+    res = -EAGAIN;
+  if (res < 0)
+    {
+      if (res == -EINTR)
+	return TRUE;
+      _mongo_uring_op_fail (ring, op, -res);
+      return FALSE;
+    }
+  if (res == 0 && op->state != URING_OP_SEND)
+    {
+      _mongo_uring_op_fail (ring, op, ECONNRESET);
+      return FALSE;
+    }
+
+  op->done += res;
+  if (op->done < op->len)
+    return TRUE;
+
+  switch (op->state)
+    {
+    case URING_OP_SEND:
+      _mongo_uring_buffer_put (ring, op);
+      op->state = URING_OP_DONE;
+      return FALSE;
+    case URING_OP_RECV_HEADER:
+      _mongo_uring_op_recv_body (ring, op);
+      return (op->state == URING_OP_RECV_BODY);
+    case URING_OP_RECV_BODY:
+      op->state = URING_OP_DONE;
+      return FALSE;
+    default:
+      return FALSE;
+    }
+}
+
+/** @internal Drive a set of operations through the ring, until all of
+ * them finished.
+ *
+ * If the ring fails, the operations not submitted yet fail right
+ * away, and the ones in flight as they complete, so that their
+ * buffers are not released while the kernel still uses them.
+ *
+ * @returns TRUE once no operation is in flight anymore, FALSE if the
+ * ring failed for good with some still in flight, in which case the
+ * operations and their buffers must not be freed.
+ */
+static gboolean
+_mongo_uring_run (mongo_uring *ring, _mongo_uring_op *ops, gint n)
+{
+  gint *queue, qhead = 0, qtail = 0, remaining = n, i, error = 0;
+
+  /* Every operation is at most once in the queue, so a queue of n
+     slots, used as a ring, is enough. */
+  queue = g_new (gint, n);
+  for (i = 0; i < n; i++)
+    {
+      if (ops[i].state == URING_OP_FAILED)
+	remaining--;
+      else
+	queue[qtail++ % n] = i;
+    }
+
+  while (remaining > 0)
+    {
+      guint head, tail;
+      gint r;
+
+      while (qhead != qtail)
+	{
+	  gint idx = queue[qhead % n];
+
+	  if (error)
+	    _mongo_uring_op_fail (ring, &ops[idx], error);
+	  else if (_mongo_uring_op_submit (ring, &ops[idx], idx) == 0)
+	    {
+	      /* With nothing in flight, there is no room to wait for. */
+	      if (ring->inflight > 0)
+		break;
+	      _mongo_uring_op_fail (ring, &ops[idx], ENOBUFS);
+	    }
+	  if (ops[idx].state == URING_OP_FAILED)
+	    remaining--;
+	  qhead++;
+	}
+      if (remaining == 0)
+	break;
+
+      tail = *ring->sq.tail;
+      head = g_atomic_int_get ((gint *)ring->sq.head);
+      r = _uring_enter (ring->fd, tail - head, 1, IORING_ENTER_GETEVENTS);
+      if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	{
+	  if (error)
+	    {
+	      for (i = 0; i < n; i++)
+		if (ops[i].state != URING_OP_DONE &&
+		    ops[i].state != URING_OP_FAILED)
+		  {
+		    ops[i].error = error;
+		    ops[i].state = URING_OP_FAILED;
+		  }
+	      g_free (queue);
+	      return FALSE;
+	    }
+	  error = errno;
+	  continue;
+	}
+
+      head = *ring->cq.head;
+      tail = g_atomic_int_get ((gint *)ring->cq.tail);
+      while (head != tail)
+	{
+	  struct io_uring_cqe *cqe = &ring->cq.cqes[head & *ring->cq.mask];
+	  guint64 ud = cqe->user_data;
+	  gint res = cqe->res;
+
+	  head++;
+	  ring->inflight--;
+	  if (ud & URING_TIMEOUT_TAG)
+	    continue;
+
+	  if (_mongo_uring_op_complete (ring, &ops[ud], res))
+	    queue[qtail++ % n] = (gint)ud;
+	  else
+	    remaining--;
+	}
+      g_atomic_int_set ((gint *)ring->cq.head, head);
+    }
+
+  /* Let the link timeouts of finished operations drain, so they do not
+     show up in the next batch. */
+  while (ring->inflight > 0)
+    {
+      guint head, tail;
+
+      if (_uring_enter (ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+	  errno != EINTR)
+	break;
+      head = *ring->cq.head;
+      tail = g_atomic_int_get ((gint *)ring->cq.tail);
+      ring->inflight -= tail - head;
+      g_atomic_int_set ((gint *)ring->cq.head, tail);
+    }
+
+  g_free (queue);
+  return TRUE;
+}
+
+static gint
+_mongo_uring_send_all (mongo_uring *ring, mongo_connection **conns,
+		       const mongo_packet **packets, gint n)
+{
+  _mongo_uring_op *ops;
+  gint i, sent = 0, e = 0;
+  gboolean settled;
+
+  ops = g_new0 (_mongo_uring_op, n);
+  for (i = 0; i < n; i++)
+    {
+      _mongo_uring_op *op = &ops[i];
+
+      op->conn = conns[i];
+      op->buf_index = -1;
+      op->state = URING_OP_SEND;
+
+      if (!conns[i] || conns[i]->fd < 0 || !packets[i])
+	{
+	  op->state = URING_OP_FAILED;
+	  op->error = (!conns[i]) ? ENOTCONN :
+	    ((!packets[i]) ? EINVAL : EBADF);
+	  continue;
+	}
+
+      if (!mongo_wire_packet_get_header_raw (packets[i], &op->h) ||
+	  (op->data_size = mongo_wire_packet_get_data (packets[i],
+						       &op->data)) == -1)
+	{
+	  op->state = URING_OP_FAILED;
+	  op->error = errno;
+	  continue;
+	}
+
+      op->len = sizeof (mongo_packet_header) + op->data_size;
+      op->buf_index = _mongo_uring_buffer_get (ring, op->len);
+      if (op->buf_index >= 0)
+	{
+	  op->buf = ring->buffers + op->buf_index * ring->buffer_size;
+	  memcpy (op->buf, &op->h, sizeof (mongo_packet_header));
+	  memcpy (op->buf + sizeof (mongo_packet_header), op->data,
+		  op->data_size);
+	}
+    }
+
+  settled = _mongo_uring_run (ring, ops, n);
+
+  for (i = 0; i < n; i++)
+    {
+      if (ops[i].state == URING_OP_DONE)
+	{
+	  ops[i].conn->request_id = ops[i].h.id;
+	  sent++;
+	}
+      else
+	e = ops[i].error;
+    }
+  /* The kernel may still write into operations the ring lost track
+     of, so those are leaked rather than freed. */
+  if (settled)
+    g_free (ops);
+
+  errno = e;
+  return sent;
+}
+
+static gint
+_mongo_uring_recv_all (mongo_uring *ring, mongo_connection **conns,
+		       mongo_packet **packets, gint n)
+{
+  _mongo_uring_op *ops;
+  gint i, received = 0, e = 0;
+  gboolean settled;
+
+  ops = g_new0 (_mongo_uring_op, n);
+  for (i = 0; i < n; i++)
+    {
+      _mongo_uring_op *op = &ops[i];
+
+      packets[i] = NULL;
+      op->conn = conns[i];
+      op->state = URING_OP_RECV_HEADER;
+      op->len = sizeof (mongo_packet_header);
+
+      if (!conns[i] || conns[i]->fd < 0)
+	{
+	  op->buf_index = -1;
+	  op->state = URING_OP_FAILED;
+	  op->error = (!conns[i]) ? ENOTCONN : EBADF;
+	  continue;
+	}
+
+      op->buf_index = _mongo_uring_buffer_get (ring, op->len);
+      if (op->buf_index >= 0)
+	op->buf = ring->buffers + op->buf_index * ring->buffer_size;
+      else
+	op->buf = (guint8 *)&op->h;
+    }
+
+  settled = _mongo_uring_run (ring, ops, n);
+
+  for (i = 0; i < n; i++)
+    {
+      _mongo_uring_op *op = &ops[i];
+
+      if (op->state == URING_OP_DONE)
+	{
+	  mongo_packet *p = mongo_wire_packet_new ();
+
+	  if (!mongo_wire_packet_set_header_raw (p, &op->h) ||
+	      !mongo_wire_packet_set_data (p, op->buf, op->data_size))
+	    {
+	      op->error = errno;
+	      mongo_wire_packet_free (p);
+	      p = NULL;
+	    }
+	  packets[i] = p;
+	}
+      if (settled)
+	{
+	  _mongo_uring_buffer_put (ring, op);
+	  g_free (op->body);
+	}
+
+      if (packets[i])
+	received++;
+      else
+	e = op->error;
+    }
+  /* See _mongo_uring_send_all(). */
+  if (settled)
+    g_free (ops);
+
+  errno = e;
+  return received;
+}
+
+#else /* !WITH_IO_URING */
+
+struct _mongo_uring
+{
+  gint fd; /**< Unused placeholder. */
+};
+
+mongo_uring *
+mongo_uring_new (guint entries, guint nbuffers, gsize buffer_size)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+void
+mongo_uring_free (mongo_uring *ring)
+{
+  errno = (ring) ? ENOSYS : EINVAL;
+}
+
+static gint
+_mongo_uring_send_all (mongo_uring *ring, mongo_connection **conns,
+		       const mongo_packet **packets, gint n)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+static gint
+_mongo_uring_recv_all (mongo_uring *ring, mongo_connection **conns,
+		       mongo_packet **packets, gint n)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif /* WITH_IO_URING */
+
+gboolean
+mongo_connection_set_uring (mongo_connection *conn, mongo_uring *ring)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  conn->uring = ring;
+  return TRUE;
+}
+
+gint
+mongo_uring_packet_send_all (mongo_uring *ring, mongo_connection **conns,
+			     const mongo_packet **packets, gint n)
+{
+  gint i, sent = 0, e = 0;
+
+  if (!conns || !packets || n <= 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (ring)
+    return _mongo_uring_send_all (ring, conns, packets, n);
+
+  for (i = 0; i < n; i++)
+    {
+      if (mongo_packet_send (conns[i], packets[i]))
+	sent++;
+      else
+	e = errno;
+    }
+  errno = e;
+  return sent;
+}
+
+gint
+mongo_uring_packet_recv_all (mongo_uring *ring, mongo_connection **conns,
+			     mongo_packet **packets, gint n)
+{
+  gint i, received = 0, e = 0;
+
+  if (!conns || !packets || n <= 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (ring)
+    return _mongo_uring_recv_all (ring, conns, packets, n);
+
+  for (i = 0; i < n; i++)
+    {
+      packets[i] = mongo_packet_recv (conns[i]);
+      if (packets[i])
+	received++;
+      else
+	e = errno;
+    }
+  errno = e;
+  return received;
+}
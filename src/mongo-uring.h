@@ -0,0 +1,163 @@
+/* mongo-uring.h - libmongo-client io_uring transport API
+ * Copyright 2011, 2012 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-uring.h
+ * MongoDB io_uring transport API public header.
+ *
+ * @addtogroup mongo_client
+ * @{
+ */
+
+#ifndef LIBMONGO_CLIENT_URING_H
+#define LIBMONGO_CLIENT_URING_H 1
+
+#include <mongo-client.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** @defgroup mongo_uring Mongo io_uring Transport
+ *
+ * An alternative transport for mongo_connection objects, which
+ * submits sends and receives through a Linux io_uring instead of
+ * issuing one system call per operation.
+ *
+ * Once a connection has a ring attached with
+ * mongo_connection_set_uring(), mongo_packet_send() and
+ * mongo_packet_recv() transparently go through the ring. The real
+ * gain comes from mongo_uring_packet_send_all() and
+ * mongo_uring_packet_recv_all(), which complete the I/O of many
+ * connections with as few io_uring_enter() calls as possible.
+ *
+ * Packet data is staged in buffers registered with the kernel. Packets
+ * that do not fit into a single buffer, or that arrive when all
+ * buffers are busy, still go through the ring, only without a
+ * registered buffer.
+ *
+ * When the library was built without io_uring support, or the running
+ * kernel does not provide it, mongo_uring_new() fails, and everything
+ * keeps working through the plain socket calls.
+ *
+ * @note A ring is not thread safe: all connections attached to the
+ * same ring must be used from the same thread.
+ *
+ * @addtogroup mongo_uring
+ * @{
+ */
+
+/** Opaque io_uring transport object. */
+typedef struct _mongo_uring mongo_uring;
+
+/** Default number of submission queue entries of a ring. */
+#define MONGO_URING_DEFAULT_ENTRIES 64
+
+/** Default number of registered buffers of a ring. */
+#define MONGO_URING_DEFAULT_BUFFERS 16
+
+/** Default size of a single registered buffer.
+ *
+ * Large enough to hold a full GridFS chunk and the surrounding
+ * message.
+ */
+#define MONGO_URING_DEFAULT_BUFFER_SIZE (288 * 1024)
+
+/** Create a new io_uring transport.
+ *
+ * @param entries is the number of submission queue entries, at least
+ * two, or zero for #MONGO_URING_DEFAULT_ENTRIES.
+ * @param nbuffers is the number of buffers to register, or zero for
+ * #MONGO_URING_DEFAULT_BUFFERS.
+ * @param buffer_size is the size of each registered buffer, or zero
+ * for #MONGO_URING_DEFAULT_BUFFER_SIZE.
+ *
+ * @returns A newly allocated ring, or NULL on error, in which case
+ * errno is set to ENOSYS if io_uring is not available at all. It is
+ * the responsibility of the caller to free the ring once it is not
+ * used anymore.
+ */
+mongo_uring *mongo_uring_new (guint entries, guint nbuffers,
+			      gsize buffer_size);
+
+/** Free an io_uring transport.
+ *
+ * @param ring is the ring to free.
+ *
+ * @note Connections still using the ring must be detached (or
+ * disconnected) before freeing it.
+ */
+void mongo_uring_free (mongo_uring *ring);
+
+/** Attach an io_uring transport to a connection.
+ *
+ * @param conn is the connection to attach the ring to.
+ * @param ring is the ring to use, or NULL to go back to plain socket
+ * calls.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note The ring is not owned by the connection, and must outlive it.
+ */
+gboolean mongo_connection_set_uring (mongo_connection *conn,
+				     mongo_uring *ring);
+
+/** Send packets on multiple connections at once.
+ *
+ * Submits all the sends to the ring, and waits until every one of
+ * them completed, using as few io_uring_enter() calls as possible.
+ *
+ * @param ring is the ring to use. If NULL, the packets are sent one
+ * by one with mongo_packet_send().
+ * @param conns is the array of connections to send on.
+ * @param packets is the array of packets to send, @a packets[i]
+ * going to @a conns[i].
+ * @param n is the number of elements in the arrays.
+ *
+ * @returns The number of packets successfully sent, or -1 on
+ * error. If not all of them were sent, errno is set to the error of
+ * the last failing send.
+ */
+gint mongo_uring_packet_send_all (mongo_uring *ring,
+				  mongo_connection **conns,
+				  const mongo_packet **packets,
+				  gint n);
+
+/** Receive a packet on each of multiple connections at once.
+ *
+ * @param ring is the ring to use. If NULL, the packets are received
+ * one by one with mongo_packet_recv().
+ * @param conns is the array of connections to receive from.
+ * @param packets is the array where the received packets will be
+ * stored, @a packets[i] being the reply read from @a conns[i], or
+ * NULL if receiving from that connection failed.
+ * @param n is the number of elements in the arrays.
+ *
+ * @returns The number of packets successfully received, or -1 on
+ * error. It is the responsibility of the caller to free the received
+ * packets.
+ */
+gint mongo_uring_packet_recv_all (mongo_uring *ring,
+				  mongo_connection **conns,
+				  mongo_packet **packets,
+				  gint n);
+
+/** @} */
+
+/** @} */
+
+G_END_DECLS
+
+#endif
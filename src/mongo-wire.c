@@ -41,6 +41,8 @@ struct _mongo_packet
   mongo_packet_header header; /**< The packet header. */
   guint8 *data; /**< The actual data of the packet. */
   gint32 data_size; /**< Size of the data payload. */
+  gint extra_refs; /**< References taken with
+		       mongo_wire_packet_ref(). */
 };
 
 /** @internal Mongo command opcodes. */
@@ -66,6 +68,19 @@ mongo_wire_packet_new (void)
   return p;
 }
 
+mongo_packet *
+mongo_wire_packet_ref (mongo_packet *p)
+{
+  if (!p)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  p->extra_refs++;
+  return p;
+}
+
 gboolean
 mongo_wire_packet_get_header (const mongo_packet *p,
 			      mongo_packet_header *header)
@@ -195,6 +210,12 @@ mongo_wire_packet_free (mongo_packet *p)
       return;
     }
 
+  if (p->extra_refs > 0)
+    {
+      p->extra_refs--;
+      return;
+    }
+
   if (p->data)
     g_free (p->data);
   g_free (p);
@@ -496,6 +517,45 @@ mongo_wire_cmd_kill_cursors_va (gint32 id, gint32 n, va_list ap)
   return p;
 }
 
+mongo_packet *
+mongo_wire_cmd_kill_cursors_array (gint32 id, gint32 n,
+				   const gint64 *cursor_ids)
+{
+  mongo_packet *p;
+  gint32 i, t_n, pos;
+  gint64 t_cid;
+
+  if (n <= 0 || !cursor_ids)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p->header.id = GINT32_TO_LE (id);
+  p->header.opcode = GINT32_TO_LE (OP_KILL_CURSORS);
+
+  p->data_size = sizeof (gint32) + sizeof (gint32) + sizeof (gint64)* n;
+  p->data = g_malloc (p->data_size);
+
+  t_n = GINT32_TO_LE (n);
+  pos = sizeof (gint32) * 2;
+  memcpy (p->data, (void *)&zero, sizeof (gint32));
+  memcpy (p->data + sizeof (gint32), (void *)&t_n, sizeof (gint32));
+
+  for (i = 0; i < n; i++)
+    {
+      t_cid = GINT64_TO_LE (cursor_ids[i]);
+
+      memcpy (p->data + pos, (void *)&t_cid, sizeof (gint64));
+      pos += sizeof (gint64);
+    }
+
+  p->header.length = GINT32_TO_LE (sizeof (p->header) + p->data_size);
+
+  return p;
+}
+
 mongo_packet *
 mongo_wire_cmd_kill_cursors (gint32 id, gint32 n, ...)
 {
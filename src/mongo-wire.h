@@ -62,6 +62,9 @@ typedef struct
 		    mongo_wire_opcode. <*/
 } mongo_packet_header;
 
+/** The largest message a MongoDB server sends, in bytes. */
+#define MONGO_WIRE_MAX_MESSAGE_SIZE (48 * 1000 * 1000)
+
 /** An opaque Mongo Packet on the wire.
  *
  * This structure contains the binary data that can be written
@@ -310,6 +313,11 @@ enum
     MONGO_WIRE_FLAG_QUERY_TAILABLE_CURSOR = 1 << 1,
     /** Allow queries made against a replica slave. */
     MONGO_WIRE_FLAG_QUERY_SLAVE_OK = 1 << 2,
+    /** Let the server skip to the oplog entries matching a query on
+     * ts, instead of scanning the whole oplog.
+     * Use only when tailing the oplog!
+     */
+    MONGO_WIRE_FLAG_QUERY_OPLOG_REPLAY = 1 << 3,
     /** Disable cursor timeout. */
     MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT = 1 << 4,
     /** Block if at the end of the data block, awaiting data.
@@ -335,7 +343,7 @@ enum
  * concatenated, and separated with a single dot.
  * @param flags are the query options. Available flags are:
  * #MONGO_WIRE_FLAG_QUERY_TAILABLE_CURSOR,
- * #MONGO_WIRE_FLAG_QUERY_SLAVE_OK,
+ * #MONGO_WIRE_FLAG_QUERY_SLAVE_OK, #MONGO_WIRE_FLAG_QUERY_OPLOG_REPLAY,
  * #MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT,
  * #MONGO_WIRE_FLAG_QUERY_AWAIT_DATA, #MONGO_WIRE_FLAG_QUERY_EXHAUST.
  * @param skip is the number of documents to skip.
@@ -24,10 +24,14 @@
 #include <bson.h>
 #include <mongo-wire.h>
 #include <mongo-client.h>
+#include <mongo-uring.h>
 #include <mongo-utils.h>
 #include <mongo-sync.h>
 #include <mongo-sync-cursor.h>
 #include <mongo-sync-pool.h>
+#include <mongo-sync-monitor.h>
+#include <mongo-sync-scan.h>
+#include <mongo-sync-tailer.h>
 #include <sync-gridfs.h>
 #include <sync-gridfs-chunk.h>
 #include <sync-gridfs-stream.h>
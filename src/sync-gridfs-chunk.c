@@ -21,8 +21,13 @@
 #include "sync-gridfs-chunk.h"
 #include "libmongo-private.h"
 
+#include <sys/uio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
+
+/** @internal The number of chunks a download asks for per batch. */
+#define MONGO_SYNC_GRIDFS_DOWNLOAD_BATCH 16
 
 void
 mongo_sync_gridfs_chunked_file_free (mongo_sync_gridfs_chunked_file *gfile)
@@ -156,55 +161,248 @@ mongo_sync_gridfs_chunked_file_cursor_new (mongo_sync_gridfs_chunked_file *gfile
   return cursor;
 }
 
-guint8 *
-mongo_sync_gridfs_chunked_file_cursor_get_chunk (mongo_sync_cursor *cursor,
-						 gint32 *size)
+const guint8 *
+mongo_sync_gridfs_chunked_file_cursor_peek_chunk (mongo_sync_cursor *cursor,
+						  gint32 *size)
 {
-  bson *b;
-  bson_cursor *c;
-  const guint8 *d;
-  guint8 *data;
-  gint32 s;
-  bson_binary_subtype sub = BSON_BINARY_SUBTYPE_USER_DEFINED;
-  gboolean r;
+  const guint8 *doc, *d;
+  gint32 dsize, s;
+  bson_type t;
 
   if (!cursor)
     {
       errno = ENOTCONN;
       return NULL;
     }
+  if (!size)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
 
-  b = mongo_sync_cursor_get_data (cursor);
-  c = bson_find (b, "data");
-  r = bson_cursor_get_binary (c, &sub, &d, &s);
-  if (!r || (sub != BSON_BINARY_SUBTYPE_GENERIC &&
-             sub != BSON_BINARY_SUBTYPE_BINARY))
+  doc = mongo_sync_cursor_get_raw_data (cursor, &dsize);
+  if (!doc)
+    return NULL;
+
+  /* A binary value is its length, the subtype, then the data. */
+  if (!bson_stream_find (doc, dsize, "data", &t, &d) ||
+      t != BSON_TYPE_BINARY ||
+      d + sizeof (gint32) + 1 > doc + dsize ||
+      (d[sizeof (gint32)] != BSON_BINARY_SUBTYPE_GENERIC &&
+       d[sizeof (gint32)] != BSON_BINARY_SUBTYPE_BINARY))
     {
-      bson_cursor_free (c);
       errno = EPROTO;
       return NULL;
     }
-  bson_cursor_free (c);
-
-  if (sub == BSON_BINARY_SUBTYPE_BINARY)
+  s = bson_stream_doc_size (d, 0);
+  d += sizeof (gint32) + 1;
+  if (s < 0 || d + s > doc + dsize)
     {
-      s -= 4;
-      data = g_malloc (s);
-      memcpy (data, d + 4, s);
+      errno = EPROTO;
+      return NULL;
     }
-  else
+
+  /* The old binary subtype wraps the data in another length. */
+  if (d[-1] == BSON_BINARY_SUBTYPE_BINARY)
     {
-      data = g_malloc (s);
-      memcpy (data, d, s);
+      if (s < (gint32)sizeof (gint32))
+	{
+	  errno = EPROTO;
+	  return NULL;
+	}
+      d += sizeof (gint32);
+      s -= sizeof (gint32);
     }
 
+  *size = s;
+  return d;
+}
+
+guint8 *
+mongo_sync_gridfs_chunked_file_cursor_get_chunk (mongo_sync_cursor *cursor,
+						 gint32 *size)
+{
+  const guint8 *d;
+  guint8 *data;
+  gint32 s;
+
+  d = mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &s);
+  if (!d)
+    return NULL;
+
+  data = g_malloc (s);
+  memcpy (data, d, s);
+
   if (size)
     *size = s;
-
-  bson_free (b);
   return data;
 }
 
+/** @internal Build a chunk document.
+ *
+ * @param oid is the ID of the file the chunk belongs to.
+ * @param n is the number of the chunk.
+ * @param data is the data of the chunk.
+ * @param size is the size of the chunk.
+ * @param chunk_size is the chunk size of the file.
+ */
+static bson *
+_mongo_sync_gridfs_chunk_new (const guint8 *oid, gint64 n,
+			      const guint8 *data, gint32 size,
+			      gint32 chunk_size)
+{
+  bson *chunk;
+
+  chunk = bson_new_sized (chunk_size + 128);
+  bson_append_oid (chunk, "files_id", oid);
+  bson_append_int64 (chunk, "n", n);
+  bson_append_binary (chunk, "data", BSON_BINARY_SUBTYPE_GENERIC,
+		      data, size);
+  bson_finish (chunk);
+
+  return chunk;
+}
+
+void
+mongo_sync_gridfs_chunk_batch_init (mongo_sync_gridfs_chunk_batch *batch)
+{
+  batch->chunks = g_ptr_array_new ();
+  batch->size = 0;
+}
+
+void
+mongo_sync_gridfs_chunk_batch_clear (mongo_sync_gridfs_chunk_batch *batch)
+{
+  guint i;
+
+  if (!batch->chunks)
+    return;
+
+  for (i = 0; i < batch->chunks->len; i++)
+    bson_free (g_ptr_array_index (batch->chunks, i));
+  g_ptr_array_free (batch->chunks, TRUE);
+  batch->chunks = NULL;
+  batch->size = 0;
+}
+
+gboolean
+mongo_sync_gridfs_chunk_batch_flush (mongo_sync_gridfs *gfs,
+				     mongo_sync_gridfs_chunk_batch *batch)
+{
+  guint i;
+
+  if (batch->chunks->len == 0)
+    return TRUE;
+
+  if (!mongo_sync_cmd_insert_n (gfs->conn, gfs->ns.chunks,
+				batch->chunks->len,
+				(const bson **)batch->chunks->pdata))
+    return FALSE;
+
+  for (i = 0; i < batch->chunks->len; i++)
+    bson_free (g_ptr_array_index (batch->chunks, i));
+  g_ptr_array_set_size (batch->chunks, 0);
+  batch->size = 0;
+
+  return TRUE;
+}
+
+gboolean
+mongo_sync_gridfs_chunk_batch_add (mongo_sync_gridfs *gfs,
+				   mongo_sync_gridfs_chunk_batch *batch,
+				   const guint8 *oid, gint64 n,
+				   const guint8 *data, gint32 size)
+{
+  bson *chunk;
+
+  chunk = _mongo_sync_gridfs_chunk_new (oid, n, data, size, size);
+
+  /* mongo_sync_cmd_insert_n() sends documents totalling less than the
+     maximum insert size in a single message. */
+  if (batch->chunks->len > 0 &&
+      batch->size + bson_size (chunk) >=
+      mongo_sync_conn_get_max_insert_size (gfs->conn) &&
+      !mongo_sync_gridfs_chunk_batch_flush (gfs, batch))
+    {
+      int e = errno;
+
+      bson_free (chunk);
+      errno = e;
+      return FALSE;
+    }
+
+  g_ptr_array_add (batch->chunks, chunk);
+  batch->size += bson_size (chunk);
+
+  return TRUE;
+}
+
+/** @internal Insert the metadata of an uploaded file, and create the
+ * file object.
+ *
+ * @returns A newly allocated file object, or NULL on error.
+ */
+static mongo_sync_gridfs_chunked_file *
+_mongo_sync_gridfs_chunked_file_finish (mongo_sync_gridfs *gfs,
+					const bson *metadata,
+					const guint8 *oid, gint64 size,
+					const gchar *md5)
+{
+  mongo_sync_gridfs_chunked_file *gfile;
+  bson *meta;
+  bson_cursor *c;
+  gint64 upload_date;
+  GTimeVal tv;
+
+  if (metadata)
+    meta = bson_new_from_data (bson_data (metadata),
+			       bson_size (metadata) - 1);
+  else
+    meta = bson_new_sized (128);
+
+  g_get_current_time (&tv);
+  upload_date =  (((gint64) tv.tv_sec) * 1000) + (gint64)(tv.tv_usec / 1000);
+
+  bson_append_int64 (meta, "length", size);
+  bson_append_int32 (meta, "chunkSize", gfs->chunk_size);
+  bson_append_utc_datetime (meta, "uploadDate", upload_date);
+  bson_append_string (meta, "md5", md5, -1);
+  bson_append_oid (meta, "_id", oid);
+  bson_finish (meta);
+
+  if (!mongo_sync_cmd_insert (gfs->conn, gfs->ns.files, meta, NULL))
+    {
+      int e = errno;
+
+      bson_free (meta);
+      errno = e;
+      return NULL;
+    }
+
+  /* Return the resulting gfile.
+   * No need to check cursor errors here, as we constructed the BSON
+   * just above, and all the fields exist and have the appropriate
+   * types.
+   */
+  gfile = g_new0 (mongo_sync_gridfs_chunked_file, 1);
+  gfile->gfs = gfs;
+
+  gfile->meta.metadata = meta;
+  gfile->meta.length = size;
+  gfile->meta.chunk_size = gfs->chunk_size;
+  gfile->meta.date = 0;
+  gfile->meta.type = LMC_GRIDFS_FILE_CHUNKED;
+
+  c = bson_find (meta, "_id");
+  bson_cursor_get_oid (c, &gfile->meta.oid);
+
+  bson_cursor_find (c, "md5");
+  bson_cursor_get_string (c, &gfile->meta.md5);
+  bson_cursor_free (c);
+
+  return gfile;
+}
+
 mongo_sync_gridfs_chunked_file *
 mongo_sync_gridfs_chunked_file_new_from_buffer (mongo_sync_gridfs *gfs,
 						const bson *metadata,
@@ -212,11 +410,9 @@ mongo_sync_gridfs_chunked_file_new_from_buffer (mongo_sync_gridfs *gfs,
 						gint64 size)
 {
   mongo_sync_gridfs_chunked_file *gfile;
-  bson *meta;
-  bson_cursor *c;
+  mongo_sync_gridfs_chunk_batch batch;
   guint8 *oid;
-  gint64 pos = 0, chunk_n = 0, upload_date;
-  GTimeVal tv;
+  gint64 pos = 0, chunk_n = 0;
   GChecksum *chk;
 
   if (!gfs)
@@ -239,91 +435,558 @@ mongo_sync_gridfs_chunked_file_new_from_buffer (mongo_sync_gridfs *gfs,
     }
 
   chk = g_checksum_new (G_CHECKSUM_MD5);
+  mongo_sync_gridfs_chunk_batch_init (&batch);
 
-  /* Insert chunks first */
+  /* Insert chunks first, as many per message as fit */
   while (pos < size)
     {
-      bson *chunk;
       gint32 csize = gfs->chunk_size;
 
       if (size - pos < csize)
 	csize = size - pos;
 
-      chunk = bson_new_sized (gfs->chunk_size + 128);
-      bson_append_oid (chunk, "files_id", oid);
-      bson_append_int64 (chunk, "n", (gint64)chunk_n);
-      bson_append_binary (chunk, "data", BSON_BINARY_SUBTYPE_GENERIC,
-			  data + pos, csize);
-      bson_finish (chunk);
-
       g_checksum_update (chk, data + pos, csize);
 
-      if (!mongo_sync_cmd_insert (gfs->conn, gfs->ns.chunks, chunk, NULL))
-	{
-	  int e = errno;
-
-	  bson_free (chunk);
-	  g_free (oid);
-	  errno = e;
-	  return NULL;
-	}
-      bson_free (chunk);
+      if (!mongo_sync_gridfs_chunk_batch_add (gfs, &batch, oid, chunk_n,
+					      data + pos, csize))
+	break;
 
       pos += csize;
       chunk_n++;
     }
 
+  if (pos < size || !mongo_sync_gridfs_chunk_batch_flush (gfs, &batch))
+    {
+      int e = errno;
+
+      mongo_sync_gridfs_chunk_batch_clear (&batch);
+      g_checksum_free (chk);
+      g_free (oid);
+      errno = e;
+      return NULL;
+    }
+  mongo_sync_gridfs_chunk_batch_clear (&batch);
+
   /* Insert metadata */
-  if (metadata)
-    meta = bson_new_from_data (bson_data (metadata),
-			       bson_size (metadata) - 1);
-  else
-    meta = bson_new_sized (128);
+  gfile = _mongo_sync_gridfs_chunked_file_finish (gfs, metadata, oid, size,
+						  g_checksum_get_string (chk));
+  g_checksum_free (chk);
+  g_free (oid);
 
-  g_get_current_time (&tv);
-  upload_date =  (((gint64) tv.tv_sec) * 1000) + (gint64)(tv.tv_usec / 1000);
+  return gfile;
+}
 
-  bson_append_int64 (meta, "length", size);
-  bson_append_int32 (meta, "chunkSize", gfs->chunk_size);
-  bson_append_utc_datetime (meta, "uploadDate", upload_date);
-  bson_append_string (meta, "md5", g_checksum_get_string (chk), -1);
-  bson_append_oid (meta, "_id", oid);
-  bson_finish (meta);
+/** @internal State shared by the workers of a parallel upload. */
+typedef struct
+{
+  mongo_sync_gridfs *gfs; /**< The GridFS to upload to. */
+  const guint8 *oid; /**< The ID of the file. */
+  const guint8 *data; /**< The data to upload. */
+  gint64 size; /**< The size of the data. */
+  gint nchunks; /**< The number of chunks to insert. */
+  gint share; /**< The most chunks a worker claims at once, so that
+		 small files are still spread over every worker. */
+
+  gint next; /**< The next chunk to insert. Atomic. */
+  gint error; /**< The errno of the first failure, if any. Atomic. */
+} _mongo_sync_gridfs_upload;
+
+/** @internal A worker of a parallel upload. */
+typedef struct
+{
+  _mongo_sync_gridfs_upload *upload; /**< The upload the worker
+					belongs to. */
+  mongo_sync_connection *conn; /**< The connection the worker inserts
+				  over. */
+  GThread *thread; /**< The thread of the worker, or NULL if it could
+		      not be started. */
+} _mongo_sync_gridfs_upload_worker;
+
+/** @internal Record the failure of an upload, unless one was recorded
+ * already. */
+static void
+_mongo_sync_gridfs_upload_fail (_mongo_sync_gridfs_upload *upload, int e)
+{
+  g_atomic_int_compare_and_exchange (&upload->error, 0, (e) ? e : EPROTO);
+}
 
-  g_checksum_free (chk);
+/** @internal Send a run of chunks in a single message, without
+ * waiting for them to be acknowledged. */
+static gboolean
+_mongo_sync_gridfs_upload_chunks (_mongo_sync_gridfs_upload *upload,
+				  mongo_sync_connection *conn,
+				  gint first, gint count)
+{
+  mongo_packet *p;
+  bson **chunks;
+  gboolean ok;
+  gint i;
+  int e;
 
-  if (!mongo_sync_cmd_insert (gfs->conn, gfs->ns.files, meta, NULL))
+  chunks = g_new (bson *, count);
+  for (i = 0; i < count; i++)
     {
-      int e = errno;
+      gint64 pos = (gint64)(first + i) * upload->gfs->chunk_size;
+      gint32 csize = upload->gfs->chunk_size;
 
-      bson_free (meta);
-      g_free (oid);
-      errno = e;
+      if (upload->size - pos < csize)
+	csize = upload->size - pos;
+
+      chunks[i] = _mongo_sync_gridfs_chunk_new (upload->oid, first + i,
+						upload->data + pos, csize,
+						upload->gfs->chunk_size);
+    }
+
+  p = mongo_wire_cmd_insert_n
+    (mongo_connection_get_requestid ((mongo_connection *)conn) + 1,
+     upload->gfs->ns.chunks, count, (const bson **)chunks);
+  for (i = 0; i < count; i++)
+    bson_free (chunks[i]);
+  g_free (chunks);
+  if (!p)
+    return FALSE;
+
+  ok = mongo_packet_send ((mongo_connection *)conn, p);
+  e = errno;
+  mongo_wire_packet_free (p);
+  errno = e;
+
+  return ok;
+}
+
+/** @internal Insert chunks over one connection, until there are no
+ * more left.
+ *
+ * The connection is checked to be a master once, then the chunks are
+ * sent back to back, and acknowledged all at once at the end: the
+ * server handles the requests of a connection in order, so once it
+ * answers getLastError, it has processed every chunk sent before.
+ */
+static gpointer
+_mongo_sync_gridfs_upload_run (gpointer data)
+{
+  _mongo_sync_gridfs_upload_worker *w =
+    (_mongo_sync_gridfs_upload_worker *)data;
+  _mongo_sync_gridfs_upload *upload = w->upload;
+  gchar *error = NULL;
+  gint n, per_message;
+
+  /* Chunks are claimed in runs that fit into a single insert, with
+     room for the few bytes of the other fields of a chunk. */
+  per_message = (mongo_sync_conn_get_max_insert_size (w->conn) - 1) /
+    (upload->gfs->chunk_size + 64);
+  per_message = CLAMP (per_message, 1, upload->share);
+
+  errno = 0;
+  if (!mongo_sync_cmd_is_master (w->conn))
+    {
+      _mongo_sync_gridfs_upload_fail (upload, errno);
       return NULL;
     }
 
-  /* Return the resulting gfile.
-   * No need to check cursor errors here, as we constructed the BSON
-   * just above, and all the fields exist and have the appropriate
-   * types.
-   */
-  gfile = g_new0 (mongo_sync_gridfs_chunked_file, 1);
-  gfile->gfs = gfs;
+  while (!g_atomic_int_get (&upload->error) &&
+	 (n = g_atomic_int_add (&upload->next, per_message)) <
+	 upload->nchunks)
+    if (!_mongo_sync_gridfs_upload_chunks
+	(upload, w->conn, n, MIN (per_message, upload->nchunks - n)))
+      {
+	_mongo_sync_gridfs_upload_fail (upload, errno);
+	return NULL;
+      }
+
+  if (!mongo_sync_cmd_get_last_error (w->conn, upload->gfs->ns.db, &error))
+    _mongo_sync_gridfs_upload_fail (upload, errno);
+  else if (error)
+    _mongo_sync_gridfs_upload_fail (upload, EPROTO);
+  g_free (error);
+
+  return NULL;
+}
 
-  gfile->meta.metadata = meta;
-  gfile->meta.length = size;
-  gfile->meta.chunk_size = gfs->chunk_size;
-  gfile->meta.date = 0;
-  gfile->meta.type = LMC_GRIDFS_FILE_CHUNKED;
+/** @internal Check that every chunk of an upload made it. */
+static gboolean
+_mongo_sync_gridfs_upload_verify (_mongo_sync_gridfs_upload *upload)
+{
+  mongo_sync_gridfs *gfs = upload->gfs;
+  bson *q;
+  gdouble n;
 
-  c = bson_find (meta, "_id");
-  bson_cursor_get_oid (c, &gfile->meta.oid);
+  q = bson_new_sized (32);
+  bson_append_oid (q, "files_id", upload->oid);
+  bson_finish (q);
+  n = mongo_sync_cmd_count (gfs->conn, gfs->ns.db,
+			    gfs->ns.chunks + strlen (gfs->ns.db) + 1, q);
+  bson_free (q);
 
-  bson_cursor_find (c, "md5");
-  bson_cursor_get_string (c, &gfile->meta.md5);
-  bson_cursor_free (c);
+  if (n < 0)
+    return FALSE;
+  if ((gint)n != upload->nchunks)
+    {
+      errno = EPROTO;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/** @internal Remove the chunks of a failed upload, as far as
+ * possible. */
+static void
+_mongo_sync_gridfs_chunks_remove (mongo_sync_gridfs *gfs, const guint8 *oid)
+{
+  bson *q;
+  int e = errno;
+
+  q = bson_new_sized (32);
+  bson_append_oid (q, "files_id", oid);
+  bson_finish (q);
+  mongo_sync_cmd_delete (gfs->conn, gfs->ns.chunks, 0, q);
+  bson_free (q);
+
+  errno = e;
+}
+
+mongo_sync_gridfs_chunked_file *
+mongo_sync_gridfs_chunked_file_new_from_buffer_parallel (mongo_sync_gridfs *gfs,
+							 const bson *metadata,
+							 const guint8 *data,
+							 gint64 size,
+							 mongo_sync_pool *pool,
+							 gint nconns)
+{
+  mongo_sync_gridfs_chunked_file *gfile = NULL;
+  _mongo_sync_gridfs_upload upload;
+  _mongo_sync_gridfs_upload_worker *workers;
+  mongo_sync_pool_connection *conn;
+  guint8 *oid;
+  gchar *md5;
+  gint i, nworkers = 0;
+
+  if (!gfs)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+  if (!data || size <= 0 || (pool && nconns <= 0))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if ((size + gfs->chunk_size - 1) / gfs->chunk_size > G_MAXINT)
+    {
+      errno = EFBIG;
+      return NULL;
+    }
+
+  oid = mongo_util_oid_new
+    (mongo_connection_get_requestid ((mongo_connection *)gfs->conn));
+  if (!oid)
+    {
+      errno = EFAULT;
+      return NULL;
+    }
+
+  memset (&upload, 0, sizeof (upload));
+  upload.gfs = gfs;
+  upload.oid = oid;
+  upload.data = data;
+  upload.size = size;
+  upload.nchunks = (size + gfs->chunk_size - 1) / gfs->chunk_size;
+
+  /* Without a pool, the chunks are pipelined over the connection of
+     the GridFS, on a thread of its own. */
+  if (!pool)
+    nconns = 1;
+  upload.share = MAX (1, upload.nchunks / MIN (nconns, upload.nchunks));
+  workers = g_new0 (_mongo_sync_gridfs_upload_worker,
+		    MIN (nconns, upload.nchunks));
+  while (nworkers < MIN (nconns, upload.nchunks))
+    {
+      if (pool)
+	{
+	  if ((conn = mongo_sync_pool_pick (pool, TRUE)) == NULL)
+	    break;
+	  workers[nworkers].conn = (mongo_sync_connection *)conn;
+	}
+      else
+	workers[nworkers].conn = gfs->conn;
+      workers[nworkers].upload = &upload;
+      workers[nworkers].thread =
+	g_thread_try_new ("mongo-sync-gridfs", _mongo_sync_gridfs_upload_run,
+			  &workers[nworkers], NULL);
+      nworkers++;
+    }
+
+  if (nworkers == 0)
+    _mongo_sync_gridfs_upload_fail (&upload, EAGAIN);
+
+  /* Checksum while the workers are busy with the network. */
+  md5 = g_compute_checksum_for_data (G_CHECKSUM_MD5, data, size);
+
+  for (i = 0; i < nworkers; i++)
+    {
+      if (workers[i].thread)
+	g_thread_join (workers[i].thread);
+      else
+	_mongo_sync_gridfs_upload_run (&workers[i]);
+      if (pool)
+	mongo_sync_pool_return
+	  (pool, (mongo_sync_pool_connection *)workers[i].conn);
+    }
+  g_free (workers);
+
+  if (upload.error)
+    errno = upload.error;
+  else if (_mongo_sync_gridfs_upload_verify (&upload))
+    gfile = _mongo_sync_gridfs_chunked_file_finish (gfs, metadata, oid,
+						    size, md5);
+  if (!gfile && nworkers > 0)
+    _mongo_sync_gridfs_chunks_remove (gfs, oid);
+
+  g_free (md5);
+  g_free (oid);
+
+  return gfile;
+}
+
+/** @internal Write out a set of buffers completely.
+ *
+ * Retries short and interrupted writes. The buffers are adjusted as
+ * they are written out.
+ */
+static gboolean
+_mongo_sync_gridfs_writev_all (gint fd, struct iovec *iov, gint n)
+{
+  while (n > 0)
+    {
+      ssize_t w = writev (fd, iov, n);
+
+      if (w < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return FALSE;
+	}
+
+      while (n > 0 && (size_t)w >= iov->iov_len)
+	{
+	  w -= iov->iov_len;
+	  iov++;
+	  n--;
+	}
+      if (n > 0)
+	{
+	  iov->iov_base = (guint8 *)iov->iov_base + w;
+	  iov->iov_len -= w;
+	}
+    }
+  return TRUE;
+}
+
+gint64
+mongo_sync_gridfs_download_to_fd (mongo_sync_gridfs_chunked_file *gfile,
+				  gint fd)
+{
+  struct iovec iov[MONGO_SYNC_GRIDFS_DOWNLOAD_BATCH];
+  mongo_sync_cursor *cursor;
+  gint64 n = 0, nchunks, written = 0;
+  gint niov = 0;
+  int e;
+
+  if (!gfile)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+  if (fd < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  nchunks = mongo_sync_gridfs_file_get_chunks (gfile);
+  if (nchunks == 0)
+    return 0;
+
+  cursor = mongo_sync_gridfs_chunked_file_cursor_new
+    (gfile, 0, MONGO_SYNC_GRIDFS_DOWNLOAD_BATCH);
+  if (!cursor)
+    return -1;
+  mongo_sync_cursor_set_batch_size (cursor, MONGO_SYNC_GRIDFS_DOWNLOAD_BATCH);
+
+  /* The next batch is requested halfway through the current one, so
+     that it arrives while the current one is being written out. */
+  mongo_sync_cursor_set_prefetch (cursor, 0.5);
+
+  while (n < nchunks)
+    {
+      const guint8 *doc, *d;
+      gint32 dsize, size;
+      gint64 cn = -1;
+      bson_type t;
+
+      /* The chunks point into the current batch, so they have to be
+	 written out before the cursor moves on to the next one. */
+      if (niov > 0 && (niov == MONGO_SYNC_GRIDFS_DOWNLOAD_BATCH ||
+		       cursor->offset >= cursor->ph.returned - 1))
+	{
+	  if (!_mongo_sync_gridfs_writev_all (fd, iov, niov))
+	    break;
+	  niov = 0;
+	}
+
+      errno = 0;
+      if (!mongo_sync_cursor_next (cursor))
+	{
+	  if (errno == 0)
+	    errno = EPROTO;
+	  break;
+	}
+
+      doc = mongo_sync_cursor_get_raw_data (cursor, &dsize);
+      if (doc && bson_stream_find (doc, dsize, "n", &t, &d))
+	{
+	  gint32 cn32;
+
+	  if (t == BSON_TYPE_INT64)
+	    {
+	      memcpy (&cn, d, sizeof (cn));
+	      cn = GINT64_FROM_LE (cn);
+	    }
+	  else if (t == BSON_TYPE_INT32)
+	    {
+	      memcpy (&cn32, d, sizeof (cn32));
+	      cn = GINT32_FROM_LE (cn32);
+	    }
+	}
+      if (cn != n)
+	{
+	  errno = EPROTO;
+	  break;
+	}
+
+      d = mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size);
+      if (!d)
+	break;
+
+      iov[niov].iov_base = (void *)d;
+      iov[niov].iov_len = size;
+      niov++;
+      written += size;
+      n++;
+    }
+
+  if (n == nchunks)
+    {
+      if (niov > 0 && !_mongo_sync_gridfs_writev_all (fd, iov, niov))
+	n = -1;
+      else if (written != gfile->meta.length)
+	{
+	  errno = EPROTO;
+	  n = -1;
+	}
+    }
+
+  e = errno;
+  mongo_sync_cursor_free (cursor);
+  errno = e;
+
+  return (n == nchunks) ? written : -1;
+}
+
+/** @internal Fill a buffer from a file descriptor, as far as possible.
+ *
+ * @returns The number of bytes read, which is less than @a size only
+ * at the end of the file, or -1 on error.
+ */
+static gint32
+_mongo_sync_gridfs_read_full (gint fd, guint8 *buffer, gint32 size)
+{
+  gint32 pos = 0;
+
+  while (pos < size)
+    {
+      ssize_t r = read (fd, buffer + pos, size - pos);
 
+      if (r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if (r == 0)
+	break;
+      pos += r;
+    }
+  return pos;
+}
+
+mongo_sync_gridfs_chunked_file *
+mongo_sync_gridfs_upload_from_fd (mongo_sync_gridfs *gfs,
+				  const bson *metadata, gint fd)
+{
+  mongo_sync_gridfs_chunked_file *gfile = NULL;
+  mongo_sync_gridfs_chunk_batch batch;
+  guint8 *oid, *buffer;
+  gint64 size = 0, chunk_n = 0;
+  gint32 r;
+  GChecksum *chk;
+  int e;
+
+  if (!gfs)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+  if (fd < 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  oid = mongo_util_oid_new
+    (mongo_connection_get_requestid ((mongo_connection *)gfs->conn));
+  if (!oid)
+    {
+      errno = EFAULT;
+      return NULL;
+    }
+
+  buffer = g_malloc (gfs->chunk_size);
+  chk = g_checksum_new (G_CHECKSUM_MD5);
+  mongo_sync_gridfs_chunk_batch_init (&batch);
+
+  while ((r = _mongo_sync_gridfs_read_full (fd, buffer,
+					    gfs->chunk_size)) > 0)
+    {
+      g_checksum_update (chk, buffer, r);
+      if (!mongo_sync_gridfs_chunk_batch_add (gfs, &batch, oid, chunk_n,
+					      buffer, r))
+	break;
+
+      size += r;
+      chunk_n++;
+      if (r < gfs->chunk_size)
+	{
+	  r = 0;
+	  break;
+	}
+    }
+
+  /* Like with buffers, empty files could not be found again. */
+  if (r == 0 && size == 0)
+    errno = EINVAL;
+  else if (r == 0 && mongo_sync_gridfs_chunk_batch_flush (gfs, &batch))
+    gfile = _mongo_sync_gridfs_chunked_file_finish
+      (gfs, metadata, oid, size, g_checksum_get_string (chk));
+  if (!gfile && chunk_n > 0)
+    _mongo_sync_gridfs_chunks_remove (gfs, oid);
+
+  e = errno;
+  mongo_sync_gridfs_chunk_batch_clear (&batch);
+  g_checksum_free (chk);
+  g_free (buffer);
   g_free (oid);
+  errno = e;
 
   return gfile;
 }
@@ -25,6 +25,7 @@
 #define LIBMONGO_SYNC_GRIDFS_CHUNK_H 1
 
 #include <sync-gridfs.h>
+#include <mongo-sync-pool.h>
 #include <glib.h>
 
 G_BEGIN_DECLS
@@ -64,6 +65,8 @@ mongo_sync_gridfs_chunked_file *mongo_sync_gridfs_chunked_find (mongo_sync_gridf
 /** Upload a file to GridFS from a buffer.
  *
  * Create a new file on GridFS from a buffer, using custom meta-data.
+ * The chunks are inserted as many per message as fit under the
+ * maximum insert size of the connection.
  *
  * @param gfs is the GridFS to create the file on.
  * @param metadata is the (optional) file metadata.
@@ -83,6 +86,49 @@ mongo_sync_gridfs_chunked_file *mongo_sync_gridfs_chunked_file_new_from_buffer (
 										const bson *metadata,
 										const guint8 *data,
 										gint64 size);
+
+/** Upload a file to GridFS from a buffer, pipelining the chunks.
+ *
+ * Like mongo_sync_gridfs_chunked_file_new_from_buffer(), but instead
+ * of waiting for each chunk to be acknowledged before sending the
+ * next, the chunks are sent back to back, and acknowledged together
+ * at the end. If a pool is given, the chunks are spread over up to
+ * @a nconns master connections picked from it, each sending on a
+ * thread of its own. Otherwise they are sent over the connection of
+ * the GridFS, on a separate thread.
+ *
+ * The MD5 checksum of the data is computed on the calling thread,
+ * while the chunks are being sent. Once every connection acknowledged
+ * its chunks, the number of chunks stored is checked, and only then
+ * is the file metadata written. If anything fails, the chunks that
+ * were stored are removed again.
+ *
+ * @param gfs is the GridFS to create the file on.
+ * @param metadata is the (optional) file metadata.
+ * @param data is the data to store on GridFS.
+ * @param size is the size of the data.
+ * @param pool is the pool to pick connections from, or NULL to use
+ * the connection of @a gfs.
+ * @param nconns is the most connections to pick from @a pool.
+ * Ignored without a pool.
+ *
+ * @returns A newly allocated file object, or NULL on error, in which
+ * case errno is set to EAGAIN if no connection could be picked from
+ * the pool. It is the responsibility of the caller to free the
+ * returned object once it is no longer needed.
+ *
+ * @note The connection of @a gfs must not be used by other threads
+ * while the upload runs. The same restrictions apply to @a metadata
+ * as with mongo_sync_gridfs_chunked_file_new_from_buffer().
+ */
+mongo_sync_gridfs_chunked_file *
+mongo_sync_gridfs_chunked_file_new_from_buffer_parallel (mongo_sync_gridfs *gfs,
+							 const bson *metadata,
+							 const guint8 *data,
+							 gint64 size,
+							 mongo_sync_pool *pool,
+							 gint nconns);
+
 /** Free a GridFS chunked file object.
  *
  * @param gfile is the file object to free.
@@ -125,6 +171,69 @@ mongo_sync_cursor *mongo_sync_gridfs_chunked_file_cursor_new (mongo_sync_gridfs_
 guint8 *mongo_sync_gridfs_chunked_file_cursor_get_chunk (mongo_sync_cursor *cursor,
 							 gint32 *size);
 
+/** Get the data of a GridFS file chunk, via a cursor, without copying.
+ *
+ * Like mongo_sync_gridfs_chunked_file_cursor_get_chunk(), but instead
+ * of a copy, returns a pointer into the reply the chunk arrived in,
+ * so that the data can be written out straight from the network
+ * buffer.
+ *
+ * @param cursor is the cursor object to work with.
+ * @param size is a pointer to a variable where the chunk's actual
+ * size will be stored.
+ *
+ * @returns A pointer to the current chunk's data, or NULL on
+ * error. The data is owned by the cursor, and is only valid until
+ * the cursor is advanced or freed.
+ */
+const guint8 *mongo_sync_gridfs_chunked_file_cursor_peek_chunk (mongo_sync_cursor *cursor,
+								gint32 *size);
+
+/* File descriptors */
+
+/** Download a GridFS chunked file into a file descriptor.
+ *
+ * The chunks are written out straight from the replies they arrive
+ * in, several at a time with writev(), without copying them. The
+ * next batch of chunks is requested while the current one is written
+ * out, so network reads and writes to @a fd overlap.
+ *
+ * @param gfile is the file to download.
+ * @param fd is the file descriptor to write the file to.
+ *
+ * @returns The number of bytes written, or -1 on error, in which case
+ * errno is set to EPROTO if the chunks stored do not make up the
+ * file. Part of the file may have been written out already then.
+ *
+ * @note The connection of the file's GridFS must not be used for
+ * anything else while the download runs.
+ */
+gint64 mongo_sync_gridfs_download_to_fd (mongo_sync_gridfs_chunked_file *gfile,
+					 gint fd);
+
+/** Upload a file to GridFS from a file descriptor.
+ *
+ * Reads @a fd until the end of the file, one chunk at a time, and
+ * inserts the chunks as many per message as fit under the maximum
+ * insert size of the connection. The chunks are removed again if the
+ * upload fails.
+ *
+ * @param gfs is the GridFS to create the file on.
+ * @param metadata is the (optional) file metadata.
+ * @param fd is the file descriptor to read the file from.
+ *
+ * @returns A newly allocated file object, or NULL on error, in which
+ * case errno is set to EINVAL if @a fd had nothing to read. It is the
+ * responsibility of the caller to free the returned object once it is
+ * no longer needed.
+ *
+ * @note The same restrictions apply to @a metadata as with
+ * mongo_sync_gridfs_chunked_file_new_from_buffer().
+ */
+mongo_sync_gridfs_chunked_file *mongo_sync_gridfs_upload_from_fd (mongo_sync_gridfs *gfs,
+								  const bson *metadata,
+								  gint fd);
+
 /** @} */
 
 G_END_DECLS
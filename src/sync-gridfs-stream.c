@@ -95,6 +95,7 @@ mongo_sync_gridfs_stream_find (mongo_sync_gridfs *gfs,
       errno = EPROTO;
       return NULL;
     }
+  stream->read_ahead.window = MONGO_SYNC_GRIDFS_STREAM_DEFAULT_READ_AHEAD;
 
   return stream;
 }
@@ -158,38 +159,26 @@ mongo_sync_gridfs_stream_new (mongo_sync_gridfs *gfs,
 
   stream->writer.buffer = g_malloc (stream->file.chunk_size);
   stream->writer.checksum = g_checksum_new (G_CHECKSUM_MD5);
+  mongo_sync_gridfs_chunk_batch_init (&stream->writer.batch);
 
   return stream;
 }
 
-static inline gboolean
-_stream_seek_chunk (mongo_sync_gridfs_stream *stream,
-		    gint64 chunk)
+/** @internal Make a chunk the current one of a reader.
+ *
+ * Takes ownership of @a chunk, even on failure.
+ */
+static gboolean
+_stream_chunk_set (mongo_sync_gridfs_stream *stream, bson *chunk)
 {
-  bson *b;
-  mongo_packet *p;
   bson_cursor *c;
   bson_binary_subtype subt = BSON_BINARY_SUBTYPE_USER_DEFINED;
   gboolean r;
 
-  b = bson_new_sized (32);
-  bson_append_oid (b, "files_id", stream->file.id);
-  bson_append_int64 (b, "n", chunk);
-  bson_finish (b);
-
-  p = mongo_sync_cmd_query (stream->gfs->conn,
-			    stream->gfs->ns.chunks, 0,
-			    0, 1, b, NULL);
-  bson_free (b);
-
   bson_free (stream->reader.bson);
-  stream->reader.bson = NULL;
+  stream->reader.bson = chunk;
   stream->reader.chunk.data = NULL;
 
-  mongo_wire_reply_packet_get_nth_document (p, 1, &stream->reader.bson);
-  mongo_wire_packet_free (p);
-  bson_finish (stream->reader.bson);
-
   c = bson_find (stream->reader.bson, "data");
   r = bson_cursor_get_binary (c, &subt, &stream->reader.chunk.data,
 			      &stream->reader.chunk.size);
@@ -211,11 +200,155 @@ _stream_seek_chunk (mongo_sync_gridfs_stream *stream,
       stream->reader.chunk.start_offset = 4;
       stream->reader.chunk.size -= 4;
     }
+  else
+    stream->reader.chunk.start_offset = 0;
   stream->reader.chunk.offset = 0;
 
   return TRUE;
 }
 
+/** @internal Fetch a single chunk with a point query. */
+static inline gboolean
+_stream_seek_chunk (mongo_sync_gridfs_stream *stream,
+		    gint64 chunk)
+{
+  bson *b, *doc = NULL;
+  mongo_packet *p;
+
+  b = bson_new_sized (32);
+  bson_append_oid (b, "files_id", stream->file.id);
+  bson_append_int64 (b, "n", chunk);
+  bson_finish (b);
+
+  p = mongo_sync_cmd_query (stream->gfs->conn,
+			    stream->gfs->ns.chunks, 0,
+			    0, 1, b, NULL);
+  bson_free (b);
+
+  mongo_wire_reply_packet_get_nth_document (p, 1, &doc);
+  mongo_wire_packet_free (p);
+  bson_finish (doc);
+
+  return _stream_chunk_set (stream, doc);
+}
+
+/** @internal Drop the read-ahead cursor of a reader, if any. */
+static void
+_stream_read_ahead_stop (mongo_sync_gridfs_stream *stream)
+{
+  if (!stream->read_ahead.cursor)
+    return;
+
+  mongo_sync_cursor_free (stream->read_ahead.cursor);
+  stream->read_ahead.cursor = NULL;
+}
+
+/** @internal Open a cursor over the chunks of a reader, starting
+ * from a given one, in order.
+ *
+ * Every batch of the cursor carries a read-ahead window worth of
+ * chunks, so reading the file sequentially costs one round-trip per
+ * window, instead of one per chunk.
+ */
+static gboolean
+_stream_read_ahead_start (mongo_sync_gridfs_stream *stream, gint64 chunk)
+{
+  bson *q, *cond, *order;
+  mongo_packet *p;
+
+  cond = bson_new_sized (16);
+  bson_append_int64 (cond, "$gte", chunk);
+  bson_finish (cond);
+
+  q = bson_new_sized (32);
+  bson_append_oid (q, "files_id", stream->file.id);
+  bson_append_document (q, "n", cond);
+  bson_finish (q);
+  bson_free (cond);
+
+  order = bson_new_sized (16);
+  bson_append_int32 (order, "n", 1);
+  bson_finish (order);
+
+  cond = bson_new_sized (64);
+  bson_append_document (cond, "$query", q);
+  bson_append_document (cond, "$orderby", order);
+  bson_finish (cond);
+  bson_free (q);
+  bson_free (order);
+
+  p = mongo_sync_cmd_query (stream->gfs->conn, stream->gfs->ns.chunks, 0,
+			    0, stream->read_ahead.window, cond, NULL);
+  bson_free (cond);
+  if (!p)
+    return FALSE;
+
+  stream->read_ahead.cursor = mongo_sync_cursor_new (stream->gfs->conn,
+						     stream->gfs->ns.chunks,
+						     p);
+  if (!stream->read_ahead.cursor)
+    {
+      mongo_wire_packet_free (p);
+      return FALSE;
+    }
+  mongo_sync_cursor_set_batch_size (stream->read_ahead.cursor,
+				    stream->read_ahead.window);
+  stream->read_ahead.next = chunk;
+
+  return TRUE;
+}
+
+/** @internal Move a reader to a chunk, while reading sequentially.
+ *
+ * Chunks come from the read-ahead cursor, which is (re)opened
+ * whenever it does not continue where the reader is, such as after a
+ * seek. Only with read-ahead disabled are chunks fetched one by one.
+ */
+static gboolean
+_stream_next_chunk (mongo_sync_gridfs_stream *stream, gint64 chunk)
+{
+  bson *doc;
+  bson_cursor *c;
+  gint64 n = -1;
+  gint32 n32;
+
+  if (stream->read_ahead.window == 0)
+    return _stream_seek_chunk (stream, chunk);
+
+  if (stream->read_ahead.cursor && stream->read_ahead.next != chunk)
+    _stream_read_ahead_stop (stream);
+  if (!stream->read_ahead.cursor &&
+      !_stream_read_ahead_start (stream, chunk))
+    return FALSE;
+
+  errno = 0;
+  if (!mongo_sync_cursor_next (stream->read_ahead.cursor))
+    {
+      int e = (errno) ? errno : EPROTO;
+
+      _stream_read_ahead_stop (stream);
+      errno = e;
+      return FALSE;
+    }
+  doc = mongo_sync_cursor_get_data (stream->read_ahead.cursor);
+  stream->read_ahead.next++;
+
+  /* A missing chunk would shift the rest of the file: catch it. */
+  c = bson_find (doc, "n");
+  if (!bson_cursor_get_int64 (c, &n) && bson_cursor_get_int32 (c, &n32))
+    n = n32;
+  bson_cursor_free (c);
+  if (n != chunk)
+    {
+      bson_free (doc);
+      _stream_read_ahead_stop (stream);
+      errno = EPROTO;
+      return FALSE;
+    }
+
+  return _stream_chunk_set (stream, doc);
+}
+
 gint64
 mongo_sync_gridfs_stream_read (mongo_sync_gridfs_stream *stream,
 			       guint8 *buffer,
@@ -241,7 +374,7 @@ mongo_sync_gridfs_stream_read (mongo_sync_gridfs_stream *stream,
 
   if (!stream->reader.chunk.data)
     {
-      if (!_stream_seek_chunk (stream, 0))
+      if (!_stream_next_chunk (stream, stream->file.current_chunk))
 	return -1;
     }
 
@@ -268,7 +401,7 @@ mongo_sync_gridfs_stream_read (mongo_sync_gridfs_stream *stream,
           stream->file.length)
 	{
 	  stream->file.current_chunk++;
-	  if (!_stream_seek_chunk (stream, stream->file.current_chunk))
+	  if (!_stream_next_chunk (stream, stream->file.current_chunk))
 	    return -1;
 	}
     }
@@ -276,33 +409,6 @@ mongo_sync_gridfs_stream_read (mongo_sync_gridfs_stream *stream,
   return pos;
 }
 
-static gboolean
-_stream_chunk_write (mongo_sync_gridfs *gfs,
-		     const guint8 *oid, gint64 n,
-		     const guint8 *buffer, gint32 size)
-{
-  bson *chunk;
-
-  chunk = bson_new_sized (size + 128);
-  bson_append_oid (chunk, "files_id", oid);
-  bson_append_int64 (chunk, "n", n);
-  bson_append_binary (chunk, "data", BSON_BINARY_SUBTYPE_GENERIC,
-		      buffer, size);
-  bson_finish (chunk);
-
-  if (!mongo_sync_cmd_insert (gfs->conn, gfs->ns.chunks, chunk, NULL))
-    {
-      int e = errno;
-
-      bson_free (chunk);
-      errno = e;
-      return FALSE;
-    }
-  bson_free (chunk);
-
-  return TRUE;
-}
-
 gboolean
 mongo_sync_gridfs_stream_write (mongo_sync_gridfs_stream *stream,
 				const guint8 *buffer,
@@ -342,11 +448,12 @@ mongo_sync_gridfs_stream_write (mongo_sync_gridfs_stream *stream,
 
       if (stream->writer.buffer_offset == stream->file.chunk_size)
 	{
-	  if (!_stream_chunk_write (stream->gfs,
-				    stream->file.id,
-				    stream->file.current_chunk,
-				    stream->writer.buffer,
-				    stream->file.chunk_size))
+	  if (!mongo_sync_gridfs_chunk_batch_add (stream->gfs,
+						  &stream->writer.batch,
+						  stream->file.id,
+						  stream->file.current_chunk,
+						  stream->writer.buffer,
+						  stream->file.chunk_size))
 	    return FALSE;
 	  g_checksum_update (stream->writer.checksum, stream->writer.buffer,
 			     stream->file.chunk_size);
@@ -359,6 +466,33 @@ mongo_sync_gridfs_stream_write (mongo_sync_gridfs_stream *stream,
   return TRUE;
 }
 
+gboolean
+mongo_sync_gridfs_stream_set_read_ahead (mongo_sync_gridfs_stream *stream,
+					 gint32 chunks)
+{
+  if (!stream)
+    {
+      errno = ENOENT;
+      return FALSE;
+    }
+  if (stream->file.type != LMC_GRIDFS_FILE_STREAM_READER)
+    {
+      errno = EOPNOTSUPP;
+      return FALSE;
+    }
+  if (chunks < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  /* The window of an open cursor is fixed by its query. */
+  _stream_read_ahead_stop (stream);
+  stream->read_ahead.window = chunks;
+
+  return TRUE;
+}
+
 gboolean
 mongo_sync_gridfs_stream_seek (mongo_sync_gridfs_stream *stream,
 			       gint64 pos,
@@ -418,6 +552,10 @@ mongo_sync_gridfs_stream_seek (mongo_sync_gridfs_stream *stream,
   chunk = real_pos / stream->file.chunk_size;
   offs = real_pos % stream->file.chunk_size;
 
+  /* Reading on from an arbitrary position is not necessarily
+     sequential, so only the chunk sought to is fetched, and reading
+     ahead resumes once the reader moves on to the next one. */
+  _stream_read_ahead_stop (stream);
   if (!_stream_seek_chunk (stream, chunk))
     return FALSE;
 
@@ -449,23 +587,31 @@ mongo_sync_gridfs_stream_close (mongo_sync_gridfs_stream *stream)
       bson *meta;
       gint64 upload_date;
       GTimeVal tv;
-      gboolean closed = FALSE;
 
       if (stream->writer.buffer_offset > 0)
 	{
-	  closed = _stream_chunk_write (stream->gfs,
-					stream->file.id,
-					stream->file.current_chunk,
-					stream->writer.buffer,
-					stream->writer.buffer_offset);
-
-	  if (closed)
-	    g_checksum_update (stream->writer.checksum,
-			       stream->writer.buffer,
-			       stream->writer.buffer_offset);
+	  if (!mongo_sync_gridfs_chunk_batch_add (stream->gfs,
+						  &stream->writer.batch,
+						  stream->file.id,
+						  stream->file.current_chunk,
+						  stream->writer.buffer,
+						  stream->writer.buffer_offset))
+	    return FALSE;
+
+	  g_checksum_update (stream->writer.checksum,
+			     stream->writer.buffer,
+			     stream->writer.buffer_offset);
+	  stream->writer.buffer_offset = 0;
+	  stream->file.current_chunk++;
 	}
 
-      if (closed)
+      /* The batch is only emptied once inserted, so a failed close
+	 can be retried. */
+      if (!mongo_sync_gridfs_chunk_batch_flush (stream->gfs,
+						&stream->writer.batch))
+	return FALSE;
+
+      if (stream->file.length > 0)
 	{
 	  g_get_current_time (&tv);
 	  upload_date =  (((gint64) tv.tv_sec) * 1000) +
@@ -494,12 +640,16 @@ mongo_sync_gridfs_stream_close (mongo_sync_gridfs_stream *stream)
 	  bson_free (meta);
 	}
 
+      mongo_sync_gridfs_chunk_batch_clear (&stream->writer.batch);
       bson_free (stream->writer.metadata);
       g_checksum_free (stream->writer.checksum);
       g_free (stream->writer.buffer);
     }
   else
-    bson_free (stream->reader.bson);
+    {
+      _stream_read_ahead_stop (stream);
+      bson_free (stream->reader.bson);
+    }
 
   g_free (stream->file.id);
   g_free (stream);
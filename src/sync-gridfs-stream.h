@@ -49,6 +49,9 @@ G_BEGIN_DECLS
 /** Opaque GridFS file stream object type. */
 typedef struct _mongo_sync_gridfs_stream mongo_sync_gridfs_stream;
 
+/** Default number of chunks stream readers read ahead. */
+#define MONGO_SYNC_GRIDFS_STREAM_DEFAULT_READ_AHEAD 16
+
 /** Create a stream reader by finding the file matching a query.
  *
  * @param gfs is the GridFS to search on.
@@ -94,6 +97,11 @@ gint64 mongo_sync_gridfs_stream_read (mongo_sync_gridfs_stream *stream,
 				      gint64 size);
 
 /** Write an arbitrary number of bytes to a GridFS stream.
+ *
+ * Finished chunks are collected, and inserted with a single message
+ * once no more fit under the maximum insert size of the connection,
+ * so an insert failing may only be reported by a later write, or by
+ * mongo_sync_gridfs_stream_close().
  *
  * @param stream is the write-only stream to write to.
  * @param buffer is the data to write.
@@ -105,6 +113,26 @@ gboolean mongo_sync_gridfs_stream_write (mongo_sync_gridfs_stream *stream,
 					 const guint8 *buffer,
 					 gint64 size);
 
+/** Set the read-ahead window of a GridFS stream reader.
+ *
+ * While reading sequentially, a reader fetches the chunks of the file
+ * with a single cursor, in batches of the read-ahead window, so that
+ * only one round-trip is needed per window. After a seek, only the
+ * chunk sought to is fetched, and the cursor is reopened once the
+ * reader moves on to the next chunk.
+ *
+ * @param stream is the read-only stream to change.
+ * @param chunks is the number of chunks to fetch per batch (see
+ * #MONGO_SYNC_GRIDFS_STREAM_DEFAULT_READ_AHEAD), or zero to fetch
+ * every chunk with a query of its own.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ *
+ * @note Fetching a batch holds that many chunks in memory at once.
+ */
+gboolean mongo_sync_gridfs_stream_set_read_ahead (mongo_sync_gridfs_stream *stream,
+						  gint32 chunks);
+
 /** Seek to an arbitrary position in a GridFS stream.
  *
  * @param stream is the read-only stream to seek in.
@@ -128,7 +156,9 @@ gboolean mongo_sync_gridfs_stream_seek (mongo_sync_gridfs_stream *stream,
  *
  * @param stream is the GridFS stream to close and free.
  *
- * @returns TRUE on success, FALSE otherwise.
+ * @returns TRUE on success, FALSE otherwise. If writing out the data
+ * of a write stream failed, the stream is not freed, and closing it
+ * can be retried.
  */
 gboolean mongo_sync_gridfs_stream_close (mongo_sync_gridfs_stream *stream);
 
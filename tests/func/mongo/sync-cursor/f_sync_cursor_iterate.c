@@ -82,7 +82,65 @@ test_func_mongo_sync_cursor_iterate (void)
 	  "Iteration really does return all documents");
 
   mongo_sync_cursor_free (sc);
+
+  /* Iterate again, prefetching each batch halfway through the
+     previous one. */
+  query = bson_new ();
+  bson_append_boolean (query, "f_sync_cursor_iterate", TRUE);
+  bson_finish (query);
+
+  sc = mongo_sync_cursor_new (conn, config.ns,
+			      mongo_sync_cmd_query (conn, config.ns, 0, 0, 3,
+						    query, NULL));
+  bson_free (query);
+
+  ok (mongo_sync_cursor_set_prefetch (sc, 0.5),
+      "mongo_sync_cursor_set_prefetch() works");
+
+  i = 0;
+  first_i32 = last_i32 = -1;
+  early_break = FALSE;
+  continous = TRUE;
+  while (mongo_sync_cursor_next (sc) && i < 10)
+    {
+      result = mongo_sync_cursor_get_data (sc);
+
+      if (!result)
+	{
+	  early_break = TRUE;
+	  break;
+	}
+      i++;
+      c = bson_find (result, "i32");
+      bson_cursor_get_int32 (c, &current_i32);
+      bson_cursor_free (c);
+      bson_free (result);
+
+      if (first_i32 == -1)
+	{
+	  first_i32 = current_i32;
+	  last_i32 = first_i32 - 1;
+	}
+
+      if (current_i32 != last_i32 + 1)
+	continous = FALSE;
+      last_i32 = current_i32;
+    }
+
+  ok (early_break == FALSE,
+      "mongo_sync_cursor_next() can iterate over the whole stuff, "
+      "with prefetching");
+  ok (continous == TRUE,
+      "Prefetching iterates over all elements, in order");
+  cmp_ok (i, ">=", 10,
+	  "Prefetching returns all documents");
+
+  mongo_sync_cursor_free (sc);
+
+  ok (mongo_sync_cmd_ping (conn),
+      "The connection is usable after freeing a prefetching cursor");
+
   mongo_sync_disconnect (conn);
 }
 
-RUN_NET_TEST (6, func_mongo_sync_cursor_iterate);
+RUN_NET_TEST (11, func_mongo_sync_cursor_iterate);
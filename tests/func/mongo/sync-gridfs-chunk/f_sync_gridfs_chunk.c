@@ -1,6 +1,9 @@
 #include "test.h"
 #include "mongo.h"
 
+#include <stdlib.h>
+#include <unistd.h>
+
 #define FILE_SIZE 1024 * 1024 + 12345
 
 static guint8 noname_oid[12];
@@ -476,6 +479,62 @@ test_func_sync_gridfs_get_binary_subtype (void)
   mongo_sync_gridfs_free (gfs, TRUE);
 }
 
+void
+test_func_sync_gridfs_fd (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_gridfs_chunked_file *gfile;
+  gchar in_name[] = "/tmp/lmc-gridfs-in-XXXXXX";
+  gchar out_name[] = "/tmp/lmc-gridfs-out-XXXXXX";
+  guint8 *data, *back;
+  gint in, out, i;
+  bson *q;
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, config.gfs_prefix);
+
+  data = g_malloc (FILE_SIZE);
+  for (i = 0; i < FILE_SIZE; i++)
+    data[i] = i % 251;
+
+  in = mkstemp (in_name);
+  out = mkstemp (out_name);
+  unlink (in_name);
+  unlink (out_name);
+  if (write (in, data, FILE_SIZE) != FILE_SIZE)
+    note ("Could not write the test file\n");
+  lseek (in, 0, SEEK_SET);
+
+  gfile = mongo_sync_gridfs_upload_from_fd (gfs, NULL, in);
+  ok (gfile != NULL,
+      "mongo_sync_gridfs_upload_from_fd() works");
+  cmp_ok (mongo_sync_gridfs_file_get_length (gfile), "==", FILE_SIZE,
+	  "The uploaded file has the right length");
+
+  cmp_ok (mongo_sync_gridfs_download_to_fd (gfile, out), "==", FILE_SIZE,
+	  "mongo_sync_gridfs_download_to_fd() works");
+
+  back = g_malloc0 (FILE_SIZE);
+  lseek (out, 0, SEEK_SET);
+  ok (read (out, back, FILE_SIZE) == FILE_SIZE &&
+      memcmp (data, back, FILE_SIZE) == 0,
+      "The downloaded file matches the uploaded one");
+
+  q = bson_new ();
+  bson_append_oid (q, "_id", mongo_sync_gridfs_file_get_id (gfile));
+  bson_finish (q);
+  mongo_sync_gridfs_remove (gfs, q);
+  bson_free (q);
+
+  mongo_sync_gridfs_chunked_file_free (gfile);
+  close (in);
+  close (out);
+  g_free (back);
+  g_free (data);
+  mongo_sync_gridfs_free (gfs, TRUE);
+}
+
 void
 test_func_sync_gridfs_chunk (void)
 {
@@ -490,10 +549,12 @@ test_func_sync_gridfs_chunk (void)
   test_func_sync_gridfs_put_binary_subtype ();
   test_func_sync_gridfs_get_binary_subtype ();
 
+  test_func_sync_gridfs_fd ();
+
   test_func_sync_gridfs_put_invalid ();
   test_func_sync_gridfs_get_invalid ();
 
   test_fync_sync_gridfs_remove ();
 }
 
-RUN_NET_TEST (37, func_sync_gridfs_chunk);
+RUN_NET_TEST (41, func_sync_gridfs_chunk);
@@ -261,6 +261,53 @@ test_func_sync_gridfs_stream_read (void)
   mongo_sync_gridfs_free (gfs, TRUE);
 }
 
+void
+test_func_sync_gridfs_stream_read_without_read_ahead (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_gridfs_stream *stream;
+  guint8 data[12345];
+  gint64 pos = 0;
+  bson *meta;
+
+  GChecksum *chk;
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, config.gfs_prefix);
+  meta = bson_build (BSON_TYPE_STRING, "filename", "libmongo-test-stream", -1,
+		     BSON_TYPE_NONE);
+  bson_finish (meta);
+
+  stream = mongo_sync_gridfs_stream_find (gfs, meta);
+  bson_free (meta);
+  ok (mongo_sync_gridfs_stream_set_read_ahead (stream, 0) == TRUE,
+      "mongo_sync_gridfs_stream_set_read_ahead() can disable read-ahead");
+
+  chk = g_checksum_new (G_CHECKSUM_MD5);
+
+  while (pos < FILE_SIZE)
+    {
+      gint64 r;
+
+      r = mongo_sync_gridfs_stream_read (stream, data, sizeof (data));
+      if (r == -1)
+	break;
+
+      g_checksum_update (chk, data, r);
+      pos += r;
+    }
+
+  cmp_ok (pos, "==", FILE_SIZE,
+	  "mongo_sync_gridfs_stream_read() works without read-ahead");
+  is (g_checksum_get_string (chk), write_md5,
+      "md5sums match");
+
+  g_checksum_free (chk);
+  mongo_sync_gridfs_stream_close (stream);
+  mongo_sync_gridfs_free (gfs, TRUE);
+}
+
 void
 test_func_sync_gridfs_stream_read_binary_subtype (void)
 {
@@ -489,6 +536,7 @@ test_func_sync_gridfs_stream (void)
   test_func_sync_gridfs_stream_write_binary_subtype ();
   test_func_sync_gridfs_stream_write_invalid ();
   test_func_sync_gridfs_stream_read ();
+  test_func_sync_gridfs_stream_read_without_read_ahead ();
   test_func_sync_gridfs_stream_read_binary_subtype ();
   test_func_sync_gridfs_stream_read_invalid ();
   test_func_sync_gridfs_stream_seek ();
@@ -498,4 +546,4 @@ test_func_sync_gridfs_stream (void)
   g_free (write_md5);
 }
 
-RUN_NET_TEST (38, func_sync_gridfs_stream);
+RUN_NET_TEST (41, func_sync_gridfs_stream);
@@ -0,0 +1,89 @@
+#include "test.h"
+#include <mongo.h>
+
+#include <errno.h>
+
+#include "libmongo-private.h"
+
+void
+test_func_mongo_sync_monitor_secondary (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_monitor *m;
+  mongo_sync_member_info info;
+  gchar *addr, *primary;
+
+  skip (!config.secondary_host, 4,
+	"Secondary server not configured");
+
+  /* Seed the monitor with the secondary only, and let it find the
+     primary on its own. */
+  conn = mongo_sync_connect (config.secondary_host, config.secondary_port,
+			     TRUE);
+  m = mongo_sync_monitor_new (conn, 500);
+  mongo_sync_monitor_refresh (m);
+
+  addr = g_strdup_printf ("%s:%d", config.secondary_host,
+			  config.secondary_port);
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.role == MONGO_SYNC_MEMBER_SECONDARY,
+      "The monitor recognises secondaries");
+  g_free (addr);
+
+  primary = mongo_sync_monitor_get_primary (m);
+  ok (primary != NULL,
+      "The monitor discovers the primary through a secondary");
+  g_free (primary);
+
+  mongo_sync_conn_set_monitor (conn, m);
+  ok (mongo_sync_reconnect (conn, TRUE) == conn,
+      "Reconnecting through the monitor works");
+  ok (mongo_sync_cmd_is_master (conn),
+      "Reconnecting through the monitor finds the master");
+
+  mongo_sync_disconnect (conn);
+  mongo_sync_monitor_free (m);
+
+  endskip;
+}
+
+void
+test_func_mongo_sync_monitor (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_monitor *m;
+  mongo_sync_member_info info;
+  gchar *addr;
+  gint64 last_seen;
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port,
+			     FALSE);
+  m = mongo_sync_monitor_new (conn, 100);
+  ok (m != NULL,
+      "mongo_sync_monitor_new() works");
+
+  mongo_sync_monitor_refresh (m);
+
+  addr = g_strdup_printf ("%s:%d", config.primary_host,
+			  config.primary_port);
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.role == MONGO_SYNC_MEMBER_PRIMARY,
+      "The monitor recognises the primary");
+  ok (info.rtt >= 0 && info.last_seen > 0,
+      "The monitor records RTT and last-seen time");
+  last_seen = info.last_seen;
+
+  /* Wait for a few heartbeats, without asking for a refresh. */
+  g_usleep (500 * 1000);
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.last_seen > last_seen,
+      "The monitor keeps checking the members on its own");
+  g_free (addr);
+
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (conn);
+
+  test_func_mongo_sync_monitor_secondary ();
+}
+
+RUN_NET_TEST (8, func_mongo_sync_monitor);
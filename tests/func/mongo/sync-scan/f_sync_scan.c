@@ -0,0 +1,103 @@
+#include "test.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define SCAN_DOCS 1000
+
+static gboolean
+_scan_mark (const bson *doc, gint partition, gpointer user_data)
+{
+  gint *seen = (gint *)user_data;
+  bson_cursor *c;
+  gint32 n = -1;
+
+  c = bson_find (doc, "n");
+  bson_cursor_get_int32 (c, &n);
+  bson_cursor_free (c);
+
+  if (n < 0 || n >= SCAN_DOCS)
+    return FALSE;
+  g_atomic_int_inc (&seen[n]);
+  return TRUE;
+}
+
+static gboolean
+_scan_verify (gint *seen)
+{
+  gint i;
+
+  for (i = 0; i < SCAN_DOCS; i++)
+    if (seen[i] != 1)
+      return FALSE;
+  return TRUE;
+}
+
+void
+test_func_mongo_sync_scan (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_pool *pool;
+  gchar *coll, *ns;
+  gint *seen, i;
+  bson *query;
+
+  coll = g_strconcat (config.coll, "_scan", NULL);
+  ns = g_strconcat (config.db, ".", coll, NULL);
+  seen = g_new0 (gint, SCAN_DOCS);
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port, FALSE);
+  mongo_sync_conn_set_safe_mode (conn, TRUE);
+  mongo_sync_cmd_drop (conn, config.db, coll);
+
+  for (i = 0; i < SCAN_DOCS; i++)
+    {
+      bson *b = bson_new ();
+
+      bson_append_int32 (b, "n", i);
+      bson_append_boolean (b, "even", (i % 2) == 0);
+      bson_finish (b);
+      mongo_sync_cmd_insert (conn, ns, b, NULL);
+      bson_free (b);
+    }
+
+  pool = mongo_sync_pool_new (config.primary_host, config.primary_port, 4, 0);
+
+  ok (mongo_sync_pool_scan (pool, ns, NULL, NULL, 4,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _scan_mark, seen),
+      "mongo_sync_pool_scan() works with sampled split points");
+  ok (_scan_verify (seen),
+      "Every document is scanned exactly once");
+
+  memset (seen, 0, sizeof (gint) * SCAN_DOCS);
+  ok (mongo_sync_pool_scan (pool, ns, NULL, NULL, 8,
+			    MONGO_SYNC_SCAN_SPLIT_BOUNDS, _scan_mark, seen),
+      "mongo_sync_pool_scan() works with interpolated split points, "
+      "and more partitions than connections");
+  ok (_scan_verify (seen),
+      "Every document is scanned exactly once");
+
+  memset (seen, 0, sizeof (gint) * SCAN_DOCS);
+  query = bson_new ();
+  bson_append_boolean (query, "even", TRUE);
+  bson_finish (query);
+  ok (mongo_sync_pool_scan (pool, ns, query, NULL, 4,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _scan_mark, seen),
+      "mongo_sync_pool_scan() works with a query");
+  for (i = 0; i < SCAN_DOCS; i++)
+    if (seen[i] != ((i % 2) == 0))
+      break;
+  cmp_ok (i, "==", SCAN_DOCS,
+	  "Only the matching documents are scanned");
+  bson_free (query);
+
+  mongo_sync_cmd_drop (conn, config.db, coll);
+  mongo_sync_pool_free (pool);
+  mongo_sync_disconnect (conn);
+  g_free (seen);
+  g_free (ns);
+  g_free (coll);
+}
+
+RUN_NET_TEST (6, func_mongo_sync_scan);
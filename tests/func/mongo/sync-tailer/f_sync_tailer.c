@@ -0,0 +1,100 @@
+#include "test.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <string.h>
+
+static gint entries;
+
+static gboolean
+_count_entries (const bson **docs, gint n, gpointer user_data)
+{
+  entries += n;
+  return TRUE;
+}
+
+static void
+_insert_entries (mongo_sync_connection *conn, const gchar *ns,
+		 gint from, gint to)
+{
+  gint i;
+
+  for (i = from; i < to; i++)
+    {
+      bson *b = bson_new ();
+
+      bson_append_timestamp (b, "ts", ((gint64)1294860709 << 32) | i);
+      bson_append_int32 (b, "i", i);
+      bson_finish (b);
+      mongo_sync_cmd_insert (conn, ns, b, NULL);
+      bson_free (b);
+    }
+}
+
+void
+test_func_mongo_sync_tailer (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+  gchar *capped_coll, *capped_ns;
+  mongo_packet *p;
+  bson *cmd;
+  gint64 last = 0;
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port, FALSE);
+  mongo_sync_conn_set_safe_mode (conn, TRUE);
+
+  capped_coll = g_strconcat (config.coll, ".tailer", NULL);
+  capped_ns = g_strconcat (config.ns, ".tailer", NULL);
+
+  cmd = bson_build (BSON_TYPE_STRING, "create", capped_coll, -1,
+		    BSON_TYPE_BOOLEAN, "capped", TRUE,
+		    BSON_TYPE_INT32, "size", 64 * 1024,
+		    BSON_TYPE_NONE);
+  bson_finish (cmd);
+  mongo_sync_cmd_drop (conn, config.db, capped_coll);
+  p = mongo_sync_cmd_custom (conn, config.db, cmd);
+  mongo_wire_packet_free (p);
+  bson_free (cmd);
+
+  t = mongo_sync_tailer_new (conn, capped_ns, NULL);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_entries, NULL), "==", 0,
+	  "Tailing an empty capped collection delivers nothing");
+
+  _insert_entries (conn, capped_ns, 1, 11);
+  while (entries < 10 &&
+	 mongo_sync_tailer_poll (t, _count_entries, NULL) >= 0)
+    ;
+  cmp_ok (entries, "==", 10,
+	  "The tailer delivers every entry");
+
+  _insert_entries (conn, capped_ns, 11, 16);
+  while (entries < 15 &&
+	 mongo_sync_tailer_poll (t, _count_entries, NULL) >= 0)
+    ;
+  cmp_ok (entries, "==", 15,
+	  "The tailer follows new entries");
+
+  ok (mongo_sync_tailer_get_last (t, &last) &&
+      last == (((gint64)1294860709 << 32) | 15),
+      "The tailer remembers the last entry");
+  mongo_sync_tailer_free (t);
+
+  /* Resume from the middle, on a fresh tailer. */
+  entries = 0;
+  t = mongo_sync_tailer_new (conn, capped_ns, NULL);
+  mongo_sync_tailer_set_start (t, ((gint64)1294860709 << 32) | 12);
+  while (entries < 3 &&
+	 mongo_sync_tailer_poll (t, _count_entries, NULL) >= 0)
+    ;
+  cmp_ok (entries, "==", 3,
+	  "The tailer resumes after the start position");
+  mongo_sync_tailer_free (t);
+
+  mongo_sync_cmd_drop (conn, config.db, capped_coll);
+  g_free (capped_ns);
+  g_free (capped_coll);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_NET_TEST (5, func_mongo_sync_tailer);
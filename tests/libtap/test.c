@@ -4,6 +4,13 @@
 
 #include <glib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 func_config_t config;
 
@@ -122,6 +129,157 @@ test_make_fake_sync_conn (gint fd, gboolean slaveok)
   return c;
 }
 
+static gboolean
+_mock_server_recv_all (gint fd, guint8 *buf, gsize size)
+{
+  gsize done = 0;
+
+  while (done < size)
+    {
+      gssize r = recv (fd, buf + done, size - done, 0);
+
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r <= 0)
+	return FALSE;
+      done += r;
+    }
+  return TRUE;
+}
+
+/* Serve a single client: answer every query and getmore with a
+   { ismaster: true, ok: 1 } reply, @delay milliseconds late, and
+   silently swallow everything else. */
+static void
+_mock_server_serve (gint fd, gint delay)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  guint8 *buf = NULL, *reply;
+  gsize bufsize = 0, reply_size;
+  bson *doc;
+
+  doc = bson_new ();
+  bson_append_boolean (doc, "ismaster", TRUE);
+  bson_append_double (doc, "ok", 1);
+  bson_finish (doc);
+
+  reply_size = sizeof (h) + sizeof (rh) + bson_size (doc);
+  reply = g_malloc (reply_size);
+
+  while (_mock_server_recv_all (fd, (guint8 *)&h, sizeof (h)))
+    {
+      gsize size = GINT32_FROM_LE (h.length) - sizeof (h);
+
+      if (size > bufsize)
+	{
+	  bufsize = size;
+	  buf = g_realloc (buf, bufsize);
+	}
+      if (!_mock_server_recv_all (fd, buf, size))
+	break;
+
+      if (GINT32_FROM_LE (h.opcode) != 2004 &&
+	  GINT32_FROM_LE (h.opcode) != 2005)
+	continue;
+
+      h.resp_to = h.id;
+      h.id = GINT32_TO_LE (1984);
+      h.opcode = GINT32_TO_LE (1);
+      h.length = GINT32_TO_LE (reply_size);
+
+      rh.flags = 0;
+      rh.cursor_id = 0;
+      rh.start = 0;
+      rh.returned = GINT32_TO_LE (1);
+
+      memcpy (reply, &h, sizeof (h));
+      memcpy (reply + sizeof (h), &rh, sizeof (rh));
+      memcpy (reply + sizeof (h) + sizeof (rh), bson_data (doc),
+	      bson_size (doc));
+      if (delay > 0)
+	g_usleep (delay * 1000);
+      if (send (fd, reply, reply_size, MSG_NOSIGNAL) != (gssize)reply_size)
+	break;
+    }
+
+  g_free (reply);
+  g_free (buf);
+  bson_free (doc);
+  close (fd);
+}
+
+pid_t
+test_mock_server_start_delayed (gint *port, gint delay)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof (sa);
+  gint fd, one = 1;
+  pid_t pid;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa.sin_port = 0;
+
+  if (bind (fd, (struct sockaddr *)&sa, sizeof (sa)) != 0 ||
+      listen (fd, 64) != 0 ||
+      getsockname (fd, (struct sockaddr *)&sa, &len) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+  *port = ntohs (sa.sin_port);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* Put the server and its connection handlers into their own
+	 process group, so stopping it drops every connection. */
+      setpgid (0, 0);
+      signal (SIGCHLD, SIG_IGN);
+      for (;;)
+	{
+	  gint c = accept (fd, NULL, NULL);
+
+	  if (c < 0)
+	    continue;
+	  if (fork () == 0)
+	    {
+	      close (fd);
+	      _mock_server_serve (c, delay);
+	      _exit (0);
+	    }
+	  close (c);
+	}
+    }
+
+  close (fd);
+  return pid;
+}
+
+pid_t
+test_mock_server_start (gint *port)
+{
+  return test_mock_server_start_delayed (port, 0);
+}
+
+void
+test_mock_server_stop (pid_t pid)
+{
+  if (pid <= 0)
+    return;
+
+  kill (-pid, SIGTERM);
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+}
+
 gboolean
 test_env_setup (void)
 {
@@ -8,6 +8,7 @@
 #include "libmongo-private.h"
 
 #include <dlfcn.h>
+#include <sys/types.h>
 
 typedef struct
 {
@@ -70,6 +71,10 @@ mongo_packet *test_mongo_wire_generate_reply (gboolean valid,
 mongo_sync_connection *test_make_fake_sync_conn (gint fd,
 						 gboolean slaveok);
 
+pid_t test_mock_server_start (gint *port);
+pid_t test_mock_server_start_delayed (gint *port, gint delay);
+void test_mock_server_stop (pid_t pid);
+
 #define SAVE_OLD_FUNC(n)				\
   static void *(*func_##n)();				\
   if (!func_##n)					\
@@ -0,0 +1,88 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#define NUM_OPS 25
+
+/* Each round is an insert (which gets no reply), followed by a small
+   query. With Nagle's algorithm enabled, the query waits for the
+   insert to be acknowledged, which the server delays. */
+static gdouble
+_small_op_rtt (mongo_connection *conn)
+{
+  mongo_packet *insert, *query, *p;
+  GTimer *timer;
+  gdouble elapsed;
+  bson *b;
+  gint i;
+
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+  insert = mongo_wire_cmd_insert (1, "test.rtt", b, NULL);
+  query = mongo_wire_cmd_custom (2, "admin", 0, b);
+  bson_free (b);
+
+  timer = g_timer_new ();
+  for (i = 0; i < NUM_OPS; i++)
+    {
+      if (!mongo_packet_send (conn, insert) ||
+	  !mongo_packet_send (conn, query) ||
+	  (p = mongo_packet_recv (conn)) == NULL)
+	{
+	  elapsed = -1;
+	  goto out;
+	}
+      mongo_wire_packet_free (p);
+    }
+  elapsed = g_timer_elapsed (timer, NULL) / NUM_OPS;
+
+ out:
+  g_timer_destroy (timer);
+  mongo_wire_packet_free (insert);
+  mongo_wire_packet_free (query);
+  return elapsed;
+}
+
+void
+test_p_client_rtt (void)
+{
+  mongo_connection *conn;
+  mongo_connection_options opts;
+  gdouble t_nagle, t_nodelay, t_busy_poll;
+  gint port;
+  pid_t server;
+
+  server = test_mock_server_start (&port);
+
+  mongo_connection_options_init (&opts);
+  opts.tcp_nodelay = FALSE;
+  conn = mongo_connect_with_options ("127.0.0.1", port, &opts);
+  t_nagle = _small_op_rtt (conn);
+  ok (t_nagle > 0,
+      "Small operations work with Nagle's algorithm enabled");
+  mongo_disconnect (conn);
+
+  conn = mongo_connect_with_options ("127.0.0.1", port, NULL);
+  t_nodelay = _small_op_rtt (conn);
+  ok (t_nodelay > 0,
+      "Small operations work with the default options");
+  mongo_disconnect (conn);
+
+  mongo_connection_options_init (&opts);
+  opts.busy_poll = 50;
+  conn = mongo_connect_with_options ("127.0.0.1", port, &opts);
+  t_busy_poll = _small_op_rtt (conn);
+  ok (t_busy_poll > 0,
+      "Small operations work with busy polling");
+  mongo_disconnect (conn);
+
+  note ("Average round-trip of %d small operations: Nagle: %.1fus, "
+	"defaults: %.1fus, busy poll: %.1fus", NUM_OPS,
+	t_nagle * 1000000, t_nodelay * 1000000, t_busy_poll * 1000000);
+
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (3, p_client_rtt);
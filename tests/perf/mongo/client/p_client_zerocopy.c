@@ -0,0 +1,100 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+#include "libmongo-private.h"
+
+#define PACKET_SIZE (1024 * 1024)
+#define NUM_PACKETS 256
+
+/* Send NUM_PACKETS inserts of PACKET_SIZE bytes each, then wait for a
+   reply, so that the server consumed everything by the time we stop
+   the clock. */
+static gdouble
+_send_packets (mongo_connection *conn, mongo_packet *insert)
+{
+  mongo_packet *p;
+  GTimer *timer;
+  gdouble elapsed;
+  bson *b;
+  gint i;
+
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+
+  timer = g_timer_new ();
+  for (i = 0; i < NUM_PACKETS; i++)
+    {
+      if (!mongo_packet_send (conn, insert))
+	{
+	  bson_free (b);
+	  g_timer_destroy (timer);
+	  return -1;
+	}
+    }
+
+  p = mongo_wire_cmd_custom (2, "admin", 0, b);
+  mongo_packet_send (conn, p);
+  mongo_wire_packet_free (p);
+  p = mongo_packet_recv (conn);
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+  bson_free (b);
+
+  if (!p)
+    return -1;
+  mongo_wire_packet_free (p);
+  return elapsed;
+}
+
+void
+test_p_client_zerocopy (void)
+{
+  mongo_connection *conn;
+  mongo_packet *insert;
+  guint8 *blob;
+  gdouble t_copy, t_zerocopy;
+  gint port;
+  pid_t server;
+  bson *b;
+
+  blob = g_malloc0 (PACKET_SIZE);
+  b = bson_new_sized (PACKET_SIZE + 64);
+  bson_append_binary (b, "blob", BSON_BINARY_SUBTYPE_GENERIC,
+		      blob, PACKET_SIZE);
+  bson_finish (b);
+  g_free (blob);
+  insert = mongo_wire_cmd_insert (1, "test.zerocopy", b, NULL);
+  bson_free (b);
+
+  server = test_mock_server_start (&port);
+
+  conn = mongo_connect ("127.0.0.1", port);
+  t_copy = _send_packets (conn, insert);
+  ok (t_copy >= 0,
+      "Copying sends work");
+  mongo_disconnect (conn);
+
+  conn = mongo_connect ("127.0.0.1", port);
+  skip (!mongo_connection_set_zerocopy (conn, 64 * 1024), 1,
+	"Zero-copy sends are not supported");
+
+  t_zerocopy = _send_packets (conn, insert);
+  ok (t_zerocopy >= 0,
+      "Zero-copy sends work");
+
+  note ("%d x %d bytes: copy: %.3fs (%.1f MiB/s), zero-copy: %.3fs "
+	"(%.1f MiB/s)", NUM_PACKETS, PACKET_SIZE,
+	t_copy, NUM_PACKETS / t_copy, t_zerocopy, NUM_PACKETS / t_zerocopy);
+
+  endskip;
+
+  mongo_disconnect (conn);
+  test_mock_server_stop (server);
+  mongo_wire_packet_free (insert);
+}
+
+RUN_TEST (2, p_client_zerocopy);
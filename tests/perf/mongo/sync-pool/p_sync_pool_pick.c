@@ -0,0 +1,103 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <string.h>
+
+#include "libmongo-private.h"
+
+#define NUM_THREADS 64
+#define NUM_CONNS 16
+#define NUM_OPS 20000
+
+typedef struct
+{
+  mongo_sync_pool *pool;
+  gint holders[NUM_CONNS]; /* Threads holding each connection. */
+  gint clashes; /* Connections handed to two threads at once. */
+  gint picks; /* Successful picks. */
+} pick_bench;
+
+static gpointer
+_pick_loop (gpointer data)
+{
+  pick_bench *b = (pick_bench *)data;
+  gint i, picks = 0;
+
+  for (i = 0; i < NUM_OPS; i++)
+    {
+      mongo_sync_pool_connection *c = mongo_sync_pool_pick (b->pool, TRUE);
+
+      if (!c)
+	continue;
+      picks++;
+      if (g_atomic_int_add (&b->holders[c->pool_id], 1) != 0)
+	g_atomic_int_inc (&b->clashes);
+      g_atomic_int_add (&b->holders[c->pool_id], -1);
+      mongo_sync_pool_return (b->pool, c);
+    }
+  g_atomic_int_add (&b->picks, picks);
+  return NULL;
+}
+
+static gdouble
+_pick_bench_run (pick_bench *b, gint nthreads)
+{
+  GThread *threads[NUM_THREADS];
+  GTimer *timer;
+  gdouble elapsed;
+  gint i;
+
+  timer = g_timer_new ();
+  for (i = 0; i < nthreads; i++)
+    threads[i] = g_thread_new ("pick", _pick_loop, b);
+  for (i = 0; i < nthreads; i++)
+    g_thread_join (threads[i]);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return elapsed;
+}
+
+void
+test_p_sync_pool_pick (void)
+{
+  pick_bench b;
+  mongo_sync_pool_connection *conns[NUM_CONNS + 1];
+  gdouble t_single, t_contended;
+  gint port, i, n;
+  pid_t server;
+
+  server = test_mock_server_start (&port);
+
+  memset (&b, 0, sizeof (b));
+  b.pool = mongo_sync_pool_new ("127.0.0.1", port, NUM_CONNS, 0);
+
+  t_single = _pick_bench_run (&b, 1);
+  cmp_ok (b.picks, "==", NUM_OPS,
+	  "A single thread always finds a free connection");
+
+  b.picks = 0;
+  t_contended = _pick_bench_run (&b, NUM_THREADS);
+  cmp_ok (b.clashes, "==", 0,
+	  "%d threads never hold the same connection at once", NUM_THREADS);
+  cmp_ok (b.picks, ">", 0,
+	  "%d threads pick connections concurrently", NUM_THREADS);
+
+  for (n = 0; n < NUM_CONNS + 1; n++)
+    if ((conns[n] = mongo_sync_pool_pick (b.pool, TRUE)) == NULL)
+      break;
+  cmp_ok (n, "==", NUM_CONNS,
+	  "Every connection is free again afterwards");
+  for (i = 0; i < n; i++)
+    mongo_sync_pool_return (b.pool, conns[i]);
+
+  note ("Pick and return: 1 thread: %.0f ops/s, %d threads: %.0f ops/s, "
+	"%d%% of picks succeeded", NUM_OPS / t_single, NUM_THREADS,
+	NUM_OPS * NUM_THREADS / t_contended,
+	b.picks * 100 / (NUM_OPS * NUM_THREADS));
+
+  mongo_sync_pool_free (b.pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (4, p_sync_pool_pick);
@@ -0,0 +1,109 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libmongo-private.h"
+
+/* Set up a listener that never accepts, and fill its backlog, so
+   further connects to it hang, like to a dead host. */
+static gint
+_blackhole_start (gint *port, gint *fillers, gint nfillers)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof (sa);
+  gint fd, i;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  bind (fd, (struct sockaddr *)&sa, sizeof (sa));
+  listen (fd, 0);
+  getsockname (fd, (struct sockaddr *)&sa, &len);
+  *port = ntohs (sa.sin_port);
+
+  for (i = 0; i < nfillers; i++)
+    {
+      fillers[i] = socket (AF_INET, SOCK_STREAM, 0);
+      fcntl (fillers[i], F_SETFL, O_NONBLOCK);
+      connect (fillers[i], (struct sockaddr *)&sa, sizeof (sa));
+    }
+  usleep (100000);
+
+  return fd;
+}
+
+void
+test_mongo_connect_first (void)
+{
+  mongo_connection *c;
+  mongo_connection_options opts;
+  const gchar *hosts[3] = { "127.0.0.1", "127.0.0.1", "localhost" };
+  gint ports[3] = { 0, 0, 0 }, fillers[4], bh, i, index = -1;
+  pid_t server;
+  GTimer *timer;
+  mongo_packet *p;
+  bson *b;
+
+  ok (mongo_connect_first (NULL, ports, 1, NULL, NULL) == NULL,
+      "mongo_connect_first() fails without hosts");
+  ok (mongo_connect_first (hosts, NULL, 1, NULL, NULL) == NULL,
+      "mongo_connect_first() fails without ports");
+  ok (mongo_connect_first (hosts, ports, 0, NULL, NULL) == NULL,
+      "mongo_connect_first() fails with zero hosts");
+
+  server = test_mock_server_start (&ports[1]);
+  bh = _blackhole_start (&ports[0], fillers, 4);
+  ports[2] = ports[1];
+
+  mongo_connection_options_init (&opts);
+  opts.connect_timeout = 300;
+
+  timer = g_timer_new ();
+  c = mongo_connect_with_options ("127.0.0.1", ports[0], &opts);
+  ok (c == NULL && errno == ETIMEDOUT,
+      "Connecting to a dead host times out");
+  cmp_ok ((gint)(g_timer_elapsed (timer, NULL) * 1000), "<", 2000,
+	  "The connect timeout is honoured");
+
+  opts.connect_delay = 50;
+  g_timer_start (timer);
+  c = mongo_connect_first (hosts, ports, 2, &opts, &index);
+  ok (c != NULL && index == 1,
+      "mongo_connect_first() connects to the live host");
+  cmp_ok ((gint)(g_timer_elapsed (timer, NULL) * 1000), "<", 300,
+	  "mongo_connect_first() does not wait for the dead host");
+  mongo_disconnect (c);
+
+  c = mongo_connect_first (&hosts[2], &ports[2], 1, NULL, &index);
+  ok (c != NULL && index == 0,
+      "mongo_connect_first() works with a name resolving to "
+      "multiple addresses");
+
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+  p = mongo_wire_cmd_custom (1, "admin", 0, b);
+  bson_free (b);
+  mongo_packet_send (c, p);
+  mongo_wire_packet_free (p);
+  p = mongo_packet_recv (c);
+  ok (p != NULL,
+      "The connection is usable");
+  mongo_wire_packet_free (p);
+  mongo_disconnect (c);
+
+  g_timer_destroy (timer);
+  for (i = 0; i < 4; i++)
+    close (fillers[i]);
+  close (bh);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (9, mongo_connect_first);
@@ -0,0 +1,63 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "libmongo-private.h"
+
+static gint
+_getsockopt_int (gint fd, gint level, gint name)
+{
+  gint v = -1;
+  socklen_t len = sizeof (v);
+
+  getsockopt (fd, level, name, &v, &len);
+  return v;
+}
+
+void
+test_mongo_connect_with_options (void)
+{
+  mongo_connection *c;
+  mongo_connection_options opts;
+  gint port;
+  pid_t server;
+
+  mongo_connection_options_init (&opts);
+
+  ok (mongo_connect_with_options (NULL, 27010, &opts) == NULL,
+      "mongo_connect_with_options() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "mongo_connect_with_options() sets errno to EINVAL with a NULL host");
+
+  server = test_mock_server_start (&port);
+
+  c = mongo_connect_with_options ("127.0.0.1", port, NULL);
+  ok (c != NULL,
+      "mongo_connect_with_options() works with default options");
+  ok (_getsockopt_int (c->fd, IPPROTO_TCP, TCP_NODELAY) != 0 &&
+      _getsockopt_int (c->fd, SOL_SOCKET, SO_KEEPALIVE) != 0,
+      "The default options are applied");
+  mongo_disconnect (c);
+
+  opts.tcp_nodelay = FALSE;
+  opts.keepalive = FALSE;
+  opts.rcvbuf = 256 * 1024;
+
+  c = mongo_connect_with_options ("127.0.0.1", port, &opts);
+  ok (c != NULL,
+      "mongo_connect_with_options() works with custom options");
+  ok (_getsockopt_int (c->fd, IPPROTO_TCP, TCP_NODELAY) == 0 &&
+      _getsockopt_int (c->fd, SOL_SOCKET, SO_KEEPALIVE) == 0,
+      "The custom options are applied");
+  ok (_getsockopt_int (c->fd, SOL_SOCKET, SO_RCVBUF) >= 256 * 1024,
+      "The buffer size is applied");
+  mongo_disconnect (c);
+
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (7, mongo_connect_with_options);
@@ -0,0 +1,40 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_connection_get_options (void)
+{
+  mongo_connection *conn;
+  mongo_connection_options opts;
+  gint port;
+  pid_t server;
+
+  ok (mongo_connection_get_options (NULL, &opts) == FALSE,
+      "mongo_connection_get_options() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "mongo_connection_get_options() sets errno to ENOTCONN");
+
+  server = test_mock_server_start (&port);
+
+  mongo_connection_options_init (&opts);
+  opts.busy_poll = 0;
+  opts.sndbuf = 128 * 1024;
+  conn = mongo_connect_with_options ("127.0.0.1", port, &opts);
+
+  ok (mongo_connection_get_options (conn, NULL) == FALSE,
+      "mongo_connection_get_options() fails with NULL options");
+  cmp_ok (errno, "==", EINVAL,
+	  "mongo_connection_get_options() sets errno to EINVAL");
+
+  memset (&opts, 0, sizeof (opts));
+  ok (mongo_connection_get_options (conn, &opts) &&
+      opts.sndbuf == 128 * 1024 && opts.tcp_nodelay == TRUE,
+      "mongo_connection_get_options() works");
+
+  mongo_disconnect (conn);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (5, mongo_connection_get_options);
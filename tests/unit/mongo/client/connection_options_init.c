@@ -0,0 +1,30 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_connection_options_init (void)
+{
+  mongo_connection_options opts;
+
+  errno = 0;
+  mongo_connection_options_init (NULL);
+  cmp_ok (errno, "==", EINVAL,
+	  "mongo_connection_options_init() fails with NULL options");
+
+  memset (&opts, 0xff, sizeof (opts));
+  mongo_connection_options_init (&opts);
+
+  ok (opts.tcp_nodelay == TRUE,
+      "Nagle's algorithm is disabled by default");
+  ok (opts.sndbuf == 0 && opts.rcvbuf == 0,
+      "Buffer sizes are left to the kernel by default");
+  ok (opts.keepalive == TRUE && opts.keepalive_idle > 0 &&
+      opts.keepalive_interval > 0 && opts.keepalive_count > 0,
+      "Keepalive is enabled by default");
+  ok (opts.busy_poll == 0,
+      "Busy polling is disabled by default");
+}
+
+RUN_TEST (5, mongo_connection_options_init);
@@ -0,0 +1,52 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_connection_set_options (void)
+{
+  mongo_connection c, *conn;
+  mongo_connection_options opts;
+  gint port, v;
+  socklen_t len = sizeof (v);
+  pid_t server;
+
+  mongo_connection_options_init (&opts);
+  c.fd = -1;
+
+  ok (mongo_connection_set_options (NULL, &opts) == FALSE,
+      "mongo_connection_set_options() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "mongo_connection_set_options() sets errno to ENOTCONN");
+  ok (mongo_connection_set_options (&c, &opts) == FALSE,
+      "mongo_connection_set_options() fails with an invalid FD");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_connect ("127.0.0.1", port);
+
+  opts.tcp_nodelay = FALSE;
+  opts.keepalive_idle = 30;
+  ok (mongo_connection_set_options (conn, &opts),
+      "mongo_connection_set_options() works");
+
+  getsockopt (conn->fd, IPPROTO_TCP, TCP_NODELAY, &v, &len);
+  ok (v == 0,
+      "mongo_connection_set_options() applies the options");
+  ok (conn->options.keepalive_idle == 30,
+      "mongo_connection_set_options() remembers the options");
+
+  ok (mongo_connection_set_options (conn, NULL) &&
+      conn->options.tcp_nodelay == TRUE,
+      "mongo_connection_set_options() restores the defaults with NULL");
+
+  mongo_disconnect (conn);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (7, mongo_connection_set_options);
@@ -0,0 +1,64 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_connection_set_uring (void)
+{
+  mongo_connection *conn, *peer;
+  mongo_uring *ring;
+  mongo_packet *p, *r;
+  gint sv[2];
+
+  ok (mongo_connection_set_uring (NULL, NULL) == FALSE,
+      "mongo_connection_set_uring() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "mongo_connection_set_uring() sets errno to ENOTCONN");
+
+  ring = mongo_uring_new (0, 0, 0);
+
+  skip (ring == NULL, 6, "io_uring is not available");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  conn = g_new0 (mongo_connection, 1);
+  conn->fd = sv[0];
+  peer = g_new0 (mongo_connection, 1);
+  peer->fd = sv[1];
+
+  ok (mongo_connection_set_uring (conn, ring),
+      "mongo_connection_set_uring() works");
+
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  ok (mongo_packet_send (conn, p),
+      "mongo_packet_send() works through the ring");
+  r = mongo_packet_recv (peer);
+  ok (r != NULL,
+      "Packets sent through the ring arrive at the peer");
+  mongo_wire_packet_free (r);
+
+  mongo_packet_send (peer, p);
+  r = mongo_packet_recv (conn);
+  ok (r != NULL,
+      "mongo_packet_recv() works through the ring");
+  mongo_wire_packet_free (r);
+  mongo_wire_packet_free (p);
+
+  mongo_connection_set_timeout (conn, 100);
+  ok (mongo_packet_recv (conn) == NULL && errno == EAGAIN,
+      "mongo_packet_recv() through the ring honours the timeout");
+
+  ok (mongo_connection_set_uring (conn, NULL),
+      "mongo_connection_set_uring() can detach the ring");
+
+  mongo_disconnect (conn);
+  mongo_disconnect (peer);
+  mongo_uring_free (ring);
+
+  endskip;
+}
+
+RUN_TEST (8, mongo_connection_set_uring);
@@ -0,0 +1,70 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_connection_set_zerocopy (void)
+{
+  mongo_connection c, *conn;
+  mongo_packet *p;
+  bson *b;
+  guint8 *blob;
+  gint port;
+  pid_t server;
+
+  c.fd = -1;
+
+  ok (mongo_connection_set_zerocopy (NULL, 1024) == FALSE,
+      "mongo_connection_set_zerocopy() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "mongo_connection_set_zerocopy() sets errno to ENOTCONN");
+  ok (mongo_connection_set_zerocopy (&c, -1) == FALSE,
+      "mongo_connection_set_zerocopy() fails with a negative threshold");
+  ok (mongo_connection_set_zerocopy (&c, 1024) == FALSE,
+      "mongo_connection_set_zerocopy() fails with an invalid FD");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_connect ("127.0.0.1", port);
+
+  skip (!mongo_connection_set_zerocopy (conn, 1024) && errno == ENOSYS, 3,
+	"Zero-copy sends are not supported");
+
+  ok (conn->zerocopy.threshold == 1024,
+      "mongo_connection_set_zerocopy() works");
+
+  blob = g_malloc0 (256 * 1024);
+  b = bson_new_sized (256 * 1024 + 64);
+  bson_append_binary (b, "blob", BSON_BINARY_SUBTYPE_GENERIC,
+		      blob, 256 * 1024);
+  bson_finish (b);
+  g_free (blob);
+
+  p = mongo_wire_cmd_insert (1, "test.zerocopy", b, NULL);
+  bson_free (b);
+  ok (mongo_packet_send (conn, p),
+      "Packets above the threshold can be sent");
+  mongo_wire_packet_free (p);
+
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+  p = mongo_wire_cmd_custom (2, "admin", 0, b);
+  bson_free (b);
+  mongo_packet_send (conn, p);
+  mongo_wire_packet_free (p);
+
+  p = mongo_packet_recv (conn);
+  ok (p != NULL,
+      "The stream stays intact after a zero-copy send");
+  mongo_wire_packet_free (p);
+
+  endskip;
+
+  mongo_disconnect (conn);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (7, mongo_connection_set_zerocopy);
@@ -3,6 +3,7 @@
 
 #include <errno.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include "libmongo-private.h"
 
@@ -11,8 +12,11 @@ test_mongo_packet_recv (void)
 {
   mongo_connection c, *conn;
   mongo_packet *p;
+  mongo_packet_header h;
   bson *b;
+  gint sv[2];
 
+  memset (&c, 0, sizeof (c));
   c.fd = -1;
 
   ok (mongo_packet_recv (NULL) == NULL,
@@ -25,6 +29,21 @@ test_mongo_packet_recv (void)
   ok (errno == EBADF,
       "mongo_packet_recv() sets errno to EBADF is the FD is bad");
 
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  h.length = GINT32_TO_LE (MONGO_WIRE_MAX_MESSAGE_SIZE + 1);
+  h.id = 0;
+  h.resp_to = 0;
+  h.opcode = GINT32_TO_LE (1);
+  if (write (sv[1], &h, sizeof (h)) != sizeof (h))
+    note ("Could not write the header\n");
+  c.fd = sv[0];
+  ok (mongo_packet_recv (&c) == NULL,
+      "mongo_packet_recv() fails with an oversized reply");
+  ok (errno == EPROTO,
+      "mongo_packet_recv() sets errno to EPROTO on an oversized reply");
+  close (sv[0]);
+  close (sv[1]);
+
   begin_network_tests (2);
 
   b = bson_new ();
@@ -53,4 +72,4 @@ test_mongo_packet_recv (void)
   end_network_tests ();
 }
 
-RUN_TEST (6, mongo_packet_recv);
+RUN_TEST (8, mongo_packet_recv);
@@ -0,0 +1,127 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Queue a single-document reply on the server end of the stream. */
+static void
+_queue_reply (mongo_connection *server, gint32 id, gint32 resp_to,
+	      gint64 cursor_id)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  mongo_packet *p;
+  guint8 *data;
+  bson *b;
+
+  b = test_bson_generate_full ();
+
+  h.length = sizeof (mongo_packet_header) + sizeof (rh) + bson_size (b);
+  h.id = id;
+  h.resp_to = resp_to;
+  h.opcode = 1;
+
+  rh.flags = 0;
+  rh.cursor_id = GINT64_TO_LE (cursor_id);
+  rh.start = 0;
+  rh.returned = GINT32_TO_LE (1);
+
+  data = g_malloc (sizeof (rh) + bson_size (b));
+  memcpy (data, &rh, sizeof (rh));
+  memcpy (data + sizeof (rh), bson_data (b), bson_size (b));
+
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_header (p, &h);
+  mongo_wire_packet_set_data (p, data, sizeof (rh) + bson_size (b));
+  mongo_packet_send (server, p);
+
+  mongo_wire_packet_free (p);
+  g_free (data);
+  bson_free (b);
+}
+
+void
+test_mongo_sync_cursor_exhaust (void)
+{
+  mongo_sync_connection *conn;
+  mongo_connection server;
+  mongo_sync_cursor *c;
+  bson *q, *doc;
+  gint sv[2], n = 0;
+  gboolean docs = TRUE;
+  guint8 buf[16];
+
+  q = bson_new ();
+  bson_finish (q);
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  memset (&server, 0, sizeof (server));
+  server.fd = sv[1];
+  conn = test_make_fake_sync_conn (sv[0], TRUE);
+
+  _queue_reply (&server, 100, 1, 777);
+  _queue_reply (&server, 101, 100, 777);
+  _queue_reply (&server, 102, 101, 0);
+
+  c = mongo_sync_cursor_new
+    (conn, "test.exhaust",
+     mongo_sync_cmd_query (conn, "test.exhaust",
+			   MONGO_WIRE_FLAG_QUERY_EXHAUST, 0, 1, q, NULL));
+  ok (c != NULL && c->exhaust,
+      "Cursors over exhaust queries read the stream");
+  ok (mongo_sync_cmd_ping (conn) == FALSE && errno == EBUSY,
+      "The connection cannot be used while the stream is running");
+
+  while (mongo_sync_cursor_next (c))
+    {
+      doc = mongo_sync_cursor_get_data (c);
+      docs &= (doc != NULL);
+      bson_free (doc);
+      n++;
+    }
+  cmp_ok (n, "==", 3,
+	  "mongo_sync_cursor_next() reads every reply of the stream");
+  ok (docs,
+      "Every document of the stream can be retrieved");
+  ok (conn->exhaust.active == FALSE,
+      "The connection is usable again once the stream ended");
+  mongo_sync_cursor_free (c);
+
+  /* Abandon a stream halfway through. */
+  _queue_reply (&server, 200, 2, 888);
+  _queue_reply (&server, 201, 200, 888);
+  _queue_reply (&server, 202, 201, 0);
+
+  c = mongo_sync_cursor_new
+    (conn, "test.exhaust",
+     mongo_sync_cmd_query (conn, "test.exhaust",
+			   MONGO_WIRE_FLAG_QUERY_EXHAUST, 0, 1, q, NULL));
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_free (c);
+
+  ok (conn->exhaust.active == FALSE &&
+      recv (sv[0], buf, sizeof (buf), MSG_DONTWAIT) == -1 &&
+      errno == EAGAIN,
+      "mongo_sync_cursor_free() reads the rest of the stream");
+
+  /* A query that fits in one reply does not start a stream. */
+  _queue_reply (&server, 300, 3, 0);
+  c = mongo_sync_cursor_new
+    (conn, "test.exhaust",
+     mongo_sync_cmd_query (conn, "test.exhaust",
+			   MONGO_WIRE_FLAG_QUERY_EXHAUST, 0, 1, q, NULL));
+  ok (c != NULL && !c->exhaust && !conn->exhaust.active,
+      "Single reply exhaust queries leave the connection usable");
+  mongo_sync_cursor_free (c);
+
+  bson_free (q);
+  mongo_sync_disconnect (conn);
+  close (sv[1]);
+}
+
+RUN_TEST (7, mongo_sync_cursor_exhaust);
@@ -0,0 +1,78 @@
+#include "test.h"
+#include "mongo.h"
+#include "config.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_cursor_set_adaptive_batching (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *c;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_cursor_set_adaptive_batching
+      (NULL, MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES) == FALSE,
+      "mongo_sync_cursor_set_adaptive_batching() fails with a NULL cursor");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, TRUE);
+
+  c = mongo_sync_cursor_new (conn, "test.batch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+
+  ok (mongo_sync_cursor_set_adaptive_batching (c, -1) == FALSE,
+      "mongo_sync_cursor_set_adaptive_batching() fails with a negative "
+      "budget");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  ok (mongo_sync_cursor_set_adaptive_batching
+      (c, MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES),
+      "mongo_sync_cursor_set_adaptive_batching() works");
+
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_next (c);
+  cmp_ok (c->batch.last, "==", 4,
+	  "Batches grow after the first one");
+
+  mongo_sync_cursor_free (c);
+
+  c = mongo_sync_cursor_new (conn, "test.batch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+  mongo_sync_cursor_set_batch_size (c, 1000);
+  mongo_sync_cursor_set_adaptive_batching (c, 1024);
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_next (c);
+  ok (c->batch.last > 0 && c->batch.last < 10,
+      "Batches are capped by the byte budget");
+
+  mongo_sync_cursor_set_adaptive_batching (c, 0);
+  mongo_sync_cursor_next (c);
+  cmp_ok (c->batch.last, "==", 1000,
+	  "Disabling adaptive sizing goes back to the set batch size");
+
+  mongo_sync_cursor_free (c);
+
+  c = mongo_sync_cursor_new (conn, "test.batch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+  mongo_sync_cursor_set_adaptive_batching
+    (c, MONGO_SYNC_CURSOR_DEFAULT_BATCH_BYTES);
+  mongo_sync_cursor_set_prefetch (c, 0.5);
+  mongo_sync_cursor_next (c);
+  ok (c->prefetch.pending == TRUE && c->batch.last == 4,
+      "Prefetched batches grow too");
+  mongo_sync_cursor_free (c);
+
+  mongo_sync_disconnect (conn);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (9, mongo_sync_cursor_set_adaptive_batching);
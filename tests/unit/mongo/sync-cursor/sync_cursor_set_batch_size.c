@@ -0,0 +1,55 @@
+#include "test.h"
+#include "mongo.h"
+#include "config.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_cursor_set_batch_size (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *c;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_cursor_set_batch_size (NULL, 10) == FALSE,
+      "mongo_sync_cursor_set_batch_size() fails with a NULL cursor");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, TRUE);
+
+  c = mongo_sync_cursor_new (conn, "test.batch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+
+  ok (mongo_sync_cursor_set_batch_size (c, -1) == FALSE,
+      "mongo_sync_cursor_set_batch_size() fails with a negative size");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_next (c);
+  cmp_ok (c->batch.last, "==", 2,
+	  "By default, batches are as big as the previous one");
+
+  ok (mongo_sync_cursor_set_batch_size (c, 10),
+      "mongo_sync_cursor_set_batch_size() works");
+  mongo_sync_cursor_next (c);
+  cmp_ok (c->batch.last, "==", 10,
+	  "Further batches are requested with the set size");
+
+  mongo_sync_cursor_set_batch_size (c, 0);
+  mongo_sync_cursor_next (c);
+  cmp_ok (c->batch.last, "==", 1,
+	  "A zero size goes back to the default");
+
+  mongo_sync_cursor_free (c);
+  mongo_sync_disconnect (conn);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (8, mongo_sync_cursor_set_batch_size);
@@ -0,0 +1,77 @@
+#include "test.h"
+#include "mongo.h"
+#include "config.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_cursor_set_prefetch (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *c;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_cursor_set_prefetch (NULL, 0.5) == FALSE,
+      "mongo_sync_cursor_set_prefetch() fails with a NULL cursor");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, TRUE);
+
+  /* A batch of two, with a live cursor. */
+  c = mongo_sync_cursor_new (conn, "test.prefetch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+
+  ok (mongo_sync_cursor_set_prefetch (c, 1.5) == FALSE,
+      "mongo_sync_cursor_set_prefetch() fails with a fraction above one");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+  ok (mongo_sync_cursor_set_prefetch (c, -0.5) == FALSE,
+      "mongo_sync_cursor_set_prefetch() fails with a negative fraction");
+
+  ok (mongo_sync_cursor_set_prefetch (c, 0.5),
+      "mongo_sync_cursor_set_prefetch() works");
+
+  mongo_sync_cursor_next (c);
+  ok (c->prefetch.pending == TRUE,
+      "The next batch is requested halfway through the current one");
+  ok (mongo_sync_cmd_ping (conn) == FALSE,
+      "The connection cannot be used while a prefetch is in flight");
+  cmp_ok (errno, "==", EBUSY,
+	  "errno is EBUSY");
+  mongo_sync_cursor_next (c);
+  ok (mongo_sync_cursor_next (c),
+      "The prefetched batch is used at the end of the current one");
+  ok (c->prefetch.pending == FALSE && c->ph.returned == 1,
+      "The cursor moved on to the prefetched batch");
+  ok (mongo_sync_cursor_get_data (c) != NULL,
+      "The prefetched batch can be read");
+
+  mongo_sync_cursor_free (c);
+
+  c = mongo_sync_cursor_new (conn, "test.prefetch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+  mongo_sync_cursor_set_prefetch (c, 0.1);
+  mongo_sync_cursor_next (c);
+  mongo_sync_cursor_free (c);
+  ok (mongo_sync_cmd_ping (conn),
+      "Freeing a cursor collects the batch still in flight");
+
+  c = mongo_sync_cursor_new (conn, "test.prefetch",
+			     test_mongo_wire_generate_reply (TRUE, 2, TRUE));
+  mongo_sync_cursor_set_prefetch (c, 1);
+  mongo_sync_cursor_next (c);
+  ok (c->prefetch.pending == FALSE,
+      "Nothing is prefetched before the given part of the batch is "
+      "consumed");
+  mongo_sync_cursor_free (c);
+
+  mongo_sync_disconnect (conn);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (14, mongo_sync_cursor_set_prefetch);
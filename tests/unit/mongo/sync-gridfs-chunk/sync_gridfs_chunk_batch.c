@@ -0,0 +1,71 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_gridfs_chunk_batch (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_gridfs_chunk_batch batch;
+  guint8 oid[12], data[1000];
+  gint port;
+  pid_t server;
+
+  mongo_util_oid_init (0);
+  memset (oid, 0, sizeof (oid));
+  memset (data, 'x', sizeof (data));
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, "test.fs");
+  mongo_sync_conn_set_max_insert_size (conn, 3000);
+
+  mongo_sync_gridfs_chunk_batch_init (&batch);
+  ok (batch.chunks->len == 0 && batch.size == 0,
+      "mongo_sync_gridfs_chunk_batch_init() creates an empty batch");
+
+  ok (mongo_sync_gridfs_chunk_batch_add (gfs, &batch, oid, 0,
+					 data, sizeof (data)) == TRUE &&
+      mongo_sync_gridfs_chunk_batch_add (gfs, &batch, oid, 1,
+					 data, sizeof (data)) == TRUE,
+      "mongo_sync_gridfs_chunk_batch_add() works");
+  cmp_ok (batch.chunks->len, "==", 2,
+	  "Chunks that fit under the maximum insert size are batched");
+  cmp_ok (batch.size, ">", 2 * (gint)sizeof (data),
+	  "The size of the batch covers the whole chunks");
+
+  mongo_sync_gridfs_chunk_batch_add (gfs, &batch, oid, 2,
+				     data, sizeof (data));
+  cmp_ok (batch.chunks->len, "==", 1,
+	  "The batch is flushed before it would grow too large");
+
+  ok (mongo_sync_gridfs_chunk_batch_flush (gfs, &batch) == TRUE,
+      "mongo_sync_gridfs_chunk_batch_flush() works");
+  ok (batch.chunks->len == 0 && batch.size == 0,
+      "Flushing empties the batch");
+  ok (mongo_sync_gridfs_chunk_batch_flush (gfs, &batch) == TRUE,
+      "Flushing an empty batch works");
+
+  mongo_sync_gridfs_chunk_batch_add (gfs, &batch, oid, 3,
+				     data, sizeof (data));
+  mongo_sync_conn_set_max_insert_size (conn, 100);
+  ok (mongo_sync_gridfs_chunk_batch_flush (gfs, &batch) == FALSE,
+      "mongo_sync_gridfs_chunk_batch_flush() fails with oversized chunks");
+  cmp_ok (errno, "==", EMSGSIZE,
+	  "errno is EMSGSIZE");
+  cmp_ok (batch.chunks->len, "==", 1,
+	  "A failed flush keeps the chunks");
+
+  mongo_sync_gridfs_chunk_batch_clear (&batch);
+  ok (batch.chunks == NULL && batch.size == 0,
+      "mongo_sync_gridfs_chunk_batch_clear() frees the batch");
+
+  mongo_sync_gridfs_free (gfs, TRUE);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (12, mongo_sync_gridfs_chunk_batch);
@@ -0,0 +1,130 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+static mongo_packet *
+_make_reply (bson **docs, gint n)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  mongo_packet *p;
+  GByteArray *data;
+  gint i;
+
+  data = g_byte_array_new ();
+  memset (&rh, 0, sizeof (rh));
+  rh.returned = GINT32_TO_LE (n);
+  g_byte_array_append (data, (guint8 *)&rh, sizeof (rh));
+  for (i = 0; i < n; i++)
+    g_byte_array_append (data, bson_data (docs[i]), bson_size (docs[i]));
+
+  p = mongo_wire_packet_new ();
+  h.opcode = GINT32_TO_LE (1);
+  h.id = GINT32_TO_LE (1984);
+  h.resp_to = GINT32_TO_LE (42);
+  h.length = GINT32_TO_LE (sizeof (mongo_packet_header) + data->len);
+  mongo_wire_packet_set_header (p, &h);
+  mongo_wire_packet_set_data (p, data->data, data->len);
+  g_byte_array_free (data, TRUE);
+
+  return p;
+}
+
+void
+test_mongo_sync_gridfs_chunked_file_cursor_peek_chunk (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  bson *docs[5];
+  const guint8 *d, *reply;
+  gint32 len;
+  guint8 old[9] = { 5, 0, 0, 0, 'w', 'o', 'r', 'l', 'd' };
+  /* The binary, and the string before it, are cut off right after
+     their type and name. */
+  guint8 cut_binary[11] = { 0, 0, 0, 0, BSON_TYPE_BINARY,
+			    'd', 'a', 't', 'a', 0, 5 };
+  guint8 cut_string[8] = { 0, 0, 0, 0, BSON_TYPE_STRING, 's', 0, 1 };
+  gint32 size;
+
+  ok (mongo_sync_gridfs_chunked_file_cursor_peek_chunk (NULL, &size) == NULL,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() fails with a "
+      "NULL cursor");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  docs[0] = bson_new ();
+  bson_append_int64 (docs[0], "n", 0);
+  bson_append_binary (docs[0], "data", BSON_BINARY_SUBTYPE_GENERIC,
+		      (const guint8 *)"hello", 5);
+  bson_finish (docs[0]);
+  docs[1] = bson_new ();
+  bson_append_int64 (docs[1], "n", 1);
+  bson_append_binary (docs[1], "data", BSON_BINARY_SUBTYPE_BINARY,
+		      old, sizeof (old));
+  bson_finish (docs[1]);
+  docs[2] = bson_new ();
+  bson_append_int64 (docs[2], "n", 2);
+  bson_append_string (docs[2], "data", "invalid", -1);
+  bson_finish (docs[2]);
+  docs[3] = bson_new_from_data (cut_binary, sizeof (cut_binary));
+  bson_finish (docs[3]);
+  docs[4] = bson_new_from_data (cut_string, sizeof (cut_string));
+  bson_finish (docs[4]);
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  cursor = mongo_sync_cursor_new (conn, "test.fs.chunks",
+				  _make_reply (docs, 5));
+
+  ok (mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, NULL) == NULL,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() fails without "
+      "a size");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  ok (mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size) == NULL,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() fails before "
+      "the cursor is advanced");
+
+  mongo_sync_cursor_next (cursor);
+  d = mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size);
+  ok (d != NULL && size == 5 && memcmp (d, "hello", 5) == 0,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() works");
+  len = mongo_wire_packet_get_data (cursor->results, &reply);
+  ok (d > reply && d + size <= reply + len,
+      "The data points into the reply");
+
+  mongo_sync_cursor_next (cursor);
+  d = mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size);
+  ok (d != NULL && size == 5 && memcmp (d, "world", 5) == 0,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() handles the "
+      "old binary subtype");
+
+  mongo_sync_cursor_next (cursor);
+  ok (mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size) == NULL,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() fails with "
+      "invalid chunks");
+  cmp_ok (errno, "==", EPROTO,
+	  "errno is EPROTO");
+
+  mongo_sync_cursor_next (cursor);
+  ok (mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size) == NULL,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() fails with a "
+      "truncated binary");
+  mongo_sync_cursor_next (cursor);
+  ok (mongo_sync_gridfs_chunked_file_cursor_peek_chunk (cursor, &size) == NULL,
+      "mongo_sync_gridfs_chunked_file_cursor_peek_chunk() fails when "
+      "a value before the data is truncated");
+
+  mongo_sync_cursor_free (cursor);
+  mongo_sync_disconnect (conn);
+  bson_free (docs[0]);
+  bson_free (docs[1]);
+  bson_free (docs[2]);
+  bson_free (docs[3]);
+  bson_free (docs[4]);
+}
+
+RUN_TEST (12, mongo_sync_gridfs_chunked_file_cursor_peek_chunk);
@@ -0,0 +1,90 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+#define BUFFER_SIZE 1024 * 1024 + 42
+
+void
+test_mongo_sync_gridfs_chunked_file_new_from_buffer_parallel (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_pool *pool;
+  bson *metadata;
+  guint8 *buffer;
+  mongo_sync_gridfs_chunked_file *gfile;
+  gint port;
+  pid_t server;
+
+  buffer = g_malloc (BUFFER_SIZE);
+  memset (buffer, 'a', BUFFER_SIZE);
+
+  metadata = bson_build (BSON_TYPE_STRING, "filename",
+			 "gridfs_file_new_from_buffer_parallel", -1,
+			 BSON_TYPE_NONE);
+  bson_finish (metadata);
+
+  ok (mongo_sync_gridfs_chunked_file_new_from_buffer_parallel
+      (NULL, metadata, buffer, BUFFER_SIZE, NULL, 0) == NULL,
+      "mongo_sync_gridfs_chunked_file_new_from_buffer_parallel() fails "
+      "with a NULL GridFS");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, "test.fs");
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  ok (mongo_sync_gridfs_chunked_file_new_from_buffer_parallel
+      (gfs, metadata, NULL, BUFFER_SIZE, NULL, 0) == NULL,
+      "mongo_sync_gridfs_chunked_file_new_from_buffer_parallel() fails "
+      "with NULL data");
+  ok (mongo_sync_gridfs_chunked_file_new_from_buffer_parallel
+      (gfs, metadata, buffer, 0, NULL, 0) == NULL,
+      "mongo_sync_gridfs_chunked_file_new_from_buffer_parallel() fails "
+      "with an invalid data size");
+  ok (mongo_sync_gridfs_chunked_file_new_from_buffer_parallel
+      (gfs, metadata, buffer, BUFFER_SIZE, pool, 0) == NULL,
+      "mongo_sync_gridfs_chunked_file_new_from_buffer_parallel() fails "
+      "with a pool, but no connections to pick");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  mongo_sync_pool_free (pool);
+  mongo_sync_gridfs_free (gfs, TRUE);
+  test_mock_server_stop (server);
+
+  begin_network_tests (2);
+
+  mongo_util_oid_init (0);
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, config.gfs_prefix);
+
+  gfile = mongo_sync_gridfs_chunked_file_new_from_buffer_parallel
+    (gfs, metadata, buffer, BUFFER_SIZE, NULL, 0);
+  ok (gfile != NULL,
+      "mongo_sync_gridfs_chunked_file_new_from_buffer_parallel() works "
+      "over a single connection");
+  mongo_sync_gridfs_chunked_file_free (gfile);
+
+  pool = mongo_sync_pool_new (config.primary_host, config.primary_port, 3, 0);
+  gfile = mongo_sync_gridfs_chunked_file_new_from_buffer_parallel
+    (gfs, NULL, buffer, BUFFER_SIZE, pool, 3);
+  ok (gfile != NULL,
+      "mongo_sync_gridfs_chunked_file_new_from_buffer_parallel() works "
+      "over a pool");
+  mongo_sync_gridfs_chunked_file_free (gfile);
+  mongo_sync_pool_free (pool);
+
+  mongo_sync_gridfs_free (gfs, TRUE);
+
+  end_network_tests ();
+
+  bson_free (metadata);
+  g_free (buffer);
+}
+
+RUN_TEST (8, mongo_sync_gridfs_chunked_file_new_from_buffer_parallel);
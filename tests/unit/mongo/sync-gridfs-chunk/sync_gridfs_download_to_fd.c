@@ -0,0 +1,53 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void
+test_mongo_sync_gridfs_download_to_fd (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_gridfs_chunked_file *gfile;
+  guint8 data[1000];
+  gint port, fds[2];
+  pid_t server;
+
+  mongo_util_oid_init (0);
+  memset (data, 'x', sizeof (data));
+
+  ok (mongo_sync_gridfs_download_to_fd (NULL, 1) == -1,
+      "mongo_sync_gridfs_download_to_fd() fails with a NULL file");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, "test.fs");
+
+  gfile = mongo_sync_gridfs_chunked_file_new_from_buffer (gfs, NULL, data,
+							  sizeof (data));
+
+  ok (mongo_sync_gridfs_download_to_fd (gfile, -1) == -1,
+      "mongo_sync_gridfs_download_to_fd() fails with an invalid fd");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  /* The mock server answers the chunk query with a document that is
+     not a chunk. */
+  if (pipe (fds) != 0)
+    fds[0] = fds[1] = -1;
+  ok (mongo_sync_gridfs_download_to_fd (gfile, fds[1]) == -1,
+      "mongo_sync_gridfs_download_to_fd() fails with invalid chunks");
+  cmp_ok (errno, "==", EPROTO,
+	  "errno is EPROTO");
+  close (fds[0]);
+  close (fds[1]);
+
+  mongo_sync_gridfs_chunked_file_free (gfile);
+  mongo_sync_gridfs_free (gfs, TRUE);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (6, mongo_sync_gridfs_download_to_fd);
@@ -0,0 +1,72 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void
+test_mongo_sync_gridfs_upload_from_fd (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_gridfs_chunked_file *gfile;
+  guint8 data[1000];
+  gchar *md5;
+  gint port, fds[2];
+  pid_t server;
+
+  mongo_util_oid_init (0);
+  memset (data, 'x', sizeof (data));
+
+  ok (mongo_sync_gridfs_upload_from_fd (NULL, NULL, 0) == NULL,
+      "mongo_sync_gridfs_upload_from_fd() fails with a NULL GridFS");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, "test.fs");
+  mongo_sync_gridfs_set_chunk_size (gfs, 256);
+
+  ok (mongo_sync_gridfs_upload_from_fd (gfs, NULL, -1) == NULL,
+      "mongo_sync_gridfs_upload_from_fd() fails with an invalid fd");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  if (pipe (fds) != 0)
+    fds[0] = fds[1] = -1;
+  ok (mongo_sync_gridfs_upload_from_fd (gfs, NULL, fds[1]) == NULL,
+      "mongo_sync_gridfs_upload_from_fd() fails when the fd cannot be read");
+
+  if (write (fds[1], data, sizeof (data)) != sizeof (data))
+    note ("Could not fill the pipe\n");
+  close (fds[1]);
+  gfile = mongo_sync_gridfs_upload_from_fd (gfs, NULL, fds[0]);
+  close (fds[0]);
+  ok (gfile != NULL,
+      "mongo_sync_gridfs_upload_from_fd() works");
+  cmp_ok (mongo_sync_gridfs_file_get_length (gfile), "==", sizeof (data),
+	  "The file has the length of the data read");
+  cmp_ok (mongo_sync_gridfs_file_get_chunks (gfile), "==", 4,
+	  "The file has the right number of chunks");
+  md5 = g_compute_checksum_for_data (G_CHECKSUM_MD5, data, sizeof (data));
+  is (mongo_sync_gridfs_file_get_md5 (gfile), md5,
+      "The file has the MD5 of the data read");
+  g_free (md5);
+  mongo_sync_gridfs_chunked_file_free (gfile);
+
+  if (pipe (fds) != 0)
+    fds[0] = fds[1] = -1;
+  close (fds[1]);
+  gfile = mongo_sync_gridfs_upload_from_fd (gfs, NULL, fds[0]);
+  close (fds[0]);
+  ok (gfile == NULL,
+      "mongo_sync_gridfs_upload_from_fd() fails with an empty file");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  mongo_sync_gridfs_free (gfs, TRUE);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (11, mongo_sync_gridfs_upload_from_fd);
@@ -0,0 +1,56 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_gridfs_stream_set_read_ahead (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_gridfs *gfs;
+  mongo_sync_gridfs_stream *stream;
+  gint port;
+  pid_t server;
+
+  mongo_util_oid_init (0);
+
+  ok (mongo_sync_gridfs_stream_set_read_ahead (NULL, 4) == FALSE,
+      "mongo_sync_gridfs_stream_set_read_ahead() fails with a NULL stream");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is ENOENT");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, FALSE);
+  gfs = mongo_sync_gridfs_new (conn, "test.fs");
+
+  stream = mongo_sync_gridfs_stream_new (gfs, NULL);
+  ok (mongo_sync_gridfs_stream_set_read_ahead (stream, 4) == FALSE,
+      "mongo_sync_gridfs_stream_set_read_ahead() fails with a write stream");
+  cmp_ok (errno, "==", EOPNOTSUPP,
+	  "errno is EOPNOTSUPP");
+  mongo_sync_gridfs_stream_close (stream);
+
+  stream = mongo_sync_gridfs_stream_new (gfs, NULL);
+  stream->file.type = LMC_GRIDFS_FILE_STREAM_READER;
+
+  ok (mongo_sync_gridfs_stream_set_read_ahead (stream, -1) == FALSE,
+      "mongo_sync_gridfs_stream_set_read_ahead() fails with a negative "
+      "window");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  ok (mongo_sync_gridfs_stream_set_read_ahead (stream, 4) == TRUE,
+      "mongo_sync_gridfs_stream_set_read_ahead() works");
+  cmp_ok (stream->read_ahead.window, "==", 4,
+	  "The read-ahead window is set");
+  ok (mongo_sync_gridfs_stream_set_read_ahead (stream, 0) == TRUE,
+      "mongo_sync_gridfs_stream_set_read_ahead() can disable read-ahead");
+
+  mongo_sync_gridfs_stream_close (stream);
+  mongo_sync_gridfs_free (gfs, TRUE);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (9, mongo_sync_gridfs_stream_set_read_ahead);
@@ -0,0 +1,54 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_conn_set_monitor (void)
+{
+  mongo_sync_connection *c, *seed;
+  mongo_sync_monitor *m;
+  gchar *addr;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_conn_set_monitor (NULL, NULL) == FALSE,
+      "mongo_sync_conn_set_monitor() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  addr = g_strdup_printf ("127.0.0.1:%d", port);
+
+  seed = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (seed, "127.0.0.1", port);
+  m = mongo_sync_monitor_new (seed, 60000);
+  mongo_sync_monitor_refresh (m);
+
+  /* A connection that knows nothing about the set on its own. */
+  c = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_conn_set_monitor (c, m),
+      "mongo_sync_conn_set_monitor() works");
+  ok (mongo_sync_reconnect (c, TRUE) == c,
+      "mongo_sync_reconnect() goes where the monitor points");
+  is (c->rs.primary, addr,
+      "The primary is taken from the monitor");
+  ok (mongo_sync_cmd_ping (c),
+      "The reconnected connection is usable");
+  ok (mongo_sync_conn_get_member_rtt (c, addr) >= 0,
+      "mongo_sync_conn_get_member_rtt() consults the monitor");
+
+  ok (mongo_sync_conn_set_monitor (c, NULL),
+      "mongo_sync_conn_set_monitor() can detach the monitor");
+
+  mongo_sync_disconnect (c);
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (seed);
+  test_mock_server_stop (server);
+  g_free (addr);
+}
+
+RUN_TEST (8, mongo_sync_conn_set_monitor);
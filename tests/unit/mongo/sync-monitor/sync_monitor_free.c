@@ -0,0 +1,22 @@
+#include "test.h"
+#include "mongo.h"
+
+void
+test_mongo_sync_monitor_free (void)
+{
+  mongo_sync_connection *c;
+
+  mongo_sync_monitor_free (NULL);
+  pass ("mongo_sync_monitor_free(NULL) works");
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", 1);
+
+  mongo_sync_monitor_free (mongo_sync_monitor_new (c, 0));
+  pass ("mongo_sync_monitor_free() stops a monitor in the middle of "
+	"a heartbeat");
+
+  mongo_sync_disconnect (c);
+}
+
+RUN_TEST (2, mongo_sync_monitor_free);
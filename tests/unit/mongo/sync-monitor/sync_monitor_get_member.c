@@ -0,0 +1,65 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_monitor_get_member (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_monitor *m;
+  mongo_sync_member_info info;
+  gchar *addr;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_monitor_get_member (NULL, "127.0.0.1:1", &info) == FALSE,
+      "mongo_sync_monitor_get_member() fails with a NULL monitor");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server = test_mock_server_start (&port);
+  addr = g_strdup_printf ("127.0.0.1:%d", port);
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", 1);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", port);
+  m = mongo_sync_monitor_new (c, 60000);
+
+  ok (mongo_sync_monitor_get_member (m, NULL, &info) == FALSE,
+      "mongo_sync_monitor_get_member() fails with a NULL member");
+  ok (mongo_sync_monitor_get_member (m, addr, NULL) == FALSE,
+      "mongo_sync_monitor_get_member() fails with a NULL info");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  mongo_sync_monitor_refresh (m);
+
+  ok (mongo_sync_monitor_get_member (m, "127.0.0.1:2", &info) == FALSE,
+      "mongo_sync_monitor_get_member() fails with an unknown member");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is ENOENT");
+
+  ok (mongo_sync_monitor_get_member (m, addr, &info),
+      "mongo_sync_monitor_get_member() works");
+  ok (info.role == MONGO_SYNC_MEMBER_PRIMARY,
+      "The role of the member is recorded");
+  ok (info.rtt >= 0,
+      "The RTT of the member is recorded");
+  ok (info.last_seen > 0,
+      "The last-seen time of the member is recorded");
+  cmp_ok (info.lag, "==", -1,
+	  "The replication lag is unknown without lastWrite");
+
+  ok (mongo_sync_monitor_get_member (m, "127.0.0.1:1", &info) &&
+      info.role == MONGO_SYNC_MEMBER_DOWN && info.rtt == -1 &&
+      info.last_seen == 0,
+      "Unreachable members are recorded as down");
+
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (server);
+  g_free (addr);
+}
+
+RUN_TEST (13, mongo_sync_monitor_get_member);
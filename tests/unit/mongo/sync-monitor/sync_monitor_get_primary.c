@@ -0,0 +1,90 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+typedef struct
+{
+  mongo_sync_monitor *monitor;
+  const gchar *primary;
+  volatile gint stop;
+  gint mismatches;
+} reader;
+
+/* Read the primary over and over, while snapshots are replaced. */
+static gpointer
+_read_primary (gpointer data)
+{
+  reader *r = (reader *)data;
+
+  while (!g_atomic_int_get (&r->stop))
+    {
+      gchar *primary = mongo_sync_monitor_get_primary (r->monitor);
+
+      if (!primary || strcmp (primary, r->primary) != 0)
+	g_atomic_int_inc (&r->mismatches);
+      g_free (primary);
+    }
+  return NULL;
+}
+
+void
+test_mongo_sync_monitor_get_primary (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_monitor *m;
+  gchar *addr, *primary;
+  reader r;
+  GThread *threads[4];
+  gint port, i;
+  pid_t server;
+
+  ok (mongo_sync_monitor_get_primary (NULL) == NULL,
+      "mongo_sync_monitor_get_primary() fails with a NULL monitor");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", 1);
+  m = mongo_sync_monitor_new (c, 60000);
+  mongo_sync_monitor_refresh (m);
+
+  ok (mongo_sync_monitor_get_primary (m) == NULL,
+      "mongo_sync_monitor_get_primary() fails without a primary");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is ENOENT");
+  mongo_sync_monitor_free (m);
+
+  server = test_mock_server_start (&port);
+  addr = g_strdup_printf ("127.0.0.1:%d", port);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", port);
+
+  m = mongo_sync_monitor_new (c, 60000);
+  mongo_sync_monitor_refresh (m);
+
+  primary = mongo_sync_monitor_get_primary (m);
+  is (primary, addr,
+      "mongo_sync_monitor_get_primary() returns the primary");
+  g_free (primary);
+
+  r.monitor = m;
+  r.primary = addr;
+  r.stop = 0;
+  r.mismatches = 0;
+  for (i = 0; i < 4; i++)
+    threads[i] = g_thread_new ("reader", _read_primary, &r);
+  for (i = 0; i < 20; i++)
+    mongo_sync_monitor_refresh (m);
+  g_atomic_int_set (&r.stop, 1);
+  for (i = 0; i < 4; i++)
+    g_thread_join (threads[i]);
+  cmp_ok (r.mismatches, "==", 0,
+	  "Snapshots can be read while new ones are published");
+
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (server);
+  g_free (addr);
+}
+
+RUN_TEST (6, mongo_sync_monitor_get_primary);
@@ -0,0 +1,38 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_monitor_new (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_monitor *m;
+
+  ok (mongo_sync_monitor_new (NULL, 0) == NULL,
+      "mongo_sync_monitor_new() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_monitor_new (c, -1) == NULL,
+      "mongo_sync_monitor_new() fails with a negative heartbeat");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  m = mongo_sync_monitor_new (c, 0);
+  ok (m != NULL,
+      "mongo_sync_monitor_new() works without any seeds");
+  mongo_sync_monitor_free (m);
+
+  mongo_sync_conn_seed_add (c, "127.0.0.1", 1);
+  m = mongo_sync_monitor_new (c, 100);
+  ok (m != NULL,
+      "mongo_sync_monitor_new() works with unreachable seeds");
+  mongo_sync_monitor_free (m);
+
+  mongo_sync_disconnect (c);
+}
+
+RUN_TEST (6, mongo_sync_monitor_new);
@@ -0,0 +1,101 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_monitor_refresh (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_monitor *m;
+  mongo_sync_member_info info;
+  gchar *addr;
+  gint port, slow_port[2];
+  pid_t server, slow[2];
+  gint64 start;
+
+  ok (mongo_sync_monitor_refresh (NULL) == FALSE,
+      "mongo_sync_monitor_refresh() fails with a NULL monitor");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server = test_mock_server_start (&port);
+  addr = g_strdup_printf ("127.0.0.1:%d", port);
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", port);
+  m = mongo_sync_monitor_new (c, 60000);
+
+  ok (mongo_sync_monitor_refresh (m),
+      "mongo_sync_monitor_refresh() works");
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.last_seen > 0,
+      "mongo_sync_monitor_refresh() waits for a full heartbeat");
+
+  test_mock_server_stop (server);
+
+  ok (mongo_sync_monitor_refresh (m),
+      "mongo_sync_monitor_refresh() works when the member went away");
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.role == MONGO_SYNC_MEMBER_DOWN,
+      "mongo_sync_monitor_refresh() notices members going down "
+      "without waiting for the heartbeat");
+
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (c);
+
+  /* Two members that take 300ms to answer each: probed one after the
+     other, a heartbeat would take at least 600ms. */
+  slow[0] = test_mock_server_start_delayed (&slow_port[0], 300);
+  slow[1] = test_mock_server_start_delayed (&slow_port[1], 300);
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", slow_port[0]);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", slow_port[1]);
+  m = mongo_sync_monitor_new (c, 60000);
+  mongo_sync_monitor_refresh (m);
+
+  start = g_get_monotonic_time ();
+  mongo_sync_monitor_refresh (m);
+  ok (g_get_monotonic_time () - start < 550 * G_TIME_SPAN_MILLISECOND,
+      "mongo_sync_monitor_refresh() probes the members in parallel");
+  g_free (addr);
+  addr = g_strdup_printf ("127.0.0.1:%d", slow_port[1]);
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.role == MONGO_SYNC_MEMBER_PRIMARY,
+      "Slow members are checked too");
+
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (slow[1]);
+
+  /* A member that does not answer within the connect timeout holds
+     the heartbeat back for no longer than its interval. */
+  server = test_mock_server_start (&port);
+  slow[1] = test_mock_server_start_delayed (&slow_port[1], 5000);
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  mongo_connection_options_init (&c->super.options);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", slow_port[1]);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", port);
+  m = mongo_sync_monitor_new (c, 300);
+
+  start = g_get_monotonic_time ();
+  mongo_sync_monitor_refresh (m);
+  ok (g_get_monotonic_time () - start < 1000 * G_TIME_SPAN_MILLISECOND,
+      "An unresponsive member delays a heartbeat by its interval at most");
+  g_free (addr);
+  addr = g_strdup_printf ("127.0.0.1:%d", port);
+  ok (mongo_sync_monitor_get_member (m, addr, &info) &&
+      info.role == MONGO_SYNC_MEMBER_PRIMARY,
+      "The members that answered are published");
+
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (server);
+  test_mock_server_stop (slow[0]);
+  test_mock_server_stop (slow[1]);
+  g_free (addr);
+}
+
+RUN_TEST (10, mongo_sync_monitor_refresh);
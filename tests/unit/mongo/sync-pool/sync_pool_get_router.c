@@ -0,0 +1,140 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+static gboolean
+_wait_for_router (mongo_sync_pool *pool, gint index, gboolean healthy,
+		  gint connections)
+{
+  mongo_sync_pool_router_info info;
+  gint i;
+
+  for (i = 0; i < 300; i++)
+    {
+      mongo_sync_pool_get_router (pool, index, &info);
+      if (info.healthy == healthy && info.connections == connections)
+	return TRUE;
+      g_usleep (10000);
+    }
+  return FALSE;
+}
+
+typedef struct
+{
+  mongo_sync_pool *pool;
+  volatile gint stop;
+} churner;
+
+/* Pick and return connections until told to stop. */
+static gpointer
+_churn (gpointer data)
+{
+  churner *ch = (churner *)data;
+
+  while (!g_atomic_int_get (&ch->stop))
+    {
+      mongo_sync_pool_connection *c;
+
+      c = mongo_sync_pool_pick_timeout (ch->pool, TRUE, 100);
+      if (c)
+	mongo_sync_pool_return (ch->pool, c);
+    }
+  return NULL;
+}
+
+void
+test_mongo_sync_pool_get_router (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_limits limits;
+  mongo_sync_pool_router_info info;
+  const gchar *routers[3] = { NULL, NULL, NULL };
+  gchar *a, *b;
+  churner ch;
+  GThread *threads[4];
+  mongo_sync_pool_connection *c;
+  gint port_a, port_b, i;
+  pid_t server_a, server_b;
+
+  ok (mongo_sync_pool_get_router (NULL, 0, &info) == FALSE,
+      "mongo_sync_pool_get_router() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server_a = test_mock_server_start (&port_a);
+  server_b = test_mock_server_start (&port_b);
+
+  pool = mongo_sync_pool_new ("127.0.0.1", port_a, 1, 0);
+  ok (mongo_sync_pool_get_router (pool, 0, &info) == FALSE,
+      "mongo_sync_pool_get_router() fails on a pool without routers");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+  mongo_sync_pool_free (pool);
+
+  a = g_strdup_printf ("127.0.0.1:%d", port_a);
+  b = g_strdup_printf ("127.0.0.1:%d", port_b);
+  routers[0] = a;
+  routers[1] = b;
+  mongo_sync_pool_limits_init (&limits, 4, 0);
+  pool = mongo_sync_pool_new_with_routers (routers, &limits, NULL);
+
+  ok (mongo_sync_pool_get_router (pool, 0, NULL) == FALSE,
+      "mongo_sync_pool_get_router() fails without a destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_pool_get_router (pool, 2, &info) == FALSE,
+      "mongo_sync_pool_get_router() fails with an invalid index");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  ok (mongo_sync_pool_get_router (pool, 1, &info) == TRUE &&
+      info.healthy && info.connections == 2 && info.rtt >= 0,
+      "mongo_sync_pool_get_router() works");
+
+  test_mock_server_stop (server_b);
+  mongo_sync_pool_start_health_checks (pool, 10);
+
+  ok (_wait_for_router (pool, 1, FALSE, 0),
+      "A router that goes away is marked down and drained");
+  ok (_wait_for_router (pool, 0, TRUE, 4),
+      "Connections to a router that is down are replaced");
+
+  mongo_sync_pool_free (pool);
+
+  /* Connections returned while their router goes down are not closed
+     under the threads returning them. */
+  server_b = test_mock_server_start (&port_b);
+  g_free (b);
+  b = g_strdup_printf ("127.0.0.1:%d", port_b);
+  routers[1] = b;
+  mongo_sync_pool_limits_init (&limits, 8, 0);
+  pool = mongo_sync_pool_new_with_routers (routers, &limits, NULL);
+  mongo_sync_pool_start_health_checks (pool, 1);
+
+  ch.pool = pool;
+  ch.stop = 0;
+  for (i = 0; i < 4; i++)
+    threads[i] = g_thread_new ("churner", _churn, &ch);
+  g_usleep (50000);
+  test_mock_server_stop (server_b);
+  g_usleep (200000);
+  g_atomic_int_set (&ch.stop, 1);
+  for (i = 0; i < 4; i++)
+    g_thread_join (threads[i]);
+
+  ok (_wait_for_router (pool, 1, FALSE, 0) &&
+      _wait_for_router (pool, 0, TRUE, 8),
+      "Connections returned while a router goes down are drained");
+  c = mongo_sync_pool_pick (pool, TRUE);
+  ok (c != NULL && mongo_sync_cmd_ping ((mongo_sync_connection *)c),
+      "The pool keeps working after a router went down under load");
+  mongo_sync_pool_return (pool, c);
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server_a);
+  g_free (a);
+  g_free (b);
+}
+
+RUN_TEST (13, mongo_sync_pool_get_router);
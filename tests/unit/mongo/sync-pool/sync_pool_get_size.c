@@ -0,0 +1,31 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_get_size (void)
+{
+  mongo_sync_pool *pool;
+  gint port, masters = -1, slaves = -1;
+  pid_t server;
+
+  ok (mongo_sync_pool_get_size (NULL, &masters, &slaves) == FALSE,
+      "mongo_sync_pool_get_size() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 3, 0);
+
+  ok (mongo_sync_pool_get_size (pool, &masters, &slaves) == TRUE &&
+      masters == 3 && slaves == 0,
+      "mongo_sync_pool_get_size() works");
+  ok (mongo_sync_pool_get_size (pool, NULL, NULL) == TRUE,
+      "mongo_sync_pool_get_size() works without destinations");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (4, mongo_sync_pool_get_size);
@@ -0,0 +1,44 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_get_wait_stats (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_wait_stats stats;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_pool_get_wait_stats (NULL, &stats) == FALSE,
+      "mongo_sync_pool_get_wait_stats() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  ok (mongo_sync_pool_get_wait_stats (pool, NULL) == FALSE,
+      "mongo_sync_pool_get_wait_stats() fails without a destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  mongo_sync_pool_pick_timeout (pool, TRUE, 10);
+  ok (mongo_sync_pool_get_wait_stats (pool, &stats) == TRUE &&
+      stats.waits == 0 && stats.waiting == 0,
+      "Picks that do not wait are not counted");
+
+  mongo_sync_pool_pick_timeout (pool, TRUE, 20);
+  mongo_sync_pool_pick_timeout (pool, TRUE, 0);
+  mongo_sync_pool_get_wait_stats (pool, &stats);
+  ok (stats.waits == 1 && stats.timeouts == 1,
+      "Waits and timeouts are counted");
+  ok (stats.max_wait >= 20000 && stats.total_wait == stats.max_wait,
+      "Wait times are recorded");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (7, mongo_sync_pool_get_wait_stats);
@@ -0,0 +1,22 @@
+#include "test.h"
+#include "mongo.h"
+
+void
+test_mongo_sync_pool_limits_init (void)
+{
+  mongo_sync_pool_limits limits;
+
+  mongo_sync_pool_limits_init (NULL, 1, 2);
+  pass ("mongo_sync_pool_limits_init() does not crash without limits");
+
+  limits.idle_timeout = 42;
+  mongo_sync_pool_limits_init (&limits, 3, 2);
+  ok (limits.min_masters == 3 && limits.max_masters == 3,
+      "The number of masters is both the minimum and the maximum");
+  ok (limits.min_slaves == 2 && limits.max_slaves == 2,
+      "The number of slaves is both the minimum and the maximum");
+  cmp_ok (limits.idle_timeout, "==", 0,
+	  "Idle connections are kept open by default");
+}
+
+RUN_TEST (4, mongo_sync_pool_limits_init);
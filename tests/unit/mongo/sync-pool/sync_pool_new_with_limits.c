@@ -0,0 +1,76 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_new_with_limits (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_limits limits;
+  mongo_sync_pool_connection *c1, *c2, *c3;
+  gint port, masters = -1, slaves = -1;
+  pid_t server;
+
+  mongo_sync_pool_limits_init (&limits, 1, 0);
+
+  ok (mongo_sync_pool_new_with_limits ("127.0.0.1", 27017, NULL,
+				       NULL) == NULL,
+      "mongo_sync_pool_new_with_limits() fails without limits");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  limits.min_masters = 2;
+  ok (mongo_sync_pool_new_with_limits ("127.0.0.1", 27017, &limits,
+				       NULL) == NULL,
+      "mongo_sync_pool_new_with_limits() fails if a minimum is above "
+      "its maximum");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  mongo_sync_pool_limits_init (&limits, 1, 0);
+  limits.idle_timeout = -1;
+  ok (mongo_sync_pool_new_with_limits ("127.0.0.1", 27017, &limits,
+				       NULL) == NULL,
+      "mongo_sync_pool_new_with_limits() fails with a negative idle "
+      "timeout");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  server = test_mock_server_start (&port);
+
+  limits.min_masters = 2;
+  limits.max_masters = 3;
+  limits.max_slaves = 4;
+  limits.idle_timeout = 0;
+  pool = mongo_sync_pool_new_with_limits ("127.0.0.1", port, &limits, NULL);
+  ok (pool != NULL,
+      "mongo_sync_pool_new_with_limits() works");
+  mongo_sync_pool_get_size (pool, &masters, &slaves);
+  ok (masters == 2 && slaves == 0,
+      "Only the minimum is opened, and no slaves without secondaries");
+
+  c1 = mongo_sync_pool_pick (pool, TRUE);
+  c2 = mongo_sync_pool_pick (pool, TRUE);
+  c3 = mongo_sync_pool_pick (pool, FALSE);
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  ok (c1 && c2 && c3 && c3 != c1 && c3 != c2 && masters == 3,
+      "mongo_sync_pool_pick() grows the pool");
+  ok (mongo_sync_cmd_ping ((mongo_sync_connection *)c3),
+      "The new connection works");
+
+  ok (mongo_sync_pool_pick (pool, TRUE) == NULL && errno == EAGAIN,
+      "mongo_sync_pool_pick() does not grow the pool above its maximum");
+  ok (mongo_sync_pool_pick_timeout (pool, TRUE, 20) == NULL &&
+      errno == ETIMEDOUT,
+      "Neither does mongo_sync_pool_pick_timeout()");
+
+  ok (mongo_sync_pool_return (pool, c3) && mongo_sync_pool_return (pool, c2) &&
+      mongo_sync_pool_return (pool, c1),
+      "Every connection can be returned");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (13, mongo_sync_pool_new_with_limits);
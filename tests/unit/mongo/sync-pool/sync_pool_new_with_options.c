@@ -0,0 +1,39 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_pool_new_with_options (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *conn;
+  mongo_connection_options opts;
+  gint port;
+  pid_t server;
+
+  mongo_connection_options_init (&opts);
+  opts.rcvbuf = 64 * 1024;
+
+  ok (mongo_sync_pool_new_with_options (NULL, 27017, 1, 0, &opts) == NULL,
+      "mongo_sync_pool_new_with_options() should fail without a HOST");
+  ok (mongo_sync_pool_new_with_options ("example.com", 27017, 0, 0,
+					&opts) == NULL,
+      "mongo_sync_pool_new_with_options() needs at least one connection");
+
+  server = test_mock_server_start (&port);
+
+  pool = mongo_sync_pool_new_with_options ("127.0.0.1", port, 2, 0, &opts);
+  ok (pool != NULL,
+      "mongo_sync_pool_new_with_options() works");
+
+  conn = mongo_sync_pool_pick (pool, TRUE);
+  ok (conn != NULL && conn->super.super.options.rcvbuf == 64 * 1024,
+      "Pooled connections use the options");
+  mongo_sync_pool_return (pool, conn);
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (4, mongo_sync_pool_new_with_options);
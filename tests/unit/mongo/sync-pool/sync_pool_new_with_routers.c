@@ -0,0 +1,76 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_new_with_routers (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_limits limits;
+  mongo_sync_pool_router_info info0, info1;
+  const gchar *empty[] = { NULL };
+  const gchar *bad[] = { "[::1", NULL };
+  const gchar *routers[3] = { NULL, NULL, NULL };
+  gchar *a, *b;
+  gint port_a, port_b, masters;
+  pid_t server_a, server_b;
+
+  mongo_sync_pool_limits_init (&limits, 4, 0);
+
+  ok (mongo_sync_pool_new_with_routers (NULL, &limits, NULL) == NULL,
+      "mongo_sync_pool_new_with_routers() fails without routers");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_pool_new_with_routers (empty, &limits, NULL) == NULL,
+      "mongo_sync_pool_new_with_routers() fails with an empty router list");
+  ok (mongo_sync_pool_new_with_routers (bad, &limits, NULL) == NULL,
+      "mongo_sync_pool_new_with_routers() fails with a bad address");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server_a = test_mock_server_start (&port_a);
+  server_b = test_mock_server_start (&port_b);
+  a = g_strdup_printf ("127.0.0.1:%d", port_a);
+  b = g_strdup_printf ("127.0.0.1:%d", port_b);
+  routers[0] = a;
+  routers[1] = b;
+
+  limits.min_masters = 5;
+  ok (mongo_sync_pool_new_with_routers (routers, &limits, NULL) == NULL,
+      "mongo_sync_pool_new_with_routers() fails with bad limits");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+  limits.min_masters = 4;
+
+  pool = mongo_sync_pool_new_with_routers (routers, &limits, NULL);
+  ok (pool != NULL,
+      "mongo_sync_pool_new_with_routers() works");
+  mongo_sync_pool_get_router (pool, 0, &info0);
+  mongo_sync_pool_get_router (pool, 1, &info1);
+  ok (info0.healthy && info1.healthy &&
+      info0.connections == 2 && info1.connections == 2,
+      "Connections are spread evenly over the routers");
+  mongo_sync_pool_free (pool);
+
+  test_mock_server_stop (server_a);
+
+  pool = mongo_sync_pool_new_with_routers (routers, &limits, NULL);
+  mongo_sync_pool_get_router (pool, 0, &info0);
+  mongo_sync_pool_get_router (pool, 1, &info1);
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  ok (pool != NULL && !info0.healthy && info0.connections == 0 &&
+      info1.connections == 4 && masters == 4,
+      "Routers that cannot be reached start out down");
+  mongo_sync_pool_free (pool);
+
+  test_mock_server_stop (server_b);
+
+  ok (mongo_sync_pool_new_with_routers (routers, &limits, NULL) == NULL,
+      "mongo_sync_pool_new_with_routers() fails if no router answers");
+
+  g_free (a);
+  g_free (b);
+}
+
+RUN_TEST (11, mongo_sync_pool_new_with_routers);
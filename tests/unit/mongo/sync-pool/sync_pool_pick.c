@@ -1,11 +1,46 @@
 #include "test.h"
 #include "mongo.h"
 
+#include <errno.h>
+
 void
 test_mongo_sync_pool_pick (void)
 {
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *c1, *c2;
+  gint port;
+  pid_t server;
+
   ok (mongo_sync_pool_pick (NULL, TRUE) == NULL,
       "mongo_sync_pool_pick() should fail without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 2, 0);
+
+  c1 = mongo_sync_pool_pick (pool, TRUE);
+  c2 = mongo_sync_pool_pick (pool, TRUE);
+  ok (c1 != NULL && c2 != NULL && c1 != c2,
+      "mongo_sync_pool_pick() picks different free connections");
+  ok (mongo_sync_pool_pick (pool, TRUE) == NULL,
+      "mongo_sync_pool_pick() fails when every connection is in use");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is EAGAIN");
+
+  mongo_sync_pool_return (pool, c2);
+  ok (mongo_sync_pool_pick (pool, FALSE) == c2,
+      "mongo_sync_pool_pick() falls back to a master when secondaries "
+      "are acceptable");
+
+  mongo_sync_pool_return (pool, c1);
+  mongo_sync_pool_return (pool, c1);
+  ok (mongo_sync_pool_pick (pool, TRUE) == c1 &&
+      mongo_sync_pool_pick (pool, TRUE) == NULL,
+      "A connection returned twice is only picked once");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
 }
 
-RUN_TEST (1, mongo_sync_pool_pick);
+RUN_TEST (7, mongo_sync_pool_pick);
@@ -0,0 +1,112 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+typedef struct
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *conn;
+  gint delay;
+} delayed_op;
+
+static gpointer
+_return_later (gpointer data)
+{
+  delayed_op *op = (delayed_op *)data;
+
+  g_usleep (op->delay * 1000);
+  mongo_sync_pool_return (op->pool, op->conn);
+  return NULL;
+}
+
+static gpointer
+_pick_waiting (gpointer data)
+{
+  delayed_op *op = (delayed_op *)data;
+
+  g_usleep (op->delay * 1000);
+  op->conn = mongo_sync_pool_pick_timeout (op->pool, TRUE, -1);
+  return NULL;
+}
+
+static void
+_wait_for_waiters (mongo_sync_pool *pool, gint n)
+{
+  mongo_sync_pool_wait_stats stats;
+
+  do
+    {
+      g_usleep (1000);
+      mongo_sync_pool_get_wait_stats (pool, &stats);
+    }
+  while (stats.waiting < n);
+}
+
+void
+test_mongo_sync_pool_pick_timeout (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *c;
+  delayed_op ret, first, second;
+  GThread *t1, *t2;
+  gint64 start;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_pool_pick_timeout (NULL, TRUE, 10) == NULL,
+      "mongo_sync_pool_pick_timeout() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  c = mongo_sync_pool_pick_timeout (pool, TRUE, 10);
+  ok (c != NULL,
+      "mongo_sync_pool_pick_timeout() picks a free connection right away");
+
+  ok (mongo_sync_pool_pick_timeout (pool, TRUE, 0) == NULL,
+      "mongo_sync_pool_pick_timeout() does not wait with a zero timeout");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is EAGAIN");
+
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_pool_pick_timeout (pool, TRUE, 50) == NULL,
+      "mongo_sync_pool_pick_timeout() fails if nothing is returned in time");
+  cmp_ok (errno, "==", ETIMEDOUT,
+	  "errno is ETIMEDOUT");
+  cmp_ok (g_get_monotonic_time () - start, ">=", 50000,
+	  "mongo_sync_pool_pick_timeout() waits until the deadline");
+
+  ret.pool = pool;
+  ret.conn = c;
+  ret.delay = 50;
+  t1 = g_thread_new ("return", _return_later, &ret);
+  ok (mongo_sync_pool_pick_timeout (pool, TRUE, 5000) == c,
+      "A returned connection is handed to the waiting caller");
+  g_thread_join (t1);
+
+  first.pool = second.pool = pool;
+  first.conn = second.conn = NULL;
+  first.delay = 0;
+  t1 = g_thread_new ("first", _pick_waiting, &first);
+  _wait_for_waiters (pool, 1);
+  second.delay = 0;
+  t2 = g_thread_new ("second", _pick_waiting, &second);
+  _wait_for_waiters (pool, 2);
+
+  mongo_sync_pool_return (pool, c);
+  g_thread_join (t1);
+  ok (first.conn == c && second.conn == NULL,
+      "Waiting callers are served in the order they started waiting");
+  mongo_sync_pool_return (pool, c);
+  g_thread_join (t2);
+  ok (second.conn == c,
+      "The next returned connection goes to the next waiting caller");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (11, mongo_sync_pool_pick_timeout);
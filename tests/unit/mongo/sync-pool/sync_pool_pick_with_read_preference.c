@@ -0,0 +1,55 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_pick_with_read_preference (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *c;
+  mongo_sync_read_preference pref;
+  gint port;
+  pid_t server;
+
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_NEAREST);
+
+  ok (mongo_sync_pool_pick_with_read_preference (NULL, &pref) == NULL,
+      "mongo_sync_pool_pick_with_read_preference() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  ok (mongo_sync_pool_pick_with_read_preference (pool, NULL) == NULL,
+      "mongo_sync_pool_pick_with_read_preference() fails without a "
+      "read preference");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  pref.mode = MONGO_SYNC_READ_SECONDARY;
+  ok (mongo_sync_pool_pick_with_read_preference (pool, &pref) == NULL,
+      "mongo_sync_pool_pick_with_read_preference() fails if there are "
+      "no eligible members");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is EAGAIN");
+
+  pref.mode = MONGO_SYNC_READ_SECONDARY_PREFERRED;
+  c = mongo_sync_pool_pick_with_read_preference (pool, &pref);
+  ok (c != NULL,
+      "mongo_sync_pool_pick_with_read_preference() falls back to the "
+      "primary");
+  ok (mongo_sync_pool_pick_with_read_preference (pool, &pref) == NULL,
+      "Connections in use are not picked again");
+
+  mongo_sync_pool_return (pool, c);
+  pref.mode = MONGO_SYNC_READ_PRIMARY;
+  ok (mongo_sync_pool_pick_with_read_preference (pool, &pref) == c,
+      "Returned connections can be picked again");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (9, mongo_sync_pool_pick_with_read_preference);
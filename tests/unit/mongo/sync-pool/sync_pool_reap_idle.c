@@ -0,0 +1,63 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_reap_idle (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_limits limits;
+  mongo_sync_pool_connection *c1, *c2, *c3;
+  gint port, masters;
+  pid_t server;
+
+  ok (mongo_sync_pool_reap_idle (NULL) == -1,
+      "mongo_sync_pool_reap_idle() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 2, 0);
+  cmp_ok (mongo_sync_pool_reap_idle (pool), "==", 0,
+	  "Pools without an idle timeout are never reaped");
+  mongo_sync_pool_free (pool);
+
+  mongo_sync_pool_limits_init (&limits, 1, 0);
+  limits.max_masters = 3;
+  limits.idle_timeout = 50;
+  pool = mongo_sync_pool_new_with_limits ("127.0.0.1", port, &limits, NULL);
+
+  c1 = mongo_sync_pool_pick (pool, TRUE);
+  c2 = mongo_sync_pool_pick_timeout (pool, TRUE, 5000);
+  c3 = mongo_sync_pool_pick_timeout (pool, TRUE, 5000);
+  mongo_sync_pool_return (pool, c1);
+  mongo_sync_pool_return (pool, c2);
+  mongo_sync_pool_return (pool, c3);
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  cmp_ok (masters, "==", 3,
+	  "The pool grew to its maximum");
+
+  cmp_ok (mongo_sync_pool_reap_idle (pool), "==", 0,
+	  "Recently used connections are not reaped");
+
+  g_usleep (100000);
+  cmp_ok (mongo_sync_pool_reap_idle (pool), "==", 2,
+	  "Idle connections are reaped");
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  cmp_ok (masters, "==", 1,
+	  "The pool shrinks to its minimum, but not below");
+
+  c1 = mongo_sync_pool_pick (pool, TRUE);
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  ok (c1 != NULL && masters == 1,
+      "The remaining connection can be picked");
+  ok (mongo_sync_cmd_ping ((mongo_sync_connection *)c1),
+      "The remaining connection works");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (9, mongo_sync_pool_reap_idle);
@@ -1,22 +1,61 @@
 #include "test.h"
 #include "mongo.h"
 
+#include <errno.h>
 #include <string.h>
 #include "libmongo-private.h"
 
 void
 test_mongo_sync_pool_return (void)
 {
-  mongo_sync_pool_connection c;
-  void *pool;
+  mongo_sync_pool_connection c, *m;
+  mongo_sync_pool *pool;
+  void *fake;
+  gint port, id;
+  pid_t server;
 
-  pool = g_malloc (1024);
+  fake = g_malloc (1024);
 
   ok (mongo_sync_pool_return (NULL, &c) == FALSE,
       "mongo_sync_pool_return() should fail without a pool");
-  ok (mongo_sync_pool_return ((mongo_sync_pool *)pool, NULL) == FALSE,
+  ok (mongo_sync_pool_return ((mongo_sync_pool *)fake, NULL) == FALSE,
       "mongo_sync_pool_return() should fail without a connection");
-  g_free (pool);
+  g_free (fake);
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  m = mongo_sync_pool_pick (pool, TRUE);
+  id = m->pool_id;
+  m->pool_id = 1;
+  errno = 0;
+  ok (mongo_sync_pool_return (pool, m) == FALSE && errno == ERANGE,
+      "mongo_sync_pool_return() fails if the connection ID is out of "
+      "range");
+  m->pool_id = -1;
+  errno = 0;
+  ok (mongo_sync_pool_return (pool, m) == FALSE && errno == ERANGE,
+      "mongo_sync_pool_return() fails with a negative connection ID");
+
+  m->pool_id = id;
+  ok (mongo_sync_pool_return (pool, m) == TRUE,
+      "mongo_sync_pool_return() works");
+  errno = 0;
+  ok (mongo_sync_pool_return (pool, m) == FALSE && errno == EINVAL,
+      "mongo_sync_pool_return() fails with a connection returned already");
+  ok (mongo_sync_pool_pick (pool, TRUE) == m,
+      "The returned connection can be picked again");
+
+  mongo_sync_pool_set_thread_affinity (pool, TRUE);
+  mongo_sync_pool_return (pool, m);
+  errno = 0;
+  ok (mongo_sync_pool_return (pool, m) == FALSE && errno == EINVAL,
+      "mongo_sync_pool_return() fails with a parked connection");
+  ok (mongo_sync_pool_pick (pool, TRUE) == m,
+      "The parked connection can still be picked");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
 }
 
-RUN_TEST (2, mongo_sync_pool_return);
+RUN_TEST (9, mongo_sync_pool_return);
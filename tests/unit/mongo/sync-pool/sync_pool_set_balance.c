@@ -0,0 +1,68 @@
+#include "test.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_set_balance (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_limits limits;
+  mongo_sync_pool_connection *c1, *c2;
+  const gchar *routers[3] = { NULL, NULL, NULL };
+  gchar *a, *b;
+  gint port_a, port_b, i, fast = 0;
+  pid_t server_a, server_b;
+
+  ok (mongo_sync_pool_set_balance (NULL,
+				   MONGO_SYNC_POOL_BALANCE_RTT) == FALSE,
+      "mongo_sync_pool_set_balance() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server_a = test_mock_server_start_delayed (&port_a, 20);
+  server_b = test_mock_server_start (&port_b);
+  a = g_strdup_printf ("127.0.0.1:%d", port_a);
+  b = g_strdup_printf ("127.0.0.1:%d", port_b);
+  routers[0] = a;
+  routers[1] = b;
+
+  mongo_sync_pool_limits_init (&limits, 4, 0);
+  pool = mongo_sync_pool_new_with_routers (routers, &limits, NULL);
+
+  ok (mongo_sync_pool_set_balance (pool, 42) == FALSE,
+      "mongo_sync_pool_set_balance() fails with an unknown strategy");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  ok (mongo_sync_pool_set_balance
+      (pool, MONGO_SYNC_POOL_BALANCE_LEAST_OUTSTANDING) == TRUE,
+      "mongo_sync_pool_set_balance() works");
+  c1 = mongo_sync_pool_pick (pool, TRUE);
+  c2 = mongo_sync_pool_pick (pool, TRUE);
+  ok (c1 && c2 && c1->router != c2->router,
+      "Least outstanding picks the router with the fewest connections "
+      "in use");
+  mongo_sync_pool_return (pool, c1);
+  mongo_sync_pool_return (pool, c2);
+
+  mongo_sync_pool_set_balance (pool, MONGO_SYNC_POOL_BALANCE_RTT);
+  for (i = 0; i < 50; i++)
+    {
+      c1 = mongo_sync_pool_pick (pool, TRUE);
+      if (c1->router == 1)
+	fast++;
+      mongo_sync_pool_return (pool, c1);
+    }
+  cmp_ok (fast, ">=", 40,
+	  "Picking by round-trip time prefers the closer router");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server_a);
+  test_mock_server_stop (server_b);
+  g_free (a);
+  g_free (b);
+}
+
+RUN_TEST (7, mongo_sync_pool_set_balance);
@@ -0,0 +1,59 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_set_monitor (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *c;
+  mongo_sync_connection *seed;
+  mongo_sync_monitor *m;
+  mongo_sync_read_preference pref;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_pool_set_monitor (NULL, NULL) == FALSE,
+      "mongo_sync_pool_set_monitor() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  seed = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (seed, "127.0.0.1", port);
+  m = mongo_sync_monitor_new (seed, 60000);
+  mongo_sync_monitor_refresh (m);
+
+  mongo_sync_pool_set_thread_affinity (pool, TRUE);
+  mongo_sync_pool_return (pool, mongo_sync_pool_pick (pool, TRUE));
+
+  ok (mongo_sync_pool_set_monitor (pool, m),
+      "mongo_sync_pool_set_monitor() works");
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_PRIMARY);
+  c = mongo_sync_pool_pick_with_read_preference (pool, &pref);
+  ok (c != NULL,
+      "Attaching a monitor puts parked connections back");
+  mongo_sync_pool_return (pool, c);
+
+  /* Once the member is gone, the monitor knows it is down. */
+  test_mock_server_stop (server);
+  mongo_sync_monitor_refresh (m);
+
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_NEAREST);
+  ok (mongo_sync_pool_pick_with_read_preference (pool, &pref) == NULL,
+      "Picking honours the roles reported by the monitor");
+
+  ok (mongo_sync_pool_set_monitor (pool, NULL),
+      "mongo_sync_pool_set_monitor() can detach the monitor");
+  ok (mongo_sync_pool_pick_with_read_preference (pool, &pref) != NULL,
+      "Without a monitor, the roles known at setup are used");
+
+  mongo_sync_pool_free (pool);
+  mongo_sync_monitor_free (m);
+  mongo_sync_disconnect (seed);
+}
+
+RUN_TEST (7, mongo_sync_pool_set_monitor);
@@ -0,0 +1,120 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+typedef struct
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *conns[3];
+  gint n;
+} picker;
+
+static gpointer
+_pick_all (gpointer data)
+{
+  picker *p = (picker *)data;
+  gint i;
+
+  for (i = 0; i < p->n; i++)
+    p->conns[i] = mongo_sync_pool_pick (p->pool, TRUE);
+  return NULL;
+}
+
+static gpointer
+_pick_waiting (gpointer data)
+{
+  picker *p = (picker *)data;
+
+  p->conns[0] = mongo_sync_pool_pick_timeout (p->pool, TRUE, -1);
+  return NULL;
+}
+
+static void
+_pick_in_thread (picker *p, mongo_sync_pool *pool, gint n)
+{
+  p->pool = pool;
+  p->n = n;
+  memset (p->conns, 0, sizeof (p->conns));
+  g_thread_join (g_thread_new ("picker", _pick_all, p));
+}
+
+void
+test_mongo_sync_pool_set_thread_affinity (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *a, *b, *c;
+  mongo_sync_pool_wait_stats stats;
+  picker p;
+  GThread *t;
+  gint port, i;
+  pid_t server;
+
+  ok (mongo_sync_pool_set_thread_affinity (NULL, TRUE) == FALSE,
+      "mongo_sync_pool_set_thread_affinity() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 3, 0);
+
+  ok (mongo_sync_pool_set_thread_affinity (pool, TRUE) == TRUE,
+      "mongo_sync_pool_set_thread_affinity() works");
+
+  a = mongo_sync_pool_pick (pool, TRUE);
+  b = mongo_sync_pool_pick (pool, TRUE);
+  mongo_sync_pool_return (pool, a);
+  mongo_sync_pool_return (pool, b);
+  mongo_sync_pool_return (pool, mongo_sync_pool_pick (pool, TRUE));
+  ok (mongo_sync_pool_pick (pool, TRUE) == b,
+      "A thread gets the connection it returned last back");
+  mongo_sync_pool_return (pool, b);
+
+  _pick_in_thread (&p, pool, 2);
+  ok (p.conns[0] != b && p.conns[1] != b,
+      "Other threads get free connections before parked ones");
+  for (i = 0; i < 2; i++)
+    mongo_sync_pool_return (pool, p.conns[i]);
+
+  /* The connection returned last is the one parked now. */
+  b = p.conns[1];
+  _pick_in_thread (&p, pool, 3);
+  ok ((p.conns[0] == b || p.conns[1] == b || p.conns[2] == b) &&
+      p.conns[0] && p.conns[1] && p.conns[2],
+      "Parked connections are taken once no free ones are left");
+  for (i = 0; i < 3; i++)
+    mongo_sync_pool_return (pool, p.conns[i]);
+
+  a = mongo_sync_pool_pick (pool, TRUE);
+  b = mongo_sync_pool_pick (pool, TRUE);
+  c = mongo_sync_pool_pick (pool, TRUE);
+  p.pool = pool;
+  p.conns[0] = NULL;
+  t = g_thread_new ("waiter", _pick_waiting, &p);
+  do
+    {
+      g_usleep (1000);
+      mongo_sync_pool_get_wait_stats (pool, &stats);
+    }
+  while (stats.waiting < 1);
+  mongo_sync_pool_return (pool, c);
+  g_thread_join (t);
+  ok (p.conns[0] == c,
+      "Connections are handed to waiters instead of being parked");
+  mongo_sync_pool_return (pool, p.conns[0]);
+  mongo_sync_pool_return (pool, b);
+  mongo_sync_pool_return (pool, a);
+
+  ok (mongo_sync_pool_set_thread_affinity (pool, FALSE) == TRUE,
+      "mongo_sync_pool_set_thread_affinity() can disable affinity");
+  _pick_in_thread (&p, pool, 3);
+  ok (p.conns[0] == a || p.conns[1] == a || p.conns[2] == a,
+      "Disabling affinity puts parked connections back");
+  for (i = 0; i < 3; i++)
+    mongo_sync_pool_return (pool, p.conns[i]);
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (9, mongo_sync_pool_set_thread_affinity);
@@ -0,0 +1,101 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+/* Wait for the pool to have a working connection again, and return
+   it. */
+static mongo_sync_pool_connection *
+_wait_for_healthy (mongo_sync_pool *pool)
+{
+  gint i;
+
+  for (i = 0; i < 200; i++)
+    {
+      mongo_sync_pool_connection *c = mongo_sync_pool_pick (pool, TRUE);
+
+      if (c && mongo_sync_cmd_ping ((mongo_sync_connection *)c))
+	return c;
+      if (c)
+	mongo_sync_pool_return (pool, c);
+      g_usleep (10000);
+    }
+  return NULL;
+}
+
+void
+test_mongo_sync_pool_start_health_checks (void)
+{
+  mongo_sync_pool *pool;
+  mongo_sync_pool_limits limits;
+  mongo_sync_pool_connection *c, *h, *c2;
+  gint port, masters;
+  pid_t server;
+
+  ok (mongo_sync_pool_start_health_checks (NULL, 100) == FALSE,
+      "mongo_sync_pool_start_health_checks() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  ok (mongo_sync_pool_start_health_checks (pool, -1) == FALSE,
+      "mongo_sync_pool_start_health_checks() fails with a negative "
+      "interval");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is ERANGE");
+
+  /* Without health checks, broken connections are caught on return. */
+  c = mongo_sync_pool_pick (pool, TRUE);
+  shutdown (c->super.super.fd, SHUT_RDWR);
+  ok (mongo_sync_pool_return (pool, c) == TRUE,
+      "A broken connection can be returned");
+  h = _wait_for_healthy (pool);
+  ok (h != NULL,
+      "A broken connection is replaced after it is returned");
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  cmp_ok (masters, "==", 1,
+	  "The replacement takes the place of the broken connection");
+
+  /* With health checks, idle connections are validated too. */
+  ok (mongo_sync_pool_start_health_checks (pool, 20) == TRUE,
+      "mongo_sync_pool_start_health_checks() works");
+  mongo_sync_pool_return (pool, h);
+  shutdown (h->super.super.fd, SHUT_RDWR);
+  g_usleep (200000);
+  c = mongo_sync_pool_pick (pool, TRUE);
+  ok (c != NULL && mongo_sync_cmd_ping ((mongo_sync_connection *)c),
+      "Idle connections that broke are replaced before they are picked");
+  mongo_sync_pool_return (pool, c);
+
+  mongo_sync_pool_free (pool);
+  pass ("mongo_sync_pool_free() stops the health checks");
+
+  /* Without an interval, idle connections are still reaped. */
+  mongo_sync_pool_limits_init (&limits, 1, 0);
+  limits.max_masters = 3;
+  limits.idle_timeout = 50;
+  pool = mongo_sync_pool_new_with_limits ("127.0.0.1", port, &limits, NULL);
+  c = mongo_sync_pool_pick (pool, TRUE);
+  h = mongo_sync_pool_pick_timeout (pool, TRUE, 5000);
+  c2 = mongo_sync_pool_pick_timeout (pool, TRUE, 5000);
+  mongo_sync_pool_return (pool, c);
+  mongo_sync_pool_return (pool, h);
+  mongo_sync_pool_return (pool, c2);
+
+  ok (mongo_sync_pool_start_health_checks (pool, 0) == TRUE,
+      "mongo_sync_pool_start_health_checks() works without an interval");
+  g_usleep (300000);
+  mongo_sync_pool_get_size (pool, &masters, NULL);
+  cmp_ok (masters, "==", 1,
+	  "Idle connections are reaped without an interval");
+  mongo_sync_pool_free (pool);
+
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (12, mongo_sync_pool_start_health_checks);
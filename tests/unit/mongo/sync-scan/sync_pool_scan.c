@@ -0,0 +1,99 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+static gboolean
+_count_docs (const bson *doc, gint partition, gpointer user_data)
+{
+  gint *counts = (gint *)user_data;
+
+  counts[partition]++;
+  return doc != NULL;
+}
+
+static gboolean
+_abort_scan (const bson *doc, gint partition, gpointer user_data)
+{
+  return FALSE;
+}
+
+void
+test_mongo_sync_pool_scan (void)
+{
+  mongo_sync_pool *pool;
+  gint counts[4] = { 0, 0, 0, 0 };
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_pool_scan (NULL, "test.ns", NULL, NULL, 1,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _count_docs,
+			    counts) == FALSE,
+      "mongo_sync_pool_scan() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  server = test_mock_server_start (&port);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 2, 0);
+
+  ok (mongo_sync_pool_scan (pool, NULL, NULL, NULL, 1,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _count_docs,
+			    counts) == FALSE,
+      "mongo_sync_pool_scan() fails with a NULL namespace");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_pool_scan (pool, "test.ns", NULL, NULL, 1,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, NULL,
+			    counts) == FALSE,
+      "mongo_sync_pool_scan() fails without a callback");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_pool_scan (pool, "test.ns", NULL, NULL, 0,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _count_docs,
+			    counts) == FALSE,
+      "mongo_sync_pool_scan() fails with zero partitions");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  /* The mock server answers every query with a single document. */
+  ok (mongo_sync_pool_scan (pool, "test.ns", NULL, NULL, 1,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _count_docs,
+			    counts),
+      "mongo_sync_pool_scan() works with a single partition");
+  cmp_ok (counts[0], "==", 1,
+	  "The document is delivered to the callback");
+  ok (mongo_sync_pool_pick (pool, TRUE) != NULL &&
+      mongo_sync_pool_pick (pool, TRUE) != NULL,
+      "Every connection is returned to the pool");
+
+  mongo_sync_pool_free (pool);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 1, 0);
+
+  ok (mongo_sync_pool_scan (pool, "test.ns", NULL, NULL, 1,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _abort_scan,
+			    NULL) == FALSE,
+      "mongo_sync_pool_scan() stops when the callback says so");
+  cmp_ok (errno, "==", ECANCELED,
+	  "errno is ECANCELED");
+
+  /* The reply to the count command carries no count. */
+  ok (mongo_sync_pool_scan (pool, "test.ns", NULL, NULL, 4,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _count_docs,
+			    counts) == FALSE,
+      "mongo_sync_pool_scan() fails if the partitions cannot be planned");
+  cmp_ok (counts[0], "==", 1,
+	  "Nothing is scanned if planning fails");
+
+  mongo_sync_pool_pick (pool, TRUE);
+  ok (mongo_sync_pool_scan (pool, "test.ns", NULL, NULL, 1,
+			    MONGO_SYNC_SCAN_SPLIT_SAMPLE, _count_docs,
+			    counts) == FALSE,
+      "mongo_sync_pool_scan() fails without free connections");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is EAGAIN");
+
+  mongo_sync_pool_free (pool);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (17, mongo_sync_pool_scan);
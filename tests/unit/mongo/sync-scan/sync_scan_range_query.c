@@ -0,0 +1,94 @@
+#include "test.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <string.h>
+
+static bson *
+_id_doc (gint32 id)
+{
+  bson *b = bson_new ();
+
+  bson_append_int32 (b, "_id", id);
+  bson_finish (b);
+  return b;
+}
+
+void
+test_mongo_sync_scan_range_query (void)
+{
+  bson *q, *lo, *hi, *r, *d, *outside;
+  bson_cursor *c;
+  gint32 v;
+
+  lo = _id_doc (10);
+  hi = _id_doc (20);
+  q = bson_new ();
+  bson_append_string (q, "name", "foo", -1);
+  bson_finish (q);
+
+  r = mongo_sync_scan_range_query (NULL, NULL, NULL);
+  cmp_ok (bson_size (r), "==", 5,
+	  "Without a query or bounds, everything matches");
+  bson_free (r);
+
+  r = mongo_sync_scan_range_query (q, NULL, NULL);
+  ok (bson_size (r) == bson_size (q) &&
+      memcmp (bson_data (r), bson_data (q), bson_size (q)) == 0,
+      "Without bounds, the query is used as-is");
+  bson_free (r);
+
+  r = mongo_sync_scan_range_query (NULL, lo, hi);
+  c = bson_find (r, "_id");
+  bson_cursor_get_document (c, &d);
+  bson_cursor_free (c);
+  c = bson_find (d, "$gte");
+  ok (bson_cursor_get_int32 (c, &v) && v == 10,
+      "The lower bound is inclusive");
+  bson_cursor_free (c);
+  c = bson_find (d, "$lt");
+  ok (bson_cursor_get_int32 (c, &v) && v == 20,
+      "The upper bound is exclusive");
+  bson_cursor_free (c);
+  bson_free (d);
+  bson_free (r);
+
+  r = mongo_sync_scan_range_query (NULL, NULL, hi);
+  c = bson_find (r, "_id");
+  bson_cursor_get_document (c, &d);
+  bson_cursor_free (c);
+  c = bson_find (d, "$gte");
+  ok (c == NULL,
+      "The range of the first partition is open at the bottom");
+  bson_cursor_free (c);
+  c = bson_find (d, "$not");
+  bson_cursor_get_document (c, &outside);
+  bson_cursor_free (c);
+  c = bson_find (outside, "$gte");
+  ok (bson_cursor_get_int32 (c, &v) && v == 20,
+      "The first partition takes everything not in the ones after it");
+  bson_cursor_free (c);
+  bson_free (outside);
+  bson_free (d);
+  bson_free (r);
+
+  r = mongo_sync_scan_range_query (q, lo, NULL);
+  c = bson_find (r, "$and");
+  ok (c != NULL,
+      "The query and the range are combined with $and");
+  bson_cursor_get_array (c, &d);
+  bson_cursor_free (c);
+  c = bson_find (d, "0");
+  ok (c != NULL && bson_cursor_next (c) &&
+      strcmp (bson_cursor_key (c), "1") == 0,
+      "The $and has both the query and the range");
+  bson_cursor_free (c);
+  bson_free (d);
+  bson_free (r);
+
+  bson_free (q);
+  bson_free (lo);
+  bson_free (hi);
+}
+
+RUN_TEST (8, mongo_sync_scan_range_query);
@@ -0,0 +1,27 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_tailer_free (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+
+  errno = 0;
+  mongo_sync_tailer_free (NULL);
+  cmp_ok (errno, "==", EINVAL,
+	  "mongo_sync_tailer_free(NULL) sets errno");
+
+  t = mongo_sync_tailer_new (conn, "local.oplog.rs", NULL);
+  mongo_sync_tailer_free (t);
+  cmp_ok (errno, "==", 0,
+	  "mongo_sync_tailer_free() works");
+
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (2, mongo_sync_tailer_free);
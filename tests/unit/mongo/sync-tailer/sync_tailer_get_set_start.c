@@ -0,0 +1,44 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_tailer_get_set_start (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+  gint64 ts = 0;
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  t = mongo_sync_tailer_new (conn, "local.oplog.rs", NULL);
+
+  ok (mongo_sync_tailer_set_start (NULL, 42) == FALSE,
+      "mongo_sync_tailer_set_start() fails with a NULL tailer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_tailer_get_last (NULL, &ts) == FALSE,
+      "mongo_sync_tailer_get_last() fails with a NULL tailer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_tailer_get_last (t, NULL) == FALSE,
+      "mongo_sync_tailer_get_last() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  ok (mongo_sync_tailer_get_last (t, &ts) == FALSE,
+      "mongo_sync_tailer_get_last() fails before anything was seen");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is ENOENT");
+
+  ok (mongo_sync_tailer_set_start (t, ((gint64)1294860709 << 32) | 3),
+      "mongo_sync_tailer_set_start() works");
+  ok (mongo_sync_tailer_get_last (t, &ts) &&
+      ts == (((gint64)1294860709 << 32) | 3),
+      "mongo_sync_tailer_get_last() returns the start position");
+
+  mongo_sync_tailer_free (t);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (10, mongo_sync_tailer_get_set_start);
@@ -0,0 +1,45 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_tailer_new (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+  bson *q;
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  q = bson_new ();
+  bson_append_string (q, "op", "i", -1);
+  bson_finish (q);
+
+  ok (mongo_sync_tailer_new (NULL, "local.oplog.rs", NULL) == NULL,
+      "mongo_sync_tailer_new() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+  ok (mongo_sync_tailer_new (conn, NULL, NULL) == NULL,
+      "mongo_sync_tailer_new() fails with a NULL namespace");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_tailer_new (conn, "oplog", NULL) == NULL,
+      "mongo_sync_tailer_new() fails with an invalid namespace");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  t = mongo_sync_tailer_new (conn, "local.oplog.rs", NULL);
+  ok (t != NULL,
+      "mongo_sync_tailer_new() works without a query");
+  mongo_sync_tailer_free (t);
+
+  t = mongo_sync_tailer_new (conn, "test.capped", q);
+  bson_free (q);
+  ok (t != NULL,
+      "mongo_sync_tailer_new() works with a query, and copies it");
+  mongo_sync_tailer_free (t);
+
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (8, mongo_sync_tailer_new);
@@ -0,0 +1,213 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static gint batches, entries;
+
+/* Queue a reply with one entry per timestamp on the server end. */
+static void
+_queue_entries (mongo_connection *server, gint32 resp_to, gint32 flags,
+		gint64 cursor_id, gint n, const gint64 *ts)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  mongo_packet *p;
+  GByteArray *data;
+  gint i;
+
+  rh.flags = GINT32_TO_LE (flags);
+  rh.cursor_id = GINT64_TO_LE (cursor_id);
+  rh.start = 0;
+  rh.returned = GINT32_TO_LE (n);
+
+  data = g_byte_array_new ();
+  g_byte_array_append (data, (const guint8 *)&rh, sizeof (rh));
+  for (i = 0; i < n; i++)
+    {
+      bson *b = bson_new ();
+
+      bson_append_timestamp (b, "ts", ts[i]);
+      bson_append_string (b, "op", "i", -1);
+      bson_finish (b);
+      g_byte_array_append (data, bson_data (b), bson_size (b));
+      bson_free (b);
+    }
+
+  h.length = sizeof (mongo_packet_header) + data->len;
+  h.id = 1984;
+  h.resp_to = resp_to;
+  h.opcode = 1;
+
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_header (p, &h);
+  mongo_wire_packet_set_data (p, data->data, data->len);
+  mongo_packet_send (server, p);
+
+  mongo_wire_packet_free (p);
+  g_byte_array_free (data, TRUE);
+}
+
+/* Receive the next request on the server end. Returns its opcode,
+   and for queries, the flags and the query itself. */
+static gint32
+_recv_request (mongo_connection *server, gint32 *flags, bson **query)
+{
+  mongo_packet_header h;
+  mongo_packet *p;
+  const guint8 *data;
+  gint32 pos, opcode;
+
+  p = mongo_packet_recv (server);
+  mongo_wire_packet_get_header (p, &h);
+  opcode = h.opcode;
+
+  if (opcode == 2004 && flags && query)
+    {
+      mongo_wire_packet_get_data (p, &data);
+      memcpy (flags, data, sizeof (gint32));
+      *flags = GINT32_FROM_LE (*flags);
+      pos = sizeof (gint32) + strlen ((const gchar *)data + 4) + 1 +
+	2 * sizeof (gint32);
+      *query = bson_new_from_data (data + pos,
+				   bson_stream_doc_size (data, pos) - 1);
+      bson_finish (*query);
+    }
+
+  mongo_wire_packet_free (p);
+  return opcode;
+}
+
+static gboolean
+_count_batch (const bson **docs, gint n, gpointer user_data)
+{
+  batches++;
+  entries += n;
+  return TRUE;
+}
+
+static gboolean
+_stop (const bson **docs, gint n, gpointer user_data)
+{
+  return FALSE;
+}
+
+void
+test_mongo_sync_tailer_poll (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+  mongo_connection server;
+  bson *q = NULL, *cond;
+  bson_cursor *c;
+  gint sv[2];
+  gint32 flags = 0, want;
+  gint64 ts = 0;
+  const gint64 first[] = { 5, 6, 7 }, resumed[] = { 7, 8 }, more[] = { 9 },
+    last[] = { 10 };
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  memset (&server, 0, sizeof (server));
+  server.fd = sv[1];
+  conn = test_make_fake_sync_conn (sv[0], TRUE);
+  t = mongo_sync_tailer_new (conn, "local.oplog.rs", NULL);
+
+  ok (mongo_sync_tailer_poll (NULL, _count_batch, NULL) == -1,
+      "mongo_sync_tailer_poll() fails with a NULL tailer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_tailer_poll (t, NULL, NULL) == -1,
+      "mongo_sync_tailer_poll() fails without a callback");
+
+  /* The first poll queries. */
+  _queue_entries (&server, 1, 0, 555, 3, first);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_batch, NULL), "==", 3,
+	  "mongo_sync_tailer_poll() delivers the entries");
+  ok (batches == 1 && entries == 3,
+      "The entries are delivered in a single batch");
+  want = MONGO_WIRE_FLAG_QUERY_TAILABLE_CURSOR |
+    MONGO_WIRE_FLAG_QUERY_AWAIT_DATA |
+    MONGO_WIRE_FLAG_QUERY_NO_CURSOR_TIMEOUT |
+    MONGO_WIRE_FLAG_QUERY_OPLOG_REPLAY;
+  ok (_recv_request (&server, &flags, &q) == 2004 &&
+      (flags & want) == want,
+      "The query is tailable, awaits data and replays the oplog");
+  c = bson_find (q, "ts");
+  ok (c == NULL,
+      "Without a start position, the query has no ts condition");
+  bson_cursor_free (c);
+  bson_free (q);
+
+  /* An empty batch keeps the cursor. */
+  _queue_entries (&server, 2, 0, 555, 0, NULL);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_batch, NULL), "==", 0,
+	  "mongo_sync_tailer_poll() handles empty batches");
+  cmp_ok (_recv_request (&server, NULL, NULL), "==", 2005,
+	  "A live cursor is continued with a getmore");
+
+  /* A dead cursor is dropped, and the next poll resumes. */
+  _queue_entries (&server, 3, MONGO_REPLY_FLAG_NO_CURSOR, 0, 0, NULL);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_batch, NULL), "==", 0,
+	  "mongo_sync_tailer_poll() survives a dead cursor");
+  _recv_request (&server, NULL, NULL);
+
+  _queue_entries (&server, 4, 0, 0, 2, resumed);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_batch, NULL), "==", 1,
+	  "Entries delivered before resuming are skipped");
+  _recv_request (&server, &flags, &q);
+  c = bson_find (q, "ts");
+  bson_cursor_get_document (c, &cond);
+  bson_cursor_free (c);
+  c = bson_find (cond, "$gte");
+  ok (bson_cursor_get_timestamp (c, &ts) && ts == 7,
+      "The tailer resumes from the last timestamp it saw");
+  bson_cursor_free (c);
+  bson_free (cond);
+  bson_free (q);
+  ok (mongo_sync_tailer_get_last (t, &ts) && ts == 8,
+      "The last timestamp is updated");
+
+  _queue_entries (&server, 5, 0, 0, 1, more);
+  ok (mongo_sync_tailer_poll (t, _stop, NULL) == -1,
+      "mongo_sync_tailer_poll() fails if the callback says so");
+  cmp_ok (errno, "==", ECANCELED,
+	  "errno is ECANCELED");
+  _recv_request (&server, NULL, NULL);
+
+  /* An empty first batch keeps its cursor too. */
+  _queue_entries (&server, 6, 0, 777, 0, NULL);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_batch, NULL), "==", 0,
+	  "mongo_sync_tailer_poll() handles an empty first batch");
+  _recv_request (&server, NULL, NULL);
+  _queue_entries (&server, 7, 0, 777, 1, last);
+  mongo_sync_tailer_poll (t, _count_batch, NULL);
+  cmp_ok (_recv_request (&server, NULL, NULL), "==", 2005,
+	  "The cursor of an empty first batch is continued");
+
+  /* A getmore that fails without the server forgetting the cursor
+     has the cursor killed before tailing resumes. */
+  _queue_entries (&server, 42, 0, 777, 0, NULL);
+  cmp_ok (mongo_sync_tailer_poll (t, _count_batch, NULL), "==", 0,
+	  "mongo_sync_tailer_poll() survives a failed getmore");
+  _recv_request (&server, NULL, NULL);
+  _queue_entries (&server, 9, 0, 888, 0, NULL);
+  mongo_sync_tailer_poll (t, _count_batch, NULL);
+  ok (_recv_request (&server, NULL, NULL) == 2007 &&
+      _recv_request (&server, NULL, NULL) == 2004,
+      "The cursor of a failed getmore is killed along with the new query");
+
+  /* Freeing the tailer kills its live cursor, along with the next
+     command. */
+  mongo_sync_tailer_free (t);
+  mongo_sync_cmd_kill_cursors (conn, 1, (gint64)99);
+  cmp_ok (_recv_request (&server, NULL, NULL), "==", 2007,
+	  "mongo_sync_tailer_free() kills the cursor");
+
+  mongo_sync_disconnect (conn);
+  close (sv[1]);
+}
+
+RUN_TEST (20, mongo_sync_tailer_poll);
@@ -0,0 +1,59 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+static gboolean
+_stop_after_three (const bson **docs, gint n, gpointer user_data)
+{
+  gint *batches = (gint *)user_data;
+
+  (*batches)++;
+  return *batches < 3;
+}
+
+void
+test_mongo_sync_tailer_run (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+  gint port, batches = 0;
+  pid_t server;
+
+  ok (mongo_sync_tailer_run (NULL, _stop_after_three, &batches) == FALSE,
+      "mongo_sync_tailer_run() fails with a NULL tailer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  server = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, TRUE);
+  t = mongo_sync_tailer_new (conn, "test.capped", NULL);
+
+  ok (mongo_sync_tailer_run (t, NULL, NULL) == FALSE,
+      "mongo_sync_tailer_run() fails without a callback");
+
+  /* The mock server answers every query with a single document, and
+     a dead cursor. */
+  ok (mongo_sync_tailer_run (t, _stop_after_three, &batches) == FALSE,
+      "mongo_sync_tailer_run() returns when the callback says so");
+  cmp_ok (errno, "==", ECANCELED,
+	  "errno is ECANCELED");
+  cmp_ok (batches, "==", 3,
+	  "mongo_sync_tailer_run() resumes until told to stop");
+
+  mongo_sync_tailer_free (t);
+  mongo_sync_disconnect (conn);
+  test_mock_server_stop (server);
+
+  conn = test_make_fake_sync_conn (-1, TRUE);
+  t = mongo_sync_tailer_new (conn, "test.capped", NULL);
+  batches = 0;
+  ok (mongo_sync_tailer_run (t, _stop_after_three, &batches) == FALSE &&
+      errno != ECANCELED,
+      "mongo_sync_tailer_run() returns on errors");
+
+  mongo_sync_tailer_free (t);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (7, mongo_sync_tailer_run);
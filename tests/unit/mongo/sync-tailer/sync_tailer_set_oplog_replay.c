@@ -0,0 +1,89 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static gboolean
+_ignore (const bson **docs, gint n, gpointer user_data)
+{
+  return TRUE;
+}
+
+/* Poll once against an empty reply, and check whether the query
+   replays the oplog. */
+static gboolean
+_poll_replays (mongo_sync_tailer *t, mongo_sync_connection *conn,
+	       mongo_connection *server)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  mongo_packet *p;
+  const guint8 *data;
+  gint32 flags;
+
+  memset (&rh, 0, sizeof (rh));
+  h.length = sizeof (h) + sizeof (rh);
+  h.id = 1984;
+  h.resp_to = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+  h.opcode = 1;
+
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_header (p, &h);
+  mongo_wire_packet_set_data (p, (const guint8 *)&rh, sizeof (rh));
+  mongo_packet_send (server, p);
+  mongo_wire_packet_free (p);
+
+  mongo_sync_tailer_poll (t, _ignore, NULL);
+
+  p = mongo_packet_recv (server);
+  mongo_wire_packet_get_data (p, &data);
+  memcpy (&flags, data, sizeof (flags));
+  mongo_wire_packet_free (p);
+
+  return (GINT32_FROM_LE (flags) & MONGO_WIRE_FLAG_QUERY_OPLOG_REPLAY) != 0;
+}
+
+void
+test_mongo_sync_tailer_set_oplog_replay (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_tailer *t;
+  mongo_connection server;
+  gint sv[2];
+
+  ok (mongo_sync_tailer_set_oplog_replay (NULL, TRUE) == FALSE,
+      "mongo_sync_tailer_set_oplog_replay() fails with a NULL tailer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  memset (&server, 0, sizeof (server));
+  server.fd = sv[1];
+  conn = test_make_fake_sync_conn (sv[0], TRUE);
+
+  t = mongo_sync_tailer_new (conn, "test.capped", NULL);
+  ok (!_poll_replays (t, conn, &server),
+      "OplogReplay is off for collections other than the oplog");
+
+  ok (mongo_sync_tailer_set_oplog_replay (t, TRUE),
+      "mongo_sync_tailer_set_oplog_replay() works");
+  ok (_poll_replays (t, conn, &server),
+      "OplogReplay can be turned on");
+  mongo_sync_tailer_free (t);
+
+  t = mongo_sync_tailer_new (conn, "local.oplog.rs", NULL);
+  ok (_poll_replays (t, conn, &server),
+      "OplogReplay is on for the oplog");
+  mongo_sync_tailer_set_oplog_replay (t, FALSE);
+  ok (!_poll_replays (t, conn, &server),
+      "OplogReplay can be turned off");
+  mongo_sync_tailer_free (t);
+
+  mongo_sync_disconnect (conn);
+  close (sv[1]);
+}
+
+RUN_TEST (7, mongo_sync_tailer_set_oplog_replay);
@@ -0,0 +1,126 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Receive the next packet on the server end, and return its opcode.
+   For kill cursors messages, return the number of cursors and the
+   first ID too. */
+static gint32
+_recv_packet (mongo_connection *server, gint32 *n, gint64 *cid)
+{
+  mongo_packet_header h;
+  mongo_packet *p;
+  const guint8 *data;
+
+  p = mongo_packet_recv (server);
+  if (!p)
+    return -1;
+  mongo_wire_packet_get_header (p, &h);
+  if (h.opcode == 2007)
+    {
+      mongo_wire_packet_get_data (p, &data);
+      memcpy (n, data + sizeof (gint32), sizeof (gint32));
+      *n = GINT32_FROM_LE (*n);
+      memcpy (cid, data + 2 * sizeof (gint32), sizeof (gint64));
+      *cid = GINT64_FROM_LE (*cid);
+    }
+  mongo_wire_packet_free (p);
+  return h.opcode;
+}
+
+static mongo_sync_cursor *
+_fake_cursor (mongo_sync_connection *conn, gint64 cursor_id)
+{
+  mongo_packet *p;
+  mongo_sync_cursor *c;
+
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  c = mongo_sync_cursor_new (conn, "test.ns", p);
+  c->ph.cursor_id = cursor_id;
+  return c;
+}
+
+void
+test_mongo_sync_conn_flush_cursor_kills (void)
+{
+  mongo_sync_connection *conn;
+  mongo_connection server;
+  gint sv[2];
+  gint32 n = 0;
+  gint64 cid = 0;
+  guint8 b;
+  gint port;
+  pid_t server_pid;
+
+  ok (mongo_sync_conn_flush_cursor_kills (NULL) == FALSE,
+      "mongo_sync_conn_flush_cursor_kills() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  memset (&server, 0, sizeof (server));
+  server.fd = sv[1];
+  conn = test_make_fake_sync_conn (sv[0], TRUE);
+
+  ok (mongo_sync_conn_flush_cursor_kills (conn),
+      "mongo_sync_conn_flush_cursor_kills() works with nothing to kill");
+
+  mongo_sync_cursor_free (_fake_cursor (conn, 0));
+  ok (conn->kills == NULL || conn->kills->len == 0,
+      "Cursors closed by the server are not killed");
+
+  mongo_sync_cursor_free (_fake_cursor (conn, 1234));
+  ok (recv (sv[1], &b, 1, MSG_DONTWAIT) == -1 && errno == EAGAIN,
+      "Freeing a cursor does not send anything");
+  cmp_ok (conn->kills->len, "==", 1,
+	  "The cursor is queued for killing");
+
+  ok (mongo_sync_conn_flush_cursor_kills (conn),
+      "mongo_sync_conn_flush_cursor_kills() works");
+  ok (_recv_packet (&server, &n, &cid) == 2007 && n == 1 && cid == 1234,
+      "The queued cursor is killed");
+  cmp_ok (conn->kills->len, "==", 0,
+	  "The queue is emptied");
+
+  mongo_sync_cursor_free (_fake_cursor (conn, 42));
+  mongo_sync_cursor_free (_fake_cursor (conn, 43));
+  mongo_sync_cmd_kill_cursors (conn, 1, (gint64)99);
+  ok (_recv_packet (&server, &n, &cid) == 2007 && n == 2 && cid == 42,
+      "Queued cursors are killed with a single message");
+  ok (_recv_packet (&server, &n, &cid) == 2007 && n == 1 && cid == 99,
+      "The kill message is piggybacked onto the next command");
+  cmp_ok (conn->kills->len, "==", 0,
+	  "The queue is emptied once the kills are sent");
+
+  mongo_sync_disconnect (conn);
+  close (sv[1]);
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  conn = test_make_fake_sync_conn (sv[0], TRUE);
+  mongo_sync_cursor_free (_fake_cursor (conn, 55));
+  close (sv[1]);
+  ok (mongo_sync_conn_flush_cursor_kills (conn) == FALSE &&
+      conn->kills->len == 1,
+      "Cursors that could not be killed stay queued");
+  mongo_sync_disconnect (conn);
+
+  server_pid = test_mock_server_start (&port);
+  conn = mongo_sync_connect ("127.0.0.1", port, TRUE);
+  mongo_sync_cursor_free (_fake_cursor (conn, 66));
+  shutdown (conn->super.fd, SHUT_RDWR);
+  ok (mongo_sync_reconnect (conn, FALSE) == conn &&
+      conn->kills->len == 1,
+      "Queued kills survive a reconnect");
+  ok (mongo_sync_cmd_ping (conn) && conn->kills->len == 0,
+      "Queued kills go out over the new connection");
+  mongo_sync_disconnect (conn);
+  test_mock_server_stop (server_pid);
+}
+
+RUN_TEST (15, mongo_sync_conn_flush_cursor_kills);
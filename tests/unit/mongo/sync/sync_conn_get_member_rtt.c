@@ -0,0 +1,52 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_conn_get_member_rtt (void)
+{
+  mongo_sync_connection *c;
+  gchar *addr;
+  gint port;
+  pid_t server;
+
+  ok (mongo_sync_conn_get_member_rtt (NULL, "127.0.0.1:27017") == -1,
+      "mongo_sync_conn_get_member_rtt() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_conn_get_member_rtt (c, NULL) == -1,
+      "mongo_sync_conn_get_member_rtt() fails with a NULL member");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_conn_get_member_rtt (c, "127.0.0.1:27017") == -1,
+      "mongo_sync_conn_get_member_rtt() fails with an unknown member");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is ENOENT");
+
+  server = test_mock_server_start (&port);
+  addr = g_strdup_printf ("127.0.0.1:%d", port);
+
+  mongo_sync_conn_seed_add (c, "127.0.0.1", 1);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", port);
+
+  ok (mongo_sync_reconnect (c, TRUE) == c,
+      "mongo_sync_reconnect() finds the reachable member");
+  ok (mongo_sync_conn_get_member_rtt (c, addr) >= 0,
+      "mongo_sync_conn_get_member_rtt() returns the RTT of the member");
+  ok (mongo_sync_conn_get_member_rtt (c, "127.0.0.1:1") == -1 &&
+      errno == ENOENT,
+      "Members that did not answer have no RTT");
+  ok (mongo_sync_cmd_ping (c),
+      "The reconnected connection is usable");
+
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (server);
+  g_free (addr);
+}
+
+RUN_TEST (10, mongo_sync_conn_get_member_rtt);
@@ -0,0 +1,39 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_connect_with_options (void)
+{
+  mongo_sync_connection *c;
+  mongo_connection_options opts;
+  gint port;
+  pid_t server;
+
+  mongo_connection_options_init (&opts);
+  opts.keepalive = FALSE;
+
+  ok (mongo_sync_connect_with_options (NULL, 27017, FALSE, &opts) == NULL,
+      "mongo_sync_connect_with_options() fails with a NULL host");
+
+  server = test_mock_server_start (&port);
+
+  c = mongo_sync_connect_with_options ("127.0.0.1", port, FALSE, &opts);
+  ok (c != NULL,
+      "mongo_sync_connect_with_options() works");
+  ok (c->super.options.keepalive == FALSE,
+      "mongo_sync_connect_with_options() applies the options");
+  ok (mongo_sync_cmd_ping (c),
+      "The connection is usable");
+
+  c->super.fd = -1;
+  ok (mongo_sync_reconnect (c, FALSE) == c &&
+      c->super.options.keepalive == FALSE,
+      "Options are preserved accross reconnects");
+
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (5, mongo_sync_connect_with_options);
@@ -0,0 +1,90 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_get_hedge_stats (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_monitor *m;
+  mongo_sync_hedge_options opts;
+  mongo_sync_hedge_stats stats;
+  mongo_sync_read_preference pref;
+  mongo_packet *p;
+  bson *q;
+  gchar *addr;
+  gint slow_port, fast_port;
+  pid_t slow, fast;
+
+  ok (mongo_sync_conn_get_hedge_stats (NULL, &stats) == FALSE,
+      "mongo_sync_conn_get_hedge_stats() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  c = test_make_fake_sync_conn (-1, TRUE);
+  ok (mongo_sync_conn_get_hedge_stats (c, NULL) == FALSE,
+      "mongo_sync_conn_get_hedge_stats() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_conn_get_hedge_stats (c, &stats) &&
+      stats.reads == 0 && stats.fired == 0 && stats.won == 0,
+      "New connections start with zero counters");
+  mongo_sync_disconnect (c);
+
+  slow = test_mock_server_start_delayed (&slow_port, 300);
+  fast = test_mock_server_start (&fast_port);
+
+  c = mongo_sync_connect ("127.0.0.1", slow_port, TRUE);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", fast_port);
+  m = mongo_sync_monitor_new (c, 60000);
+  mongo_sync_monitor_refresh (m);
+  mongo_sync_conn_set_monitor (c, m);
+
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_NEAREST);
+  mongo_sync_conn_set_read_preference (c, &pref);
+
+  opts.delay = 20;
+  opts.percentile = 0;
+  mongo_sync_conn_set_hedged_reads (c, &opts);
+
+  q = bson_new ();
+  bson_finish (q);
+
+  p = mongo_sync_cmd_query (c, "test.hedge", 0, 0, 1, q, NULL);
+  ok (p != NULL,
+      "Hedged queries work");
+  mongo_wire_packet_free (p);
+
+  mongo_sync_conn_get_hedge_stats (c, &stats);
+  ok (stats.reads == 1 && stats.fired == 1 && stats.won == 1,
+      "The hedge fires, and wins against a slow member");
+  addr = g_strdup_printf ("127.0.0.1:%d", fast_port);
+  is (c->address, addr,
+      "The connection moves over to the winning member");
+
+  p = mongo_sync_cmd_query (c, "test.hedge", 0, 0, 1, q, NULL);
+  mongo_wire_packet_free (p);
+  mongo_sync_conn_get_hedge_stats (c, &stats);
+  ok (stats.reads == 2 && stats.fired == 1,
+      "Fast replies are not hedged");
+  is (c->address, addr,
+      "The connection stays on the winning member");
+  g_free (addr);
+
+  mongo_sync_conn_set_hedged_reads (c, NULL);
+  p = mongo_sync_cmd_query (c, "test.hedge", 0, 0, 1, q, NULL);
+  mongo_wire_packet_free (p);
+  mongo_sync_conn_get_hedge_stats (c, &stats);
+  ok (stats.reads == 2,
+      "Reads are not counted when hedging is disabled");
+
+  bson_free (q);
+  mongo_sync_disconnect (c);
+  mongo_sync_monitor_free (m);
+
+  test_mock_server_stop (slow);
+  test_mock_server_stop (fast);
+}
+
+RUN_TEST (11, mongo_sync_get_hedge_stats);
@@ -0,0 +1,115 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+void
+test_mongo_sync_get_set_read_preference (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_read_preference pref, got;
+  struct sockaddr_in sa;
+  socklen_t len = sizeof (sa);
+  gint port, blackhole;
+  gint64 start;
+  pid_t server;
+
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_SECONDARY);
+
+  ok (mongo_sync_conn_get_read_preference (NULL, &got) == FALSE,
+      "mongo_sync_conn_get_read_preference() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+  ok (mongo_sync_conn_set_read_preference (NULL, &pref) == FALSE,
+      "mongo_sync_conn_set_read_preference() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_conn_get_read_preference (c, NULL) == FALSE,
+      "mongo_sync_conn_get_read_preference() fails with a NULL preference");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  ok (mongo_sync_conn_set_read_preference (c, NULL) == FALSE,
+      "mongo_sync_conn_set_read_preference() fails with a NULL preference");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+
+  pref.latency_window = -1;
+  ok (mongo_sync_conn_set_read_preference (c, &pref) == FALSE,
+      "mongo_sync_conn_set_read_preference() fails with a negative "
+      "latency window");
+  pref.latency_window = 10;
+  pref.max_staleness = -1;
+  ok (mongo_sync_conn_set_read_preference (c, &pref) == FALSE,
+      "mongo_sync_conn_set_read_preference() fails with a negative "
+      "staleness bound");
+  pref.max_staleness = 0;
+  pref.mode = (mongo_sync_read_mode)42;
+  ok (mongo_sync_conn_set_read_preference (c, &pref) == FALSE,
+      "mongo_sync_conn_set_read_preference() fails with an invalid mode");
+  pref.mode = MONGO_SYNC_READ_SECONDARY;
+
+  ok (mongo_sync_conn_set_read_preference (c, &pref),
+      "mongo_sync_conn_set_read_preference() works");
+  ok (mongo_sync_conn_get_read_preference (c, &got) &&
+      got.mode == MONGO_SYNC_READ_SECONDARY && got.latency_window == 10,
+      "mongo_sync_conn_get_read_preference() works");
+  ok (mongo_sync_conn_get_slaveok (c),
+      "Non-primary read preferences turn SLAVE_OK on");
+
+  pref.mode = MONGO_SYNC_READ_PRIMARY;
+  mongo_sync_conn_set_read_preference (c, &pref);
+  ok (mongo_sync_conn_get_slaveok (c) == FALSE,
+      "The primary read preference turns SLAVE_OK off");
+
+  mongo_sync_disconnect (c);
+
+  server = test_mock_server_start (&port);
+  c = mongo_sync_connect ("127.0.0.1", port, FALSE);
+  ok (mongo_sync_conn_get_read_preference (c, &got) &&
+      got.mode == MONGO_SYNC_READ_PRIMARY_PREFERRED,
+      "New connections prefer the primary");
+
+  /* The mock server is always a primary. */
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_SECONDARY);
+  mongo_sync_conn_set_read_preference (c, &pref);
+  shutdown (c->super.fd, SHUT_RDWR);
+  ok (mongo_sync_reconnect (c, FALSE) == NULL,
+      "mongo_sync_reconnect() honours the read preference");
+
+  mongo_sync_read_preference_init (&pref,
+				   MONGO_SYNC_READ_SECONDARY_PREFERRED);
+  mongo_sync_conn_set_read_preference (c, &pref);
+  ok (mongo_sync_reconnect (c, FALSE) == c,
+      "mongo_sync_reconnect() falls back to the primary when secondaries "
+      "are only preferred");
+
+  /* A member that accepts connections, but never answers. */
+  blackhole = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  bind (blackhole, (struct sockaddr *)&sa, sizeof (sa));
+  listen (blackhole, 8);
+  getsockname (blackhole, (struct sockaddr *)&sa, &len);
+  mongo_sync_conn_seed_add (c, "127.0.0.1", ntohs (sa.sin_port));
+
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_reconnect (c, FALSE) == c &&
+      g_get_monotonic_time () - start < G_USEC_PER_SEC,
+      "mongo_sync_reconnect() does not wait for unresponsive members "
+      "once a fallback answered");
+  close (blackhole);
+
+  mongo_sync_disconnect (c);
+  test_mock_server_stop (server);
+}
+
+RUN_TEST (19, mongo_sync_get_set_read_preference);
@@ -0,0 +1,22 @@
+#include "test.h"
+#include "mongo.h"
+
+void
+test_mongo_sync_read_preference_init (void)
+{
+  mongo_sync_read_preference pref;
+
+  mongo_sync_read_preference_init (NULL, MONGO_SYNC_READ_NEAREST);
+  pass ("mongo_sync_read_preference_init(NULL) works");
+
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_NEAREST);
+  ok (pref.mode == MONGO_SYNC_READ_NEAREST,
+      "mongo_sync_read_preference_init() sets the mode");
+  cmp_ok (pref.latency_window, "==", MONGO_SYNC_DEFAULT_LATENCY_WINDOW,
+	  "The latency window defaults to "
+	  "MONGO_SYNC_DEFAULT_LATENCY_WINDOW");
+  cmp_ok (pref.max_staleness, "==", 0,
+	  "Staleness is not bound by default");
+}
+
+RUN_TEST (4, mongo_sync_read_preference_init);
@@ -0,0 +1,96 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+static mongo_sync_rs_member primary = {
+  (gchar *)"p:27017", 20000, MONGO_SYNC_MEMBER_PRIMARY, 1, -1, 0
+};
+static mongo_sync_rs_member near = {
+  (gchar *)"s1:27017", 1000, MONGO_SYNC_MEMBER_SECONDARY, 1, -1, 500
+};
+static mongo_sync_rs_member close_enough = {
+  (gchar *)"s2:27017", 10000, MONGO_SYNC_MEMBER_SECONDARY, 1, -1, 100
+};
+static mongo_sync_rs_member far = {
+  (gchar *)"s3:27017", 80000, MONGO_SYNC_MEMBER_SECONDARY, 1, -1, 0
+};
+static mongo_sync_rs_member down = {
+  (gchar *)"s4:27017", 10, MONGO_SYNC_MEMBER_DOWN, 1, -1, -1
+};
+
+void
+test_mongo_sync_read_preference_select (void)
+{
+  const mongo_sync_rs_member *members[] =
+    { &down, &primary, &far, &close_enough, &near };
+  const mongo_sync_rs_member *secondaries[] = { &far, &near };
+  const mongo_sync_rs_member *unknown[] = { &primary, &far };
+  mongo_sync_read_preference pref;
+  gboolean only_window = TRUE, seen_near = FALSE, seen_close = FALSE;
+  gint i, n;
+
+  mongo_sync_read_preference_init (&pref, MONGO_SYNC_READ_PRIMARY);
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 1,
+	  "primary selects the primary");
+  cmp_ok (mongo_sync_read_preference_select (&pref, secondaries, 2),
+	  "==", -1,
+	  "primary selects nothing without a primary");
+
+  pref.mode = MONGO_SYNC_READ_PRIMARY_PREFERRED;
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 1,
+	  "primaryPreferred selects the primary if there is one");
+  cmp_ok (mongo_sync_read_preference_select (&pref, secondaries, 2),
+	  "==", 1,
+	  "primaryPreferred falls back to the closest secondary");
+
+  pref.mode = MONGO_SYNC_READ_SECONDARY;
+  for (n = 0; n < 64; n++)
+    {
+      i = mongo_sync_read_preference_select (&pref, members, 5);
+      if (i == 4)
+	seen_near = TRUE;
+      else if (i == 3)
+	seen_close = TRUE;
+      else
+	only_window = FALSE;
+    }
+  ok (only_window,
+      "secondary only selects secondaries within the latency window");
+  ok (seen_near && seen_close,
+      "secondary spreads the load over the latency window");
+
+  pref.latency_window = 0;
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 4,
+	  "A zero latency window selects the closest secondary");
+
+  pref.max_staleness = 200;
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 3,
+	  "Secondaries lagging too much are not eligible");
+  pref.max_staleness = 0;
+
+  cmp_ok (mongo_sync_read_preference_select (&pref, unknown, 1), "==", -1,
+	  "secondary selects nothing without a secondary");
+
+  pref.mode = MONGO_SYNC_READ_SECONDARY_PREFERRED;
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 4,
+	  "secondaryPreferred selects a secondary if there is one");
+  cmp_ok (mongo_sync_read_preference_select (&pref, unknown, 1), "==", 0,
+	  "secondaryPreferred falls back to the primary");
+
+  pref.mode = MONGO_SYNC_READ_NEAREST;
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 4,
+	  "nearest selects the closest member");
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 3), "==", 1,
+	  "nearest selects the primary if that is the closest");
+
+  far.rtt = -1;
+  primary.rtt = -1;
+  i = mongo_sync_read_preference_select (&pref, unknown, 2);
+  ok (i == 0 || i == 1,
+      "Members with unknown RTT are eligible if no RTT is known");
+  cmp_ok (mongo_sync_read_preference_select (&pref, members, 5), "==", 4,
+	  "Members with unknown RTT are skipped if others are known");
+}
+
+RUN_TEST (15, mongo_sync_read_preference_select);
@@ -0,0 +1,52 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_set_hedged_reads (void)
+{
+  mongo_sync_connection *c;
+  mongo_sync_hedge_options opts;
+
+  opts.delay = 10;
+  opts.percentile = 0;
+
+  ok (mongo_sync_conn_set_hedged_reads (NULL, &opts) == FALSE,
+      "mongo_sync_conn_set_hedged_reads() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is ENOTCONN");
+
+  c = test_make_fake_sync_conn (-1, TRUE);
+
+  opts.delay = -1;
+  ok (mongo_sync_conn_set_hedged_reads (c, &opts) == FALSE,
+      "mongo_sync_conn_set_hedged_reads() fails with a negative delay");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is EINVAL");
+  opts.delay = 10;
+  opts.percentile = 100;
+  ok (mongo_sync_conn_set_hedged_reads (c, &opts) == FALSE,
+      "mongo_sync_conn_set_hedged_reads() fails with an invalid "
+      "percentile");
+  opts.percentile = -1;
+  ok (mongo_sync_conn_set_hedged_reads (c, &opts) == FALSE,
+      "mongo_sync_conn_set_hedged_reads() fails with a negative "
+      "percentile");
+
+  opts.percentile = 95;
+  ok (mongo_sync_conn_set_hedged_reads (c, &opts),
+      "mongo_sync_conn_set_hedged_reads() works");
+  ok (c->hedge.enabled && c->hedge.opts.delay == 10 &&
+      c->hedge.opts.percentile == 95,
+      "mongo_sync_conn_set_hedged_reads() stores the settings");
+
+  ok (mongo_sync_conn_set_hedged_reads (c, NULL),
+      "mongo_sync_conn_set_hedged_reads() can disable hedging");
+  ok (c->hedge.enabled == FALSE,
+      "Hedging is disabled");
+
+  mongo_sync_disconnect (c);
+}
+
+RUN_TEST (10, mongo_sync_set_hedged_reads);
@@ -0,0 +1,27 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_uring_free (void)
+{
+  mongo_uring *ring;
+
+  errno = 0;
+  mongo_uring_free (NULL);
+  cmp_ok (errno, "==", EINVAL,
+	  "mongo_uring_free() with a NULL ring sets errno to EINVAL");
+
+  ring = mongo_uring_new (0, 0, 0);
+
+  skip (ring == NULL, 1, "io_uring is not available");
+
+  mongo_uring_free (ring);
+  cmp_ok (errno, "==", 0,
+	  "mongo_uring_free() works");
+
+  endskip;
+}
+
+RUN_TEST (2, mongo_uring_free);
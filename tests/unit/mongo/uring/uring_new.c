@@ -0,0 +1,33 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_uring_new (void)
+{
+  mongo_uring *ring;
+
+  ok (mongo_uring_new (0, 0, 4) == NULL,
+      "mongo_uring_new() fails with a buffer smaller than a header");
+  ok (mongo_uring_new (1, 0, 0) == NULL,
+      "mongo_uring_new() fails with a single entry");
+
+  ring = mongo_uring_new (0, 0, 0);
+
+  skip (ring == NULL && errno == ENOSYS, 2,
+	"io_uring is not available");
+
+  ok (ring != NULL,
+      "mongo_uring_new() works with the defaults");
+  mongo_uring_free (ring);
+
+  ring = mongo_uring_new (4, 2, 4096);
+  ok (ring != NULL,
+      "mongo_uring_new() works with custom sizes");
+  mongo_uring_free (ring);
+
+  endskip;
+}
+
+RUN_TEST (4, mongo_uring_new);
@@ -0,0 +1,118 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+static gboolean
+_packets_equal (const mongo_packet *a, const mongo_packet *b)
+{
+  mongo_packet_header ha, hb;
+  const guint8 *da, *db;
+  gint32 sa, sb;
+
+  if (!a || !b)
+    return FALSE;
+
+  mongo_wire_packet_get_header (a, &ha);
+  mongo_wire_packet_get_header (b, &hb);
+  sa = mongo_wire_packet_get_data (a, &da);
+  sb = mongo_wire_packet_get_data (b, &db);
+
+  return (memcmp (&ha, &hb, sizeof (ha)) == 0 && sa == sb &&
+	  memcmp (da, db, sa) == 0);
+}
+
+static void
+_test_recv (mongo_uring *ring, const gchar *what)
+{
+  mongo_connection *conns[2], *peer;
+  mongo_packet *packets[2], *p1, *p2;
+  gint sv1[2], sv2[2];
+
+  p1 = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  p2 = test_mongo_wire_generate_reply (TRUE, 0, FALSE);
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv1);
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv2);
+
+  conns[0] = g_new0 (mongo_connection, 1);
+  conns[1] = g_new0 (mongo_connection, 1);
+  conns[0]->fd = sv1[0];
+  conns[1]->fd = sv2[0];
+
+  peer = g_new0 (mongo_connection, 1);
+  peer->fd = sv1[1];
+  mongo_packet_send (peer, p1);
+  peer->fd = sv2[1];
+  mongo_packet_send (peer, p2);
+
+  ok (mongo_uring_packet_recv_all (ring, conns, packets, 2) == 2,
+      "mongo_uring_packet_recv_all() works %s", what);
+  ok (_packets_equal (packets[0], p1) && _packets_equal (packets[1], p2),
+      "mongo_uring_packet_recv_all() receives the packets %s", what);
+  mongo_wire_packet_free (packets[0]);
+  mongo_wire_packet_free (packets[1]);
+
+  peer->fd = sv1[1];
+  mongo_packet_send (peer, p1);
+  close (sv2[1]);
+
+  ok (mongo_uring_packet_recv_all (ring, conns, packets, 2) == 1 &&
+      _packets_equal (packets[0], p1) && packets[1] == NULL,
+      "mongo_uring_packet_recv_all() reports partial failures %s", what);
+  mongo_wire_packet_free (packets[0]);
+
+  close (sv1[0]);
+  close (sv1[1]);
+  close (sv2[0]);
+  g_free (peer);
+  g_free (conns[0]);
+  g_free (conns[1]);
+  mongo_wire_packet_free (p1);
+  mongo_wire_packet_free (p2);
+}
+
+void
+test_mongo_uring_packet_recv_all (void)
+{
+  mongo_connection *conns[1];
+  mongo_packet *packets[1];
+  mongo_uring *ring;
+
+  conns[0] = NULL;
+
+  ok (mongo_uring_packet_recv_all (NULL, NULL, packets, 1) == -1,
+      "mongo_uring_packet_recv_all() fails without connections");
+  ok (mongo_uring_packet_recv_all (NULL, conns, NULL, 1) == -1,
+      "mongo_uring_packet_recv_all() fails without packets");
+  ok (mongo_uring_packet_recv_all (NULL, conns, packets, 0) == -1,
+      "mongo_uring_packet_recv_all() fails with zero packets");
+
+  _test_recv (NULL, "without a ring");
+
+  ring = mongo_uring_new (0, 0, 0);
+  skip (ring == NULL, 8, "io_uring is not available");
+
+  ok (mongo_uring_packet_recv_all (ring, conns, packets, 1) == 0 &&
+      errno == ENOTCONN,
+      "mongo_uring_packet_recv_all() fails with a NULL connection");
+  ok (packets[0] == NULL,
+      "mongo_uring_packet_recv_all() sets the packet to NULL on failure");
+
+  _test_recv (ring, "with registered buffers");
+  mongo_uring_free (ring);
+
+  /* One buffer, too small for the bigger reply: exercises both the
+     unbuffered path, and running out of buffers. */
+  ring = mongo_uring_new (0, 1, 64);
+  _test_recv (ring, "with a small buffer");
+  mongo_uring_free (ring);
+
+  endskip;
+}
+
+RUN_TEST (14, mongo_uring_packet_recv_all);
@@ -0,0 +1,103 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+static gboolean
+_verify_sent (gint fd, const mongo_packet *p)
+{
+  mongo_packet_header h;
+  const guint8 *data;
+  gint32 size;
+  guint8 *buf;
+  gboolean res;
+
+  mongo_wire_packet_get_header_raw (p, &h);
+  size = mongo_wire_packet_get_data (p, &data);
+
+  buf = g_malloc (sizeof (h) + size);
+  if (recv (fd, buf, sizeof (h) + size, MSG_WAITALL) !=
+      (gssize)(sizeof (h) + size))
+    {
+      g_free (buf);
+      return FALSE;
+    }
+
+  res = (memcmp (buf, &h, sizeof (h)) == 0 &&
+	 memcmp (buf + sizeof (h), data, size) == 0);
+  g_free (buf);
+  return res;
+}
+
+void
+test_mongo_uring_packet_send_all (void)
+{
+  mongo_connection *conns[2];
+  const mongo_packet *packets[2];
+  mongo_packet *p1, *p2;
+  mongo_uring *ring;
+  gint sv1[2], sv2[2];
+
+  p1 = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  p2 = test_mongo_wire_generate_reply (TRUE, 0, FALSE);
+
+  conns[0] = g_new0 (mongo_connection, 1);
+  conns[1] = g_new0 (mongo_connection, 1);
+  packets[0] = p1;
+  packets[1] = p2;
+
+  ok (mongo_uring_packet_send_all (NULL, NULL, packets, 2) == -1,
+      "mongo_uring_packet_send_all() fails without connections");
+  ok (mongo_uring_packet_send_all (NULL, conns, NULL, 2) == -1,
+      "mongo_uring_packet_send_all() fails without packets");
+  ok (mongo_uring_packet_send_all (NULL, conns, packets, 0) == -1,
+      "mongo_uring_packet_send_all() fails with zero packets");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv1);
+  socketpair (AF_UNIX, SOCK_STREAM, 0, sv2);
+  conns[0]->fd = sv1[0];
+  conns[1]->fd = sv2[0];
+
+  ok (mongo_uring_packet_send_all (NULL, conns, packets, 2) == 2,
+      "mongo_uring_packet_send_all() works without a ring");
+  ok (_verify_sent (sv1[1], p1) && _verify_sent (sv2[1], p2),
+      "mongo_uring_packet_send_all() without a ring sends the packets");
+
+  ring = mongo_uring_new (0, 1, 0);
+
+  skip (ring == NULL, 5, "io_uring is not available");
+
+  conns[0]->request_id = conns[1]->request_id = 0;
+  ok (mongo_uring_packet_send_all (ring, conns, packets, 2) == 2,
+      "mongo_uring_packet_send_all() works");
+  ok (_verify_sent (sv1[1], p1) && _verify_sent (sv2[1], p2),
+      "mongo_uring_packet_send_all() sends the packets");
+  ok (mongo_connection_get_requestid (conns[0]) == 1984 &&
+      mongo_connection_get_requestid (conns[1]) == 1984,
+      "mongo_uring_packet_send_all() updates the request IDs");
+
+  close (sv2[1]);
+  ok (mongo_uring_packet_send_all (ring, conns, packets, 2) == 1,
+      "mongo_uring_packet_send_all() reports partial failures");
+  cmp_ok (errno, "==", EPIPE,
+	  "mongo_uring_packet_send_all() sets errno on failure");
+  _verify_sent (sv1[1], p1);
+
+  mongo_uring_free (ring);
+
+  endskip;
+
+  close (sv1[0]);
+  close (sv1[1]);
+  close (sv2[0]);
+  g_free (conns[0]);
+  g_free (conns[1]);
+  mongo_wire_packet_free (p1);
+  mongo_wire_packet_free (p2);
+}
+
+RUN_TEST (10, mongo_uring_packet_send_all);